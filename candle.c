@@ -2,58 +2,217 @@
 #include <stdlib.h>
 
 #include "candle_defs.h"
+#include "candle_transport.h"
 #include "candle_ctrl_req.h"
-#include "ch_9.h"
 
-static bool candle_read_di(HDEVINFO hdi, SP_DEVICE_INTERFACE_DATA interfaceData, candle_device_t *dev)
+#define CANDLE_RX_THREAD_POLL_MS 100
+#define CANDLE_RX_THREAD_BACKOFF_MS 10
+#define CANDLE_RX_POISON 0xDD
+#define CANDLE_TX_SLOT_MASK ((1u<<CANDLE_TX_SLOTS)-1)
+#define CANDLE_TX_WRITING_SHIFT 16
+#define CANDLE_CLOCK_SYNC_MS 1000
+#define CANDLE_CLOCK_SYNC_MS_MIN 10
+#define CANDLE_CLOCK_SYNC_MS_MAX 60000
+#define CANDLE_AUTOBAUD_GOOD_FRAMES 4   /* this many frames and no errors end the search */
+#define CANDLE_AUTOBAUD_BAD_FRAMES 4    /* this many errors and no frames skip a candidate */
+#define CANDLE_AUTOBAUD_READ_FRAMES 32
+
+static void candle_rx_thread(void *arg);
+static void candle_rx_free_rings(candle_device_t *dev);
+static void candle_clock_thread(void *arg);
+
+const candle_transport_t *candle_transport_default(void)
 {
-    /* get required length first (this call always fails with an error) */
-    ULONG requiredLength=0;
-    SetupDiGetDeviceInterfaceDetail(hdi, &interfaceData, NULL, 0, &requiredLength, NULL);
-    if (GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
-        dev->last_error = CANDLE_ERR_SETUPDI_IF_DETAILS;
-        return false;
+#if defined(CANDLE_TRANSPORT_FAKE)
+    return &candle_transport_fake;
+#elif defined(_WIN32)
+    return &candle_transport_winusb;
+#else
+    return &candle_transport_libusb;
+#endif
+}
+
+/* static descriptors of devices seen before, keyed by path and shared by
+   all lists, so a rescan does not have to ask the devices again. An entry
+   is forgotten once its device leaves, as another may take the path. */
+typedef struct {
+    wchar_t path[256];      /* empty for a free entry */
+    candle_device_config_t dconf;
+    candle_capability_t bt_const[CANDLE_MAX_CHANNELS];
+} candle_desc_cache_entry_t;
+
+static candle_desc_cache_entry_t candle_desc_cache[CANDLE_MAX_DEVICES];
+static uint32_t candle_desc_cache_count;
+static uint32_t candle_desc_cache_next;
+static candle_mutex_t candle_desc_cache_lock;
+static candle_once_t candle_desc_cache_once = CANDLE_ONCE_INIT;
+
+static void candle_desc_cache_init(void)
+{
+    candle_mutex_init(&candle_desc_cache_lock);
+}
+
+static candle_desc_cache_entry_t *candle_desc_cache_find(const wchar_t *path)
+{
+    for (uint32_t i=0; i<candle_desc_cache_count; i++) {
+        if (wcscmp(candle_desc_cache[i].path, path) == 0) {
+            return &candle_desc_cache[i];
+        }
     }
+    return NULL;
+}
 
-    PSP_DEVICE_INTERFACE_DETAIL_DATA detail_data =
-        (PSP_DEVICE_INTERFACE_DETAIL_DATA) LocalAlloc(LMEM_FIXED, requiredLength);
+/* bt_const takes CANDLE_MAX_CHANNELS entries */
+static bool candle_desc_cache_get(const wchar_t *path, candle_device_config_t *dconf, candle_capability_t *bt_const)
+{
+    candle_once(&candle_desc_cache_once, candle_desc_cache_init);
+    candle_mutex_lock(&candle_desc_cache_lock);
+    candle_desc_cache_entry_t *e = candle_desc_cache_find(path);
+    if (e != NULL) {
+        *dconf = e->dconf;
+        memcpy(bt_const, e->bt_const, sizeof(e->bt_const));
+    }
+    candle_mutex_unlock(&candle_desc_cache_lock);
+    return (e != NULL);
+}
 
-    if (detail_data != NULL) {
-        detail_data->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
-    } else {
-        dev->last_error = CANDLE_ERR_MALLOC;
+static void candle_desc_cache_put(const candle_device_t *dev)
+{
+    candle_once(&candle_desc_cache_once, candle_desc_cache_init);
+    candle_mutex_lock(&candle_desc_cache_lock);
+    candle_desc_cache_entry_t *e = candle_desc_cache_find(dev->path);
+    if (e == NULL) {
+        e = candle_desc_cache_find(L"");
+    }
+    if (e == NULL) {
+        e = &candle_desc_cache[candle_desc_cache_next];
+        candle_desc_cache_next = (candle_desc_cache_next + 1) % CANDLE_MAX_DEVICES;
+        if (candle_desc_cache_count < CANDLE_MAX_DEVICES) {
+            candle_desc_cache_count++;
+        }
+    }
+    memcpy(e->path, dev->path, sizeof(e->path));
+    e->dconf = dev->dconf;
+    memcpy(e->bt_const, dev->bt_const, sizeof(e->bt_const));
+    candle_mutex_unlock(&candle_desc_cache_lock);
+}
+
+static void candle_desc_cache_forget(const wchar_t *path)
+{
+    candle_once(&candle_desc_cache_once, candle_desc_cache_init);
+    candle_mutex_lock(&candle_desc_cache_lock);
+    candle_desc_cache_entry_t *e = candle_desc_cache_find(path);
+    if (e != NULL) {
+        e->path[0] = L'\0';
+    }
+    candle_mutex_unlock(&candle_desc_cache_lock);
+}
+
+/* channels exposed by the device, as reported by its config */
+static unsigned candle_dev_channels(const candle_device_t *dev)
+{
+    unsigned n = dev->dconf.icount + 1;
+    return (n > CANDLE_MAX_CHANNELS) ? CANDLE_MAX_CHANNELS : n;
+}
+
+static bool candle_dev_check_channel(candle_device_t *dev, uint8_t ch)
+{
+    if ( !dev->info_valid || (ch >= candle_dev_channels(dev)) ) {
+        dev->last_error = CANDLE_ERR_CHANNEL_OUT_OF_RANGE;
         return false;
     }
+    return true;
+}
+
+/* per channel reads need per channel rings and a channel of the device; the
+   error goes to that channel's reader where it has one */
+static bool candle_rx_check_channel(candle_device_t *dev, uint8_t ch)
+{
+    candle_err_t err;
+    if (dev->rx_chans == NULL) {
+        err = CANDLE_ERR_INVALID_OPTION;
+    } else if ( !dev->info_valid || (ch >= candle_dev_channels(dev)) ) {
+        err = CANDLE_ERR_CHANNEL_OUT_OF_RANGE;
+    } else {
+        return true;
+    }
 
-    bool retval = true;
-    ULONG length = requiredLength;
-    if (!SetupDiGetDeviceInterfaceDetail(hdi, &interfaceData, detail_data, length, &requiredLength, NULL) ) {
-        dev->last_error = CANDLE_ERR_SETUPDI_IF_DETAILS2;
-        retval = false;
-    } else if (FAILED(StringCchCopy(dev->path, sizeof(dev->path), detail_data->DevicePath))) {
-        dev->last_error = CANDLE_ERR_PATH_LEN;
-        retval = false;
+    if ( (dev->rx_chans != NULL) && (ch < dev->tx_channels) ) {
+        dev->rx_chans[ch].last_error = err;
+    } else {
+        dev->last_error = err;
     }
+    return false;
+}
 
-    LocalFree(detail_data);
+/* transfers and channel requests need the device opened */
+static bool candle_dev_check_open(candle_device_t *dev)
+{
+    if (!dev->is_open) {
+        dev->last_error = CANDLE_ERR_DEVICE_NOT_OPEN;
+        return false;
+    }
+    return true;
+}
 
-    if (!retval) {
+/* device config and the capabilities of every channel */
+static bool candle_dev_read_descriptors(candle_device_t *dev)
+{
+    if (!candle_ctrl_get_config(dev, &dev->dconf)) {
         return false;
     }
 
-    /* try to open to read device infos and see if it is avail */
-    if (candle_dev_open(dev)) {
+    for (unsigned ch=0; ch<candle_dev_channels(dev); ch++) {
+        if (!candle_ctrl_get_capability(dev, ch, &dev->bt_const[ch])) {
+            dev->last_error = CANDLE_ERR_GET_BITTIMING_CONST;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* see if the device can be opened, and read its descriptors unless they are
+   cached. Only the transport is opened; no reads are queued. */
+static void candle_dev_probe(candle_device_t *dev)
+{
+    candle_dev_options_t opts = dev->opts;
+    candle_dev_options_init(&dev->opts);
+    dev->opts.rx_urb_count = 1;
+    dev->probing = true;
+
+    if (dev->transport->open(dev)) {
         dev->state = CANDLE_DEVSTATE_AVAIL;
-        candle_dev_close(dev);
+        if (!dev->info_valid && candle_dev_read_descriptors(dev)) {
+            dev->info_valid = true;
+            candle_desc_cache_put(dev);
+        }
+        dev->transport->close(dev);
     } else {
         dev->state = CANDLE_DEVSTATE_INUSE;
     }
 
+    dev->probing = false;
+    dev->opts = opts;
+    dev->probed = true;
     dev->last_error = CANDLE_ERR_OK;
-    return true;
+}
+
+/* once the device is unplugged every further transfer fails the same way */
+static candle_err_t candle_dev_note_gone(candle_device_t *dev, candle_err_t err)
+{
+    if (err == CANDLE_ERR_DEVICE_GONE) {
+        candle_atomic_store(&dev->gone, 1);
+    }
+    return err;
 }
 
 bool candle_list_scan(candle_list_handle *list)
+{
+    return candle_list_scan_transport(list, candle_transport_default());
+}
+
+bool candle_list_scan_transport(candle_list_handle *list, const candle_transport_t *transport)
 {
     if (list==NULL) {
         return false;
@@ -64,66 +223,299 @@ bool candle_list_scan(candle_list_handle *list)
     if (l==NULL) {
         return false;
     }
+    l->transport = transport;
+    candle_mutex_init(&l->lock);
+    candle_cond_init(&l->cond);
 
-    GUID guid;
-    if (CLSIDFromString(L"{c15b4308-04d3-11e6-b3ea-6057189e6443}", &guid) != NOERROR) {
-        l->last_error = CANDLE_ERR_CLSID;
-        return false;
+    if (!transport->scan(l)) {
+        return false; // keep last_error from scan call
     }
 
-    HDEVINFO hdi = SetupDiGetClassDevs(&guid, NULL, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
-    if (hdi == INVALID_HANDLE_VALUE) {
-        l->last_error = CANDLE_ERR_GET_DEVICES;
+    for (unsigned i=0; i<l->num_devices; i++) {
+        candle_list_entry_t *e = &l->dev[i];
+        e->state = CANDLE_DEVSTATE_AVAIL;
+        e->info_valid = candle_desc_cache_get(e->path, &e->dconf, e->bt_const);
+    }
+
+    l->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+bool candle_list_add(candle_list_t *l, const wchar_t *path)
+{
+    if (l->num_devices == l->capacity) {
+        uint32_t capacity = (l->capacity == 0) ? 4 : 2 * l->capacity;
+        candle_list_entry_t *dev = realloc(l->dev, capacity * sizeof(candle_list_entry_t));
+        if (dev == NULL) {
+            l->last_error = CANDLE_ERR_MALLOC;
+            return false;
+        }
+        l->dev = dev;
+        l->capacity = capacity;
+    }
+
+    candle_list_entry_t *e = &l->dev[l->num_devices];
+    memset(e, 0, sizeof(*e));
+    e->path = malloc((wcslen(path) + 1) * sizeof(wchar_t));
+    if (e->path == NULL) {
+        l->last_error = CANDLE_ERR_MALLOC;
         return false;
     }
+    wcscpy(e->path, path);
+
+    l->num_devices++;
+    return true;
+}
+
+static candle_device_t *candle_dev_from_entry(const candle_list_t *l, const candle_list_entry_t *e)
+{
+    candle_device_t *dev = calloc(1, sizeof(candle_device_t));
+    if (dev == NULL) {
+        return NULL;
+    }
 
-    bool rv = false;
-    for (unsigned i=0; i<CANDLE_MAX_DEVICES; i++) {
+    wcsncpy(dev->path, e->path, sizeof(dev->path)/sizeof(dev->path[0]) - 1);
+    dev->transport = l->transport;
+    dev->state = e->state;
+    dev->probed = e->probed;
+    dev->info_valid = e->info_valid;
+    dev->dconf = e->dconf;
+    memcpy(dev->bt_const, e->bt_const, sizeof(dev->bt_const));
+    return dev;
+}
+
+static void candle_probe_thread(void *arg)
+{
+    candle_dev_probe((candle_device_t*)arg);
+}
 
-        SP_DEVICE_INTERFACE_DATA interfaceData;
-        interfaceData.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
+bool candle_list_probe(candle_list_handle list)
+{
+    candle_list_t *l = (candle_list_t *)list;
+    if (l==NULL) {
+        return false;
+    }
 
-        if (SetupDiEnumDeviceInterfaces(hdi, NULL, &guid, i, &interfaceData)) {
+    candle_device_t *devs[CANDLE_MAX_DEVICES];
+    candle_thread_t threads[CANDLE_MAX_DEVICES];
+    bool started[CANDLE_MAX_DEVICES];
 
-            if (!candle_read_di(hdi, interfaceData, &l->dev[i])) {
-                l->last_error = l->dev[i].last_error;
-                rv = false;
-                break;
-            }
+    candle_mutex_lock(&l->lock);
+    for (unsigned i=0; i<l->num_devices; i++) {
+        devs[i] = l->dev[i].probed ? NULL : candle_dev_from_entry(l, &l->dev[i]);
+        started[i] = (devs[i] != NULL)
+                  && candle_thread_start(&threads[i], candle_probe_thread, devs[i]);
+    }
 
+    for (unsigned i=0; i<l->num_devices; i++) {
+        if (devs[i] == NULL) {
+            continue;
+        }
+        if (started[i]) {
+            candle_thread_join(threads[i]);
         } else {
+            candle_dev_probe(devs[i]);
+        }
+
+        candle_list_entry_t *e = &l->dev[i];
+        e->state = devs[i]->state;
+        e->probed = true;
+        e->info_valid = devs[i]->info_valid;
+        e->dconf = devs[i]->dconf;
+        memcpy(e->bt_const, devs[i]->bt_const, sizeof(e->bt_const));
+        free(devs[i]);
+    }
+    candle_mutex_unlock(&l->lock);
+
+    l->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+typedef struct {
+    candle_hotplug_event_t event;
+    wchar_t *path;
+} candle_hotplug_note_t;
+
+static bool candle_list_contains(const candle_list_t *l, const wchar_t *path)
+{
+    for (unsigned i=0; i<l->num_devices; i++) {
+        if (wcscmp(l->dev[i].path, path) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* the work of candle_list_refresh(); leaves l->last_error alone, so the
+   monitor thread does not race the caller's own list calls on it */
+static candle_err_t candle_list_update(candle_list_t *l, candle_hotplug_cb_t cb, void *arg)
+{
+    /* a scan only collects paths, so this is cheap enough to poll */
+    candle_list_t now;
+    memset(&now, 0, sizeof(now));
+    bool rc = l->transport->scan(&now);
+
+    candle_hotplug_note_t *notes = NULL;
+    unsigned num_notes = 0;
+    if (rc) {
+        notes = calloc(now.num_devices + l->num_devices + 1, sizeof(candle_hotplug_note_t));
+        if (notes == NULL) {
+            now.last_error = CANDLE_ERR_MALLOC;
+            rc = false;
+        }
+    }
+
+    if (rc) {
+        candle_mutex_lock(&l->lock);
 
-            DWORD err = GetLastError();
-            if (err==ERROR_NO_MORE_ITEMS) {
-                l->num_devices = i;
-                l->last_error = CANDLE_ERR_OK;
-                rv = true;
+        /* the paths of removed entries move into the notes */
+        unsigned kept = 0;
+        for (unsigned i=0; i<l->num_devices; i++) {
+            if (candle_list_contains(&now, l->dev[i].path)) {
+                l->dev[kept++] = l->dev[i];
             } else {
-                l->last_error = CANDLE_ERR_SETUPDI_IF_ENUM;
-                rv = false;
+                candle_desc_cache_forget(l->dev[i].path);
+                notes[num_notes].event = CANDLE_HOTPLUG_LEFT;
+                notes[num_notes].path = l->dev[i].path;
+                num_notes++;
             }
-            break;
+        }
+        l->num_devices = kept;
+
+        for (unsigned i=0; i<now.num_devices; i++) {
+            if ( (l->num_devices >= CANDLE_MAX_DEVICES) || candle_list_contains(l, now.dev[i].path) ) {
+                continue;
+            }
+            if (!candle_list_add(l, now.dev[i].path)) {
+                now.last_error = l->last_error;
+                rc = false;
+                break;
+            }
+            candle_list_entry_t *e = &l->dev[l->num_devices-1];
+            e->state = CANDLE_DEVSTATE_AVAIL;
+            e->info_valid = candle_desc_cache_get(e->path, &e->dconf, e->bt_const);
+            notes[num_notes].event = CANDLE_HOTPLUG_ARRIVED;
+            notes[num_notes].path = now.dev[i].path;
+            now.dev[i].path = NULL;
+            num_notes++;
+        }
+
+        candle_mutex_unlock(&l->lock);
+    }
+
+    /* without the lock, so the callback may use the list */
+    for (unsigned i=0; i<num_notes; i++) {
+        if (cb != NULL) {
+            cb(l, notes[i].event, notes[i].path, arg);
+        }
+        free(notes[i].path);
+    }
+    free(notes);
 
+    for (unsigned i=0; i<now.num_devices; i++) {
+        free(now.dev[i].path);
+    }
+    free(now.dev);
+
+    return rc ? CANDLE_ERR_OK : now.last_error;
+}
+
+bool candle_list_refresh(candle_list_handle list, candle_hotplug_cb_t cb, void *arg)
+{
+    candle_list_t *l = (candle_list_t *)list;
+    if (l==NULL) {
+        return false;
+    }
+
+    l->last_error = candle_list_update(l, cb, arg);
+    return l->last_error == CANDLE_ERR_OK;
+}
+
+static void candle_hotplug_thread(void *arg)
+{
+    candle_list_t *l = (candle_list_t *)arg;
+
+    candle_mutex_lock(&l->lock);
+    while (!l->hotplug_stop) {
+        candle_cond_wait(&l->cond, &l->lock, l->hotplug_interval_ms);
+        if (l->hotplug_stop) {
+            break;
         }
+        candle_mutex_unlock(&l->lock);
+        candle_list_update(l, l->hotplug_cb, l->hotplug_arg);
+        candle_mutex_lock(&l->lock);
+    }
+    candle_mutex_unlock(&l->lock);
+}
+
+bool candle_list_hotplug_start(candle_list_handle list, uint32_t interval_ms, candle_hotplug_cb_t cb, void *arg)
+{
+    candle_list_t *l = (candle_list_t *)list;
+    if (l==NULL) {
+        return false;
+    }
+
+    if ( l->hotplug_running || (interval_ms == 0) ) {
+        l->last_error = CANDLE_ERR_INVALID_OPTION;
+        return false;
+    }
 
+    l->hotplug_stop = false;
+    l->hotplug_interval_ms = interval_ms;
+    l->hotplug_cb = cb;
+    l->hotplug_arg = arg;
+    if (!candle_thread_start(&l->hotplug_thread, candle_hotplug_thread, l)) {
+        l->last_error = CANDLE_ERR_CREATE_THREAD;
+        return false;
     }
+    l->hotplug_running = true;
+
+    l->last_error = CANDLE_ERR_OK;
+    return true;
+}
 
-    SetupDiDestroyDeviceInfoList(hdi);
+bool candle_list_hotplug_stop(candle_list_handle list)
+{
+    candle_list_t *l = (candle_list_t *)list;
+    if (l==NULL) {
+        return false;
+    }
 
-    return rv;
+    if (l->hotplug_running) {
+        candle_mutex_lock(&l->lock);
+        l->hotplug_stop = true;
+        candle_cond_broadcast(&l->cond);
+        candle_mutex_unlock(&l->lock);
+        candle_thread_join(l->hotplug_thread);
+        l->hotplug_running = false;
+    }
 
+    l->last_error = CANDLE_ERR_OK;
+    return true;
 }
 
 bool candle_list_free(candle_list_handle list)
 {
-    free(list);
+    candle_list_t *l = (candle_list_t *)list;
+    if (l != NULL) {
+        candle_list_hotplug_stop(l);
+        for (unsigned i=0; i<l->num_devices; i++) {
+            free(l->dev[i].path);
+        }
+        free(l->dev);
+        candle_cond_destroy(&l->cond);
+        candle_mutex_destroy(&l->lock);
+    }
+    free(l);
     return true;
 }
 
 bool candle_list_length(candle_list_handle list, uint8_t *len)
 {
     candle_list_t *l = (candle_list_t *)list;
+    candle_mutex_lock(&l->lock);
     *len = l->num_devices;
+    candle_mutex_unlock(&l->lock);
     return true;
 }
 
@@ -134,19 +526,21 @@ bool candle_dev_get(candle_list_handle list, uint8_t dev_num, candle_handle *hde
         return false;
     }
 
-    if (dev_num >= CANDLE_MAX_DEVICES) {
+    candle_mutex_lock(&l->lock);
+    if (dev_num >= l->num_devices) {
+        candle_mutex_unlock(&l->lock);
         l->last_error = CANDLE_ERR_DEV_OUT_OF_RANGE;
         return false;
     }
 
-    candle_device_t *dev = calloc(1, sizeof(candle_device_t));
+    candle_device_t *dev = candle_dev_from_entry(l, &l->dev[dev_num]);
+    candle_mutex_unlock(&l->lock);
     *hdev = dev;
     if (dev==NULL) {
         l->last_error = CANDLE_ERR_MALLOC;
         return false;
     }
 
-    memcpy(dev, &l->dev[dev_num], sizeof(candle_device_t));
     l->last_error = CANDLE_ERR_OK;
     dev->last_error = CANDLE_ERR_OK;
     return true;
@@ -159,6 +553,9 @@ bool candle_dev_get_state(candle_handle hdev, candle_devstate_t *state)
         return false;
     } else {
         candle_device_t *dev = (candle_device_t*)hdev;
+        if (!dev->probed) {
+            candle_dev_probe(dev);
+        }
         *state = dev->state;
         return true;
     }
@@ -174,344 +571,1689 @@ wchar_t *candle_dev_get_path(candle_handle hdev)
     }
 }
 
-static bool candle_dev_interal_open(candle_handle hdev)
+static bool candle_alloc_rxurbs(candle_device_t *dev)
 {
-    candle_device_t *dev = (candle_device_t*)hdev;
+    uint32_t count = dev->opts.rx_urb_count;
+    uint32_t size = dev->opts.rx_urb_size;
 
-    memset(dev->rxevents, 0, sizeof(dev->rxevents));
-    memset(dev->rxurbs, 0, sizeof(dev->rxurbs));
+    /* room for everything a single urb can yield */
+    if (dev->opts.flags & CANDLE_DEVOPT_RX_PACKED) {
+        dev->rx_pending_size = candle_rx_parse_max_frames(size);
+    } else {
+        dev->rx_pending_size = 1;
+    }
+    if (dev->opts.flags & CANDLE_DEVOPT_TS_OVFL_FRAMES) {
+        dev->rx_pending_size++;
+    }
 
-    dev->deviceHandle = CreateFile(
-        dev->path,
-        GENERIC_WRITE | GENERIC_READ,
-        FILE_SHARE_WRITE | FILE_SHARE_READ,
-        NULL,
-        OPEN_EXISTING,
-        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED,
-        NULL
-    );
+    /* a borrow pins at most one urb, keep at least one in flight. A single
+       urb is never lent out, its frames are handed out as copies. */
+    uint32_t borrow_limit = (count > 1) ? count - 1 : UINT32_MAX - 1;
+    dev->rx_max_borrows = dev->opts.rx_max_borrows;
+    if (dev->rx_max_borrows > borrow_limit) {
+        dev->rx_max_borrows = borrow_limit;
+    }
 
-    if (dev->deviceHandle == INVALID_HANDLE_VALUE) {
-        dev->last_error = CANDLE_ERR_CREATE_FILE;
+    dev->rxurbs = calloc(count, sizeof(canlde_rx_urb));
+    dev->rx_order = calloc(count, sizeof(unsigned));
+    dev->rx_pending = calloc(dev->rx_pending_size, sizeof(candle_frame_t));
+    dev->rx_borrows = calloc(dev->rx_max_borrows + 1, sizeof(candle_rx_borrow_t));
+    uint8_t *bufs = malloc((size_t)count * size);
+
+    if ( (dev->rxurbs==NULL) || (dev->rx_order==NULL) || (dev->rx_pending==NULL) || (dev->rx_borrows==NULL) || (bufs==NULL) ) {
+        free(dev->rxurbs);
+        free(dev->rx_order);
+        free(dev->rx_pending);
+        free(dev->rx_borrows);
+        free(bufs);
+        dev->rxurbs = NULL;
+        dev->rx_order = NULL;
+        dev->rx_pending = NULL;
+        dev->rx_borrows = NULL;
+        dev->last_error = CANDLE_ERR_MALLOC;
         return false;
     }
 
-    if (!WinUsb_Initialize(dev->deviceHandle, &dev->winUSBHandle)) {
-        dev->last_error = CANDLE_ERR_WINUSB_INITIALIZE;
-        goto close_handle;
+    for (unsigned i=0; i<count; i++) {
+        dev->rxurbs[i].buf = &bufs[(size_t)i * size];
     }
 
-    USB_INTERFACE_DESCRIPTOR ifaceDescriptor;
-    if (!WinUsb_QueryInterfaceSettings(dev->winUSBHandle, 0, &ifaceDescriptor)) {
-        dev->last_error = CANDLE_ERR_QUERY_INTERFACE;
-        goto winusb_free;
+    dev->rx_order_head = 0;
+    dev->rx_order_count = 0;
+    dev->rx_idle_count = 0;
+    dev->rx_pending_head = 0;
+    dev->rx_pending_count = 0;
+    memset(&dev->rx_cursor, 0, sizeof(dev->rx_cursor));
+    dev->rx_cursor_ovfl = false;
+    dev->rx_borrow_count = 0;
+    dev->ts_valid = false;
+    dev->ts_last = 0;
+    dev->ts_epoch = 0;
+    dev->ts_host_ns = 0;
+    candle_rx_parser_reset(&dev->rx_parser);
+    return true;
+}
+
+static void candle_free_rxurbs(candle_device_t *dev)
+{
+    if (dev->rxurbs != NULL) {
+        free(dev->rxurbs[0].buf);
+        free(dev->rxurbs);
+        dev->rxurbs = NULL;
     }
+    free(dev->rx_order);
+    free(dev->rx_pending);
+    free(dev->rx_borrows);
+    dev->rx_order = NULL;
+    dev->rx_pending = NULL;
+    dev->rx_borrows = NULL;
+}
 
-    dev->interfaceNumber = ifaceDescriptor.bInterfaceNumber;
-    unsigned pipes_found = 0;
+static bool candle_alloc_tx(candle_device_t *dev)
+{
+    dev->tx_channels = candle_dev_channels(dev);
+    dev->tx_state = calloc(dev->tx_channels, sizeof(uint32_t));
+    dev->tx_frames = calloc(dev->tx_channels * CANDLE_TX_SLOTS, sizeof(candle_frame_t));
 
-    for (uint8_t i=0; i<ifaceDescriptor.bNumEndpoints; i++) {
+    if ( (dev->tx_state==NULL) || (dev->tx_frames==NULL) ) {
+        dev->last_error = CANDLE_ERR_MALLOC;
+        return false;
+    }
 
-        WINUSB_PIPE_INFORMATION pipeInfo;
-        if (!WinUsb_QueryPipe(dev->winUSBHandle, 0, i, &pipeInfo)) {
-            dev->last_error = CANDLE_ERR_QUERY_PIPE;
-            goto winusb_free;
-        }
+    return dev->transport->alloc_writes(dev, dev->tx_channels * CANDLE_TX_SLOTS);
+}
 
-        if (pipeInfo.PipeType == UsbdPipeTypeBulk && USB_ENDPOINT_DIRECTION_IN(pipeInfo.PipeId)) {
-            dev->bulkInPipe = pipeInfo.PipeId;
-            pipes_found++;
-        } else if (pipeInfo.PipeType == UsbdPipeTypeBulk && USB_ENDPOINT_DIRECTION_OUT(pipeInfo.PipeId)) {
-            dev->bulkOutPipe = pipeInfo.PipeId;
-            pipes_found++;
-        } else {
-            dev->last_error = CANDLE_ERR_PARSE_IF_DESCR;
-            goto winusb_free;
-        }
+static void candle_free_tx(candle_device_t *dev)
+{
+    free(dev->tx_state);
+    free(dev->tx_frames);
+    dev->tx_state = NULL;
+    dev->tx_frames = NULL;
+    dev->tx_channels = 0;
+}
+
+static bool candle_dev_interal_open(candle_handle hdev)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
 
+    if (!candle_alloc_rxurbs(dev)) {
+        return false;
     }
 
-    if (pipes_found != 2) {
-        dev->last_error = CANDLE_ERR_PARSE_IF_DESCR;
-        goto winusb_free;
+    if (!dev->transport->open(dev)) {
+        goto free_rxurbs; // keep last_error from transport
     }
+    dev->gone = 0;
 
     if (!candle_ctrl_set_host_format(dev)) {
-        goto winusb_free;
+        goto transport_close;
     }
 
     if (!candle_ctrl_set_timestamp_mode(dev, true)) {
-        goto winusb_free;
+        goto transport_close;
     }
 
-    if (!candle_ctrl_get_config(dev, &dev->dconf)) {
-        goto winusb_free;
+    if (!candle_dev_read_descriptors(dev)) {
+        goto transport_close;
     }
+    candle_rx_parser_init(&dev->rx_parser, candle_dev_channels(dev));
 
-    if (!candle_ctrl_get_capability(dev, 0, &dev->bt_const)) {
-        dev->last_error = CANDLE_ERR_GET_BITTIMING_CONST;
-        goto winusb_free;
+    if (!candle_alloc_tx(dev)) {
+        goto transport_close;
     }
+    dev->info_valid = true;
+    candle_desc_cache_put(dev);
 
+    dev->state = CANDLE_DEVSTATE_AVAIL;
+    dev->probed = true;
     dev->last_error = CANDLE_ERR_OK;
     return true;
 
-winusb_free:
-    WinUsb_Free(dev->winUSBHandle);
+transport_close:
+    dev->transport->close(dev);
+    candle_free_tx(dev);
 
-close_handle:
-    CloseHandle(dev->deviceHandle);
+free_rxurbs:
+    candle_free_rxurbs(dev);
     return false;
 
 }
 
-static bool candle_prepare_read(candle_device_t *dev, unsigned urb_num)
+static candle_err_t candle_prepare_read(candle_device_t *dev, unsigned urb_num)
 {
-    bool rc = WinUsb_ReadPipe(
-        dev->winUSBHandle,
-        dev->bulkInPipe,
-        dev->rxurbs[urb_num].buf,
-        sizeof(dev->rxurbs[urb_num].buf),
-        NULL,
-        &dev->rxurbs[urb_num].ovl
-    );
+    canlde_rx_urb *urb = &dev->rxurbs[urb_num];
+    urb->done = false;
+
+    candle_err_t err = candle_dev_note_gone(dev, dev->transport->submit_read(dev, urb_num));
+    if (err != CANDLE_ERR_OK) {
+        if (!urb->idle) {
+            urb->idle = true;
+            dev->rx_idle_count++;
+        }
+        return err;
+    }
 
-    if (rc || (GetLastError()!=ERROR_IO_PENDING)) {
-        dev->last_error = CANDLE_ERR_PREPARE_READ;
-        return false;
-    } else {
-        dev->last_error = CANDLE_ERR_OK;
-        return true;
+    if (urb->idle) {
+        urb->idle = false;
+        dev->rx_idle_count--;
     }
+
+    dev->rx_order[(dev->rx_order_head + dev->rx_order_count) % dev->opts.rx_urb_count] = urb_num;
+    dev->rx_order_count++;
+    return CANDLE_ERR_OK;
 }
 
-static bool candle_close_rxurbs(candle_device_t *dev)
+void candle_dev_options_init(candle_dev_options_t *opts)
 {
-    for (unsigned i=0; i<CANDLE_URB_COUNT; i++) {
-        if (dev->rxevents[i] != NULL) {
-            CloseHandle(dev->rxevents[i]);
-        }
-    }
-    return true;
+    memset(opts, 0, sizeof(*opts));
+    opts->rx_urb_count = CANDLE_URB_COUNT;
+    opts->rx_urb_size = CANDLE_URB_SIZE;
+    opts->rx_ring_frames = CANDLE_RX_RING_FRAMES;
+    opts->rx_max_borrows = CANDLE_RX_MAX_BORROWS;
+    opts->clock_sync_ms = CANDLE_CLOCK_SYNC_MS;
 }
 
-
 bool candle_dev_open(candle_handle hdev)
 {
-    candle_device_t *dev = (candle_device_t*)hdev;
-
-    if (candle_dev_interal_open(dev)) {
-        for (unsigned i=0; i<CANDLE_URB_COUNT; i++) {
-            HANDLE ev = CreateEvent(NULL, true, false, NULL);
-            dev->rxevents[i] = ev;
-            dev->rxurbs[i].ovl.hEvent = ev;
-            if (!candle_prepare_read(dev, i)) {
-                candle_close_rxurbs(dev);
-                return false; // keep last_error from prepare_read call
-            }
-        }
-        dev->last_error = CANDLE_ERR_OK;
-        return true;
-    } else {
-        return false; // keep last_error from open_device call
-    }
-
+    candle_dev_options_t opts;
+    candle_dev_options_init(&opts);
+    return candle_dev_open_ex(hdev, &opts);
 }
 
-bool candle_dev_close(candle_handle hdev)
+/* the device ring, or with CANDLE_DEVOPT_RX_PER_CHANNEL one ring per channel */
+static bool candle_rx_alloc_rings(candle_device_t *dev)
 {
-    candle_device_t *dev = (candle_device_t*)hdev;
-
-    candle_close_rxurbs(dev);
-
-    WinUsb_Free(dev->winUSBHandle);
-    dev->winUSBHandle = NULL;
-    CloseHandle(dev->deviceHandle);
-    dev->deviceHandle = NULL;
-
-    dev->last_error = CANDLE_ERR_OK;
-    return true;
-}
+    if (!(dev->opts.flags & CANDLE_DEVOPT_RX_PER_CHANNEL)) {
+        return candle_ring_init(&dev->rx_ring, dev->opts.rx_ring_frames);
+    }
 
-bool candle_dev_free(candle_handle hdev)
-{
-    free(hdev);
+    dev->rx_chans = calloc(dev->tx_channels, sizeof(candle_rx_channel_t));
+    if (dev->rx_chans == NULL) {
+        return false;
+    }
+    for (uint32_t ch=0; ch<dev->tx_channels; ch++) {
+        if (!candle_ring_init(&dev->rx_chans[ch].ring, dev->opts.rx_ring_frames)) {
+            candle_rx_free_rings(dev);
+            return false;
+        }
+    }
     return true;
 }
 
-candle_err_t candle_dev_last_error(candle_handle hdev)
+static void candle_rx_free_rings(candle_device_t *dev)
 {
-    candle_device_t *dev = (candle_device_t*)hdev;
-    return dev->last_error;
+    candle_ring_free(&dev->rx_ring);
+    if (dev->rx_chans != NULL) {
+        for (uint32_t ch=0; ch<dev->tx_channels; ch++) {
+            candle_ring_free(&dev->rx_chans[ch].ring);
+        }
+        free(dev->rx_chans);
+        dev->rx_chans = NULL;
+    }
 }
 
-bool candle_channel_count(candle_handle hdev, uint8_t *num_channels)
+/* the threads must be gone before the transport cancels its urbs */
+static void candle_dev_stop_threads(candle_device_t *dev)
 {
-    // TODO check if info was already read from device; try to do so; throw error...
-    candle_device_t *dev = (candle_device_t*)hdev;
-    *num_channels = dev->dconf.icount+1;
-    return true;
-}
+    if (dev->clock_running) {
+        candle_clock_stop(&dev->clock);
+        candle_thread_join(dev->clock_thread);
+        dev->clock_running = false;
+        candle_clock_free(&dev->clock);
+    }
 
-bool candle_channel_get_capabilities(candle_handle hdev, uint8_t ch, candle_capability_t *cap)
-{
-    // TODO check if info was already read from device; try to do so; throw error...
-    candle_device_t *dev = (candle_device_t*)hdev;
-    memcpy(cap, &dev->bt_const, sizeof(candle_capability_t));
-    return true;
+    if (dev->rx_thread_running) {
+        candle_atomic_store(&dev->rx_thread_stop, 1);
+        candle_thread_join(dev->rx_thread);
+        dev->rx_thread_running = false;
+        candle_rx_free_rings(dev);
+    }
 }
 
-bool candle_channel_set_timing(candle_handle hdev, uint8_t ch, candle_bittiming_t *data)
+bool candle_dev_open_ex(candle_handle hdev, const candle_dev_options_t *opts)
 {
-    // TODO ensure device is open, check channel count..
     candle_device_t *dev = (candle_device_t*)hdev;
-    return candle_ctrl_set_bittiming(dev, ch, data);
-}
 
-bool candle_channel_set_bitrate(candle_handle hdev, uint8_t ch, uint32_t bitrate)
+    /* the urbs, rings and threads of the running open would be replaced */
+    if (dev->is_open) {
+        dev->last_error = CANDLE_ERR_DEVICE_ALREADY_OPEN;
+        return false;
+    }
+    if ( (opts->rx_urb_count < 1) || (opts->rx_urb_count > CANDLE_URB_COUNT_MAX)
+      || (opts->rx_urb_size < sizeof(candle_frame_t)) || (opts->rx_urb_size > CANDLE_URB_SIZE_MAX) ) {
+        dev->last_error = CANDLE_ERR_INVALID_OPTION;
+        return false;
+    }
+    if ( (opts->flags & CANDLE_DEVOPT_RX_THREAD)
+      && ((opts->rx_ring_frames < 1) || (opts->rx_ring_frames > CANDLE_RING_SIZE_MAX)) ) {
+        dev->last_error = CANDLE_ERR_INVALID_OPTION;
+        return false;
+    }
+    if ( (opts->flags & CANDLE_DEVOPT_RX_PER_CHANNEL) && !(opts->flags & CANDLE_DEVOPT_RX_THREAD) ) {
+        dev->last_error = CANDLE_ERR_INVALID_OPTION;
+        return false;
+    }
+    if ( (opts->flags & CANDLE_DEVOPT_CLOCK_SYNC)
+      && ((opts->clock_sync_ms < CANDLE_CLOCK_SYNC_MS_MIN) || (opts->clock_sync_ms > CANDLE_CLOCK_SYNC_MS_MAX)) ) {
+        dev->last_error = CANDLE_ERR_INVALID_OPTION;
+        return false;
+    }
+    dev->opts = *opts;
+
+    if (!candle_dev_interal_open(dev)) {
+        return false; // keep last_error from open_device call
+    }
+
+    candle_err_t err;
+    for (unsigned i=0; i<dev->opts.rx_urb_count; i++) {
+        err = candle_prepare_read(dev, i);
+        if (err != CANDLE_ERR_OK) {
+            goto close;
+        }
+    }
+
+    if (dev->opts.flags & CANDLE_DEVOPT_RX_THREAD) {
+        if (!candle_rx_alloc_rings(dev)) {
+            err = CANDLE_ERR_MALLOC;
+            goto close;
+        }
+        dev->rx_thread_stop = 0;
+        dev->rx_thread_error = CANDLE_ERR_OK;
+        if (!candle_thread_start(&dev->rx_thread, candle_rx_thread, dev)) {
+            err = CANDLE_ERR_CREATE_THREAD;
+            candle_rx_free_rings(dev);
+            goto close;
+        }
+        dev->rx_thread_running = true;
+    }
+
+    if (dev->opts.flags & CANDLE_DEVOPT_CLOCK_SYNC) {
+        candle_clock_init(&dev->clock);
+        if (!candle_thread_start(&dev->clock_thread, candle_clock_thread, dev)) {
+            err = CANDLE_ERR_CREATE_THREAD;
+            candle_clock_free(&dev->clock);
+            goto close;
+        }
+        dev->clock_running = true;
+    }
+
+    dev->is_open = true;
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+
+close:
+    candle_dev_stop_threads(dev);
+    dev->transport->close(dev);
+    candle_free_tx(dev);
+    candle_free_rxurbs(dev);
+    dev->last_error = err;
+    return false;
+}
+
+bool candle_dev_close(candle_handle hdev)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+
+    dev->is_open = false;
+    candle_dev_stop_threads(dev);
+    dev->transport->close(dev);
+    candle_free_tx(dev);
+    candle_free_rxurbs(dev);
+
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+bool candle_dev_free(candle_handle hdev)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+    if (dev != NULL) {
+        candle_filter_compiled_free(dev->rx_filter);
+        candle_change_free(dev->rx_change);
+    }
+    free(hdev);
+    return true;
+}
+
+bool candle_dev_get_rx_stats(candle_handle hdev, candle_rx_stats_t *stats)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+
+    if (dev->rx_chans != NULL) {
+        stats->frames = 0;
+        stats->overflows = 0;
+        for (uint32_t ch=0; ch<dev->tx_channels; ch++) {
+            stats->frames += candle_atomic_load(&dev->rx_chans[ch].ring.pushed);
+            stats->overflows += candle_atomic_load(&dev->rx_chans[ch].ring.overflows);
+        }
+    } else if (dev->rx_thread_running) {
+        stats->frames = candle_atomic_load(&dev->rx_ring.pushed);
+        stats->overflows = candle_atomic_load(&dev->rx_ring.overflows);
+    } else {
+        stats->frames = 0;
+        stats->overflows = 0;
+    }
+    stats->filtered = candle_atomic_load(&dev->rx_filtered);
+    stats->changed = candle_atomic_load(&dev->rx_changed);
+    stats->unchanged = candle_atomic_load(&dev->rx_unchanged);
+
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+bool candle_filter_create(candle_filter_handle *filter)
+{
+    if (filter==NULL) {
+        return false;
+    }
+
+    *filter = calloc(1, sizeof(candle_filter_t));
+    return *filter != NULL;
+}
+
+bool candle_filter_free(candle_filter_handle filter)
+{
+    candle_filter_t *f = (candle_filter_t *)filter;
+    if (f != NULL) {
+        free(f->rules);
+        free(f);
+    }
+    return true;
+}
+
+bool candle_filter_add_mask(candle_filter_handle filter, bool extended, uint32_t value, uint32_t mask)
+{
+    if (filter==NULL) {
+        return false;
+    }
+
+    candle_filter_rule_t rule = { extended, false, value, mask };
+    return candle_filter_add((candle_filter_t *)filter, &rule);
+}
+
+bool candle_filter_add_range(candle_filter_handle filter, bool extended, uint32_t first, uint32_t last)
+{
+    uint32_t max_id = extended ? CANDLE_FILTER_EXT_MAX : CANDLE_FILTER_STD_IDS - 1;
+    if ( (filter==NULL) || (first > last) || (last > max_id) ) {
+        return false;
+    }
+
+    candle_filter_rule_t rule = { extended, true, first, last };
+    return candle_filter_add((candle_filter_t *)filter, &rule);
+}
+
+/* after swapping rx_filter or rx_change: wait until the receive path is
+   done with what it may have loaded before */
+static void candle_rx_filter_quiesce(candle_device_t *dev)
+{
+    candle_atomic_fence();
+    while (candle_atomic_load(&dev->rx_filter_busy)) {
+        candle_sleep_ms(0);
+    }
+}
+
+bool candle_dev_set_filter(candle_handle hdev, candle_filter_handle filter)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+
+    candle_filter_compiled_t *compiled = NULL;
+    if (filter != NULL) {
+        compiled = candle_filter_compile((const candle_filter_t *)filter);
+        if (compiled == NULL) {
+            dev->last_error = CANDLE_ERR_MALLOC;
+            return false;
+        }
+    }
+
+    candle_filter_compiled_t *old = candle_atomic_exchange(&dev->rx_filter, compiled);
+    candle_rx_filter_quiesce(dev);
+    candle_filter_compiled_free(old);
+
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+bool candle_dev_set_change_filter(candle_handle hdev, bool enable, uint32_t heartbeat_ms, const candle_change_heartbeat_t *ids, size_t num_ids)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+
+    candle_change_table_t *table = NULL;
+    if (enable) {
+        if (heartbeat_ms > CANDLE_CHANGE_HEARTBEAT_MS_MAX) {
+            dev->last_error = CANDLE_ERR_INVALID_OPTION;
+            return false;
+        }
+        for (size_t i=0; i<num_ids; i++) {
+            if (ids[i].heartbeat_ms > CANDLE_CHANGE_HEARTBEAT_MS_MAX) {
+                dev->last_error = CANDLE_ERR_INVALID_OPTION;
+                return false;
+            }
+        }
+
+        table = candle_change_create(heartbeat_ms);
+        if (table == NULL) {
+            dev->last_error = CANDLE_ERR_MALLOC;
+            return false;
+        }
+        for (size_t i=0; i<num_ids; i++) {
+            if (!candle_change_set_heartbeat(table, ids[i].channel, ids[i].can_id, ids[i].heartbeat_ms)) {
+                candle_change_free(table);
+                dev->last_error = CANDLE_ERR_MALLOC;
+                return false;
+            }
+        }
+    }
+
+    candle_change_table_t *old = candle_atomic_exchange(&dev->rx_change, table);
+    candle_rx_filter_quiesce(dev);
+    candle_change_free(old);
+
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+candle_err_t candle_dev_last_error(candle_handle hdev)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+    return dev->last_error;
+}
+
+bool candle_channel_count(candle_handle hdev, uint8_t *num_channels)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+    if (!dev->info_valid) {
+        candle_dev_probe(dev);
+    }
+    if (!dev->info_valid) {
+        dev->last_error = CANDLE_ERR_GET_DEVICE_INFO;
+        return false;
+    }
+    *num_channels = candle_dev_channels(dev);
+    return true;
+}
+
+bool candle_channel_get_capabilities(candle_handle hdev, uint8_t ch, candle_capability_t *cap)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+    if (!dev->info_valid) {
+        candle_dev_probe(dev);
+    }
+    if (!dev->info_valid) {
+        dev->last_error = CANDLE_ERR_GET_BITTIMING_CONST;
+        return false;
+    }
+    if (!candle_dev_check_channel(dev, ch)) {
+        return false;
+    }
+    memcpy(cap, &dev->bt_const[ch], sizeof(candle_capability_t));
+    return true;
+}
+
+bool candle_channel_set_timing(candle_handle hdev, uint8_t ch, candle_bittiming_t *data)
 {
-    // TODO ensure device is open, check channel count..
     candle_device_t *dev = (candle_device_t*)hdev;
+    if (!candle_dev_check_open(dev) || !candle_dev_check_channel(dev, ch)) {
+        return false;
+    }
+    return candle_ctrl_set_bittiming(dev, ch, data);
+}
+
+bool candle_channel_set_bitrate(candle_handle hdev, uint8_t ch, uint32_t bitrate)
+{
+    return candle_channel_set_bitrate_ex(hdev, ch, bitrate, 0, NULL);
+}
 
-    if (dev->bt_const.fclk_can != 48000000) {
-        /* this function only works for the candleLight base clock of 48MHz */
-        dev->last_error = CANDLE_ERR_BITRATE_FCLK;
+bool candle_channel_set_bitrate_ex(candle_handle hdev, uint8_t ch, uint32_t bitrate, uint32_t sample_point, candle_bittiming_result_t *result)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+    if (!candle_dev_check_open(dev) || !candle_dev_check_channel(dev, ch)) {
         return false;
     }
 
     candle_bittiming_t t;
-    t.prop_seg = 1;
-    t.sjw = 1;
-    t.phase_seg1 = 13 - t.prop_seg;
-    t.phase_seg2 = 2;
-
-    switch (bitrate) {
-        case 10000:
-            t.brp = 300;
+    candle_err_t err = candle_bt_calc_cached(&dev->bt_cache, &dev->bt_const[ch], bitrate, sample_point, &t, result);
+    if (err != CANDLE_ERR_OK) {
+        dev->last_error = err;
+        return false;
+    }
+
+    return candle_ctrl_set_bittiming(dev, ch, &t);
+}
+
+/* the device drops queued frames on a mode change, so their echoes never come */
+static void candle_tx_reset_echoes(candle_device_t *dev, uint8_t ch)
+{
+    if (ch < dev->tx_channels) {
+        candle_atomic_and(&dev->tx_state[ch], ~CANDLE_TX_SLOT_MASK);
+    }
+}
+
+bool candle_channel_start(candle_handle hdev, uint8_t ch, uint32_t flags)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+    if (!candle_dev_check_open(dev) || !candle_dev_check_channel(dev, ch)) {
+        return false;
+    }
+    candle_tx_reset_echoes(dev, ch);
+    return candle_ctrl_set_device_mode(dev, ch, CANDLE_DEVMODE_START, flags);
+}
+
+bool candle_channel_stop(candle_handle hdev, uint8_t ch)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+    if (!candle_dev_check_open(dev) || !candle_dev_check_channel(dev, ch)) {
+        return false;
+    }
+    bool rc = candle_ctrl_set_device_mode(dev, ch, CANDLE_DEVMODE_RESET, 0);
+    candle_tx_reset_echoes(dev, ch);
+    return rc;
+}
+
+static const uint32_t candle_autobaud_default[] = {
+    500000, 250000, 125000, 1000000, 100000, 83333, 50000, 800000, 20000, 10000
+};
+
+static uint32_t candle_autobaud_hits(candle_device_t *dev, uint32_t bitrate)
+{
+    for (unsigned i=0; i<CANDLE_AUTOBAUD_HISTORY; i++) {
+        if (dev->autobaud_hits[i].bitrate == bitrate) {
+            return dev->autobaud_hits[i].hits;
+        }
+    }
+    return 0;
+}
+
+/* count a detection, replacing the least used entry for a new bitrate */
+static void candle_autobaud_record(candle_device_t *dev, uint32_t bitrate)
+{
+    unsigned victim = 0;
+    for (unsigned i=0; i<CANDLE_AUTOBAUD_HISTORY; i++) {
+        if (dev->autobaud_hits[i].bitrate == bitrate) {
+            dev->autobaud_hits[i].hits++;
+            return;
+        }
+        if (dev->autobaud_hits[i].hits < dev->autobaud_hits[victim].hits) {
+            victim = i;
+        }
+    }
+    dev->autobaud_hits[victim].bitrate = bitrate;
+    dev->autobaud_hits[victim].hits = 1;
+}
+
+static bool candle_autobaud_read(candle_device_t *dev, uint8_t ch, candle_frame_t *frames, uint32_t *count, uint32_t timeout_ms)
+{
+    return (dev->rx_chans != NULL) ? candle_channel_frame_read_many(dev, ch, frames, CANDLE_AUTOBAUD_READ_FRAMES, count, timeout_ms)
+                                   : candle_frame_read_many(dev, frames, CANDLE_AUTOBAUD_READ_FRAMES, count, timeout_ms);
+}
+
+/* drop what is still queued from the last candidate, so it isn't scored
+   against the next one */
+static void candle_autobaud_drain(candle_device_t *dev, uint8_t ch)
+{
+    candle_frame_t frames[CANDLE_AUTOBAUD_READ_FRAMES];
+    uint32_t count;
+
+    while (candle_autobaud_read(dev, ch, frames, &count, 0) && (count > 0)) {
+    }
+}
+
+/* listen on ch for up to slice_ms; stops early once the outcome is obvious */
+static candle_err_t candle_autobaud_listen(candle_device_t *dev, uint8_t ch, uint32_t slice_ms, uint32_t *valid, uint32_t *errors)
+{
+    candle_frame_t frames[CANDLE_AUTOBAUD_READ_FRAMES];
+    uint64_t deadline = candle_time_ns() + (uint64_t)slice_ms * 1000000;
+
+    *valid = 0;
+    *errors = 0;
+    while ( (*valid < CANDLE_AUTOBAUD_GOOD_FRAMES) || (*errors > 0) ) {
+        if ( (*errors >= CANDLE_AUTOBAUD_BAD_FRAMES) && (*valid == 0) ) {
             break;
+        }
 
-        case 20000:
-            t.brp = 150;
+        uint64_t now = candle_time_ns();
+        if (now >= deadline) {
             break;
+        }
+
+        uint32_t count;
+        uint32_t ms = (uint32_t)((deadline - now + 999999) / 1000000);
+        if (!candle_autobaud_read(dev, ch, frames, &count, ms)) {
+            candle_err_t err = candle_channel_last_error(dev, ch);
+            if (err == CANDLE_ERR_READ_TIMEOUT) {
+                break;
+            }
+            return err;
+        }
+
+        for (uint32_t i=0; i<count; i++) {
+            if (frames[i].channel != ch) {
+                continue;
+            }
+            switch (candle_frame_type(&frames[i])) {
+                case CANDLE_FRAMETYPE_RECEIVE:
+                    (*valid)++;
+                    break;
+                case CANDLE_FRAMETYPE_ERROR:
+                    (*errors)++;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    return CANDLE_ERR_OK;
+}
 
-        case 50000:
-            t.brp = 60;
+bool candle_channel_autobaud(candle_handle hdev, uint8_t ch, const uint32_t *candidates, size_t num_candidates, uint32_t timeout_ms, uint32_t *detected)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+    if (!candle_dev_check_open(dev) || !candle_dev_check_channel(dev, ch)) {
+        return false;
+    }
+
+    if (candidates == NULL) {
+        candidates = candle_autobaud_default;
+        num_candidates = sizeof(candle_autobaud_default) / sizeof(candle_autobaud_default[0]);
+    }
+    if (num_candidates == 0) {
+        dev->last_error = CANDLE_ERR_INVALID_OPTION;
+        return false;
+    }
+
+    /* most frequently detected rates first, otherwise keep the caller's order */
+    uint32_t *order = malloc(num_candidates * sizeof(uint32_t));
+    if (order == NULL) {
+        dev->last_error = CANDLE_ERR_MALLOC;
+        return false;
+    }
+    for (size_t i=0; i<num_candidates; i++) {
+        uint32_t rate = candidates[i];
+        uint32_t hits = candle_autobaud_hits(dev, rate);
+        size_t k = i;
+        while ( (k > 0) && (candle_autobaud_hits(dev, order[k-1]) < hits) ) {
+            order[k] = order[k-1];
+            k--;
+        }
+        order[k] = rate;
+    }
+
+    uint32_t slice_ms = timeout_ms / num_candidates;
+    if (slice_ms == 0) {
+        slice_ms = 1;
+    }
+
+    candle_err_t err = CANDLE_ERR_AUTOBAUD_FAILED;
+    uint32_t best_rate = 0;
+    int64_t best_score = 0;
+
+    /* every received frame counts, whatever the acceptance and change filters say */
+    candle_filter_compiled_t *filter = candle_atomic_exchange(&dev->rx_filter, NULL);
+    candle_change_table_t *change = candle_atomic_exchange(&dev->rx_change, NULL);
+    candle_rx_filter_quiesce(dev);
+
+    for (size_t i=0; i<num_candidates; i++) {
+        uint32_t valid, errors;
+
+        if (!candle_channel_set_bitrate(dev, ch, order[i])) {
+            continue; // not reachable with this clock
+        }
+        if (!candle_channel_start(dev, ch, CANDLE_MODE_LISTEN_ONLY)) {
+            err = dev->last_error;
+            break;
+        }
+        candle_err_t rc = candle_autobaud_listen(dev, ch, slice_ms, &valid, &errors);
+        if (!candle_channel_stop(dev, ch)) {
+            err = dev->last_error;
             break;
+        }
+        candle_autobaud_drain(dev, ch);
+        if (rc != CANDLE_ERR_OK) {
+            err = rc;
+            break;
+        }
 
-        case 83333:
-            t.brp = 36;
+        int64_t score = (int64_t)valid - errors;
+        if ( (valid > 0) && (score > best_score) ) {
+            best_rate = order[i];
+            best_score = score;
+            err = CANDLE_ERR_OK;
+        }
+        if ( (valid >= CANDLE_AUTOBAUD_GOOD_FRAMES) && (errors == 0) ) {
             break;
+        }
+    }
+    free(order);
+
+    /* a filter set in the meantime replaces the one put aside */
+    candle_filter_compiled_t *no_filter = NULL;
+    if (!candle_atomic_cas(&dev->rx_filter, &no_filter, filter)) {
+        candle_filter_compiled_free(filter);
+    }
+    candle_change_table_t *no_change = NULL;
+    if (!candle_atomic_cas(&dev->rx_change, &no_change, change)) {
+        candle_change_free(change);
+    }
+
+    if ( (err == CANDLE_ERR_OK) && !candle_channel_set_bitrate(dev, ch, best_rate) ) {
+        err = dev->last_error;
+    }
+    if (err != CANDLE_ERR_OK) {
+        dev->last_error = err;
+        return false;
+    }
+
+    candle_autobaud_record(dev, best_rate);
+    *detected = best_rate;
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+bool candle_frame_send(candle_handle hdev, uint8_t ch, candle_frame_t *frame)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+
+    if (!candle_dev_check_open(dev) || !candle_dev_check_channel(dev, ch)) {
+        return false;
+    }
+    if (candle_atomic_load(&dev->gone)) {
+        dev->last_error = CANDLE_ERR_DEVICE_GONE;
+        return false;
+    }
+
+    frame->echo_id = 0;
+    frame->channel = ch;
+
+    uint32_t written;
+    bool rc = dev->transport->write(dev, frame, sizeof(*frame), &written);
+    candle_dev_note_gone(dev, dev->last_error);
+    return rc;
+}
+
+bool candle_frame_send_many(candle_handle hdev, uint8_t ch, const candle_frame_t *frames, size_t n, size_t *sent)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+    candle_frame_t chunk[CANDLE_TX_CHUNK_FRAMES];
+
+    /* without firmware support every frame needs its own transfer */
+    size_t per_write = (dev->opts.flags & CANDLE_DEVOPT_TX_PACKED) ? CANDLE_TX_CHUNK_FRAMES : 1;
+
+    *sent = 0;
+    if (!candle_dev_check_open(dev) || !candle_dev_check_channel(dev, ch)) {
+        return false;
+    }
+    if (candle_atomic_load(&dev->gone)) {
+        dev->last_error = CANDLE_ERR_DEVICE_GONE;
+        return false;
+    }
+
+    while (*sent < n) {
+        size_t k = n - *sent;
+        if (k > CANDLE_TX_CHUNK_FRAMES) {
+            k = CANDLE_TX_CHUNK_FRAMES;
+        }
+
+        memcpy(chunk, &frames[*sent], k * sizeof(candle_frame_t));
+        for (size_t i=0; i<k; i++) {
+            chunk[i].echo_id = 0;
+            chunk[i].channel = ch;
+        }
+
+        for (size_t i=0; i<k; i+=per_write) {
+            uint32_t len = (uint32_t)(((k - i < per_write) ? k - i : per_write) * sizeof(candle_frame_t));
+            uint32_t written = 0;
+            bool rc = dev->transport->write(dev, &chunk[i], len, &written);
+
+            /* only whole frames count as sent */
+            *sent += written / sizeof(candle_frame_t);
+            if (!rc || (written != len)) {
+                if (candle_dev_note_gone(dev, dev->last_error) != CANDLE_ERR_DEVICE_GONE) {
+                    dev->last_error = CANDLE_ERR_SEND_FRAME;
+                }
+                return false;
+            }
+        }
+    }
+
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+bool candle_frame_send_async(candle_handle hdev, uint8_t ch, const candle_frame_t *frame)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+
+    if (!candle_dev_check_open(dev) || !candle_dev_check_channel(dev, ch)) {
+        return false;
+    }
+    if (candle_atomic_load(&dev->gone)) {
+        dev->last_error = CANDLE_ERR_DEVICE_GONE;
+        return false;
+    }
+
+    /* claim a slot that is neither waiting for its echo nor still being written */
+    uint32_t *state = &dev->tx_state[ch];
+    uint32_t old = candle_atomic_load(state);
+    unsigned slot;
+    do {
+        uint32_t busy = (old | (old >> CANDLE_TX_WRITING_SHIFT)) & CANDLE_TX_SLOT_MASK;
+        if (busy == CANDLE_TX_SLOT_MASK) {
+            dev->last_error = CANDLE_ERR_SEND_WOULD_BLOCK;
+            return false;
+        }
+        for (slot=0; busy & (1u<<slot); slot++);
+    } while (!candle_atomic_cas(state, &old, old | (1u<<slot) | (1u<<(slot+CANDLE_TX_WRITING_SHIFT))));
+
+    unsigned n = ch * CANDLE_TX_SLOTS + slot;
+    candle_frame_t *f = &dev->tx_frames[n];
+    memcpy(f, frame, sizeof(candle_frame_t));
+    f->echo_id = CANDLE_TX_ECHO_BASE + n;
+    f->channel = ch;
+
+    candle_err_t err = candle_dev_note_gone(dev, dev->transport->submit_write(dev, n, f, sizeof(candle_frame_t)));
+    if (err != CANDLE_ERR_OK) {
+        candle_atomic_and(state, ~((1u<<slot) | (1u<<(slot+CANDLE_TX_WRITING_SHIFT))));
+    }
+
+    dev->last_error = err;
+    return err == CANDLE_ERR_OK;
+}
+
+void candle_tx_complete(candle_device_t *dev, unsigned slot, bool ok)
+{
+    uint32_t bit = 1u << (slot % CANDLE_TX_SLOTS);
+    uint32_t clear = bit << CANDLE_TX_WRITING_SHIFT;
+    if (!ok) {
+        /* a frame that never reached the device won't be echoed either */
+        clear |= bit;
+    }
+    candle_atomic_and(&dev->tx_state[slot / CANDLE_TX_SLOTS], ~clear);
+}
+
+/* stamp the timestamp epoch into a received frame, returns true if the
+   device counter wrapped (once or more) right before it. The host time
+   since the newest frame says how far the counter can have moved on, which
+   a quiet bus may leave longer than a whole wrap: a frame gets the latest
+   time that is no more than CANDLE_TS_SLACK_US ahead of that guess. The
+   slack covers frames that were only read late; anything older than the
+   newest frame counts as out of order. now_ns is candle_time_ns(). */
+static bool candle_rx_timebase(candle_device_t *dev, candle_frame_t *frame, uint64_t now_ns)
+{
+    uint32_t ts = frame->timestamp_us;
+    uint32_t epoch = dev->ts_epoch;
+    bool wrapped = false;
+
+    if (!dev->ts_valid) {
+        dev->ts_valid = true;
+        dev->ts_last = ts;
+        dev->ts_host_ns = now_ns;
+        frame->reserved = (uint8_t)epoch;
+        return false;
+    }
+
+    uint64_t last = ((uint64_t)epoch << 32) | dev->ts_last;
+    uint64_t limit = last + (now_ns - dev->ts_host_ns) / 1000 + CANDLE_TS_SLACK_US;
+    uint64_t t = (limit & ~(uint64_t)0xFFFFFFFF) | ts;
+    bool newest = (t >= last);
+    if (t > limit) {
+        /* from the epoch before, if there is one */
+        if (t >= ((uint64_t)1 << 32)) {
+            t -= (uint64_t)1 << 32;
+            newest = (t >= last);
+        } else {
+            newest = false;
+        }
+    }
+
+    if (newest) {
+        if ((uint32_t)(t >> 32) != epoch) {
+            epoch = (uint32_t)(t >> 32);
+            wrapped = true;
+            candle_atomic_store(&dev->ts_epoch, epoch);
+        }
+        dev->ts_last = ts;
+        dev->ts_host_ns = now_ns;
+    } else {
+        epoch = (uint32_t)(t >> 32);
+    }
+
+    frame->reserved = (uint8_t)epoch;
+    return wrapped;
+}
+
+static void candle_rx_ovfl_frame(candle_frame_t *frame, uint8_t epoch)
+{
+    memset(frame, 0, sizeof(candle_frame_t));
+    frame->echo_id = 0xFFFFFFFF;
+    frame->flags = CANDLE_FRAME_FLAG_TIMESTAMP_OVFL;
+    frame->reserved = epoch;
+}
+
+/* runs once for every received frame, in delivery order and possibly on the
+   RX thread: frees the tx slots of echoed frames and extends timestamps.
+   Returns the index of the first frame after a counter wrap, or num_frames. */
+static uint32_t candle_rx_inspect(candle_device_t *dev, candle_frame_t *frames, uint32_t num_frames)
+{
+    uint32_t wrap = num_frames;
+    uint64_t now = candle_time_ns();
+
+    for (uint32_t i=0; i<num_frames; i++) {
+        uint32_t n = frames[i].echo_id - CANDLE_TX_ECHO_BASE;
+        if ( (frames[i].echo_id != 0xFFFFFFFF) && (frames[i].echo_id >= CANDLE_TX_ECHO_BASE)
+          && (n < dev->tx_channels * CANDLE_TX_SLOTS) ) {
+            candle_atomic_and(&dev->tx_state[n / CANDLE_TX_SLOTS], ~(1u << (n % CANDLE_TX_SLOTS)));
+        }
+
+        if (candle_rx_timebase(dev, &frames[i], now)) {
+            wrap = i;
+        }
+    }
+
+    return wrap;
+}
+
+/* drop the frames the acceptance filter rejects, then those the change
+   filter suppresses; see candle_filter_apply() for mark. A replaced filter
+   or change table is only freed once rx_filter_busy is clear. */
+static uint32_t candle_rx_filter(candle_device_t *dev, candle_frame_t *frames, uint32_t num_frames, uint32_t *mark)
+{
+    if ( (candle_atomic_load(&dev->rx_filter) == NULL) && (candle_atomic_load(&dev->rx_change) == NULL) ) {
+        return num_frames;
+    }
+
+    candle_atomic_store(&dev->rx_filter_busy, 1);
+    candle_atomic_fence();
+
+    candle_filter_compiled_t *filter = candle_atomic_load(&dev->rx_filter);
+    uint32_t kept = (filter != NULL) ? candle_filter_apply(filter, frames, num_frames, mark) : num_frames;
+    if (kept < num_frames) {
+        candle_atomic_store(&dev->rx_filtered, dev->rx_filtered + (num_frames - kept));
+    }
+
+    candle_change_table_t *change = candle_atomic_load(&dev->rx_change);
+    if (change != NULL) {
+        uint32_t passed;
+        uint32_t received = kept;
+        kept = candle_change_apply(change, frames, received, mark, &passed);
+        candle_atomic_store(&dev->rx_changed, dev->rx_changed + passed);
+        candle_atomic_store(&dev->rx_unchanged, dev->rx_unchanged + (received - kept));
+    }
+
+    candle_atomic_store(&dev->rx_filter_busy, 0);
+    return kept;
+}
+
+/* try again to submit urbs whose last submission failed */
+static void candle_rx_retry_idle(candle_device_t *dev)
+{
+    for (unsigned i=0; (i<dev->opts.rx_urb_count) && (dev->rx_idle_count>0); i++) {
+        if (dev->rxurbs[i].idle) {
+            candle_prepare_read(dev, i);
+        }
+    }
+}
+
+static bool candle_rx_oldest_done(candle_device_t *dev)
+{
+    return (dev->rx_order_count > 0) && dev->rxurbs[dev->rx_order[dev->rx_order_head]].done;
+}
+
+/* timeout_ms from now on the host monotonic clock */
+static uint64_t candle_rx_deadline(uint32_t timeout_ms)
+{
+    return candle_time_ns() + (uint64_t)timeout_ms * 1000000;
+}
+
+/* whole milliseconds left until deadline, rounded up */
+static uint32_t candle_rx_ms_left(uint64_t deadline)
+{
+    uint64_t now = candle_time_ns();
+    return (now >= deadline) ? 0 : (uint32_t)((deadline - now + 999999) / 1000000);
+}
+
+/* wait until the oldest outstanding urb is done; once deadline has passed
+   only what has completed by then is reaped. Urbs that complete out of
+   order stay done until all older ones are, so frames are delivered strictly
+   in submission order. */
+static candle_err_t candle_rx_wait(candle_device_t *dev, uint64_t deadline)
+{
+    if (candle_atomic_load(&dev->gone)) {
+        return CANDLE_ERR_DEVICE_GONE;
+    }
+
+    if (dev->rx_idle_count > 0) {
+        candle_rx_retry_idle(dev);
+    }
+
+    if (dev->rx_order_count == 0) {
+        return CANDLE_ERR_PREPARE_READ;
+    }
+
+    while (!candle_rx_oldest_done(dev)) {
+        uint32_t ms = candle_rx_ms_left(deadline);
+        candle_err_t err = dev->transport->reap(dev, ms);
+        if (err != CANDLE_ERR_OK) {
+            return candle_dev_note_gone(dev, err);
+        }
+        if ( (ms == 0) && !candle_rx_oldest_done(dev) ) {
+            return CANDLE_ERR_READ_TIMEOUT;
+        }
+    }
+    return CANDLE_ERR_OK;
+}
+
+static unsigned candle_rx_pop_oldest(candle_device_t *dev)
+{
+    unsigned urb_num = dev->rx_order[dev->rx_order_head];
+    dev->rx_order_head = (dev->rx_order_head + 1) % dev->opts.rx_urb_count;
+    dev->rx_order_count--;
+    return urb_num;
+}
+
+/* split a done urb into frames and hand the urb back to the transport.
+   frames must have room for dev->rx_pending_size entries. */
+static candle_err_t candle_rx_urb_frames(candle_device_t *dev, unsigned urb_num, candle_frame_t *frames, uint32_t *num_frames)
+{
+    canlde_rx_urb *urb = &dev->rxurbs[urb_num];
+    *num_frames = 0;
+
+    candle_err_t err = candle_dev_note_gone(dev, urb->status);
+    if (err != CANDLE_ERR_OK) {
+        /* the stream is interrupted, a kept partial frame can't be completed */
+        candle_rx_parser_reset(&dev->rx_parser);
+    } else if (dev->opts.flags & CANDLE_DEVOPT_RX_PACKED) {
+        *num_frames = candle_rx_parse(&dev->rx_parser, urb->buf, urb->bytes_transfered, frames);
+    } else if (urb->bytes_transfered != sizeof(candle_frame_t)) {
+        err = CANDLE_ERR_READ_SIZE;
+    } else if (!candle_rx_record_valid(&dev->rx_parser, urb->buf)) {
+        dev->rx_parser.invalid++;
+    } else {
+        memcpy(frames, urb->buf, sizeof(candle_frame_t));
+        *num_frames = 1;
+    }
+
+    uint32_t wrap = candle_rx_inspect(dev, frames, *num_frames);
+    bool wrapped = (wrap < *num_frames);
+    uint8_t wrap_epoch = wrapped ? frames[wrap].reserved : 0;
+
+    *num_frames = candle_rx_filter(dev, frames, *num_frames, &wrap);
+    if ( wrapped && (dev->opts.flags & CANDLE_DEVOPT_TS_OVFL_FRAMES) ) {
+        /* rx_pending_size leaves room for this one */
+        memmove(&frames[wrap+1], &frames[wrap], (*num_frames - wrap) * sizeof(candle_frame_t));
+        candle_rx_ovfl_frame(&frames[wrap], wrap_epoch);
+        (*num_frames)++;
+    }
+
+    candle_err_t submit_err = candle_prepare_read(dev, urb_num);
+    return (submit_err != CANDLE_ERR_OK) ? submit_err : err;
+}
+
+static uint32_t candle_rx_take_pending(candle_device_t *dev, candle_frame_t *frames, uint32_t max)
+{
+    uint32_t n = (dev->rx_pending_count < max) ? dev->rx_pending_count : max;
+    memcpy(frames, &dev->rx_pending[dev->rx_pending_head], n * sizeof(candle_frame_t));
+    dev->rx_pending_head += n;
+    dev->rx_pending_count -= n;
+    return n;
+}
+
+/* hand a urb back to the transport once nothing refers to its buffer any more */
+static void candle_rx_unpin(candle_device_t *dev, unsigned urb_num)
+{
+    bool cursor = (dev->rx_cursor.count > 0) && (dev->rx_cursor_urb == urb_num);
+    if ( (dev->rxurbs[urb_num].borrows == 0) && !cursor ) {
+        /* a failed submission leaves the urb idle, it is retried before the next wait */
+        candle_prepare_read(dev, urb_num);
+    }
+}
+
+static uint32_t candle_rx_cursor_left(candle_device_t *dev)
+{
+    return (dev->rx_cursor.stitched ? 1 : 0) + dev->rx_cursor.count;
+}
+
+/* point the peek cursor at the frames of a done urb */
+static candle_err_t candle_rx_cursor_load(candle_device_t *dev, unsigned urb_num)
+{
+    canlde_rx_urb *urb = &dev->rxurbs[urb_num];
+    memset(&dev->rx_cursor, 0, sizeof(dev->rx_cursor));
+    dev->rx_cursor_urb = urb_num;
+    dev->rx_cursor_ovfl = false;
+
+    candle_err_t err = urb->status;
+    if (err != CANDLE_ERR_OK) {
+        candle_rx_parser_reset(&dev->rx_parser);
+    } else if (dev->opts.flags & CANDLE_DEVOPT_RX_PACKED) {
+        candle_rx_parse_span(&dev->rx_parser, urb->buf, urb->bytes_transfered, &dev->rx_cursor_stitched, &dev->rx_cursor);
+    } else if (urb->bytes_transfered != sizeof(candle_frame_t)) {
+        err = CANDLE_ERR_READ_SIZE;
+    } else if (!candle_rx_record_valid(&dev->rx_parser, urb->buf)) {
+        dev->rx_parser.invalid++;
+    } else {
+        dev->rx_cursor.count = 1;
+    }
+
+    /* the records are inspected and filtered in place, the urb is ours
+       until resubmitted */
+    candle_frame_t *records = (candle_frame_t*)&urb->buf[dev->rx_cursor.offset];
+    uint32_t count = dev->rx_cursor.count;
+    bool stitched_wrap = dev->rx_cursor.stitched && (candle_rx_inspect(dev, &dev->rx_cursor_stitched, 1) == 0);
+    uint32_t wrap = candle_rx_inspect(dev, records, count);
+    bool records_wrap = (wrap < count);
+    if (records_wrap) {
+        dev->rx_cursor_ovfl = true;
+        dev->rx_cursor_ovfl_epoch = records[wrap].reserved;
+    } else if (stitched_wrap) {
+        dev->rx_cursor_ovfl = true;
+        dev->rx_cursor_ovfl_epoch = dev->rx_cursor_stitched.reserved;
+    }
+
+    if ( dev->rx_cursor.stitched && (candle_rx_filter(dev, &dev->rx_cursor_stitched, 1, NULL) == 0) ) {
+        dev->rx_cursor.stitched = false;
+    }
+    dev->rx_cursor.count = candle_rx_filter(dev, records, count, &wrap);
+    if (records_wrap) {
+        dev->rx_cursor_ovfl_left = dev->rx_cursor.count - wrap;
+    } else if (stitched_wrap) {
+        dev->rx_cursor_ovfl_left = candle_rx_cursor_left(dev);
+    }
+    if (!(dev->opts.flags & CANDLE_DEVOPT_TS_OVFL_FRAMES)) {
+        dev->rx_cursor_ovfl = false;
+    }
+
+    if (dev->rx_cursor.count == 0) {
+        candle_err_t submit_err = candle_prepare_read(dev, urb_num);
+        if (submit_err != CANDLE_ERR_OK) {
+            return submit_err;
+        }
+    }
+    return err;
+}
+
+static bool candle_rx_cursor_ovfl_due(candle_device_t *dev)
+{
+    return dev->rx_cursor_ovfl && (candle_rx_cursor_left(dev) == dev->rx_cursor_ovfl_left);
+}
+
+/* copy out frames still left in the peek cursor */
+static uint32_t candle_rx_take_cursor(candle_device_t *dev, candle_frame_t *frames, uint32_t max)
+{
+    canlde_rx_urb *urb = &dev->rxurbs[dev->rx_cursor_urb];
+    bool held = (dev->rx_cursor.count > 0);
+    uint32_t n = 0;
+
+    /* an overflow frame may be due after the last filtered record */
+    while ( (n < max) && ((candle_rx_cursor_left(dev) > 0) || dev->rx_cursor_ovfl) ) {
+
+        if (candle_rx_cursor_ovfl_due(dev)) {
+            candle_rx_ovfl_frame(&frames[n++], dev->rx_cursor_ovfl_epoch);
+            dev->rx_cursor_ovfl = false;
+            continue;
+        }
+
+        if (dev->rx_cursor.stitched) {
+            memcpy(&frames[n++], &dev->rx_cursor_stitched, sizeof(candle_frame_t));
+            dev->rx_cursor.stitched = false;
+            continue;
+        }
+
+        /* a run of records, up to a pending overflow frame */
+        uint32_t k = (dev->rx_cursor.count < max - n) ? dev->rx_cursor.count : max - n;
+        if ( dev->rx_cursor_ovfl && (dev->rx_cursor.count - k < dev->rx_cursor_ovfl_left) ) {
+            k = dev->rx_cursor.count - dev->rx_cursor_ovfl_left;
+        }
+        memcpy(&frames[n], &urb->buf[dev->rx_cursor.offset], k * sizeof(candle_frame_t));
+        dev->rx_cursor.offset += k * sizeof(candle_frame_t);
+        dev->rx_cursor.count -= k;
+        n += k;
+    }
+
+    if (held && (dev->rx_cursor.count == 0)) {
+        candle_rx_unpin(dev, dev->rx_cursor_urb);
+    }
+
+    return n;
+}
+
+/* reap urbs on the calling thread */
+static candle_err_t candle_rx_read_urbs(candle_device_t *dev, candle_frame_t *frames, uint32_t max, uint32_t *count, uint32_t timeout_ms)
+{
+    /* frames left over from an earlier call go first */
+    *count = candle_rx_take_pending(dev, frames, max);
+    *count += candle_rx_take_cursor(dev, &frames[*count], max - *count);
+
+    /* a packed transfer may hold only part of a frame, so keep reading */
+    uint64_t deadline = candle_rx_deadline(timeout_ms);
+    candle_err_t err = CANDLE_ERR_OK;
+    while ( (*count == 0) && (err == CANDLE_ERR_OK) && (max > 0) ) {
+
+        candle_err_t wait_err = candle_rx_wait(dev, deadline);
+        if (wait_err != CANDLE_ERR_OK) {
+            return wait_err;
+        }
+
+        /* everything that has completed in order by now; the rest stays
+           done and is picked up by the next call */
+        while ( (*count < max) && candle_rx_oldest_done(dev) ) {
+            unsigned urb_num = candle_rx_pop_oldest(dev);
+            uint32_t n;
+            if (max - *count >= dev->rx_pending_size) {
+                err = candle_rx_urb_frames(dev, urb_num, &frames[*count], &n);
+                *count += n;
+            } else {
+                err = candle_rx_urb_frames(dev, urb_num, dev->rx_pending, &n);
+                dev->rx_pending_head = 0;
+                dev->rx_pending_count = n;
+                *count += candle_rx_take_pending(dev, &frames[*count], max - *count);
+            }
+            if (err != CANDLE_ERR_OK) {
+                break;
+            }
+        }
+
+        /* transfers whose frames were all filtered out don't extend the wait */
+        if ( (*count == 0) && (err == CANDLE_ERR_OK) && (candle_time_ns() >= deadline) ) {
+            return CANDLE_ERR_READ_TIMEOUT;
+        }
+    }
+
+    return (*count > 0) ? CANDLE_ERR_OK : err;
+}
+
+/* RX thread side: hand a frame to the reader(s) it is for, returns the
+   rings it went to as a bit mask */
+static uint32_t candle_rx_queue(candle_device_t *dev, const candle_frame_t *frame)
+{
+    if (dev->rx_chans == NULL) {
+        candle_ring_push(&dev->rx_ring, frame);
+        return 1;
+    }
+
+    if (frame->flags & CANDLE_FRAME_FLAG_TIMESTAMP_OVFL) {
+        /* the wrap concerns every channel's timestamps */
+        for (uint32_t ch=0; ch<dev->tx_channels; ch++) {
+            candle_ring_push(&dev->rx_chans[ch].ring, frame);
+        }
+        return (1u << dev->tx_channels) - 1;
+    }
+
+    if (frame->channel >= dev->tx_channels) {
+        return 0; // not a channel of this device
+    }
+    candle_ring_push(&dev->rx_chans[frame->channel].ring, frame);
+    return 1u << frame->channel;
+}
+
+static void candle_rx_wake(candle_device_t *dev, uint32_t rings)
+{
+    if (dev->rx_chans == NULL) {
+        candle_ring_wake(&dev->rx_ring);
+        return;
+    }
+
+    for (uint32_t ch=0; ch<dev->tx_channels; ch++) {
+        if (rings & (1u << ch)) {
+            candle_ring_wake(&dev->rx_chans[ch].ring);
+        }
+    }
+}
+
+/* every reader gets to see the error once */
+static void candle_rx_park_error(candle_device_t *dev, candle_err_t err)
+{
+    if (dev->rx_chans == NULL) {
+        candle_atomic_store(&dev->rx_thread_error, err);
+        return;
+    }
+
+    for (uint32_t ch=0; ch<dev->tx_channels; ch++) {
+        candle_atomic_store(&dev->rx_chans[ch].error, err);
+    }
+}
+
+/* with CANDLE_DEVOPT_RX_THREAD this is the only user of the urbs, rx_order
+   and rx_pending. It never touches dev->last_error; errors are parked in
+   rx_thread_error, or per channel, for the readers. */
+static void candle_rx_thread(void *arg)
+{
+    candle_device_t *dev = (candle_device_t*)arg;
+
+    while (!candle_atomic_load(&dev->rx_thread_stop)) {
+
+        candle_err_t err = candle_rx_wait(dev, candle_rx_deadline(CANDLE_RX_THREAD_POLL_MS));
+        if (err == CANDLE_ERR_READ_TIMEOUT) {
+            continue;
+        }
+
+        uint32_t queued = 0;
+        while ( (err == CANDLE_ERR_OK) && candle_rx_oldest_done(dev) ) {
+            uint32_t n;
+            err = candle_rx_urb_frames(dev, candle_rx_pop_oldest(dev), dev->rx_pending, &n);
+            for (uint32_t i=0; i<n; i++) {
+                queued |= candle_rx_queue(dev, &dev->rx_pending[i]);
+            }
+        }
+
+        if (err != CANDLE_ERR_OK) {
+            candle_rx_park_error(dev, err);
+            queued = ~0u;
+        }
+        if (queued != 0) {
+            candle_rx_wake(dev, queued);
+        }
+        if (err == CANDLE_ERR_DEVICE_GONE) {
+            candle_sleep_ms(CANDLE_RX_THREAD_POLL_MS);
+        } else if (err != CANDLE_ERR_OK) {
+            candle_sleep_ms(CANDLE_RX_THREAD_BACKOFF_MS);
+        }
+    }
+}
+
+/* with CANDLE_DEVOPT_CLOCK_SYNC: pairs a device timestamp with the host
+   time halfway through the control request that fetched it */
+static void candle_clock_thread(void *arg)
+{
+    candle_device_t *dev = (candle_device_t*)arg;
+
+    do {
+        uint32_t ts_us;
+        uint64_t t0 = candle_time_ns();
+        bool rc = candle_ctrl_get_timestamp(dev, &ts_us);
+        uint64_t t1 = candle_time_ns();
+        if (rc) {
+            candle_clock_add_sample(&dev->clock, ts_us, t0 + (t1 - t0) / 2, t1 - t0);
+        }
+    } while (candle_clock_wait(&dev->clock, dev->opts.clock_sync_ms));
+}
+
+/* pick up what the RX thread has queued in ring; error is where it parks
+   its errors for this reader */
+static candle_err_t candle_rx_read_ring(candle_device_t *dev, candle_ring_t *ring, uint32_t *error, candle_frame_t *frames, uint32_t max, uint32_t *count, uint32_t timeout_ms)
+{
+    *count = candle_ring_pop(ring, frames, max);
+    if ( (*count > 0) || (max == 0) ) {
+        return CANDLE_ERR_OK;
+    }
+
+    if (candle_ring_wait(ring, error, timeout_ms)) {
+        *count = candle_ring_pop(ring, frames, max);
+        return CANDLE_ERR_OK;
+    }
+
+    /* frames queued before an error are handed out first */
+    candle_err_t err = candle_atomic_exchange(error, CANDLE_ERR_OK);
+    if (candle_atomic_load(&dev->gone)) {
+        err = CANDLE_ERR_DEVICE_GONE;
+    }
+    return (err != CANDLE_ERR_OK) ? err : CANDLE_ERR_READ_TIMEOUT;
+}
+
+static candle_err_t candle_rx_peek(candle_device_t *dev, const candle_frame_t **frame, uint32_t timeout_ms)
+{
+    if (dev->rx_borrow_count >= dev->rx_max_borrows) {
+        return CANDLE_ERR_BORROW_LIMIT;
+    }
+
+    candle_rx_borrow_t *b = dev->rx_borrows;
+    while (b->frame != NULL) {
+        b++;
+    }
+
+    canlde_rx_urb *urb = NULL;
+    const candle_frame_t *f = &b->copy;
+
+    /* frames already split off by candle_frame_read() go first */
+    if (candle_rx_take_pending(dev, &b->copy, 1) == 0) {
+
+        uint64_t deadline = candle_rx_deadline(timeout_ms);
+        while ( !dev->rx_cursor.stitched && (dev->rx_cursor.count == 0) && !dev->rx_cursor_ovfl ) {
+            candle_err_t err = candle_rx_wait(dev, deadline);
+            if (err == CANDLE_ERR_OK) {
+                err = candle_rx_cursor_load(dev, candle_rx_pop_oldest(dev));
+            }
+            if (err != CANDLE_ERR_OK) {
+                return err;
+            }
+            if ( (dev->rx_cursor.count == 0) && !dev->rx_cursor.stitched && !dev->rx_cursor_ovfl
+              && (candle_time_ns() >= deadline) ) {
+                return CANDLE_ERR_READ_TIMEOUT;
+            }
+        }
+
+        if (dev->rx_cursor.stitched || candle_rx_cursor_ovfl_due(dev)) {
+            candle_rx_take_cursor(dev, &b->copy, 1);
+        } else if (dev->opts.rx_urb_count == 1) {
+            /* pinning the only urb would stop reception until the release:
+               copy its frames out and put it straight back in flight */
+            dev->rx_pending_head = 0;
+            dev->rx_pending_count = candle_rx_take_cursor(dev, dev->rx_pending, dev->rx_pending_size);
+            candle_rx_take_pending(dev, &b->copy, 1);
+        } else {
+            urb = &dev->rxurbs[dev->rx_cursor_urb];
+            f = (const candle_frame_t*)&urb->buf[dev->rx_cursor.offset];
+            urb->borrows++;
+            dev->rx_cursor.offset += sizeof(candle_frame_t);
+            dev->rx_cursor.count--;
+        }
+    }
+
+    b->frame = f;
+    b->urb = urb;
+    dev->rx_borrow_count++;
+    *frame = f;
+    return CANDLE_ERR_OK;
+}
+
+bool candle_frame_peek(candle_handle hdev, const candle_frame_t **frame, uint32_t timeout_ms)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+
+    if (!candle_dev_check_open(dev)) {
+        return false;
+    }
+    if (dev->rx_thread_running) {
+        /* the urbs belong to the RX thread */
+        dev->last_error = CANDLE_ERR_INVALID_OPTION;
+        return false;
+    }
 
-        case 100000:
-            t.brp = 30;
-            break;
+    dev->last_error = candle_rx_peek(dev, frame, timeout_ms);
+    return dev->last_error == CANDLE_ERR_OK;
+}
 
-        case 125000:
-            t.brp = 24;
-            break;
+bool candle_frame_release(candle_handle hdev, const candle_frame_t *frame)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
 
-        case 250000:
-            t.brp = 12;
+    candle_rx_borrow_t *b = NULL;
+    for (uint32_t i=0; (dev->rx_borrows != NULL) && (frame != NULL) && (i<dev->rx_max_borrows); i++) {
+        if (dev->rx_borrows[i].frame == frame) {
+            b = &dev->rx_borrows[i];
             break;
+        }
+    }
 
-        case 500000:
-            t.brp = 6;
-            break;
+    if (b == NULL) {
+        /* not borrowed, or released twice */
+        dev->last_error = CANDLE_ERR_BORROW_INVALID;
+        return false;
+    }
 
-        case 800000:
-            t.brp = 4;
-            t.phase_seg1 = 12 - t.prop_seg;
-            t.phase_seg2 = 2;
-            break;
+#ifndef NDEBUG
+    /* make reads through a stale pointer stand out */
+    memset((void*)b->frame, CANDLE_RX_POISON, sizeof(candle_frame_t));
+#endif
 
-        case 1000000:
-            t.brp = 3;
-            break;
+    b->frame = NULL;
+    dev->rx_borrow_count--;
 
-        default:
-            dev->last_error = CANDLE_ERR_BITRATE_UNSUPPORTED;
-            return false;
+    if (b->urb != NULL) {
+        b->urb->borrows--;
+        candle_rx_unpin(dev, (unsigned)(b->urb - dev->rxurbs));
     }
 
-    return candle_ctrl_set_bittiming(dev, ch, &t);
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
 }
 
-bool candle_channel_start(candle_handle hdev, uint8_t ch, uint32_t flags)
+bool candle_frame_read(candle_handle hdev, candle_frame_t *frame, uint32_t timeout_ms)
 {
-    // TODO ensure device is open, check channel count..
-    candle_device_t *dev = (candle_device_t*)hdev;
-    return candle_ctrl_set_device_mode(dev, ch, CANDLE_DEVMODE_START, flags);
+    uint32_t count;
+    return candle_frame_read_many(hdev, frame, 1, &count, timeout_ms);
 }
 
-bool candle_channel_stop(candle_handle hdev, uint8_t ch)
+bool candle_frame_read_many(candle_handle hdev, candle_frame_t *frames, uint32_t max, uint32_t *count, uint32_t timeout_ms)
 {
-    // TODO ensure device is open, check channel count..
     candle_device_t *dev = (candle_device_t*)hdev;
-    return candle_ctrl_set_device_mode(dev, ch, CANDLE_DEVMODE_RESET, 0);
+
+    if (!candle_dev_check_open(dev)) {
+        *count = 0;
+        return false;
+    }
+    if (dev->rx_chans != NULL) {
+        /* frames are only queued per channel */
+        *count = 0;
+        dev->last_error = CANDLE_ERR_INVALID_OPTION;
+    } else if (dev->rx_thread_running) {
+        dev->last_error = candle_rx_read_ring(dev, &dev->rx_ring, &dev->rx_thread_error, frames, max, count, timeout_ms);
+    } else {
+        dev->last_error = candle_rx_read_urbs(dev, frames, max, count, timeout_ms);
+    }
+    return dev->last_error == CANDLE_ERR_OK;
 }
 
-bool candle_frame_send(candle_handle hdev, uint8_t ch, candle_frame_t *frame)
+bool candle_channel_frame_read(candle_handle hdev, uint8_t ch, candle_frame_t *frame, uint32_t timeout_ms)
+{
+    uint32_t count;
+    return candle_channel_frame_read_many(hdev, ch, frame, 1, &count, timeout_ms);
+}
+
+bool candle_channel_frame_read_many(candle_handle hdev, uint8_t ch, candle_frame_t *frames, uint32_t max, uint32_t *count, uint32_t timeout_ms)
 {
-    // TODO ensure device is open, check channel count..
     candle_device_t *dev = (candle_device_t*)hdev;
 
-    unsigned long bytes_sent = 0;
+    *count = 0;
+    if (!candle_dev_check_open(dev) || !candle_rx_check_channel(dev, ch)) {
+        return false;
+    }
+
+    /* nothing here is shared with readers of other channels */
+    candle_rx_channel_t *c = &dev->rx_chans[ch];
+    c->last_error = candle_rx_read_ring(dev, &c->ring, &c->error, frames, max, count, timeout_ms);
+    return c->last_error == CANDLE_ERR_OK;
+}
 
-    frame->echo_id = 0;
-    frame->channel = ch;
+/* reads into a batch in rounds of up to CANDLE_BATCH_READ_FRAMES; only the
+   first waits. c selects the ring of one channel, NULL the device's frames. */
+static candle_err_t candle_rx_read_batch(candle_device_t *dev, candle_rx_channel_t *c, candle_frame_batch_t *batch, uint32_t max, uint32_t *count, uint32_t timeout_ms)
+{
+    candle_frame_t frames[CANDLE_BATCH_READ_FRAMES];
+
+    *count = 0;
+    if (!candle_batch_reserve(batch, batch->count + max)) {
+        return CANDLE_ERR_MALLOC;
+    }
 
-    bool rc = WinUsb_WritePipe(
-        dev->winUSBHandle,
-        dev->bulkOutPipe,
-        (uint8_t*)frame,
-        sizeof(*frame),
-        &bytes_sent,
-        0
-    );
+    while (*count < max) {
+        uint32_t want = (max - *count < CANDLE_BATCH_READ_FRAMES) ? max - *count : CANDLE_BATCH_READ_FRAMES;
+        uint32_t wait_ms = (*count == 0) ? timeout_ms : 0;
+        uint32_t n = 0;
+        candle_err_t err;
 
-    dev->last_error = rc ? CANDLE_ERR_OK : CANDLE_ERR_SEND_FRAME;
-    return rc;
+        if (c != NULL) {
+            err = candle_rx_read_ring(dev, &c->ring, &c->error, frames, want, &n, wait_ms);
+        } else if (dev->rx_thread_running) {
+            err = candle_rx_read_ring(dev, &dev->rx_ring, &dev->rx_thread_error, frames, want, &n, wait_ms);
+        } else {
+            err = candle_rx_read_urbs(dev, frames, want, &n, wait_ms);
+        }
+        if (err != CANDLE_ERR_OK) {
+            /* nothing more right now is not an error once frames are in */
+            return ((*count > 0) && (err == CANDLE_ERR_READ_TIMEOUT)) ? CANDLE_ERR_OK : err;
+        }
 
+        size_t at = batch->count;
+        candle_batch_append(batch, frames, n);
+        for (uint32_t i=0; i<n; i++) {
+            batch->timestamp64_us[at + i] = candle_frame_timestamp64_us(dev, &frames[i]);
+        }
+        *count += n;
+        if (n < want) {
+            break;
+        }
+    }
+    return CANDLE_ERR_OK;
 }
 
-bool candle_frame_read(candle_handle hdev, candle_frame_t *frame, uint32_t timeout_ms)
+bool candle_frame_read_batch(candle_handle hdev, candle_frame_batch_t *batch, uint32_t max, uint32_t *count, uint32_t timeout_ms)
 {
-    // TODO ensure device is open..
     candle_device_t *dev = (candle_device_t*)hdev;
 
-    DWORD wait_result = WaitForMultipleObjects(CANDLE_URB_COUNT, dev->rxevents, false, timeout_ms);
-    if (wait_result == WAIT_TIMEOUT) {
-        dev->last_error = CANDLE_ERR_READ_TIMEOUT;
+    if (!candle_dev_check_open(dev)) {
+        *count = 0;
         return false;
     }
+    if (dev->rx_chans != NULL) {
+        /* frames are only queued per channel */
+        *count = 0;
+        dev->last_error = CANDLE_ERR_INVALID_OPTION;
+    } else {
+        dev->last_error = candle_rx_read_batch(dev, NULL, batch, max, count, timeout_ms);
+    }
+    return dev->last_error == CANDLE_ERR_OK;
+}
+
+bool candle_channel_frame_read_batch(candle_handle hdev, uint8_t ch, candle_frame_batch_t *batch, uint32_t max, uint32_t *count, uint32_t timeout_ms)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
 
-    if ( (wait_result < WAIT_OBJECT_0) || (wait_result >= WAIT_OBJECT_0 + CANDLE_URB_COUNT) ) {
-        dev->last_error = CANDLE_ERR_READ_WAIT;
+    *count = 0;
+    if (!candle_dev_check_open(dev) || !candle_rx_check_channel(dev, ch)) {
         return false;
     }
 
-    DWORD urb_num = wait_result - WAIT_OBJECT_0;
-    DWORD bytes_transfered;
+    candle_rx_channel_t *c = &dev->rx_chans[ch];
+    c->last_error = candle_rx_read_batch(dev, c, batch, max, count, timeout_ms);
+    return c->last_error == CANDLE_ERR_OK;
+}
 
-    if (!WinUsb_GetOverlappedResult(dev->winUSBHandle, &dev->rxurbs[urb_num].ovl, &bytes_transfered, false)) {
-        candle_prepare_read(dev, urb_num);
-        dev->last_error = CANDLE_ERR_READ_RESULT;
+bool candle_channel_get_rx_stats(candle_handle hdev, uint8_t ch, candle_rx_stats_t *stats)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+
+    if (dev->rx_chans == NULL) {
+        dev->last_error = CANDLE_ERR_INVALID_OPTION;
         return false;
     }
-
-    if (bytes_transfered != sizeof(*frame)) {
-        candle_prepare_read(dev, urb_num);
-        dev->last_error = CANDLE_ERR_READ_SIZE;
+    if (!candle_dev_check_channel(dev, ch)) {
         return false;
     }
 
-    memcpy(frame, dev->rxurbs[urb_num].buf, sizeof(*frame));
+    candle_rx_channel_t *c = &dev->rx_chans[ch];
+    stats->frames = candle_atomic_load(&c->ring.pushed);
+    stats->overflows = candle_atomic_load(&c->ring.overflows);
+    stats->filtered = candle_atomic_load(&dev->rx_filtered); // these are not kept per channel
+    stats->changed = candle_atomic_load(&dev->rx_changed);
+    stats->unchanged = candle_atomic_load(&dev->rx_unchanged);
+    c->last_error = CANDLE_ERR_OK;
+    return true;
+}
 
-    return candle_prepare_read(dev, urb_num);
+candle_err_t candle_channel_last_error(candle_handle hdev, uint8_t ch)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+    if ( (dev->rx_chans == NULL) || (ch >= dev->tx_channels) ) {
+        return dev->last_error;
+    }
+    return dev->rx_chans[ch].last_error;
 }
 
 candle_frametype_t candle_frame_type(candle_frame_t *frame)
 {
+    if (frame->flags & CANDLE_FRAME_FLAG_TIMESTAMP_OVFL) {
+        return CANDLE_FRAMETYPE_TIMESTAMP_OVFL;
+    }
+
     if (frame->echo_id != 0xFFFFFFFF) {
         return CANDLE_FRAMETYPE_ECHO;
     };
@@ -547,3 +2289,332 @@ uint32_t candle_frame_timestamp_us(candle_frame_t *frame)
 {
     return frame->timestamp_us;
 }
+
+uint64_t candle_frame_timestamp64_us(candle_handle hdev, candle_frame_t *frame)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+
+    /* the frame carries the low byte of its epoch, the device the rest */
+    uint32_t epoch = candle_atomic_load(&dev->ts_epoch);
+    epoch -= (uint8_t)((uint8_t)epoch - frame->reserved);
+
+    return ((uint64_t)epoch << 32) | frame->timestamp_us;
+}
+
+bool candle_frame_host_time_ns(candle_handle hdev, candle_frame_t *frame, uint64_t *host_ns)
+{
+    candle_device_t *dev = (candle_device_t*)hdev;
+
+    if ( !dev->clock_running || !candle_clock_host_ns(&dev->clock, frame->timestamp_us, host_ns) ) {
+        dev->last_error = CANDLE_ERR_CLOCK_NOT_SYNCED;
+        return false;
+    }
+
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+bool candle_dbc_load(const char *path, candle_dbc_handle *dbc)
+{
+    if ( (path==NULL) || (dbc==NULL) ) {
+        return false;
+    }
+
+    candle_dbc_t *d = calloc(1, sizeof(candle_dbc_t));
+    *dbc = d;
+    if (d==NULL) {
+        return false;
+    }
+    return candle_dbc_load_file(d, path);
+}
+
+bool candle_dbc_load_string(const char *text, size_t len, candle_dbc_handle *dbc)
+{
+    if ( (text==NULL) || (dbc==NULL) ) {
+        return false;
+    }
+
+    candle_dbc_t *d = calloc(1, sizeof(candle_dbc_t));
+    *dbc = d;
+    if (d==NULL) {
+        return false;
+    }
+    return candle_dbc_parse(d, text, len);
+}
+
+bool candle_dbc_free(candle_dbc_handle dbc)
+{
+    candle_dbc_t *d = (candle_dbc_t *)dbc;
+    if (d != NULL) {
+        candle_dbc_clear(d);
+        free(d);
+    }
+    return true;
+}
+
+candle_err_t candle_dbc_last_error(candle_dbc_handle dbc, uint32_t *line)
+{
+    candle_dbc_t *d = (candle_dbc_t *)dbc;
+    if (line != NULL) {
+        *line = d->error_line;
+    }
+    return d->last_error;
+}
+
+bool candle_dbc_message_count(candle_dbc_handle dbc, uint32_t *count)
+{
+    candle_dbc_t *d = (candle_dbc_t *)dbc;
+    if ( (d==NULL) || (count==NULL) ) {
+        return false;
+    }
+    *count = d->num_msgs;
+    return true;
+}
+
+const candle_dbc_message_t *candle_dbc_message(candle_dbc_handle dbc, uint32_t index)
+{
+    candle_dbc_t *d = (candle_dbc_t *)dbc;
+    if ( (d==NULL) || (index >= d->num_msgs) ) {
+        return NULL;
+    }
+    return &d->msgs[index].info;
+}
+
+const candle_dbc_message_t *candle_dbc_find(candle_dbc_handle dbc, uint32_t can_id)
+{
+    const candle_dbc_msg_t *m = candle_dbc_lookup((candle_dbc_t *)dbc, can_id);
+    return (m != NULL) ? &m->info : NULL;
+}
+
+/* the message of a data frame, NULL for anything else */
+static const candle_dbc_msg_t *candle_dbc_frame_message(candle_dbc_handle dbc, const candle_frame_t *frame)
+{
+    if ( (frame->can_id & 0x60000000) || (frame->flags & CANDLE_FRAME_FLAG_TIMESTAMP_OVFL) ) {
+        return NULL;
+    }
+    return candle_dbc_lookup((candle_dbc_t *)dbc, frame->can_id);
+}
+
+const candle_dbc_message_t *candle_dbc_decode(candle_dbc_handle dbc, candle_frame_t *frame, double *values)
+{
+    const candle_dbc_msg_t *m = candle_dbc_frame_message(dbc, frame);
+    if (m == NULL) {
+        return NULL;
+    }
+    candle_dbc_decode_msg(m, frame, values);
+    return &m->info;
+}
+
+const candle_dbc_message_t *candle_dbc_decode_raw(candle_dbc_handle dbc, candle_frame_t *frame, int64_t *raw)
+{
+    const candle_dbc_msg_t *m = candle_dbc_frame_message(dbc, frame);
+    if (m == NULL) {
+        return NULL;
+    }
+    candle_dbc_decode_msg_raw(m, frame, raw);
+    return &m->info;
+}
+
+bool candle_dbc_extract(candle_dbc_handle dbc, const candle_frame_t *frames, size_t num_frames, uint32_t can_id, const candle_dbc_column_t *columns, size_t num_columns, size_t *index, size_t *count)
+{
+    candle_dbc_t *d = (candle_dbc_t *)dbc;
+    if ( (d==NULL) || (count==NULL) || ((frames==NULL) && (num_frames > 0)) || ((columns==NULL) && (num_columns > 0)) ) {
+        return false;
+    }
+
+    const candle_dbc_msg_t *m = candle_dbc_lookup(d, can_id);
+    if (m == NULL) {
+        d->last_error = CANDLE_ERR_DBC_NO_MESSAGE;
+        return false;
+    }
+    for (size_t i=0; i<num_columns; i++) {
+        if (columns[i].signal >= m->info.num_signals) {
+            d->last_error = CANDLE_ERR_INVALID_OPTION;
+            return false;
+        }
+    }
+
+    *count = candle_dbc_extract_msg(m, frames, num_frames, columns, num_columns, index);
+    d->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+bool candle_frame_batch_init(candle_frame_batch_t *batch, size_t capacity)
+{
+    if (batch==NULL) {
+        return false;
+    }
+    memset(batch, 0, sizeof(*batch));
+    return candle_batch_reserve(batch, capacity);
+}
+
+bool candle_frame_batch_reserve(candle_frame_batch_t *batch, size_t capacity)
+{
+    return (batch!=NULL) && candle_batch_reserve(batch, capacity);
+}
+
+bool candle_frame_batch_free(candle_frame_batch_t *batch)
+{
+    if (batch!=NULL) {
+        candle_batch_release(batch);
+    }
+    return true;
+}
+
+bool candle_frame_batch_clear(candle_frame_batch_t *batch)
+{
+    if (batch==NULL) {
+        return false;
+    }
+    batch->count = 0;
+    return true;
+}
+
+bool candle_frame_batch_append(candle_frame_batch_t *batch, const candle_frame_t *frames, size_t num_frames)
+{
+    if ( (batch==NULL) || ((frames==NULL) && (num_frames > 0)) ) {
+        return false;
+    }
+
+    if (num_frames > batch->capacity - batch->count) {
+        /* grow geometrically, so appending frame by frame stays linear */
+        size_t capacity = (batch->capacity < CANDLE_BATCH_MIN_FRAMES) ? CANDLE_BATCH_MIN_FRAMES : 2 * batch->capacity;
+        if (capacity < batch->count + num_frames) {
+            capacity = batch->count + num_frames;
+        }
+        if (!candle_batch_reserve(batch, capacity)) {
+            return false;
+        }
+    }
+
+    candle_batch_append(batch, frames, num_frames);
+    return true;
+}
+
+bool candle_frame_batch_get(const candle_frame_batch_t *batch, size_t first, candle_frame_t *frames, size_t num_frames)
+{
+    if ( (batch==NULL) || (first > batch->count) || (num_frames > batch->count - first) ) {
+        return false;
+    }
+
+    candle_batch_get(batch, first, frames, num_frames);
+    return true;
+}
+
+size_t candle_frame_batch_select_id(const candle_frame_batch_t *batch, uint32_t can_id, size_t *index)
+{
+    return candle_batch_select_id(batch, can_id, index);
+}
+
+size_t candle_frame_batch_select_time(const candle_frame_batch_t *batch, uint32_t from_us, uint32_t to_us, size_t *index)
+{
+    return candle_batch_select_time(batch, from_us, to_us, index);
+}
+
+bool candle_capture_create(const char *path, candle_capture_handle *cap)
+{
+    if ( (path==NULL) || (cap==NULL) ) {
+        return false;
+    }
+
+    candle_capture_t *c = calloc(1, sizeof(candle_capture_t));
+    *cap = c;
+    if (c==NULL) {
+        return false;
+    }
+    return candle_capture_create_file(c, path);
+}
+
+bool candle_capture_write(candle_capture_handle cap, candle_handle hdev, const candle_frame_t *frames, size_t num_frames)
+{
+    candle_capture_t *c = (candle_capture_t *)cap;
+    if ( (c==NULL) || ((frames==NULL) && (num_frames > 0)) ) {
+        return false;
+    }
+    if ( !c->writing || (c->file==NULL) ) {
+        c->last_error = CANDLE_ERR_INVALID_OPTION;
+        return false;
+    }
+    return candle_capture_append(c, hdev, frames, num_frames);
+}
+
+bool candle_capture_open(const char *path, candle_capture_handle *cap)
+{
+    if ( (path==NULL) || (cap==NULL) ) {
+        return false;
+    }
+
+    candle_capture_t *c = calloc(1, sizeof(candle_capture_t));
+    *cap = c;
+    if (c==NULL) {
+        return false;
+    }
+    return candle_capture_open_file(c, path);
+}
+
+bool candle_capture_close(candle_capture_handle cap)
+{
+    candle_capture_t *c = (candle_capture_t *)cap;
+    bool rc = true;
+    if (c != NULL) {
+        rc = candle_capture_finish(c);
+        free(c);
+    }
+    return rc;
+}
+
+candle_err_t candle_capture_last_error(candle_capture_handle cap)
+{
+    candle_capture_t *c = (candle_capture_t *)cap;
+    return c->last_error;
+}
+
+bool candle_capture_info(candle_capture_handle cap, uint64_t *num_frames, uint64_t *first_us, uint64_t *last_us)
+{
+    candle_capture_t *c = (candle_capture_t *)cap;
+    if (c==NULL) {
+        return false;
+    }
+    if (c->writing) {
+        c->last_error = CANDLE_ERR_INVALID_OPTION;
+        return false;
+    }
+
+    if (num_frames != NULL) {
+        *num_frames = c->num_frames;
+    }
+    if (first_us != NULL) {
+        *first_us = (c->num_blocks > 0) ? c->min_after[0] : 0;
+    }
+    if (last_us != NULL) {
+        *last_us = (c->num_blocks > 0) ? c->max_before[c->num_blocks - 1] : 0;
+    }
+    return true;
+}
+
+bool candle_capture_next_block(candle_capture_handle cap, uint64_t from_us, uint64_t to_us, const uint32_t *ids, size_t num_ids, uint64_t *cursor, const candle_capture_record_t **records, uint32_t *count)
+{
+    candle_capture_t *c = (candle_capture_t *)cap;
+    if ( (c==NULL) || (cursor==NULL) || (records==NULL) || (count==NULL) ) {
+        return false;
+    }
+    if (c->writing) {
+        c->last_error = CANDLE_ERR_INVALID_OPTION;
+        return false;
+    }
+    return candle_capture_find_block(c, from_us, to_us, ids, num_ids, cursor, records, count);
+}
+
+bool candle_capture_query(candle_capture_handle cap, uint64_t from_us, uint64_t to_us, const uint32_t *ids, size_t num_ids, candle_frame_batch_t *batch, size_t *count)
+{
+    candle_capture_t *c = (candle_capture_t *)cap;
+    if ( (c==NULL) || (batch==NULL) || (count==NULL) ) {
+        return false;
+    }
+    *count = 0;
+    if (c->writing) {
+        c->last_error = CANDLE_ERR_INVALID_OPTION;
+        return false;
+    }
+    return candle_capture_select(c, from_us, to_us, ids, num_ids, batch, count);
+}
@@ -1,6 +1,7 @@
 #pragma once
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -8,6 +9,9 @@ extern "C" {
 
 typedef void* candle_list_handle;
 typedef void* candle_handle;
+typedef void* candle_filter_handle;
+typedef void* candle_dbc_handle;
+typedef void* candle_capture_handle;
 
 typedef enum {
     CANDLE_DEVSTATE_AVAIL,
@@ -59,6 +63,25 @@ typedef enum {
     CANDLE_ERR_SETUPDI_IF_ENUM     = 25,
     CANDLE_ERR_SET_TIMESTAMP_MODE  = 26,
     CANDLE_ERR_DEV_OUT_OF_RANGE    = 27,
+    CANDLE_ERR_CLAIM_INTERFACE     = 28,
+    CANDLE_ERR_CREATE_THREAD       = 29,
+    CANDLE_ERR_INVALID_OPTION      = 30,
+    CANDLE_ERR_COMPLETION_PORT     = 31,
+    CANDLE_ERR_BORROW_LIMIT        = 32,
+    CANDLE_ERR_BORROW_INVALID      = 33,
+    CANDLE_ERR_SEND_WOULD_BLOCK    = 34,
+    CANDLE_ERR_CHANNEL_OUT_OF_RANGE = 35,
+    CANDLE_ERR_CLOCK_NOT_SYNCED    = 36,
+    CANDLE_ERR_AUTOBAUD_FAILED     = 37,
+    CANDLE_ERR_DEVICE_GONE         = 38,
+    CANDLE_ERR_DBC_FILE            = 39,
+    CANDLE_ERR_DBC_SYNTAX          = 40,
+    CANDLE_ERR_DBC_NO_MESSAGE      = 41,
+    CANDLE_ERR_CAPTURE_FILE        = 42,
+    CANDLE_ERR_CAPTURE_FORMAT      = 43,
+    CANDLE_ERR_CAPTURE_END         = 44,
+    CANDLE_ERR_DEVICE_NOT_OPEN     = 45,
+    CANDLE_ERR_DEVICE_ALREADY_OPEN = 46,
 } candle_err_t;
 
 #pragma pack(push,1)
@@ -69,11 +92,16 @@ typedef struct {
     uint8_t can_dlc;
     uint8_t channel;
     uint8_t flags;
-    uint8_t reserved;
+    uint8_t reserved;       /* received frames: timestamp epoch, see candle_frame_timestamp64_us() */
     uint8_t data[8];
     uint32_t timestamp_us;
 } candle_frame_t;
 
+typedef struct {
+    uint64_t timestamp_us;  /* frame.timestamp_us extended past the wrap */
+    candle_frame_t frame;
+} candle_capture_record_t;
+
 typedef struct {
     uint32_t feature;
     uint32_t fclk_can;
@@ -97,7 +125,116 @@ typedef struct {
 
 #pragma pack(pop)
 
+typedef struct {
+    uint32_t bitrate;       /* bitrate the chosen timing gives */
+    int32_t error_ppm;      /* its deviation from the requested bitrate */
+    uint32_t sample_point;  /* in permille */
+} candle_bittiming_result_t;
+
+typedef enum {
+    CANDLE_DEVOPT_RX_PACKED = 0x01, /* bulk-IN transfers may carry several concatenated frames */
+    CANDLE_DEVOPT_RX_THREAD = 0x02, /* reap urbs on a dedicated thread that feeds a frame ring */
+    CANDLE_DEVOPT_TX_PACKED = 0x04, /* the device accepts several concatenated frames per bulk-OUT transfer */
+    CANDLE_DEVOPT_TS_OVFL_FRAMES = 0x08, /* insert a CANDLE_FRAMETYPE_TIMESTAMP_OVFL frame where the device counter wraps */
+    CANDLE_DEVOPT_CLOCK_SYNC = 0x10, /* sample the device clock in the background, see candle_frame_host_time_ns() */
+    CANDLE_DEVOPT_RX_PER_CHANNEL = 0x20 /* with CANDLE_DEVOPT_RX_THREAD: a ring per channel, read by candle_channel_frame_read() */
+} candle_devopt_t;
+
+typedef struct {
+    uint32_t rx_urb_count; /* number of bulk-IN reads kept in flight (1..1024, default 30) */
+    uint32_t rx_urb_size;  /* buffer size of each read in bytes (24..16384, default 64) */
+    uint32_t flags;        /* candle_devopt_t */
+    uint32_t rx_ring_frames; /* frame ring size with CANDLE_DEVOPT_RX_THREAD, per channel with CANDLE_DEVOPT_RX_PER_CHANNEL (1..1048576, default 4096) */
+    uint32_t rx_max_borrows; /* frames candle_frame_peek() may hand out at once (default 8, at most rx_urb_count-1; with a single urb peeked frames are copies) */
+    uint32_t clock_sync_ms;  /* device clock sampling period with CANDLE_DEVOPT_CLOCK_SYNC (10..60000, default 1000) */
+} candle_dev_options_t;
+
+typedef enum {
+    CANDLE_HOTPLUG_ARRIVED,
+    CANDLE_HOTPLUG_LEFT
+} candle_hotplug_event_t;
+
+/* called from the monitor thread, after the list has been updated */
+typedef void (*candle_hotplug_cb_t)(candle_list_handle list, candle_hotplug_event_t event, const wchar_t *path, void *arg);
+
+typedef struct {
+    uint8_t channel;
+    uint32_t can_id;        /* as in candle_frame_t, including the extended id flag */
+    uint32_t heartbeat_ms;
+} candle_change_heartbeat_t;
+
+typedef struct {
+    uint64_t frames;       /* frames queued by the RX thread */
+    uint64_t overflows;    /* frames dropped because the ring was full */
+    uint64_t filtered;     /* frames rejected by the acceptance filter */
+    uint64_t changed;      /* frames passed by the change filter */
+    uint64_t unchanged;    /* frames it suppressed */
+} candle_rx_stats_t;
+
+/* Frames as columns (struct of arrays), for scans that look at one or two
+   fields of many frames. Frame i is entry i of every array; each array
+   starts on a 64-byte boundary. Filled by candle_frame_batch_append() and
+   candle_frame_read_batch(), the arrays may be read directly.
+   timestamp64_us is the full timestamp: from candle_frame_timestamp64_us()
+   for frames read from a device, from the file for candle_capture_query(),
+   else timestamp_us with the epoch byte above it. */
+typedef struct {
+    size_t count;
+    size_t capacity;
+    uint32_t *can_id;       /* as in candle_frame_t */
+    uint32_t *timestamp_us;
+    uint64_t *data;         /* the 8 data bytes of each frame, in memory order */
+    uint32_t *echo_id;
+    uint8_t *can_dlc;
+    uint8_t *channel;
+    uint8_t *flags;
+    uint8_t *epoch;         /* candle_frame_t.reserved */
+    uint64_t *timestamp64_us;
+    void *block;            /* the allocation behind all arrays */
+} candle_frame_batch_t;
+
+#define CANDLE_DBC_MUX_SWITCH (-2)
+
+typedef struct {
+    const char *name;
+    const char *unit;
+    uint32_t start_bit;     /* as in the DBC: the lsb for Intel, the msb for Motorola byte order */
+    uint32_t length;
+    bool motorola;
+    bool is_signed;
+    int32_t mux;            /* -1: always sent, CANDLE_DBC_MUX_SWITCH: the multiplexer, else the multiplexer value it is sent with */
+    double factor;
+    double offset;
+    double min;
+    double max;
+} candle_dbc_signal_t;
+
+typedef struct {
+    uint32_t can_id;        /* as in candle_frame_t, including the extended id flag */
+    const char *name;
+    uint8_t dlc;
+    uint32_t num_signals;
+    const candle_dbc_signal_t *signals;
+} candle_dbc_message_t;
+
+typedef struct {
+    uint32_t signal;        /* index into the signals of the message */
+    float *values;          /* physical values, NAN where the frame does not carry the signal; may be NULL */
+    int64_t *raw;           /* raw values, 0 where not carried; may be NULL */
+} candle_dbc_column_t;
+
+/* only collects device paths; availability and descriptors are probed on
+   first use, or for all devices at once by candle_list_probe() */
 bool candle_list_scan(candle_list_handle *list);
+/* probe all devices of the list in parallel */
+bool candle_list_probe(candle_list_handle list);
+/* rescan paths and add/remove only the devices that changed; indexes of the
+   remaining devices may shift when one is removed */
+bool candle_list_refresh(candle_list_handle list, candle_hotplug_cb_t cb, void *arg);
+/* run candle_list_refresh() every interval_ms on a monitor thread; its
+   errors are not reported, the next poll tries again */
+bool candle_list_hotplug_start(candle_list_handle list, uint32_t interval_ms, candle_hotplug_cb_t cb, void *arg);
+bool candle_list_hotplug_stop(candle_list_handle list);
 bool candle_list_free(candle_list_handle list);
 bool candle_list_length(candle_list_handle list, uint8_t *len);
 
@@ -105,18 +242,101 @@ bool candle_dev_get(candle_list_handle list, uint8_t dev_num, candle_handle *hde
 bool candle_dev_get_state(candle_handle hdev, candle_devstate_t *state);
 wchar_t *candle_dev_get_path(candle_handle hdev);
 bool candle_dev_open(candle_handle hdev);
+void candle_dev_options_init(candle_dev_options_t *opts);
+/* fails with CANDLE_ERR_DEVICE_ALREADY_OPEN on a handle that is open */
+bool candle_dev_open_ex(candle_handle hdev, const candle_dev_options_t *opts);
 bool candle_dev_close(candle_handle hdev);
+bool candle_dev_get_rx_stats(candle_handle hdev, candle_rx_stats_t *stats);
 bool candle_dev_free(candle_handle hdev);
 
+/* Host-side acceptance filter: a set of rules, each for either 11-bit or
+   29-bit ids, of which a received frame has to match at least one. Echo,
+   error and overflow frames are never filtered. */
+bool candle_filter_create(candle_filter_handle *filter);
+bool candle_filter_free(candle_filter_handle filter);
+/* accept ids with (id & mask) == (value & mask) */
+bool candle_filter_add_mask(candle_filter_handle filter, bool extended, uint32_t value, uint32_t mask);
+/* accept ids first..last, inclusive */
+bool candle_filter_add_range(candle_filter_handle filter, bool extended, uint32_t first, uint32_t last);
+/* compile filter and swap it in for the frames received from now on, also
+   while reading; NULL accepts all frames again. filter is not referenced
+   afterwards and may be changed or freed. */
+bool candle_dev_set_filter(candle_handle hdev, candle_filter_handle filter);
+/* deliver on change: drop received frames whose dlc and 8 data bytes repeat
+   the last frame delivered for the same channel and id, unless the id's
+   heartbeat has run out since, by device time. heartbeat_ms (at most
+   2147483) applies to all ids not listed in ids; 0 lets no repeated frame
+   through. enable false turns the stage off. Remembered payloads start over
+   with every call. */
+bool candle_dev_set_change_filter(candle_handle hdev, bool enable, uint32_t heartbeat_ms, const candle_change_heartbeat_t *ids, size_t num_ids);
+
 bool candle_channel_count(candle_handle hdev, uint8_t *num_channels);
 bool candle_channel_get_capabilities(candle_handle hdev, uint8_t ch, candle_capability_t *cap);
 bool candle_channel_set_timing(candle_handle hdev, uint8_t ch, candle_bittiming_t *data);
 bool candle_channel_set_bitrate(candle_handle hdev, uint8_t ch, uint32_t bitrate);
+/* solve the bit timing from the channel's capabilities for a sample point in
+   permille (0 = 875); result may be NULL. Fails with
+   CANDLE_ERR_BITRATE_UNSUPPORTED if no timing comes within 0.5%. */
+bool candle_channel_set_bitrate_ex(candle_handle hdev, uint8_t ch, uint32_t bitrate, uint32_t sample_point, candle_bittiming_result_t *result);
+/* try each candidate bitrate (NULL: the standard ones) in listen-only mode
+   for an equal share of timeout_ms, scoring received against error frames.
+   Rates that were detected before on this device are tried first. The
+   channel is left stopped with the detected bitrate set. Frames read in the
+   meantime, including those of other channels, are dropped. Filters are put
+   aside while searching; one set in the meantime is kept. */
+bool candle_channel_autobaud(candle_handle hdev, uint8_t ch, const uint32_t *candidates, size_t num_candidates, uint32_t timeout_ms, uint32_t *detected);
 bool candle_channel_start(candle_handle hdev, uint8_t ch, uint32_t flags);
 bool candle_channel_stop(candle_handle hdev, uint8_t ch);
 
+/* with CANDLE_DEVOPT_RX_PER_CHANNEL, where candle_frame_read() is not
+   available: the frames of channel ch, and overflow frames. Each channel
+   has its own ring, wakeup and counters, so readers of different channels
+   can run on separate threads; their errors are kept per channel too and
+   read back with candle_channel_last_error(). */
+bool candle_channel_frame_read(candle_handle hdev, uint8_t ch, candle_frame_t *frame, uint32_t timeout_ms);
+bool candle_channel_frame_read_many(candle_handle hdev, uint8_t ch, candle_frame_t *frames, uint32_t max, uint32_t *count, uint32_t timeout_ms);
+bool candle_channel_frame_read_batch(candle_handle hdev, uint8_t ch, candle_frame_batch_t *batch, uint32_t max, uint32_t *count, uint32_t timeout_ms);
+bool candle_channel_get_rx_stats(candle_handle hdev, uint8_t ch, candle_rx_stats_t *stats);
+candle_err_t candle_channel_last_error(candle_handle hdev, uint8_t ch);
+
 bool candle_frame_send(candle_handle hdev, uint8_t ch, candle_frame_t *frame);
+/* queue a frame without waiting for the USB transfer. Up to 10 frames per
+   channel stay in flight until their echo has been read; while the window
+   is full this fails with CANDLE_ERR_SEND_WOULD_BLOCK. */
+bool candle_frame_send_async(candle_handle hdev, uint8_t ch, const candle_frame_t *frame);
+/* blocking send of n frames; with CANDLE_DEVOPT_TX_PACKED they go out in as
+   few bulk transfers as possible. *sent is the number of frames the device
+   accepted, also on failure. */
+bool candle_frame_send_many(candle_handle hdev, uint8_t ch, const candle_frame_t *frames, size_t n, size_t *sent);
 bool candle_frame_read(candle_handle hdev, candle_frame_t *frame, uint32_t timeout_ms);
+bool candle_frame_read_many(candle_handle hdev, candle_frame_t *frames, uint32_t max, uint32_t *count, uint32_t timeout_ms);
+
+/* zero-copy read: *frame points into the receive buffer, which is only handed
+   back to the device by candle_frame_release(). Not available together with
+   CANDLE_DEVOPT_RX_THREAD. */
+bool candle_frame_peek(candle_handle hdev, const candle_frame_t **frame, uint32_t timeout_ms);
+bool candle_frame_release(candle_handle hdev, const candle_frame_t *frame);
+
+/* columnar frame batches, see candle_frame_batch_t. init and reserve fail
+   only for lack of memory. */
+bool candle_frame_batch_init(candle_frame_batch_t *batch, size_t capacity);
+bool candle_frame_batch_reserve(candle_frame_batch_t *batch, size_t capacity);
+bool candle_frame_batch_free(candle_frame_batch_t *batch);
+bool candle_frame_batch_clear(candle_frame_batch_t *batch);
+/* converts frames to columns at the end of the batch, growing it as needed */
+bool candle_frame_batch_append(candle_frame_batch_t *batch, const candle_frame_t *frames, size_t num_frames);
+/* frames first..first+num_frames-1 of the batch back as candle_frame_t */
+bool candle_frame_batch_get(const candle_frame_batch_t *batch, size_t first, candle_frame_t *frames, size_t num_frames);
+/* positions of the frames with this can_id (as in candle_frame_t), or with a
+   timestamp in from_us..to_us (inclusive, across a counter wrap if to_us <
+   from_us). index needs room for batch->count entries, or may be NULL to
+   only count; returns the number found. */
+size_t candle_frame_batch_select_id(const candle_frame_batch_t *batch, uint32_t can_id, size_t *index);
+size_t candle_frame_batch_select_time(const candle_frame_batch_t *batch, uint32_t from_us, uint32_t to_us, size_t *index);
+/* as candle_frame_read_many(), appending up to max frames to batch. Once the
+   first frames are in, what else is already received is taken without
+   waiting. *count is the number appended, also on failure. */
+bool candle_frame_read_batch(candle_handle hdev, candle_frame_batch_t *batch, uint32_t max, uint32_t *count, uint32_t timeout_ms);
 
 candle_frametype_t candle_frame_type(candle_frame_t *frame);
 uint32_t candle_frame_id(candle_frame_t *frame);
@@ -124,9 +344,72 @@ bool candle_frame_is_extended_id(candle_frame_t *frame);
 uint8_t candle_frame_dlc(candle_frame_t *frame);
 uint8_t *candle_frame_data(candle_frame_t *frame);
 uint32_t candle_frame_timestamp_us(candle_frame_t *frame);
+/* device timestamp extended past the 32-bit wrap (~71 minutes), for frames
+   read from hdev during the last ~12 days */
+uint64_t candle_frame_timestamp64_us(candle_handle hdev, candle_frame_t *frame);
+/* host monotonic time (CLOCK_MONOTONIC / QueryPerformanceCounter, in ns) at
+   which the device stamped the frame. Needs CANDLE_DEVOPT_CLOCK_SYNC; fails
+   with CANDLE_ERR_CLOCK_NOT_SYNCED until the first clock sample is in. */
+bool candle_frame_host_time_ns(candle_handle hdev, candle_frame_t *frame, uint64_t *host_ns);
 
 candle_err_t candle_dev_last_error(candle_handle hdev);
 
+/* Signal decoding from a DBC file. Each message is compiled into a plan of
+   shifts and masks when loading, so decoding a frame does not allocate.
+   Only BO_ and SG_ lines are read; signals are integers (SIG_VALTYPE_ is
+   ignored). On failure dbc is still returned, to be queried with
+   candle_dbc_last_error() and freed. */
+bool candle_dbc_load(const char *path, candle_dbc_handle *dbc);
+bool candle_dbc_load_string(const char *text, size_t len, candle_dbc_handle *dbc);
+bool candle_dbc_free(candle_dbc_handle dbc);
+/* line is that of the offending BO_ or SG_ line for CANDLE_ERR_DBC_SYNTAX */
+candle_err_t candle_dbc_last_error(candle_dbc_handle dbc, uint32_t *line);
+bool candle_dbc_message_count(candle_dbc_handle dbc, uint32_t *count);
+const candle_dbc_message_t *candle_dbc_message(candle_dbc_handle dbc, uint32_t index);
+/* can_id as in candle_frame_t; NULL if the DBC has no such message */
+const candle_dbc_message_t *candle_dbc_find(candle_dbc_handle dbc, uint32_t can_id);
+/* physical values (raw * factor + offset) of all signals of the frame's
+   message, in the order of its signals. Signals the frame does not carry,
+   because it is too short or sent with another multiplexer value, are NAN.
+   Returns the message, or NULL for unknown ids and non-data frames. */
+const candle_dbc_message_t *candle_dbc_decode(candle_dbc_handle dbc, candle_frame_t *frame, double *values);
+/* as candle_dbc_decode(), raw values sign extended; signals not carried are 0 */
+const candle_dbc_message_t *candle_dbc_decode_raw(candle_dbc_handle dbc, candle_frame_t *frame, int64_t *raw);
+/* batch decoding for recorded frames: the given signals of every data frame
+   of message can_id in frames, one column entry per such frame, so each
+   column must have room for num_frames entries. index, if not NULL, gets
+   the position of each in frames, and *count their number. Uses SSSE3 or
+   AVX2 kernels where the cpu has them. */
+bool candle_dbc_extract(candle_dbc_handle dbc, const candle_frame_t *frames, size_t num_frames, uint32_t can_id, const candle_dbc_column_t *columns, size_t num_columns, size_t *index, size_t *count);
+
+/* Capture files: 32-byte records in blocks of 4096, each block followed by
+   a footer with its time range and a set of the ids in it, so a reader can
+   skip blocks without touching their records. Written sequentially;
+   candle_capture_open() maps the file and only reads the footers. A block is
+   written once it is full, the last one by candle_capture_close(); a file
+   cut short loses at most its last block. */
+bool candle_capture_create(const char *path, candle_capture_handle *cap);
+/* 64-bit timestamps come from candle_frame_timestamp64_us() if hdev is
+   given, else the writer extends timestamp_us itself, which needs frames in
+   about time order and no gap longer than ~35 minutes */
+bool candle_capture_write(candle_capture_handle cap, candle_handle hdev, const candle_frame_t *frames, size_t num_frames);
+bool candle_capture_open(const char *path, candle_capture_handle *cap);
+/* for a writer, writes the last block; false if that fails */
+bool candle_capture_close(candle_capture_handle cap);
+candle_err_t candle_capture_last_error(candle_capture_handle cap);
+/* first_us and last_us are the lowest and highest timestamp; all may be NULL */
+bool candle_capture_info(candle_capture_handle cap, uint64_t *num_frames, uint64_t *first_us, uint64_t *last_us);
+/* zero-copy access to the blocks that may hold frames with a timestamp in
+   from_us..to_us (inclusive) and one of ids (can_id as in candle_frame_t,
+   NULL for any). Start with *cursor 0; each call returns the records of the
+   next such block, which stay valid until close, and advances *cursor. Not
+   every record need match. Fails with CANDLE_ERR_CAPTURE_END after the
+   last. */
+bool candle_capture_next_block(candle_capture_handle cap, uint64_t from_us, uint64_t to_us, const uint32_t *ids, size_t num_ids, uint64_t *cursor, const candle_capture_record_t **records, uint32_t *count);
+/* appends the frames that do match to batch, in file order; *count is their
+   number */
+bool candle_capture_query(candle_capture_handle cap, uint64_t from_us, uint64_t to_us, const uint32_t *ids, size_t num_ids, candle_frame_batch_t *batch, size_t *count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,222 @@
+#include "candle_batch.h"
+#include "candle_os.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CANDLE_BATCH_X86 1
+#include <immintrin.h>
+#endif
+
+static size_t candle_batch_column_size(size_t capacity, size_t size)
+{
+    return (capacity * size + CANDLE_CACHE_LINE - 1) & ~(size_t)(CANDLE_CACHE_LINE - 1);
+}
+
+bool candle_batch_reserve(candle_frame_batch_t *batch, size_t capacity)
+{
+    if (capacity <= batch->capacity) {
+        return true;
+    }
+
+    if (capacity > SIZE_MAX / 64) {
+        return false;
+    }
+    size_t size32 = candle_batch_column_size(capacity, sizeof(uint32_t));
+    size_t size64 = candle_batch_column_size(capacity, sizeof(uint64_t));
+    size_t size8 = candle_batch_column_size(capacity, sizeof(uint8_t));
+
+    uint8_t *block = candle_aligned_alloc(3 * size32 + 2 * size64 + 4 * size8, CANDLE_CACHE_LINE);
+    if (block == NULL) {
+        return false;
+    }
+
+    candle_frame_batch_t grown = *batch;
+    uint8_t *p = block;
+    grown.can_id = (uint32_t *)p;        p += size32;
+    grown.timestamp_us = (uint32_t *)p;  p += size32;
+    grown.echo_id = (uint32_t *)p;       p += size32;
+    grown.data = (uint64_t *)p;          p += size64;
+    grown.timestamp64_us = (uint64_t *)p; p += size64;
+    grown.can_dlc = p;                   p += size8;
+    grown.channel = p;                   p += size8;
+    grown.flags = p;                     p += size8;
+    grown.epoch = p;
+
+    if (batch->count > 0) {
+        memcpy(grown.can_id, batch->can_id, batch->count * sizeof(uint32_t));
+        memcpy(grown.timestamp_us, batch->timestamp_us, batch->count * sizeof(uint32_t));
+        memcpy(grown.echo_id, batch->echo_id, batch->count * sizeof(uint32_t));
+        memcpy(grown.data, batch->data, batch->count * sizeof(uint64_t));
+        memcpy(grown.timestamp64_us, batch->timestamp64_us, batch->count * sizeof(uint64_t));
+        memcpy(grown.can_dlc, batch->can_dlc, batch->count);
+        memcpy(grown.channel, batch->channel, batch->count);
+        memcpy(grown.flags, batch->flags, batch->count);
+        memcpy(grown.epoch, batch->epoch, batch->count);
+    }
+
+    candle_aligned_free(batch->block);
+    grown.block = block;
+    grown.capacity = capacity;
+    *batch = grown;
+    return true;
+}
+
+void candle_batch_release(candle_frame_batch_t *batch)
+{
+    candle_aligned_free(batch->block);
+    memset(batch, 0, sizeof(*batch));
+}
+
+static void candle_batch_append_scalar(candle_frame_batch_t *batch, const candle_frame_t *frames, size_t num_frames)
+{
+    size_t at = batch->count;
+    uint32_t *restrict can_id = batch->can_id + at;
+    uint32_t *restrict timestamp_us = batch->timestamp_us + at;
+    uint32_t *restrict echo_id = batch->echo_id + at;
+    uint64_t *restrict data = batch->data + at;
+    uint8_t *restrict can_dlc = batch->can_dlc + at;
+    uint8_t *restrict channel = batch->channel + at;
+    uint8_t *restrict flags = batch->flags + at;
+    uint8_t *restrict epoch = batch->epoch + at;
+
+    for (size_t i=0; i<num_frames; i++) {
+        const candle_frame_t *f = &frames[i];
+        can_id[i] = f->can_id;
+        timestamp_us[i] = f->timestamp_us;
+        echo_id[i] = f->echo_id;
+        memcpy(&data[i], f->data, sizeof(uint64_t));
+        can_dlc[i] = f->can_dlc;
+        channel[i] = f->channel;
+        flags[i] = f->flags;
+        epoch[i] = f->reserved;
+    }
+}
+
+#ifdef CANDLE_BATCH_X86
+
+/* 8 frames at a time: each 4-byte field of the 24-byte frames is one gather,
+ * the byte fields share one and are sorted apart with a shuffle.
+ */
+__attribute__((target("avx2")))
+static size_t candle_batch_append_avx2(candle_frame_batch_t *batch, const candle_frame_t *frames, size_t num_frames)
+{
+    const __m256i stride = _mm256_setr_epi32(0, 6, 12, 18, 24, 30, 36, 42);
+    /* per 128-bit lane: the 4 dlc bytes, then channel, flags, epoch */
+    const __m256i by_field = _mm256_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15,
+                                              0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+    /* then the two lanes' dwords of each field next to each other */
+    const __m256i by_lane = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    size_t at = batch->count;
+    size_t i = 0;
+    for (; i+8<=num_frames; i+=8, at+=8) {
+        const int *p = (const int *)&frames[i];
+        __m256i echo_id = _mm256_i32gather_epi32(p, stride, 4);
+        __m256i can_id = _mm256_i32gather_epi32(p + 1, stride, 4);
+        __m256i bytes = _mm256_i32gather_epi32(p + 2, stride, 4);
+        __m256i lo = _mm256_i32gather_epi32(p + 3, stride, 4);
+        __m256i hi = _mm256_i32gather_epi32(p + 4, stride, 4);
+        __m256i timestamp = _mm256_i32gather_epi32(p + 5, stride, 4);
+
+        _mm256_storeu_si256((__m256i *)&batch->echo_id[at], echo_id);
+        _mm256_storeu_si256((__m256i *)&batch->can_id[at], can_id);
+        _mm256_storeu_si256((__m256i *)&batch->timestamp_us[at], timestamp);
+
+        __m256i d0 = _mm256_unpacklo_epi32(lo, hi);
+        __m256i d1 = _mm256_unpackhi_epi32(lo, hi);
+        _mm256_storeu_si256((__m256i *)&batch->data[at], _mm256_permute2x128_si256(d0, d1, 0x20));
+        _mm256_storeu_si256((__m256i *)&batch->data[at + 4], _mm256_permute2x128_si256(d0, d1, 0x31));
+
+        __m256i fields = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(bytes, by_field), by_lane);
+        __m128i dlc_channel = _mm256_castsi256_si128(fields);
+        __m128i flags_epoch = _mm256_extracti128_si256(fields, 1);
+        _mm_storel_epi64((__m128i *)&batch->can_dlc[at], dlc_channel);
+        _mm_storel_epi64((__m128i *)&batch->channel[at], _mm_srli_si128(dlc_channel, 8));
+        _mm_storel_epi64((__m128i *)&batch->flags[at], flags_epoch);
+        _mm_storel_epi64((__m128i *)&batch->epoch[at], _mm_srli_si128(flags_epoch, 8));
+    }
+    _mm256_zeroupper();
+    return i;
+}
+
+#endif
+
+void candle_batch_append(candle_frame_batch_t *batch, const candle_frame_t *frames, size_t num_frames)
+{
+    size_t at = batch->count;
+    size_t done = 0;
+#ifdef CANDLE_BATCH_X86
+    if (candle_cpu_isa() >= CANDLE_ISA_AVX2) {
+        done = candle_batch_append_avx2(batch, frames, num_frames);
+        batch->count += done;
+    }
+#endif
+    candle_batch_append_scalar(batch, frames + done, num_frames - done);
+    batch->count += num_frames - done;
+
+    /* from the columns just written, as a loop the compiler vectorizes */
+    const uint32_t *restrict timestamp_us = batch->timestamp_us;
+    const uint8_t *restrict epoch = batch->epoch;
+    uint64_t *restrict timestamp64_us = batch->timestamp64_us;
+    for (size_t i=at; i<batch->count; i++) {
+        timestamp64_us[i] = ((uint64_t)epoch[i] << 32) | timestamp_us[i];
+    }
+}
+
+void candle_batch_get(const candle_frame_batch_t *batch, size_t first, candle_frame_t *frames, size_t num_frames)
+{
+    for (size_t i=0; i<num_frames; i++) {
+        candle_frame_t *f = &frames[i];
+        size_t k = first + i;
+        f->echo_id = batch->echo_id[k];
+        f->can_id = batch->can_id[k];
+        f->can_dlc = batch->can_dlc[k];
+        f->channel = batch->channel[k];
+        f->flags = batch->flags[k];
+        f->reserved = batch->epoch[k];
+        memcpy(f->data, &batch->data[k], sizeof(f->data));
+        f->timestamp_us = batch->timestamp_us[k];
+    }
+}
+
+/* every position is written, only matches advance n, so there is no branch
+   to mispredict; without index the loop is a plain vectorizable count */
+size_t candle_batch_select_id(const candle_frame_batch_t *batch, uint32_t can_id, size_t *index)
+{
+    const uint32_t *ids = batch->can_id;
+    size_t n = 0;
+
+    if (index == NULL) {
+        for (size_t i=0; i<batch->count; i++) {
+            n += (ids[i] == can_id);
+        }
+        return n;
+    }
+
+    for (size_t i=0; i<batch->count; i++) {
+        index[n] = i;
+        n += (ids[i] == can_id);
+    }
+    return n;
+}
+
+size_t candle_batch_select_time(const candle_frame_batch_t *batch, uint32_t from_us, uint32_t to_us, size_t *index)
+{
+    const uint32_t *ts = batch->timestamp_us;
+    uint32_t span = to_us - from_us;
+    size_t n = 0;
+
+    if (index == NULL) {
+        for (size_t i=0; i<batch->count; i++) {
+            n += (ts[i] - from_us <= span);
+        }
+        return n;
+    }
+
+    for (size_t i=0; i<batch->count; i++) {
+        index[n] = i;
+        n += (ts[i] - from_us <= span);
+    }
+    return n;
+}
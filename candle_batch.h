@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "candle.h"
+
+#define CANDLE_BATCH_MIN_FRAMES  256   /* capacity a growing batch starts with */
+#define CANDLE_BATCH_READ_FRAMES 256   /* frames moved per round by candle_frame_read_batch() */
+
+bool candle_batch_reserve(candle_frame_batch_t *batch, size_t capacity);
+void candle_batch_release(candle_frame_batch_t *batch);
+
+/* the batch must have room for num_frames more; timestamp64_us is made
+   from timestamp_us and the epoch byte */
+void candle_batch_append(candle_frame_batch_t *batch, const candle_frame_t *frames, size_t num_frames);
+/* frames [first, first+num_frames) of the batch, which must exist */
+void candle_batch_get(const candle_frame_batch_t *batch, size_t first, candle_frame_t *frames, size_t num_frames);
+
+size_t candle_batch_select_id(const candle_frame_batch_t *batch, uint32_t can_id, size_t *index);
+size_t candle_batch_select_time(const candle_frame_batch_t *batch, uint32_t from_us, uint32_t to_us, size_t *index);
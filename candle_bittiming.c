@@ -0,0 +1,310 @@
+#include "candle_bittiming.h"
+#include <string.h>
+
+/* Precomputed timings for the usual bitrates and sample points on the
+ * clocks candleLight-family adapters run at, checked at compile time.
+ * X(fclk, bitrate, sample point, brp, tseg1, tseg2)
+ */
+#define CANDLE_BT_TABLE(X) \
+    X( 48000000,   10000, 875, 300, 13,  2) \
+    X( 48000000,   20000, 875, 150, 13,  2) \
+    X( 48000000,   50000, 875,  60, 13,  2) \
+    X( 48000000,   83333, 875,  36, 13,  2) \
+    X( 48000000,  100000, 875,  30, 13,  2) \
+    X( 48000000,  125000, 875,  24, 13,  2) \
+    X( 48000000,  250000, 875,  12, 13,  2) \
+    X( 48000000,  500000, 875,   6, 13,  2) \
+    X( 48000000,  800000, 875,   4, 12,  2) \
+    X( 48000000, 1000000, 875,   3, 13,  2) \
+    X( 48000000,   10000, 800, 240, 15,  4) \
+    X( 48000000,   20000, 800, 120, 15,  4) \
+    X( 48000000,   50000, 800,  48, 15,  4) \
+    X( 48000000,   83333, 800,  36, 12,  3) \
+    X( 48000000,  100000, 800,  24, 15,  4) \
+    X( 48000000,  125000, 800,  24, 12,  3) \
+    X( 48000000,  250000, 800,  12, 12,  3) \
+    X( 48000000,  500000, 800,   6, 12,  3) \
+    X( 48000000,  800000, 800,   3, 15,  4) \
+    X( 48000000, 1000000, 800,   3, 12,  3) \
+    X( 48000000,   10000, 750, 240, 14,  5) \
+    X( 48000000,   20000, 750, 120, 14,  5) \
+    X( 48000000,   50000, 750,  48, 14,  5) \
+    X( 48000000,   83333, 750,  36, 11,  4) \
+    X( 48000000,  100000, 750,  24, 14,  5) \
+    X( 48000000,  125000, 750,  24, 11,  4) \
+    X( 48000000,  250000, 750,  12, 11,  4) \
+    X( 48000000,  500000, 750,   6, 11,  4) \
+    X( 48000000,  800000, 750,   3, 14,  5) \
+    X( 48000000, 1000000, 750,   3, 11,  4) \
+    X( 80000000,   10000, 875, 125, 55,  8) \
+    X( 80000000,   20000, 875, 100, 34,  5) \
+    X( 80000000,   50000, 875,  25, 55,  8) \
+    X( 80000000,   83333, 875,  15, 55,  8) \
+    X( 80000000,  100000, 875,  20, 34,  5) \
+    X( 80000000,  125000, 875,  10, 55,  8) \
+    X( 80000000,  250000, 875,   5, 55,  8) \
+    X( 80000000,  500000, 875,   4, 34,  5) \
+    X( 80000000,  800000, 875,   2, 43,  6) \
+    X( 80000000, 1000000, 875,   2, 34,  5) \
+    X( 80000000,   10000, 800, 100, 63, 16) \
+    X( 80000000,   20000, 800,  50, 63, 16) \
+    X( 80000000,   50000, 800,  20, 63, 16) \
+    X( 80000000,   83333, 800,  12, 63, 16) \
+    X( 80000000,  100000, 800,  10, 63, 16) \
+    X( 80000000,  125000, 800,   8, 63, 16) \
+    X( 80000000,  250000, 800,   4, 63, 16) \
+    X( 80000000,  500000, 800,   2, 63, 16) \
+    X( 80000000,  800000, 800,   2, 39, 10) \
+    X( 80000000, 1000000, 800,   1, 63, 16) \
+    X( 80000000,   10000, 750, 125, 47, 16) \
+    X( 80000000,   20000, 750, 100, 29, 10) \
+    X( 80000000,   50000, 750,  25, 47, 16) \
+    X( 80000000,   83333, 750,  15, 47, 16) \
+    X( 80000000,  100000, 750,  20, 29, 10) \
+    X( 80000000,  125000, 750,  10, 47, 16) \
+    X( 80000000,  250000, 750,   5, 47, 16) \
+    X( 80000000,  500000, 750,   4, 29, 10) \
+    X( 80000000,  800000, 750,   5, 14,  5) \
+    X( 80000000, 1000000, 750,   2, 29, 10) \
+    X(160000000,   10000, 875, 250, 55,  8) \
+    X(160000000,   20000, 875, 125, 55,  8) \
+    X(160000000,   50000, 875,  50, 55,  8) \
+    X(160000000,   83333, 875,  30, 55,  8) \
+    X(160000000,  100000, 875,  25, 55,  8) \
+    X(160000000,  125000, 875,  20, 55,  8) \
+    X(160000000,  250000, 875,  10, 55,  8) \
+    X(160000000,  500000, 875,   5, 55,  8) \
+    X(160000000,  800000, 875,   5, 34,  5) \
+    X(160000000, 1000000, 875,   4, 34,  5) \
+    X(160000000,   10000, 800, 200, 63, 16) \
+    X(160000000,   20000, 800, 100, 63, 16) \
+    X(160000000,   50000, 800,  40, 63, 16) \
+    X(160000000,   83333, 800,  24, 63, 16) \
+    X(160000000,  100000, 800,  20, 63, 16) \
+    X(160000000,  125000, 800,  16, 63, 16) \
+    X(160000000,  250000, 800,   8, 63, 16) \
+    X(160000000,  500000, 800,   4, 63, 16) \
+    X(160000000,  800000, 800,   4, 39, 10) \
+    X(160000000, 1000000, 800,   2, 63, 16) \
+    X(160000000,   10000, 750, 250, 47, 16) \
+    X(160000000,   20000, 750, 125, 47, 16) \
+    X(160000000,   50000, 750,  50, 47, 16) \
+    X(160000000,   83333, 750,  30, 47, 16) \
+    X(160000000,  100000, 750,  25, 47, 16) \
+    X(160000000,  125000, 750,  20, 47, 16) \
+    X(160000000,  250000, 750,  10, 47, 16) \
+    X(160000000,  500000, 750,   5, 47, 16) \
+    X(160000000,  800000, 750,   5, 29, 10) \
+    X(160000000, 1000000, 750,   4, 29, 10)
+
+#define CANDLE_BT_TABLE_MAX_ERROR_PPM 100
+#define CANDLE_BT_TABLE_MAX_SP_ERROR 20     /* permille */
+
+#define CANDLE_BT_NBT(tseg1, tseg2) (1ull + (tseg1) + (tseg2))
+#define CANDLE_BT_DIV(bitrate, brp, tseg1, tseg2) ((uint64_t)(bitrate) * (brp) * CANDLE_BT_NBT(tseg1, tseg2))
+#define CANDLE_BT_ABSDIFF(a, b) (((a) > (b)) ? ((a) - (b)) : ((b) - (a)))
+
+/* each entry must hit its bitrate and sample point, or the array size goes negative */
+#define CANDLE_BT_CHECK(fclk, bitrate, sp, brp, tseg1, tseg2) \
+    typedef char candle_bt_check_##fclk##_##bitrate##_##sp[ \
+        ( (CANDLE_BT_ABSDIFF((uint64_t)(fclk), CANDLE_BT_DIV(bitrate, brp, tseg1, tseg2)) * 1000000 \
+            <= CANDLE_BT_TABLE_MAX_ERROR_PPM * CANDLE_BT_DIV(bitrate, brp, tseg1, tseg2)) \
+       && (CANDLE_BT_ABSDIFF(1000 * (1ull + (tseg1)), (uint64_t)(sp) * CANDLE_BT_NBT(tseg1, tseg2)) \
+            <= CANDLE_BT_TABLE_MAX_SP_ERROR * CANDLE_BT_NBT(tseg1, tseg2)) ) ? 1 : -1];
+CANDLE_BT_TABLE(CANDLE_BT_CHECK)
+
+typedef struct {
+    uint32_t fclk;
+    uint32_t bitrate;
+    uint16_t sample_point;
+    uint16_t brp;
+    uint8_t tseg1;
+    uint8_t tseg2;
+} candle_bt_table_entry_t;
+
+#define CANDLE_BT_ENTRY(fclk, bitrate, sp, brp, tseg1, tseg2) { fclk, bitrate, sp, brp, tseg1, tseg2 },
+static const candle_bt_table_entry_t candle_bt_table[] = {
+    CANDLE_BT_TABLE(CANDLE_BT_ENTRY)
+};
+
+static uint64_t candle_bt_absdiff(uint64_t a, uint64_t b)
+{
+    return (a > b) ? (a - b) : (b - a);
+}
+
+/* split the nbt-1 quanta after the sync segment into tseg1/tseg2, with the
+   sample point (the end of tseg1) as close to sample_point as the limits allow */
+static bool candle_bt_split(const candle_capability_t *cap, uint32_t nbt, uint32_t sample_point, uint32_t *tseg1)
+{
+    int64_t lo = cap->tseg1_min;
+    int64_t hi = cap->tseg1_max;
+    if ((int64_t)nbt - 1 - cap->tseg2_max > lo) {
+        lo = (int64_t)nbt - 1 - cap->tseg2_max;
+    }
+    if ((int64_t)nbt - 1 - cap->tseg2_min < hi) {
+        hi = (int64_t)nbt - 1 - cap->tseg2_min;
+    }
+    if ( (lo > hi) || (hi < 1) ) {
+        return false;
+    }
+
+    int64_t t1 = ((int64_t)sample_point * nbt + 500) / 1000 - 1;
+    if (t1 < lo) {
+        t1 = lo;
+    }
+    if (t1 > hi) {
+        t1 = hi;
+    }
+    *tseg1 = (uint32_t)t1;
+    return true;
+}
+
+static void candle_bt_fill(const candle_capability_t *cap, uint32_t bitrate, uint32_t brp, uint32_t nbt, uint32_t tseg1, candle_bittiming_t *timing, candle_bittiming_result_t *result)
+{
+    uint32_t tseg2 = nbt - 1 - tseg1;
+    timing->brp = brp;
+    timing->prop_seg = tseg1 / 2;
+    timing->phase_seg1 = tseg1 - timing->prop_seg;
+    timing->phase_seg2 = tseg2;
+    timing->sjw = (timing->phase_seg1 < tseg2 / 2) ? timing->phase_seg1 : tseg2 / 2;
+    if (timing->sjw > cap->sjw_max) {
+        timing->sjw = cap->sjw_max;
+    }
+    if (timing->sjw < 1) {
+        timing->sjw = 1;
+    }
+
+    if (result != NULL) {
+        uint64_t div = (uint64_t)brp * nbt;
+        result->bitrate = (uint32_t)((cap->fclk_can + div / 2) / div);
+        result->sample_point = (1000 * (1 + tseg1) + nbt / 2) / nbt;
+        result->error_ppm = (int32_t)(((int64_t)cap->fclk_can - (int64_t)(div * bitrate)) * 1000000 / (int64_t)(div * bitrate));
+    }
+}
+
+/* table entries are only used where the channel's limits allow them */
+static bool candle_bt_lookup(const candle_capability_t *cap, uint32_t bitrate, uint32_t sample_point, candle_bittiming_t *timing, candle_bittiming_result_t *result)
+{
+    if (sample_point == 0) {
+        sample_point = CANDLE_BT_SAMPLE_POINT_DEFAULT;
+    }
+
+    for (size_t i=0; i<sizeof(candle_bt_table)/sizeof(candle_bt_table[0]); i++) {
+        const candle_bt_table_entry_t *e = &candle_bt_table[i];
+        if ( (e->fclk != cap->fclk_can) || (e->bitrate != bitrate) || (e->sample_point != sample_point) ) {
+            continue;
+        }
+        if ( (e->tseg1 < cap->tseg1_min) || (e->tseg1 > cap->tseg1_max)
+          || (e->tseg2 < cap->tseg2_min) || (e->tseg2 > cap->tseg2_max)
+          || (e->brp < cap->brp_min) || (e->brp > cap->brp_max) || (cap->brp_inc == 0) || (e->brp % cap->brp_inc != 0) ) {
+            return false;
+        }
+        candle_bt_fill(cap, bitrate, e->brp, 1 + e->tseg1 + e->tseg2, e->tseg1, timing, result);
+        return true;
+    }
+    return false;
+}
+
+candle_err_t candle_bt_calc(const candle_capability_t *cap, uint32_t bitrate, uint32_t sample_point, candle_bittiming_t *timing, candle_bittiming_result_t *result)
+{
+    if ( (cap->fclk_can == 0) || (cap->brp_inc == 0) || (cap->brp_max == 0) || (cap->tseg2_max == 0) ) {
+        return CANDLE_ERR_BITRATE_FCLK;
+    }
+    if ( (bitrate == 0) || (sample_point >= 1000) ) {
+        return CANDLE_ERR_BITRATE_UNSUPPORTED;
+    }
+    if (sample_point == 0) {
+        sample_point = CANDLE_BT_SAMPLE_POINT_DEFAULT;
+    }
+
+    bool found = false;
+    uint64_t best_rate_err = 0;     /* ppb */
+    uint64_t best_sp_err = 0;       /* ppm of a bit */
+    uint32_t best_nbt = 0, best_brp = 0, best_tseg1 = 0;
+
+    uint32_t nbt_min = 1 + cap->tseg1_min + cap->tseg2_min;
+    if (nbt_min < 3) {
+        nbt_min = 3;
+    }
+    for (uint32_t nbt = 1 + cap->tseg1_max + cap->tseg2_max; nbt >= nbt_min; nbt--) {
+
+        /* the two usable prescalers around the ideal one */
+        uint64_t brp_ideal = cap->fclk_can / ((uint64_t)nbt * bitrate);
+        brp_ideal -= brp_ideal % cap->brp_inc;
+
+        for (uint64_t brp = brp_ideal; brp <= brp_ideal + cap->brp_inc; brp += cap->brp_inc) {
+            if ( (brp < cap->brp_min) || (brp > cap->brp_max) || (brp == 0) ) {
+                continue;
+            }
+
+            uint64_t div = (uint64_t)bitrate * brp * nbt;
+            uint64_t rate_err = candle_bt_absdiff(cap->fclk_can, div) * 1000000000ull / div;
+            if (found && (rate_err > best_rate_err)) {
+                continue;
+            }
+
+            uint32_t tseg1;
+            if (!candle_bt_split(cap, nbt, sample_point, &tseg1)) {
+                continue;
+            }
+            uint64_t sp_err = candle_bt_absdiff((1ull + tseg1) * 1000000 / nbt, (uint64_t)sample_point * 1000);
+
+            if (!found || (rate_err < best_rate_err) || (sp_err < best_sp_err)) {
+                found = true;
+                best_rate_err = rate_err;
+                best_sp_err = sp_err;
+                best_nbt = nbt;
+                best_brp = (uint32_t)brp;
+                best_tseg1 = tseg1;
+            }
+        }
+    }
+
+    if ( !found || (best_rate_err > CANDLE_BT_MAX_ERROR_PPM * 1000ull) ) {
+        return CANDLE_ERR_BITRATE_UNSUPPORTED;
+    }
+
+    candle_bt_fill(cap, bitrate, best_brp, best_nbt, best_tseg1, timing, result);
+    return CANDLE_ERR_OK;
+}
+
+candle_err_t candle_bt_calc_cached(candle_bt_cache_t *cache, const candle_capability_t *cap, uint32_t bitrate, uint32_t sample_point, candle_bittiming_t *timing, candle_bittiming_result_t *result)
+{
+    if (candle_bt_lookup(cap, bitrate, sample_point, timing, result)) {
+        return CANDLE_ERR_OK;
+    }
+
+    for (unsigned i=0; i<CANDLE_BT_CACHE_SIZE; i++) {
+        candle_bt_cache_entry_t *e = &cache->entry[i];
+        if ( e->valid && (e->bitrate == bitrate) && (e->sample_point == sample_point)
+          && (memcmp(&e->cap, cap, sizeof(*cap)) == 0) ) {
+            *timing = e->timing;
+            if (result != NULL) {
+                *result = e->result;
+            }
+            return CANDLE_ERR_OK;
+        }
+    }
+
+    candle_bittiming_t t;
+    candle_bittiming_result_t r;
+    candle_err_t err = candle_bt_calc(cap, bitrate, sample_point, &t, &r);
+    if (err != CANDLE_ERR_OK) {
+        return err;
+    }
+
+    candle_bt_cache_entry_t *e = &cache->entry[cache->next];
+    e->valid = true;
+    e->cap = *cap;
+    e->bitrate = bitrate;
+    e->sample_point = sample_point;
+    e->timing = t;
+    e->result = r;
+    cache->next = (cache->next + 1) % CANDLE_BT_CACHE_SIZE;
+
+    *timing = t;
+    if (result != NULL) {
+        *result = r;
+    }
+    return CANDLE_ERR_OK;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "candle.h"
+
+#define CANDLE_BT_SAMPLE_POINT_DEFAULT 875  /* permille, CiA 301 recommendation */
+#define CANDLE_BT_MAX_ERROR_PPM 5000
+#define CANDLE_BT_CACHE_SIZE 8
+
+/* Bit-timing solver working from the limits a channel reports. All
+ * BRP/TSEG1/TSEG2 combinations the limits allow are considered; the one
+ * with the smallest bitrate error wins, then the one closest to the
+ * requested sample point, then the one with the most time quanta.
+ * sample_point is in permille, 0 picks CANDLE_BT_SAMPLE_POINT_DEFAULT.
+ */
+candle_err_t candle_bt_calc(const candle_capability_t *cap, uint32_t bitrate, uint32_t sample_point, candle_bittiming_t *timing, candle_bittiming_result_t *result);
+
+typedef struct {
+    bool valid;
+    candle_capability_t cap;
+    uint32_t bitrate;
+    uint32_t sample_point;
+    candle_bittiming_t timing;
+    candle_bittiming_result_t result;
+} candle_bt_cache_entry_t;
+
+/* small round-robin cache of solved timings, not thread safe */
+typedef struct {
+    candle_bt_cache_entry_t entry[CANDLE_BT_CACHE_SIZE];
+    uint32_t next;
+} candle_bt_cache_t;
+
+/* tries the precomputed table for the known adapter clocks first, then the
+   cache, then candle_bt_calc() */
+candle_err_t candle_bt_calc_cached(candle_bt_cache_t *cache, const candle_capability_t *cap, uint32_t bitrate, uint32_t sample_point, candle_bittiming_t *timing, candle_bittiming_result_t *result);
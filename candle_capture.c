@@ -0,0 +1,395 @@
+#ifndef _WIN32
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include "candle_capture.h"
+#include "candle_batch.h"
+#include <stdlib.h>
+#include <string.h>
+
+static uint64_t candle_capture_block_size(void)
+{
+    return (uint64_t)CANDLE_CAPTURE_BLOCK_FRAMES * sizeof(candle_capture_record_t) + sizeof(candle_capture_footer_t);
+}
+
+static uint32_t candle_capture_bloom_hash1(uint32_t can_id)
+{
+    return (can_id * 0x9E3779B1u) >> 21;
+}
+
+static uint32_t candle_capture_bloom_hash2(uint32_t can_id)
+{
+    return (can_id * 0x85EBCA77u) >> 21;
+}
+
+static void candle_capture_set_bit(uint8_t *bits, uint32_t k)
+{
+    bits[k / 8] |= (uint8_t)(1u << (k % 8));
+}
+
+static bool candle_capture_get_bit(const uint8_t *bits, uint32_t k)
+{
+    return (bits[k / 8] >> (k % 8)) & 1;
+}
+
+static void candle_capture_add_id(candle_capture_footer_t *footer, uint32_t can_id)
+{
+    if (can_id < CANDLE_CAPTURE_STD_IDS) {
+        candle_capture_set_bit(footer->std_ids, can_id);
+    } else {
+        candle_capture_set_bit(footer->ext_ids, candle_capture_bloom_hash1(can_id));
+        candle_capture_set_bit(footer->ext_ids, candle_capture_bloom_hash2(can_id));
+    }
+}
+
+/* false only if the block surely has none of ids */
+static bool candle_capture_may_have_id(const candle_capture_footer_t *footer, const uint32_t *ids, size_t num_ids)
+{
+    if (ids == NULL) {
+        return true;
+    }
+
+    for (size_t i=0; i<num_ids; i++) {
+        uint32_t id = ids[i];
+        if (id < CANDLE_CAPTURE_STD_IDS) {
+            if (candle_capture_get_bit(footer->std_ids, id)) {
+                return true;
+            }
+        } else if ( candle_capture_get_bit(footer->ext_ids, candle_capture_bloom_hash1(id))
+                 && candle_capture_get_bit(footer->ext_ids, candle_capture_bloom_hash2(id)) ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void candle_capture_reset_footer(candle_capture_footer_t *footer)
+{
+    memset(footer, 0, sizeof(*footer));
+    memcpy(footer->magic, CANDLE_CAPTURE_BLOCK_MAGIC, sizeof(footer->magic));
+    footer->first_us = UINT64_MAX;
+}
+
+bool candle_capture_create_file(candle_capture_t *cap, const char *path)
+{
+    cap->writing = true;
+    cap->records = malloc(CANDLE_CAPTURE_BLOCK_FRAMES * sizeof(candle_capture_record_t));
+    if (cap->records == NULL) {
+        cap->last_error = CANDLE_ERR_MALLOC;
+        return false;
+    }
+    candle_capture_reset_footer(&cap->footer);
+
+    cap->file = fopen(path, "wb");
+    if (cap->file == NULL) {
+        cap->last_error = CANDLE_ERR_CAPTURE_FILE;
+        return false;
+    }
+
+    candle_capture_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CANDLE_CAPTURE_MAGIC, sizeof(header.magic));
+    header.version = CANDLE_CAPTURE_VERSION;
+    header.header_size = sizeof(candle_capture_header_t);
+    header.record_size = sizeof(candle_capture_record_t);
+    header.block_frames = CANDLE_CAPTURE_BLOCK_FRAMES;
+    header.footer_size = sizeof(candle_capture_footer_t);
+
+    if (fwrite(&header, sizeof(header), 1, cap->file) != 1) {
+        cap->last_error = CANDLE_ERR_CAPTURE_FILE;
+        return false;
+    }
+    return true;
+}
+
+static bool candle_capture_write_block(candle_capture_t *cap)
+{
+    candle_capture_footer_t *footer = &cap->footer;
+    if ( (fwrite(cap->records, sizeof(candle_capture_record_t), footer->count, cap->file) != footer->count)
+      || (fwrite(footer, sizeof(*footer), 1, cap->file) != 1) ) {
+        cap->last_error = CANDLE_ERR_CAPTURE_FILE;
+        return false;
+    }
+    candle_capture_reset_footer(footer);
+    return true;
+}
+
+bool candle_capture_append(candle_capture_t *cap, candle_handle hdev, const candle_frame_t *frames, size_t num_frames)
+{
+    candle_capture_footer_t *footer = &cap->footer;
+
+    for (size_t i=0; i<num_frames; i++) {
+        candle_frame_t *f = (candle_frame_t *)&frames[i];
+        uint64_t ts;
+        if (hdev != NULL) {
+            ts = candle_frame_timestamp64_us(hdev, f);
+        } else if (cap->have_last) {
+            /* by the signed distance to the previous frame */
+            ts = cap->last_us + (int64_t)(int32_t)(f->timestamp_us - (uint32_t)cap->last_us);
+        } else {
+            ts = f->timestamp_us;
+        }
+        cap->last_us = ts;
+        cap->have_last = true;
+
+        candle_capture_record_t *r = &cap->records[footer->count++];
+        r->timestamp_us = ts;
+        memcpy(&r->frame, f, sizeof(candle_frame_t));
+
+        if (ts < footer->first_us) {
+            footer->first_us = ts;
+        }
+        if (ts > footer->last_us) {
+            footer->last_us = ts;
+        }
+        candle_capture_add_id(footer, f->can_id);
+
+        if ( (footer->count == CANDLE_CAPTURE_BLOCK_FRAMES) && !candle_capture_write_block(cap) ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool candle_capture_valid_footer(const candle_capture_footer_t *footer, uint32_t count)
+{
+    return (memcmp(footer->magic, CANDLE_CAPTURE_BLOCK_MAGIC, sizeof(footer->magic)) == 0)
+        && (footer->count == count)
+        && (footer->first_us <= footer->last_us);
+}
+
+static const candle_capture_record_t *candle_capture_block_records(const candle_capture_t *cap, size_t block)
+{
+    const uint8_t *base = (const uint8_t *)cap->map.data + sizeof(candle_capture_header_t);
+    return (const candle_capture_record_t *)(base + block * candle_capture_block_size());
+}
+
+bool candle_capture_open_file(candle_capture_t *cap, const char *path)
+{
+    if (!candle_file_map(&cap->map, path)) {
+        cap->last_error = CANDLE_ERR_CAPTURE_FILE;
+        return false;
+    }
+
+    const candle_capture_header_t *header = cap->map.data;
+    if ( (cap->map.size < sizeof(candle_capture_header_t))
+      || (memcmp(header->magic, CANDLE_CAPTURE_MAGIC, sizeof(header->magic)) != 0)
+      || (header->version != CANDLE_CAPTURE_VERSION)
+      || (header->header_size != sizeof(candle_capture_header_t))
+      || (header->record_size != sizeof(candle_capture_record_t))
+      || (header->block_frames != CANDLE_CAPTURE_BLOCK_FRAMES)
+      || (header->footer_size != sizeof(candle_capture_footer_t)) ) {
+        cap->last_error = CANDLE_ERR_CAPTURE_FORMAT;
+        return false;
+    }
+
+    uint64_t body = cap->map.size - sizeof(candle_capture_header_t);
+    size_t full = (size_t)(body / candle_capture_block_size());
+    uint64_t rest = body % candle_capture_block_size();
+
+    /* a last block without its footer was cut short, and is left out */
+    uint32_t last_count = 0;
+    if ( (rest >= sizeof(candle_capture_footer_t))
+      && ((rest - sizeof(candle_capture_footer_t)) % sizeof(candle_capture_record_t) == 0) ) {
+        last_count = (uint32_t)((rest - sizeof(candle_capture_footer_t)) / sizeof(candle_capture_record_t));
+        const candle_capture_footer_t *footer = (const candle_capture_footer_t *)(candle_capture_block_records(cap, full) + last_count);
+        if (!candle_capture_valid_footer(footer, last_count)) {
+            last_count = 0;
+        }
+    }
+    cap->num_blocks = full + (last_count > 0);
+
+    cap->footers = malloc((cap->num_blocks + 1) * sizeof(*cap->footers));
+    cap->max_before = malloc((cap->num_blocks + 1) * sizeof(uint64_t));
+    cap->min_after = malloc((cap->num_blocks + 1) * sizeof(uint64_t));
+    if ( (cap->footers == NULL) || (cap->max_before == NULL) || (cap->min_after == NULL) ) {
+        cap->last_error = CANDLE_ERR_MALLOC;
+        return false;
+    }
+
+    uint64_t max_ts = 0;
+    for (size_t k=0; k<cap->num_blocks; k++) {
+        uint32_t count = (k < full) ? CANDLE_CAPTURE_BLOCK_FRAMES : last_count;
+        const candle_capture_footer_t *footer = (const candle_capture_footer_t *)(candle_capture_block_records(cap, k) + count);
+        if (!candle_capture_valid_footer(footer, count)) {
+            cap->last_error = CANDLE_ERR_CAPTURE_FORMAT;
+            return false;
+        }
+        cap->footers[k] = footer;
+        cap->num_frames += count;
+        if (footer->last_us > max_ts) {
+            max_ts = footer->last_us;
+        }
+        cap->max_before[k] = max_ts;
+    }
+
+    uint64_t min_ts = UINT64_MAX;
+    for (size_t k=cap->num_blocks; k-- > 0; ) {
+        if (cap->footers[k]->first_us < min_ts) {
+            min_ts = cap->footers[k]->first_us;
+        }
+        cap->min_after[k] = min_ts;
+    }
+    return true;
+}
+
+bool candle_capture_finish(candle_capture_t *cap)
+{
+    bool rc = true;
+
+    if (cap->file != NULL) {
+        if (cap->footer.count > 0) {
+            rc = candle_capture_write_block(cap);
+        }
+        if (fclose(cap->file) != 0) {
+            rc = false;
+        }
+        cap->file = NULL;
+    }
+    free(cap->records);
+    cap->records = NULL;
+
+    candle_file_unmap(&cap->map);
+    free(cap->footers);
+    free(cap->max_before);
+    free(cap->min_after);
+    cap->footers = NULL;
+    cap->max_before = NULL;
+    cap->min_after = NULL;
+    return rc;
+}
+
+bool candle_capture_find_block(candle_capture_t *cap, uint64_t from_us, uint64_t to_us, const uint32_t *ids, size_t num_ids, uint64_t *cursor, const candle_capture_record_t **records, uint32_t *count)
+{
+    /* blocks before lo end before from_us */
+    size_t lo = 0, hi = cap->num_blocks;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cap->max_before[mid] < from_us) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    size_t first = lo;
+
+    /* blocks from end on start after to_us */
+    lo = first;
+    hi = cap->num_blocks;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cap->min_after[mid] <= to_us) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    size_t end = lo;
+
+    for (size_t k=(*cursor > first) ? (size_t)*cursor : first; k<end; k++) {
+        const candle_capture_footer_t *footer = cap->footers[k];
+        if ( (footer->first_us <= to_us) && (footer->last_us >= from_us)
+          && candle_capture_may_have_id(footer, ids, num_ids) ) {
+            *records = candle_capture_block_records(cap, k);
+            *count = footer->count;
+            *cursor = k + 1;
+            return true;
+        }
+    }
+
+    *cursor = cap->num_blocks;
+    cap->last_error = CANDLE_ERR_CAPTURE_END;
+    return false;
+}
+
+/* appends frames with their 64-bit timestamps from the records */
+static bool candle_capture_flush(candle_capture_t *cap, candle_frame_batch_t *batch, const candle_frame_t *frames, const uint64_t *timestamps, size_t n)
+{
+    if (n == 0) {
+        return true;
+    }
+    if (!candle_frame_batch_append(batch, frames, n)) {
+        cap->last_error = CANDLE_ERR_MALLOC;
+        return false;
+    }
+    memcpy(&batch->timestamp64_us[batch->count - n], timestamps, n * sizeof(uint64_t));
+    return true;
+}
+
+bool candle_capture_select(candle_capture_t *cap, uint64_t from_us, uint64_t to_us, const uint32_t *ids, size_t num_ids, candle_frame_batch_t *batch, size_t *count)
+{
+    /* the 11-bit ids as a bitmap, the rest are compared one by one */
+    uint8_t std_ids[CANDLE_CAPTURE_STD_IDS / 8];
+    uint32_t *other = NULL;
+    size_t num_other = 0;
+
+    if (ids != NULL) {
+        memset(std_ids, 0, sizeof(std_ids));
+        other = malloc((num_ids + 1) * sizeof(uint32_t));
+        if (other == NULL) {
+            cap->last_error = CANDLE_ERR_MALLOC;
+            return false;
+        }
+        for (size_t i=0; i<num_ids; i++) {
+            if (ids[i] < CANDLE_CAPTURE_STD_IDS) {
+                candle_capture_set_bit(std_ids, ids[i]);
+            } else {
+                other[num_other++] = ids[i];
+            }
+        }
+    }
+
+    candle_frame_t frames[CANDLE_BATCH_READ_FRAMES];
+    uint64_t timestamps[CANDLE_BATCH_READ_FRAMES];
+    size_t n = 0;
+    bool rc = true;
+    uint64_t cursor = 0;
+    const candle_capture_record_t *records;
+    uint32_t num_records;
+    *count = 0;
+
+    while (candle_capture_find_block(cap, from_us, to_us, ids, num_ids, &cursor, &records, &num_records)) {
+        for (uint32_t i=0; i<num_records; i++) {
+            const candle_capture_record_t *r = &records[i];
+            if ( (r->timestamp_us < from_us) || (r->timestamp_us > to_us) ) {
+                continue;
+            }
+            if (ids != NULL) {
+                uint32_t id = r->frame.can_id;
+                bool match = false;
+                if (id < CANDLE_CAPTURE_STD_IDS) {
+                    match = candle_capture_get_bit(std_ids, id);
+                } else {
+                    for (size_t j=0; (j<num_other) && !match; j++) {
+                        match = (other[j] == id);
+                    }
+                }
+                if (!match) {
+                    continue;
+                }
+            }
+
+            timestamps[n] = r->timestamp_us;
+            memcpy(&frames[n++], &r->frame, sizeof(candle_frame_t));
+            if (n == CANDLE_BATCH_READ_FRAMES) {
+                if (!candle_capture_flush(cap, batch, frames, timestamps, n)) {
+                    rc = false;
+                    goto free_ids;
+                }
+                *count += n;
+                n = 0;
+            }
+        }
+    }
+
+    if (!candle_capture_flush(cap, batch, frames, timestamps, n)) {
+        rc = false;
+        goto free_ids;
+    }
+    *count += n;
+    cap->last_error = CANDLE_ERR_OK;
+
+free_ids:
+    free(other);
+    return rc;
+}
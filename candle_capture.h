@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "candle.h"
+#include "candle_os.h"
+
+/* File layout, all in host byte order:
+ *
+ *     header | records, footer | records, footer | ...
+ *
+ * Every block but the last holds CANDLE_CAPTURE_BLOCK_FRAMES records, so
+ * block k starts at a fixed offset and its footer is found without reading
+ * the blocks before it. The last block is followed by its footer directly.
+ */
+#define CANDLE_CAPTURE_MAGIC        "CANDLCAP"
+#define CANDLE_CAPTURE_BLOCK_MAGIC  "CANDLBLK"
+#define CANDLE_CAPTURE_VERSION      1
+#define CANDLE_CAPTURE_BLOCK_FRAMES 4096
+#define CANDLE_CAPTURE_STD_IDS      2048
+#define CANDLE_CAPTURE_BLOOM_BITS   2048
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t record_size;
+    uint32_t block_frames;
+    uint32_t footer_size;
+    uint8_t reserved[36];
+} candle_capture_header_t;
+
+/* Ids without flag bits (11-bit data frames, and overflow frames) are kept
+ * exactly in std_ids, all others as two bits of a bloom filter.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t count;         /* records in the block */
+    uint32_t reserved0;
+    uint64_t first_us;      /* lowest and highest timestamp in the block */
+    uint64_t last_us;
+    uint8_t reserved[32];
+    uint8_t std_ids[CANDLE_CAPTURE_STD_IDS / 8];
+    uint8_t ext_ids[CANDLE_CAPTURE_BLOOM_BITS / 8];
+} candle_capture_footer_t;
+
+typedef struct {
+    candle_err_t last_error;
+    bool writing;
+
+    /* writer */
+    FILE *file;
+    candle_capture_record_t *records;   /* of the block being filled */
+    candle_capture_footer_t footer;
+    uint64_t last_us;       /* of the previous frame, to extend timestamps without a device */
+    bool have_last;
+
+    /* reader */
+    candle_file_map_t map;
+    size_t num_blocks;
+    uint64_t num_frames;
+    const candle_capture_footer_t **footers;
+    /* max_before[k]: highest last_us of blocks 0..k, min_after[k]: lowest
+       first_us of blocks k..end; both are sorted, so the blocks a time
+       range can be in are found by binary search even if the file is not
+       in time order */
+    uint64_t *max_before;
+    uint64_t *min_after;
+} candle_capture_t;
+
+bool candle_capture_create_file(candle_capture_t *cap, const char *path);
+bool candle_capture_append(candle_capture_t *cap, candle_handle hdev, const candle_frame_t *frames, size_t num_frames);
+bool candle_capture_open_file(candle_capture_t *cap, const char *path);
+/* writes the last block of a writer; frees everything either way */
+bool candle_capture_finish(candle_capture_t *cap);
+
+bool candle_capture_find_block(candle_capture_t *cap, uint64_t from_us, uint64_t to_us, const uint32_t *ids, size_t num_ids, uint64_t *cursor, const candle_capture_record_t **records, uint32_t *count);
+bool candle_capture_select(candle_capture_t *cap, uint64_t from_us, uint64_t to_us, const uint32_t *ids, size_t num_ids, candle_frame_batch_t *batch, size_t *count);
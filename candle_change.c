@@ -0,0 +1,164 @@
+#include "candle_change.h"
+#include "candle_defs.h"
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t candle_change_hash(uint8_t channel, uint32_t can_id, uint32_t bits)
+{
+    return ((can_id ^ ((uint32_t)channel << 24)) * 0x9E3779B1u) >> (32 - bits);
+}
+
+static candle_change_slot_t *candle_change_find(candle_change_table_t *t, uint8_t channel, uint32_t can_id)
+{
+    uint32_t mask = (1u << t->bits) - 1;
+    uint32_t k = candle_change_hash(channel, can_id, t->bits);
+
+    for (;;) {
+        candle_change_slot_t *s = &t->slots[k];
+        if (!s->used || ((s->can_id == can_id) && (s->channel == channel))) {
+            return s;
+        }
+        k = (k + 1) & mask;
+    }
+}
+
+static bool candle_change_grow(candle_change_table_t *t)
+{
+    if (t->bits >= CANDLE_CHANGE_MAX_BITS) {
+        return false;
+    }
+
+    candle_change_table_t bigger = *t;
+    bigger.bits = t->bits + 1;
+    bigger.slots = calloc(1u << bigger.bits, sizeof(candle_change_slot_t));
+    if (bigger.slots == NULL) {
+        return false;
+    }
+
+    for (uint32_t i=0; i<(1u << t->bits); i++) {
+        if (t->slots[i].used) {
+            *candle_change_find(&bigger, t->slots[i].channel, t->slots[i].can_id) = t->slots[i];
+        }
+    }
+
+    free(t->slots);
+    *t = bigger;
+    return true;
+}
+
+/* the slot of (channel, can_id), added if new; NULL once the table is full */
+static candle_change_slot_t *candle_change_lookup(candle_change_table_t *t, uint8_t channel, uint32_t can_id)
+{
+    candle_change_slot_t *s = candle_change_find(t, channel, can_id);
+    if (s->used) {
+        return s;
+    }
+
+    if (2 * (t->count + 1) > (1u << t->bits)) {
+        if (!candle_change_grow(t)) {
+            return NULL;
+        }
+        s = candle_change_find(t, channel, can_id);
+    }
+
+    memset(s, 0, sizeof(*s));
+    s->used = 1;
+    s->channel = channel;
+    s->can_id = can_id;
+    s->heartbeat_us = t->heartbeat_us;
+    t->count++;
+    return s;
+}
+
+candle_change_table_t *candle_change_create(uint32_t heartbeat_ms)
+{
+    candle_change_table_t *t = calloc(1, sizeof(candle_change_table_t));
+    if (t == NULL) {
+        return NULL;
+    }
+
+    t->bits = CANDLE_CHANGE_MIN_BITS;
+    t->slots = calloc(1u << t->bits, sizeof(candle_change_slot_t));
+    if (t->slots == NULL) {
+        free(t);
+        return NULL;
+    }
+    t->heartbeat_us = heartbeat_ms * 1000;
+    return t;
+}
+
+void candle_change_free(candle_change_table_t *t)
+{
+    if (t != NULL) {
+        free(t->slots);
+        free(t);
+    }
+}
+
+bool candle_change_set_heartbeat(candle_change_table_t *t, uint8_t channel, uint32_t can_id, uint32_t heartbeat_ms)
+{
+    candle_change_slot_t *s = candle_change_lookup(t, channel, can_id & ~0x20000000u);
+    if (s == NULL) {
+        return false;
+    }
+    s->heartbeat_us = heartbeat_ms * 1000;
+    return true;
+}
+
+/* true if the frame is to be delivered, and then remembers its payload */
+static bool candle_change_pass(candle_change_table_t *t, const candle_frame_t *frame)
+{
+    candle_change_slot_t *s = candle_change_lookup(t, frame->channel, frame->can_id);
+    if (s == NULL) {
+        return true;
+    }
+
+    uint64_t a, b;
+    memcpy(&a, frame->data, sizeof(a));
+    memcpy(&b, s->data, sizeof(b));
+
+    if ( s->seen && (s->dlc == frame->can_dlc) && (a == b)
+      && ((s->heartbeat_us == 0) || (frame->timestamp_us - s->last_us < s->heartbeat_us)) ) {
+        return false;
+    }
+
+    s->seen = 1;
+    s->dlc = frame->can_dlc;
+    memcpy(s->data, frame->data, sizeof(s->data));
+    s->last_us = frame->timestamp_us;
+    return true;
+}
+
+uint32_t candle_change_apply(candle_change_table_t *t, candle_frame_t *frames, uint32_t num_frames, uint32_t *mark, uint32_t *passed)
+{
+    uint32_t kept = 0;
+    uint32_t before_mark = 0;
+    *passed = 0;
+
+    for (uint32_t i=0; i<num_frames; i++) {
+        if ( (mark != NULL) && (i == *mark) ) {
+            before_mark = kept;
+        }
+
+        const candle_frame_t *f = &frames[i];
+        bool received = (f->echo_id == 0xFFFFFFFF)
+                     && !(f->flags & CANDLE_FRAME_FLAG_TIMESTAMP_OVFL)
+                     && !(f->can_id & 0x20000000);
+        if (received) {
+            if (!candle_change_pass(t, f)) {
+                continue;
+            }
+            (*passed)++;
+        }
+
+        if (kept != i) {
+            memcpy(&frames[kept], &frames[i], sizeof(candle_frame_t));
+        }
+        kept++;
+    }
+
+    if (mark != NULL) {
+        *mark = (*mark < num_frames) ? before_mark : kept;
+    }
+    return kept;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "candle.h"
+
+#define CANDLE_CHANGE_MIN_BITS 8               /* 256 slots to start with */
+#define CANDLE_CHANGE_MAX_BITS 16              /* ids beyond half of this many slots always pass */
+#define CANDLE_CHANGE_HEARTBEAT_MS_MAX 2147483 /* half the device counter period */
+
+/* 24 bytes, so a probe usually stays within one cache line */
+typedef struct {
+    uint32_t can_id;        /* without the error flag */
+    uint8_t channel;
+    uint8_t used;
+    uint8_t seen;           /* dlc/data/last_us hold the last frame passed */
+    uint8_t dlc;
+    uint32_t heartbeat_us;  /* 0: unchanged frames never pass */
+    uint32_t last_us;
+    uint8_t data[8];
+} candle_change_slot_t;
+
+/* Deliver-on-change state, owned by the receive path: the last payload
+ * passed for each (channel, id), in an open addressing table with linear
+ * probing that doubles while it is more than half full.
+ */
+typedef struct {
+    candle_change_slot_t *slots;
+    uint32_t bits;
+    uint32_t count;
+    uint32_t heartbeat_us;  /* for ids without their own */
+} candle_change_table_t;
+
+candle_change_table_t *candle_change_create(uint32_t heartbeat_ms);
+void candle_change_free(candle_change_table_t *t);
+/* give one id a heartbeat of its own; before the table is in use */
+bool candle_change_set_heartbeat(candle_change_table_t *t, uint8_t channel, uint32_t can_id, uint32_t heartbeat_ms);
+
+/* drop received frames that repeat the last payload passed for their id
+   and are within its heartbeat; other frames are not looked at. mark is as
+   for candle_filter_apply(), *passed counts the received frames kept.
+   Returns the number of frames kept. */
+uint32_t candle_change_apply(candle_change_table_t *t, candle_frame_t *frames, uint32_t num_frames, uint32_t *mark, uint32_t *passed);
@@ -0,0 +1,126 @@
+#include "candle_clock.h"
+#include <string.h>
+
+/* round trips this much slower than twice the best recent one are dropped */
+#define CANDLE_CLOCK_RTT_SLACK_NS 250000ull
+
+void candle_clock_init(candle_clock_t *clock)
+{
+    memset(clock, 0, sizeof(*clock));
+    candle_mutex_init(&clock->lock);
+    candle_cond_init(&clock->cond);
+}
+
+void candle_clock_free(candle_clock_t *clock)
+{
+    candle_cond_destroy(&clock->cond);
+    candle_mutex_destroy(&clock->lock);
+}
+
+/* fit relative to the newest sample, so the sums stay small */
+static void candle_clock_fit(candle_clock_t *clock)
+{
+    uint32_t newest = (clock->head + clock->count - 1) % CANDLE_CLOCK_WINDOW;
+    clock->dev_ref = clock->dev_us[newest];
+    clock->host_ref = clock->host_ns[newest];
+
+    double mx = 0, my = 0;
+    for (uint32_t i=0; i<clock->count; i++) {
+        uint32_t k = (clock->head + i) % CANDLE_CLOCK_WINDOW;
+        mx += (double)(int32_t)(clock->dev_us[k] - clock->dev_ref);
+        my += (double)(int64_t)(clock->host_ns[k] - clock->host_ref);
+    }
+    mx /= clock->count;
+    my /= clock->count;
+
+    double sxx = 0, sxy = 0;
+    for (uint32_t i=0; i<clock->count; i++) {
+        uint32_t k = (clock->head + i) % CANDLE_CLOCK_WINDOW;
+        double dx = (double)(int32_t)(clock->dev_us[k] - clock->dev_ref) - mx;
+        double dy = (double)(int64_t)(clock->host_ns[k] - clock->host_ref) - my;
+        sxx += dx * dx;
+        sxy += dx * dy;
+    }
+
+    /* a single sample only gives the offset, assume a perfect crystal */
+    clock->slope = (sxx > 0) ? (sxy / sxx) : 1000.0;
+    clock->offset_ns = my - clock->slope * mx;
+    clock->valid = true;
+}
+
+bool candle_clock_add_sample(candle_clock_t *clock, uint32_t dev_us, uint64_t host_ns, uint64_t rtt_ns)
+{
+    candle_mutex_lock(&clock->lock);
+
+    clock->rtt_ns[clock->rtt_next] = rtt_ns;
+    clock->rtt_next = (clock->rtt_next + 1) % CANDLE_CLOCK_WINDOW;
+    if (clock->rtt_count < CANDLE_CLOCK_WINDOW) {
+        clock->rtt_count++;
+    }
+
+    uint64_t min_rtt_ns = rtt_ns;
+    for (uint32_t i=0; i<clock->rtt_count; i++) {
+        if (clock->rtt_ns[i] < min_rtt_ns) {
+            min_rtt_ns = clock->rtt_ns[i];
+        }
+    }
+    if (rtt_ns > 2 * min_rtt_ns + CANDLE_CLOCK_RTT_SLACK_NS) {
+        candle_mutex_unlock(&clock->lock);
+        return false;
+    }
+
+    if (clock->count > 0) {
+        uint32_t newest = (clock->head + clock->count - 1) % CANDLE_CLOCK_WINDOW;
+        if ((int32_t)(dev_us - clock->dev_us[newest]) <= 0) {
+            /* the device counter went backwards, e.g. after a firmware reset */
+            clock->count = 0;
+        }
+    }
+
+    if (clock->count == CANDLE_CLOCK_WINDOW) {
+        clock->head = (clock->head + 1) % CANDLE_CLOCK_WINDOW;
+        clock->count--;
+    }
+    uint32_t k = (clock->head + clock->count) % CANDLE_CLOCK_WINDOW;
+    clock->dev_us[k] = dev_us;
+    clock->host_ns[k] = host_ns;
+    clock->count++;
+
+    candle_clock_fit(clock);
+
+    candle_mutex_unlock(&clock->lock);
+    return true;
+}
+
+bool candle_clock_host_ns(candle_clock_t *clock, uint32_t dev_us, uint64_t *host_ns)
+{
+    candle_mutex_lock(&clock->lock);
+
+    bool rc = clock->valid;
+    if (rc) {
+        double x = (double)(int32_t)(dev_us - clock->dev_ref);
+        *host_ns = clock->host_ref + (int64_t)(clock->offset_ns + clock->slope * x);
+    }
+
+    candle_mutex_unlock(&clock->lock);
+    return rc;
+}
+
+bool candle_clock_wait(candle_clock_t *clock, uint32_t ms)
+{
+    candle_mutex_lock(&clock->lock);
+    if (!clock->stop) {
+        candle_cond_wait(&clock->cond, &clock->lock, ms);
+    }
+    bool rc = !clock->stop;
+    candle_mutex_unlock(&clock->lock);
+    return rc;
+}
+
+void candle_clock_stop(candle_clock_t *clock)
+{
+    candle_mutex_lock(&clock->lock);
+    clock->stop = true;
+    candle_cond_broadcast(&clock->cond);
+    candle_mutex_unlock(&clock->lock);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "candle_os.h"
+
+#define CANDLE_CLOCK_WINDOW 32
+
+/* Relates the device's 32-bit microsecond counter to the host monotonic
+ * clock. Samples are kept in a sliding window and host time is estimated by
+ * a least-squares line through it, which follows both the offset and the
+ * drift of the adapter crystal.
+ */
+typedef struct {
+    candle_mutex_t lock;
+    candle_cond_t cond;
+    bool stop;
+
+    /* samples, oldest at head */
+    uint32_t dev_us[CANDLE_CLOCK_WINDOW];
+    uint64_t host_ns[CANDLE_CLOCK_WINDOW];
+    uint32_t head;
+    uint32_t count;
+
+    /* round trips of the last CANDLE_CLOCK_WINDOW samples offered, kept or
+       not, so the best one follows a bus that got slower for good */
+    uint64_t rtt_ns[CANDLE_CLOCK_WINDOW];
+    uint32_t rtt_next;
+    uint32_t rtt_count;
+
+    /* host_ns = host_ref + offset_ns + slope * (int32_t)(dev_us - dev_ref) */
+    bool valid;
+    uint32_t dev_ref;
+    uint64_t host_ref;
+    double offset_ns;
+    double slope;           /* host ns per device us */
+} candle_clock_t;
+
+void candle_clock_init(candle_clock_t *clock);
+void candle_clock_free(candle_clock_t *clock);
+
+/* host_ns is the midpoint of a request that took rtt_ns; returns false if
+   the sample was dropped for a slow round trip */
+bool candle_clock_add_sample(candle_clock_t *clock, uint32_t dev_us, uint64_t host_ns, uint64_t rtt_ns);
+/* valid for device times within ~35 minutes of the newest sample */
+bool candle_clock_host_ns(candle_clock_t *clock, uint32_t dev_us, uint64_t *host_ns);
+
+/* sampling thread side: sleeps ms, returns false once candle_clock_stop() was called */
+bool candle_clock_wait(candle_clock_t *clock, uint32_t ms);
+void candle_clock_stop(candle_clock_t *clock);
@@ -1,4 +1,6 @@
 #include "candle_ctrl_req.h"
+#include "candle_transport.h"
+#include "candle_os.h"
 #include "ch_9.h"
 
 enum {
@@ -13,19 +15,31 @@ enum {
 };
 
 
-static bool usb_control_msg(WINUSB_INTERFACE_HANDLE hnd, uint8_t request, uint8_t requesttype, uint16_t value, uint16_t index, void *data, uint16_t size)
+static bool usb_control_msg(candle_device_t *dev, uint8_t request, uint8_t requesttype, uint16_t value, uint16_t index, void *data, uint16_t size)
 {
-    WINUSB_SETUP_PACKET packet;
-    memset(&packet, 0, sizeof(packet));
-
-    packet.Request = request;
-    packet.RequestType = requesttype;
-    packet.Value = value;
-    packet.Index = index;
-    packet.Length = size;
+    if (candle_atomic_load(&dev->gone)) {
+        dev->last_error = CANDLE_ERR_DEVICE_GONE;
+        return false;
+    }
+    if (dev->transport->control(dev, request, requesttype, value, index, data, size)) {
+        return true;
+    }
+    /* once unplugged every further transfer fails the same way */
+    if (dev->last_error == CANDLE_ERR_DEVICE_GONE) {
+        candle_atomic_store(&dev->gone, 1);
+    }
+    return false;
+}
 
-    unsigned long bytes_sent = 0;
-    return WinUsb_ControlTransfer(hnd, packet, (uint8_t*)data, size, &bytes_sent, 0);
+/* an unplugged device is reported as such rather than by the request that failed */
+static bool candle_ctrl_result(candle_device_t *dev, bool rc, candle_err_t err)
+{
+    if (rc) {
+        dev->last_error = CANDLE_ERR_OK;
+    } else if (!candle_atomic_load(&dev->gone)) {
+        dev->last_error = err;
+    }
+    return rc;
 }
 
 bool candle_ctrl_set_host_format(candle_device_t *dev)
@@ -34,7 +48,7 @@ bool candle_ctrl_set_host_format(candle_device_t *dev)
     hconf.byte_order = 0x0000beef;
 
     bool rc = usb_control_msg(
-        dev->winUSBHandle,
+        dev,
         CANDLE_BREQ_HOST_FORMAT,
         USB_DIR_OUT|USB_TYPE_VENDOR|USB_RECIP_INTERFACE,
         1,
@@ -43,8 +57,7 @@ bool candle_ctrl_set_host_format(candle_device_t *dev)
         sizeof(hconf)
     );
 
-    dev->last_error = rc ? CANDLE_ERR_OK : CANDLE_ERR_SET_HOST_FORMAT;
-    return rc;
+    return candle_ctrl_result(dev, rc, CANDLE_ERR_SET_HOST_FORMAT);
 }
 
 bool candle_ctrl_set_timestamp_mode(candle_device_t *dev, bool enable_timestamps)
@@ -52,7 +65,7 @@ bool candle_ctrl_set_timestamp_mode(candle_device_t *dev, bool enable_timestamps
     uint32_t ts_config = enable_timestamps ? 1 : 0;
 
     bool rc = usb_control_msg(
-        dev->winUSBHandle,
+        dev,
         CANDLE_TIMESTAMP_ENABLE,
         USB_DIR_OUT|USB_TYPE_VENDOR|USB_RECIP_INTERFACE,
         1,
@@ -61,8 +74,7 @@ bool candle_ctrl_set_timestamp_mode(candle_device_t *dev, bool enable_timestamps
         0
     );
 
-    dev->last_error = rc ? CANDLE_ERR_OK : CANDLE_ERR_SET_TIMESTAMP_MODE;
-    return rc;
+    return candle_ctrl_result(dev, rc, CANDLE_ERR_SET_TIMESTAMP_MODE);
 }
 
 bool candle_ctrl_set_device_mode(candle_device_t *dev, uint8_t channel, uint32_t mode, uint32_t flags)
@@ -72,7 +84,7 @@ bool candle_ctrl_set_device_mode(candle_device_t *dev, uint8_t channel, uint32_t
     dm.flags = flags;
 
     bool rc = usb_control_msg(
-        dev->winUSBHandle,
+        dev,
         CANDLE_BREQ_MODE,
         USB_DIR_OUT|USB_TYPE_VENDOR|USB_RECIP_INTERFACE,
         channel,
@@ -81,15 +93,14 @@ bool candle_ctrl_set_device_mode(candle_device_t *dev, uint8_t channel, uint32_t
         sizeof(dm)
     );
 
-    dev->last_error = rc ? CANDLE_ERR_OK : CANDLE_ERR_SET_DEVICE_MODE;
-    return rc;
+    return candle_ctrl_result(dev, rc, CANDLE_ERR_SET_DEVICE_MODE);
 }
 
 
 bool candle_ctrl_get_config(candle_device_t *dev, candle_device_config_t *dconf)
 {
     bool rc = usb_control_msg(
-        dev->winUSBHandle,
+        dev,
         CANDLE_BREQ_DEVICE_CONFIG,
         USB_DIR_IN|USB_TYPE_VENDOR|USB_RECIP_INTERFACE,
         1,
@@ -98,14 +109,13 @@ bool candle_ctrl_get_config(candle_device_t *dev, candle_device_config_t *dconf)
         sizeof(*dconf)
     );
 
-    dev->last_error = rc ? CANDLE_ERR_OK : CANDLE_ERR_GET_DEVICE_INFO;
-    return rc;
+    return candle_ctrl_result(dev, rc, CANDLE_ERR_GET_DEVICE_INFO);
 }
 
 bool candle_ctrl_get_capability(candle_device_t *dev, uint8_t channel, candle_capability_t *data)
 {
     bool rc = usb_control_msg(
-        dev->winUSBHandle,
+        dev,
         CANDLE_BREQ_BT_CONST,
         USB_DIR_IN|USB_TYPE_VENDOR|USB_RECIP_INTERFACE,
         channel,
@@ -114,14 +124,13 @@ bool candle_ctrl_get_capability(candle_device_t *dev, uint8_t channel, candle_ca
         sizeof(*data)
     );
 
-    dev->last_error = rc ? CANDLE_ERR_OK : CANDLE_ERR_GET_BITTIMING_CONST;
-    return rc;
+    return candle_ctrl_result(dev, rc, CANDLE_ERR_GET_BITTIMING_CONST);
 }
 
 bool candle_ctrl_set_bittiming(candle_device_t *dev, uint8_t channel, candle_bittiming_t *data)
 {
     bool rc = usb_control_msg(
-        dev->winUSBHandle,
+        dev,
         CANDLE_BREQ_BITTIMING,
         USB_DIR_OUT|USB_TYPE_VENDOR|USB_RECIP_INTERFACE,
         channel,
@@ -130,6 +139,20 @@ bool candle_ctrl_set_bittiming(candle_device_t *dev, uint8_t channel, candle_bit
         sizeof(*data)
     );
 
-    dev->last_error = rc ? CANDLE_ERR_OK : CANDLE_ERR_SET_BITTIMING;
-    return rc;
+    return candle_ctrl_result(dev, rc, CANDLE_ERR_SET_BITTIMING);
+}
+
+/* called from the clock sampling thread, so it leaves dev->last_error alone
+   unless the device is gone */
+bool candle_ctrl_get_timestamp(candle_device_t *dev, uint32_t *ts_us)
+{
+    return usb_control_msg(
+        dev,
+        CANDLE_TIMESTAMP_GET,
+        USB_DIR_IN|USB_TYPE_VENDOR|USB_RECIP_INTERFACE,
+        0,
+        dev->interfaceNumber,
+        ts_us,
+        sizeof(*ts_us)
+    );
 }
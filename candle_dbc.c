@@ -0,0 +1,538 @@
+#include "candle_dbc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static void candle_dbc_skip_ws(char **s)
+{
+    while ((**s == ' ') || (**s == '\t')) {
+        (*s)++;
+    }
+}
+
+static bool candle_dbc_keyword(char **s, const char *kw)
+{
+    size_t n = strlen(kw);
+    if ( (strncmp(*s, kw, n) != 0) || (((*s)[n] != ' ') && ((*s)[n] != '\t')) ) {
+        return false;
+    }
+    *s += n;
+    return true;
+}
+
+static bool candle_dbc_expect(char **s, char c)
+{
+    candle_dbc_skip_ws(s);
+    if (**s != c) {
+        return false;
+    }
+    (*s)++;
+    return true;
+}
+
+static bool candle_dbc_uint(char **s, uint32_t *v)
+{
+    candle_dbc_skip_ws(s);
+    if ((**s < '0') || (**s > '9')) {
+        return false;
+    }
+
+    char *end;
+    unsigned long u = strtoul(*s, &end, 10);
+    if (u > 0xFFFFFFFFul) {
+        return false;
+    }
+    *v = (uint32_t)u;
+    *s = end;
+    return true;
+}
+
+static bool candle_dbc_double(char **s, double *v)
+{
+    candle_dbc_skip_ws(s);
+    char *end;
+    *v = strtod(*s, &end);
+    if (end == *s) {
+        return false;
+    }
+    *s = end;
+    return true;
+}
+
+/* copy of the span [start, end), NULL if out of memory */
+static char *candle_dbc_strdup(candle_dbc_t *dbc, const char *start, const char *end)
+{
+    char *str = malloc(end - start + 1);
+    if (str == NULL) {
+        dbc->last_error = CANDLE_ERR_MALLOC;
+        return NULL;
+    }
+    memcpy(str, start, end - start);
+    str[end - start] = '\0';
+    return str;
+}
+
+static bool candle_dbc_ident(candle_dbc_t *dbc, char **s, char **name)
+{
+    candle_dbc_skip_ws(s);
+    char *start = *s;
+    while ( ((**s >= 'a') && (**s <= 'z')) || ((**s >= 'A') && (**s <= 'Z'))
+         || ((**s >= '0') && (**s <= '9')) || (**s == '_') ) {
+        (*s)++;
+    }
+    if (*s == start) {
+        return false;
+    }
+    *name = candle_dbc_strdup(dbc, start, *s);
+    return *name != NULL;
+}
+
+static bool candle_dbc_string(candle_dbc_t *dbc, char **s, char **str)
+{
+    if (!candle_dbc_expect(s, '"')) {
+        return false;
+    }
+    char *start = *s;
+    char *end = strchr(start, '"');
+    if (end == NULL) {
+        return false;
+    }
+    *s = end + 1;
+    *str = candle_dbc_strdup(dbc, start, end);
+    return *str != NULL;
+}
+
+/* BO_ <id> <name>: <dlc> <transmitter> */
+static bool candle_dbc_parse_message(candle_dbc_t *dbc, char *s, uint32_t line, candle_dbc_msg_t **cur)
+{
+    uint32_t id, dlc;
+    char *name = NULL;
+
+    *cur = NULL;
+    if (!candle_dbc_uint(&s, &id)) {
+        return false;
+    }
+
+    bool extended = (id & 0x80000000) != 0;
+    id &= 0x7FFFFFFF;
+    if (id > 0x1FFFFFFF) {
+        /* pseudo messages such as VECTOR__INDEPENDENT_SIG_MSG, skipped with their signals */
+        return true;
+    }
+    if (!extended && (id >= CANDLE_DBC_STD_IDS)) {
+        return false;
+    }
+
+    if (!candle_dbc_ident(dbc, &s, &name) || !candle_dbc_expect(&s, ':') || !candle_dbc_uint(&s, &dlc)) {
+        free(name);
+        return false;
+    }
+
+    if (dbc->num_msgs == dbc->capacity) {
+        uint32_t capacity = (dbc->capacity == 0) ? 64 : 2 * dbc->capacity;
+        if (capacity > CANDLE_DBC_MAX_MESSAGES) {
+            capacity = CANDLE_DBC_MAX_MESSAGES;
+        }
+        candle_dbc_msg_t *msgs = NULL;
+        if (capacity > dbc->capacity) {
+            msgs = realloc(dbc->msgs, capacity * sizeof(candle_dbc_msg_t));
+            if (msgs == NULL) {
+                dbc->last_error = CANDLE_ERR_MALLOC;
+            }
+        }
+        if (msgs == NULL) {
+            free(name);
+            return false;
+        }
+        dbc->msgs = msgs;
+        dbc->capacity = capacity;
+    }
+
+    candle_dbc_msg_t *m = &dbc->msgs[dbc->num_msgs++];
+    memset(m, 0, sizeof(*m));
+    m->info.can_id = extended ? (id | 0x80000000) : id;
+    m->info.name = name;
+    m->info.dlc = (dlc > 0xFF) ? 0xFF : (uint8_t)dlc;
+    m->mux_index = -1;
+    m->line = line;
+    *cur = m;
+    return true;
+}
+
+static void candle_dbc_compile_signal(const candle_dbc_signal_t *sig, candle_dbc_plan_t *p)
+{
+    memset(p, 0, sizeof(*p));
+    p->factor = sig->factor;
+    p->offset = sig->offset;
+    p->mux = (sig->mux >= 0) ? sig->mux : -1;
+    p->min_dlc = 0xFF;
+
+    uint32_t shift = 64;
+    if (sig->motorola) {
+        /* start is the msb, numbered within its byte; bytes count down in the big endian word */
+        if (sig->start_bit < 64) {
+            uint32_t msb = (7 - sig->start_bit / 8) * 8 + sig->start_bit % 8;
+            if (msb + 1 >= sig->length) {
+                shift = msb + 1 - sig->length;
+                p->min_dlc = 8 - shift / 8;
+            }
+        }
+        p->order = 1;
+    } else if (sig->start_bit + sig->length <= 64) {
+        shift = sig->start_bit;
+        p->min_dlc = (sig->start_bit + sig->length - 1) / 8 + 1;
+    }
+
+    if (shift < 64) {
+        /* otherwise the signal lies past the 8 data bytes of a classic frame and is never present */
+        p->shift = shift;
+        p->mask = (sig->length == 64) ? ~(uint64_t)0 : (((uint64_t)1 << sig->length) - 1);
+        p->sign = sig->is_signed ? ((uint64_t)1 << (sig->length - 1)) : 0;
+    }
+}
+
+/* SG_ <name> [M|m<n>] : <start>|<length>@<order><sign> (<factor>,<offset>) [<min>|<max>] "<unit>" <receivers> */
+static bool candle_dbc_parse_signal(candle_dbc_t *dbc, candle_dbc_msg_t *m, char *s)
+{
+    candle_dbc_signal_t sig;
+    memset(&sig, 0, sizeof(sig));
+    sig.mux = -1;
+
+    char *name = NULL;
+    char *unit = NULL;
+    if (!candle_dbc_ident(dbc, &s, &name)) {
+        goto fail;
+    }
+
+    candle_dbc_skip_ws(&s);
+    if (*s == 'M') {
+        sig.mux = CANDLE_DBC_MUX_SWITCH;
+        s++;
+    } else if (*s == 'm') {
+        uint32_t value;
+        s++;
+        if (!candle_dbc_uint(&s, &value) || (value > 0x7FFFFFFF)) {
+            goto fail;
+        }
+        sig.mux = (int32_t)value;
+        if (*s == 'M') {
+            /* nested multiplexing: only the value of the top-level switch is checked */
+            s++;
+        }
+    }
+
+    uint32_t start, length;
+    if ( !candle_dbc_expect(&s, ':') || !candle_dbc_uint(&s, &start)
+      || !candle_dbc_expect(&s, '|') || !candle_dbc_uint(&s, &length)
+      || !candle_dbc_expect(&s, '@') ) {
+        goto fail;
+    }
+    if ( ((s[0] != '0') && (s[0] != '1')) || ((s[1] != '+') && (s[1] != '-')) ) {
+        goto fail;
+    }
+    sig.motorola = (s[0] == '0');
+    sig.is_signed = (s[1] == '-');
+    s += 2;
+
+    if ( !candle_dbc_expect(&s, '(') || !candle_dbc_double(&s, &sig.factor)
+      || !candle_dbc_expect(&s, ',') || !candle_dbc_double(&s, &sig.offset)
+      || !candle_dbc_expect(&s, ')') || !candle_dbc_expect(&s, '[')
+      || !candle_dbc_double(&s, &sig.min) || !candle_dbc_expect(&s, '|')
+      || !candle_dbc_double(&s, &sig.max) || !candle_dbc_expect(&s, ']')
+      || !candle_dbc_string(dbc, &s, &unit) ) {
+        goto fail;
+    }
+    if ((length == 0) || (length > 64)) {
+        goto fail;
+    }
+    sig.start_bit = start;
+    sig.length = length;
+
+    if (m == NULL) {
+        /* signal of a skipped pseudo message */
+        free(name);
+        free(unit);
+        return true;
+    }
+
+    if (m->info.num_signals == m->capacity) {
+        uint32_t capacity = (m->capacity == 0) ? 8 : 2 * m->capacity;
+        candle_dbc_signal_t *signals = realloc((void *)m->info.signals, capacity * sizeof(candle_dbc_signal_t));
+        if (signals == NULL) {
+            dbc->last_error = CANDLE_ERR_MALLOC;
+            goto fail;
+        }
+        m->info.signals = signals;
+        candle_dbc_plan_t *plans = realloc(m->plans, capacity * sizeof(candle_dbc_plan_t));
+        if (plans == NULL) {
+            dbc->last_error = CANDLE_ERR_MALLOC;
+            goto fail;
+        }
+        m->plans = plans;
+        m->capacity = capacity;
+    }
+
+    if (sig.mux == CANDLE_DBC_MUX_SWITCH) {
+        m->mux_index = (int32_t)m->info.num_signals;
+    }
+    sig.name = name;
+    sig.unit = unit;
+    candle_dbc_compile_signal(&sig, &m->plans[m->info.num_signals]);
+    ((candle_dbc_signal_t *)m->info.signals)[m->info.num_signals++] = sig;
+    return true;
+
+fail:
+    free(name);
+    free(unit);
+    return false;
+}
+
+static uint32_t candle_dbc_hash(uint32_t id, uint32_t bits)
+{
+    return (id * 0x9E3779B1u) >> (32 - bits);
+}
+
+/* fails on duplicate ids, blaming the second BO_ line */
+static bool candle_dbc_build_index(candle_dbc_t *dbc)
+{
+    memset(dbc->std_index, 0xFF, sizeof(dbc->std_index));
+
+    uint32_t num_ext = 0;
+    for (uint32_t i=0; i<dbc->num_msgs; i++) {
+        if (dbc->msgs[i].info.can_id & 0x80000000) {
+            num_ext++;
+        }
+    }
+
+    if (num_ext > 0) {
+        /* at most half full, so probe chains stay short */
+        uint32_t bits = 4;
+        while ((1u << bits) < 2 * num_ext) {
+            bits++;
+        }
+        dbc->ext_keys = malloc((1u << bits) * sizeof(uint32_t));
+        dbc->ext_index = malloc((1u << bits) * sizeof(uint16_t));
+        if ((dbc->ext_keys == NULL) || (dbc->ext_index == NULL)) {
+            dbc->last_error = CANDLE_ERR_MALLOC;
+            return false;
+        }
+        memset(dbc->ext_keys, 0xFF, (1u << bits) * sizeof(uint32_t));
+        dbc->ext_bits = bits;
+    }
+
+    for (uint32_t i=0; i<dbc->num_msgs; i++) {
+        uint32_t id = dbc->msgs[i].info.can_id & 0x1FFFFFFF;
+        uint16_t *slot;
+
+        if (dbc->msgs[i].info.can_id & 0x80000000) {
+            uint32_t mask = (1u << dbc->ext_bits) - 1;
+            uint32_t k = candle_dbc_hash(id, dbc->ext_bits);
+            while ( (dbc->ext_keys[k] != CANDLE_DBC_EXT_EMPTY) && (dbc->ext_keys[k] != id) ) {
+                k = (k + 1) & mask;
+            }
+            if (dbc->ext_keys[k] == id) {
+                goto duplicate;
+            }
+            dbc->ext_keys[k] = id;
+            slot = &dbc->ext_index[k];
+        } else {
+            if (dbc->std_index[id] != CANDLE_DBC_NO_MESSAGE) {
+                goto duplicate;
+            }
+            slot = &dbc->std_index[id];
+        }
+        *slot = (uint16_t)i;
+        continue;
+
+duplicate:
+        dbc->last_error = CANDLE_ERR_DBC_SYNTAX;
+        dbc->error_line = dbc->msgs[i].line;
+        return false;
+    }
+    return true;
+}
+
+bool candle_dbc_parse(candle_dbc_t *dbc, const char *text, size_t len)
+{
+    char *buf = NULL;
+    size_t buf_size = 0;
+    candle_dbc_msg_t *cur = NULL;
+    bool in_message = false;
+    uint32_t line = 0;
+    bool rc = true;
+
+    dbc->last_error = CANDLE_ERR_OK;
+    dbc->error_line = 0;
+
+    size_t pos = 0;
+    while (rc && (pos < len)) {
+        const char *nl = memchr(text + pos, '\n', len - pos);
+        size_t eol = (nl != NULL) ? (size_t)(nl - text) : len;
+        line++;
+
+        /* lines are parsed from a NUL-terminated copy */
+        if (eol - pos + 1 > buf_size) {
+            buf_size = 2 * (eol - pos + 1);
+            char *p = realloc(buf, buf_size);
+            if (p == NULL) {
+                dbc->last_error = CANDLE_ERR_MALLOC;
+                rc = false;
+                break;
+            }
+            buf = p;
+        }
+        memcpy(buf, text + pos, eol - pos);
+        buf[eol - pos] = '\0';
+        pos = eol + 1;
+
+        char *s = buf;
+        candle_dbc_skip_ws(&s);
+        if (candle_dbc_keyword(&s, "BO_")) {
+            in_message = true;
+            rc = candle_dbc_parse_message(dbc, s, line, &cur);
+        } else if (candle_dbc_keyword(&s, "SG_")) {
+            rc = in_message && candle_dbc_parse_signal(dbc, cur, s);
+        }
+        /* everything else (comments, attributes, value tables, ...) is not needed for decoding */
+    }
+    free(buf);
+
+    if (!rc) {
+        if (dbc->last_error == CANDLE_ERR_OK) {
+            dbc->last_error = CANDLE_ERR_DBC_SYNTAX;
+        }
+        dbc->error_line = line;
+        return false;
+    }
+    return candle_dbc_build_index(dbc);
+}
+
+bool candle_dbc_load_file(candle_dbc_t *dbc, const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        dbc->last_error = CANDLE_ERR_DBC_FILE;
+        return false;
+    }
+
+    char *text = NULL;
+    size_t len = 0;
+    size_t capacity = 0;
+    bool rc = true;
+
+    for (;;) {
+        if (len == capacity) {
+            capacity = (capacity == 0) ? 65536 : 2 * capacity;
+            char *p = realloc(text, capacity);
+            if (p == NULL) {
+                dbc->last_error = CANDLE_ERR_MALLOC;
+                rc = false;
+                break;
+            }
+            text = p;
+        }
+        size_t n = fread(text + len, 1, capacity - len, f);
+        len += n;
+        if (n == 0) {
+            if (ferror(f)) {
+                dbc->last_error = CANDLE_ERR_DBC_FILE;
+                rc = false;
+            }
+            break;
+        }
+    }
+    fclose(f);
+
+    if (rc) {
+        rc = candle_dbc_parse(dbc, text, len);
+    }
+    free(text);
+    return rc;
+}
+
+void candle_dbc_clear(candle_dbc_t *dbc)
+{
+    for (uint32_t i=0; i<dbc->num_msgs; i++) {
+        candle_dbc_msg_t *m = &dbc->msgs[i];
+        for (uint32_t k=0; k<m->info.num_signals; k++) {
+            free((void *)m->info.signals[k].name);
+            free((void *)m->info.signals[k].unit);
+        }
+        free((void *)m->info.signals);
+        free((void *)m->info.name);
+        free(m->plans);
+    }
+    free(dbc->msgs);
+    free(dbc->ext_keys);
+    free(dbc->ext_index);
+
+    dbc->msgs = NULL;
+    dbc->num_msgs = 0;
+    dbc->capacity = 0;
+    dbc->ext_keys = NULL;
+    dbc->ext_index = NULL;
+    dbc->ext_bits = 0;
+}
+
+const candle_dbc_msg_t *candle_dbc_lookup(const candle_dbc_t *dbc, uint32_t can_id)
+{
+    uint32_t id = can_id & 0x1FFFFFFF;
+
+    if (!(can_id & 0x80000000)) {
+        if (id >= CANDLE_DBC_STD_IDS) {
+            return NULL;
+        }
+        uint16_t k = dbc->std_index[id];
+        return (k == CANDLE_DBC_NO_MESSAGE) ? NULL : &dbc->msgs[k];
+    }
+
+    if (dbc->ext_keys == NULL) {
+        return NULL;
+    }
+    uint32_t mask = (1u << dbc->ext_bits) - 1;
+    uint32_t k = candle_dbc_hash(id, dbc->ext_bits);
+    while (dbc->ext_keys[k] != CANDLE_DBC_EXT_EMPTY) {
+        if (dbc->ext_keys[k] == id) {
+            return &dbc->msgs[dbc->ext_index[k]];
+        }
+        k = (k + 1) & mask;
+    }
+    return NULL;
+}
+
+/* data bytes in both byte orders, and the multiplexer value in effect (-1: none) */
+static inline int64_t candle_dbc_prepare(const candle_dbc_msg_t *m, const candle_frame_t *frame, uint64_t *words)
+{
+    uint64_t le = candle_dbc_load_le(frame->data);
+    words[0] = le;
+    words[1] = __builtin_bswap64(le);
+
+    if ( (m->mux_index < 0) || (frame->can_dlc < m->plans[m->mux_index].min_dlc) ) {
+        return -1;
+    }
+    return candle_dbc_raw_value(&m->plans[m->mux_index], words[m->plans[m->mux_index].order]);
+}
+
+void candle_dbc_decode_msg(const candle_dbc_msg_t *m, const candle_frame_t *frame, double *values)
+{
+    uint64_t words[2];
+    int64_t mux = candle_dbc_prepare(m, frame, words);
+
+    for (uint32_t i=0; i<m->info.num_signals; i++) {
+        const candle_dbc_plan_t *p = &m->plans[i];
+        double v = (double)candle_dbc_raw_value(p, words[p->order]) * p->factor + p->offset;
+        values[i] = candle_dbc_present(p, frame->can_dlc, mux) ? v : NAN;
+    }
+}
+
+void candle_dbc_decode_msg_raw(const candle_dbc_msg_t *m, const candle_frame_t *frame, int64_t *raw)
+{
+    uint64_t words[2];
+    int64_t mux = candle_dbc_prepare(m, frame, words);
+
+    for (uint32_t i=0; i<m->info.num_signals; i++) {
+        const candle_dbc_plan_t *p = &m->plans[i];
+        raw[i] = candle_dbc_raw_value(p, words[p->order]) & -(int64_t)candle_dbc_present(p, frame->can_dlc, mux);
+    }
+}
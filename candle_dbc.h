@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "candle.h"
+
+#define CANDLE_DBC_STD_IDS      2048
+#define CANDLE_DBC_MAX_MESSAGES 0xFFFF      /* message indexes are 16 bit */
+#define CANDLE_DBC_NO_MESSAGE   0xFFFF
+#define CANDLE_DBC_EXT_EMPTY    0xFFFFFFFF  /* never a valid id */
+
+/* Decode plan of one signal. The raw value is
+ *     (word[order] >> shift) & mask
+ * where word[0] holds the 8 data bytes little endian and word[1] the same
+ * bytes big endian, so both byte orders are one shift and one mask. It is
+ * sign extended by (raw ^ sign) - sign, which is a no-op for sign == 0.
+ */
+typedef struct {
+    uint64_t mask;
+    uint64_t sign;          /* top bit of mask for signed signals, else 0 */
+    double factor;
+    double offset;
+    uint8_t shift;
+    uint8_t order;          /* 0: Intel, 1: Motorola */
+    uint8_t min_dlc;        /* shorter frames do not carry the signal; 255 for signals past byte 8 */
+    uint8_t reserved;
+    int32_t mux;            /* multiplexer value the signal is sent with, -1: always */
+} candle_dbc_plan_t;
+
+typedef struct {
+    candle_dbc_message_t info;  /* info.signals runs parallel to plans */
+    candle_dbc_plan_t *plans;
+    int32_t mux_index;      /* plan of the multiplexer switch, -1 if none */
+    uint32_t capacity;
+    uint32_t line;          /* of the BO_ line, for error reports */
+} candle_dbc_msg_t;
+
+/* A DBC file compiled for decoding. Messages are found by a dense table for
+ * 11-bit ids and an open addressing hash for 29-bit ids.
+ */
+typedef struct {
+    candle_err_t last_error;
+    uint32_t error_line;
+
+    candle_dbc_msg_t *msgs;
+    uint32_t num_msgs;
+    uint32_t capacity;
+
+    uint16_t std_index[CANDLE_DBC_STD_IDS]; /* CANDLE_DBC_NO_MESSAGE if unused */
+    uint32_t *ext_keys;     /* CANDLE_DBC_EXT_EMPTY marks free slots */
+    uint16_t *ext_index;
+    uint32_t ext_bits;
+} candle_dbc_t;
+
+static inline uint64_t candle_dbc_load_le(const uint8_t *data)
+{
+    uint64_t le;
+    memcpy(&le, data, sizeof(le));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    le = __builtin_bswap64(le);
+#endif
+    return le;
+}
+
+/* word is the data in the byte order of the plan */
+static inline int64_t candle_dbc_raw_value(const candle_dbc_plan_t *p, uint64_t word)
+{
+    uint64_t raw = (word >> p->shift) & p->mask;
+    return (int64_t)((raw ^ p->sign) - p->sign);
+}
+
+/* mux is the value of the multiplexer in the frame, -1 if none */
+static inline bool candle_dbc_present(const candle_dbc_plan_t *p, uint8_t dlc, int64_t mux)
+{
+    return (dlc >= p->min_dlc) & ((p->mux < 0) | (p->mux == mux));
+}
+
+/* both leave last_error and error_line set on failure */
+bool candle_dbc_parse(candle_dbc_t *dbc, const char *text, size_t len);
+bool candle_dbc_load_file(candle_dbc_t *dbc, const char *path);
+void candle_dbc_clear(candle_dbc_t *dbc);
+
+/* can_id as in candle_frame_t; NULL if the DBC has no such message */
+const candle_dbc_msg_t *candle_dbc_lookup(const candle_dbc_t *dbc, uint32_t can_id);
+
+/* one value per signal of m; signals the frame does not carry come out as
+   NAN (physical) or 0 (raw) */
+void candle_dbc_decode_msg(const candle_dbc_msg_t *m, const candle_frame_t *frame, double *values);
+void candle_dbc_decode_msg_raw(const candle_dbc_msg_t *m, const candle_frame_t *frame, int64_t *raw);
+
+#define CANDLE_DBC_BATCH_FRAMES 256  /* frames scanned per round of candle_dbc_extract_msg() */
+
+/* data frames of m in frames into columns, see candle_dbc_extract() */
+size_t candle_dbc_extract_msg(const candle_dbc_msg_t *m, const candle_frame_t *frames, size_t num_frames, const candle_dbc_column_t *columns, size_t num_columns, size_t *index);
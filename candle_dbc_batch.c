@@ -0,0 +1,327 @@
+#include "candle_dbc.h"
+#include "candle_defs.h"
+#include "candle_os.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CANDLE_DBC_X86 1
+#include <immintrin.h>
+#endif
+
+#define CANDLE_DBC_EXP52 0x4330000000000000ull  /* bit pattern of 2^52 */
+#define CANDLE_DBC_TWO52 4503599627370496.0
+#define CANDLE_DBC_EXACT_MASK ((1ull << 52) - 1) /* raw values up to this convert through CANDLE_DBC_EXP52 */
+
+/* Matching frames are first gathered into a block: their data words in both
+ * byte orders, dlc and multiplexer value. Each column is then one pass of
+ * shift, mask and scale over the contiguous words.
+ */
+typedef struct {
+    uint64_t le[CANDLE_DBC_BATCH_FRAMES];
+    uint64_t be[CANDLE_DBC_BATCH_FRAMES];
+    int64_t mux[CANDLE_DBC_BATCH_FRAMES];
+    uint8_t dlc[CANDLE_DBC_BATCH_FRAMES];
+    uint16_t pos[CANDLE_DBC_BATCH_FRAMES];  /* within the scanned frames */
+    uint32_t n;
+} candle_dbc_block_t;
+
+typedef void (*candle_dbc_scan_fn)(const candle_frame_t *frames, uint32_t num_frames, uint32_t can_id, candle_dbc_block_t *b);
+typedef void (*candle_dbc_bswap_fn)(const uint64_t *in, uint64_t *out, uint32_t n);
+typedef void (*candle_dbc_column_fn)(const candle_dbc_plan_t *p, const uint64_t *words, uint32_t n, float *values, int64_t *raw);
+
+typedef struct {
+    candle_dbc_scan_fn scan;
+    candle_dbc_bswap_fn bswap;
+    candle_dbc_column_fn column;
+} candle_dbc_kernels_t;
+
+static inline bool candle_dbc_is_data_of(const candle_frame_t *f, uint32_t can_id)
+{
+    return (f->can_id == can_id) && !(f->flags & CANDLE_FRAME_FLAG_TIMESTAMP_OVFL);
+}
+
+static inline void candle_dbc_take(candle_dbc_block_t *b, const candle_frame_t *f, uint32_t pos)
+{
+    b->le[b->n] = candle_dbc_load_le(f->data);
+    b->dlc[b->n] = f->can_dlc;
+    b->pos[b->n] = (uint16_t)pos;
+    b->n++;
+}
+
+static void candle_dbc_scan_scalar(const candle_frame_t *frames, uint32_t num_frames, uint32_t can_id, candle_dbc_block_t *b)
+{
+    for (uint32_t k=0; k<num_frames; k++) {
+        if (candle_dbc_is_data_of(&frames[k], can_id)) {
+            candle_dbc_take(b, &frames[k], k);
+        }
+    }
+}
+
+static void candle_dbc_bswap_scalar(const uint64_t *in, uint64_t *out, uint32_t n)
+{
+    for (uint32_t k=0; k<n; k++) {
+        out[k] = __builtin_bswap64(in[k]);
+    }
+}
+
+static void candle_dbc_column_scalar(const candle_dbc_plan_t *p, const uint64_t *words, uint32_t n, float *values, int64_t *raw)
+{
+    for (uint32_t k=0; k<n; k++) {
+        int64_t v = candle_dbc_raw_value(p, words[k]);
+        if (raw != NULL) {
+            raw[k] = v;
+        }
+        if (values != NULL) {
+            values[k] = (float)((double)v * p->factor + p->offset);
+        }
+    }
+}
+
+#ifdef CANDLE_DBC_X86
+
+/* The vector kernels convert raw values to double without a 64-bit integer
+ * conversion (AVX2 has none): raw ^ sign is the value offset by sign into
+ * [0, 2^52), which ORed into the mantissa of 2^52 is exactly 2^52 + raw +
+ * sign as a double. Subtracting 2^52 + sign leaves raw. Signals longer than
+ * 52 bits go through the scalar kernel.
+ */
+
+__attribute__((target("ssse3")))
+static void candle_dbc_bswap_ssse3(const uint64_t *in, uint64_t *out, uint32_t n)
+{
+    const __m128i rev = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    uint32_t k = 0;
+    for (; k+2<=n; k+=2) {
+        __m128i w = _mm_loadu_si128((const __m128i *)&in[k]);
+        _mm_storeu_si128((__m128i *)&out[k], _mm_shuffle_epi8(w, rev));
+    }
+    candle_dbc_bswap_scalar(in + k, out + k, n - k);
+}
+
+__attribute__((target("ssse3")))
+static void candle_dbc_column_ssse3(const candle_dbc_plan_t *p, const uint64_t *words, uint32_t n, float *values, int64_t *raw)
+{
+    if ( (values != NULL) && (p->mask > CANDLE_DBC_EXACT_MASK) ) {
+        candle_dbc_column_scalar(p, words, n, values, raw);
+        return;
+    }
+
+    const __m128i count = _mm_cvtsi32_si128(p->shift);
+    const __m128i mask = _mm_set1_epi64x((long long)p->mask);
+    const __m128i sign = _mm_set1_epi64x((long long)p->sign);
+    const __m128i exp52 = _mm_set1_epi64x((long long)CANDLE_DBC_EXP52);
+    const __m128d bias = _mm_set1_pd(CANDLE_DBC_TWO52 + (double)p->sign);
+    const __m128d factor = _mm_set1_pd(p->factor);
+    const __m128d offset = _mm_set1_pd(p->offset);
+
+    uint32_t k = 0;
+    for (; k+4<=n; k+=4) {
+        __m128i u0 = _mm_loadu_si128((const __m128i *)&words[k]);
+        __m128i u1 = _mm_loadu_si128((const __m128i *)&words[k + 2]);
+        u0 = _mm_xor_si128(_mm_and_si128(_mm_srl_epi64(u0, count), mask), sign);
+        u1 = _mm_xor_si128(_mm_and_si128(_mm_srl_epi64(u1, count), mask), sign);
+
+        if (raw != NULL) {
+            _mm_storeu_si128((__m128i *)&raw[k], _mm_sub_epi64(u0, sign));
+            _mm_storeu_si128((__m128i *)&raw[k + 2], _mm_sub_epi64(u1, sign));
+        }
+        if (values != NULL) {
+            __m128d d0 = _mm_sub_pd(_mm_castsi128_pd(_mm_or_si128(u0, exp52)), bias);
+            __m128d d1 = _mm_sub_pd(_mm_castsi128_pd(_mm_or_si128(u1, exp52)), bias);
+            d0 = _mm_add_pd(_mm_mul_pd(d0, factor), offset);
+            d1 = _mm_add_pd(_mm_mul_pd(d1, factor), offset);
+            _mm_storeu_ps(&values[k], _mm_movelh_ps(_mm_cvtpd_ps(d0), _mm_cvtpd_ps(d1)));
+        }
+    }
+    candle_dbc_column_scalar(p, words + k, n - k, (values != NULL) ? values + k : NULL, (raw != NULL) ? raw + k : NULL);
+}
+
+__attribute__((target("avx2")))
+static void candle_dbc_scan_avx2(const candle_frame_t *frames, uint32_t num_frames, uint32_t can_id, candle_dbc_block_t *b)
+{
+    /* can_id and the dword holding flags of 8 frames, 6 dwords apart */
+    const __m256i stride = _mm256_setr_epi32(0, 6, 12, 18, 24, 30, 36, 42);
+    const __m256i id = _mm256_set1_epi32((int)can_id);
+    const __m256i ovfl = _mm256_set1_epi32(CANDLE_FRAME_FLAG_TIMESTAMP_OVFL << 16);
+    const __m256i zero = _mm256_setzero_si256();
+
+    uint32_t k = 0;
+    for (; k+8<=num_frames; k+=8) {
+        const int *p = (const int *)((const uint8_t *)&frames[k] + offsetof(candle_frame_t, can_id));
+        __m256i ids = _mm256_i32gather_epi32(p, stride, 4);
+        __m256i flags = _mm256_i32gather_epi32(p + 1, stride, 4);
+        __m256i hit = _mm256_and_si256(_mm256_cmpeq_epi32(ids, id),
+                                       _mm256_cmpeq_epi32(_mm256_and_si256(flags, ovfl), zero));
+
+        unsigned bits = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(hit));
+        while (bits != 0) {
+            unsigned j = (unsigned)__builtin_ctz(bits);
+            bits &= bits - 1;
+            candle_dbc_take(b, &frames[k + j], k + j);
+        }
+    }
+    for (; k<num_frames; k++) {
+        if (candle_dbc_is_data_of(&frames[k], can_id)) {
+            candle_dbc_take(b, &frames[k], k);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void candle_dbc_bswap_avx2(const uint64_t *in, uint64_t *out, uint32_t n)
+{
+    const __m256i rev = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                         7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    uint32_t k = 0;
+    for (; k+4<=n; k+=4) {
+        __m256i w = _mm256_loadu_si256((const __m256i *)&in[k]);
+        _mm256_storeu_si256((__m256i *)&out[k], _mm256_shuffle_epi8(w, rev));
+    }
+    _mm256_zeroupper();
+    candle_dbc_bswap_scalar(in + k, out + k, n - k);
+}
+
+__attribute__((target("avx2")))
+static void candle_dbc_column_avx2(const candle_dbc_plan_t *p, const uint64_t *words, uint32_t n, float *values, int64_t *raw)
+{
+    if ( (values != NULL) && (p->mask > CANDLE_DBC_EXACT_MASK) ) {
+        candle_dbc_column_scalar(p, words, n, values, raw);
+        return;
+    }
+
+    const __m128i count = _mm_cvtsi32_si128(p->shift);
+    const __m256i mask = _mm256_set1_epi64x((long long)p->mask);
+    const __m256i sign = _mm256_set1_epi64x((long long)p->sign);
+    const __m256i exp52 = _mm256_set1_epi64x((long long)CANDLE_DBC_EXP52);
+    const __m256d bias = _mm256_set1_pd(CANDLE_DBC_TWO52 + (double)p->sign);
+    const __m256d factor = _mm256_set1_pd(p->factor);
+    const __m256d offset = _mm256_set1_pd(p->offset);
+
+    uint32_t k = 0;
+    for (; k+8<=n; k+=8) {
+        __m256i u0 = _mm256_loadu_si256((const __m256i *)&words[k]);
+        __m256i u1 = _mm256_loadu_si256((const __m256i *)&words[k + 4]);
+        u0 = _mm256_xor_si256(_mm256_and_si256(_mm256_srl_epi64(u0, count), mask), sign);
+        u1 = _mm256_xor_si256(_mm256_and_si256(_mm256_srl_epi64(u1, count), mask), sign);
+
+        if (raw != NULL) {
+            _mm256_storeu_si256((__m256i *)&raw[k], _mm256_sub_epi64(u0, sign));
+            _mm256_storeu_si256((__m256i *)&raw[k + 4], _mm256_sub_epi64(u1, sign));
+        }
+        if (values != NULL) {
+            /* separate multiply and add, to round as the scalar kernel does */
+            __m256d d0 = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(u0, exp52)), bias);
+            __m256d d1 = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(u1, exp52)), bias);
+            d0 = _mm256_add_pd(_mm256_mul_pd(d0, factor), offset);
+            d1 = _mm256_add_pd(_mm256_mul_pd(d1, factor), offset);
+            _mm256_storeu_ps(&values[k], _mm256_set_m128(_mm256_cvtpd_ps(d1), _mm256_cvtpd_ps(d0)));
+        }
+    }
+    /* the tail call is not covered by the implicit vzeroupper on return */
+    _mm256_zeroupper();
+    candle_dbc_column_scalar(p, words + k, n - k, (values != NULL) ? values + k : NULL, (raw != NULL) ? raw + k : NULL);
+}
+
+#endif
+
+static void candle_dbc_kernels(candle_dbc_kernels_t *kern)
+{
+    kern->scan = candle_dbc_scan_scalar;
+    kern->bswap = candle_dbc_bswap_scalar;
+    kern->column = candle_dbc_column_scalar;
+
+#ifdef CANDLE_DBC_X86
+    switch (candle_cpu_isa()) {
+        case CANDLE_ISA_AVX2:
+            kern->scan = candle_dbc_scan_avx2;
+            kern->bswap = candle_dbc_bswap_avx2;
+            kern->column = candle_dbc_column_avx2;
+            break;
+        case CANDLE_ISA_SSSE3:
+            kern->bswap = candle_dbc_bswap_ssse3;
+            kern->column = candle_dbc_column_ssse3;
+            break;
+        default:
+            break;
+    }
+#endif
+}
+
+/* NAN / 0 for the entries of frames that do not carry the signal */
+static void candle_dbc_column_fixup(const candle_dbc_plan_t *p, const candle_dbc_block_t *b, float *values, int64_t *raw)
+{
+    for (uint32_t k=0; k<b->n; k++) {
+        if (!candle_dbc_present(p, b->dlc[k], b->mux[k])) {
+            if (values != NULL) {
+                values[k] = NAN;
+            }
+            if (raw != NULL) {
+                raw[k] = 0;
+            }
+        }
+    }
+}
+
+size_t candle_dbc_extract_msg(const candle_dbc_msg_t *m, const candle_frame_t *frames, size_t num_frames, const candle_dbc_column_t *columns, size_t num_columns, size_t *index)
+{
+    candle_dbc_kernels_t kern;
+    candle_dbc_kernels(&kern);
+
+    bool need_be = false;
+    for (size_t c=0; c<num_columns; c++) {
+        need_be |= (m->plans[columns[c].signal].order != 0);
+    }
+    const candle_dbc_plan_t *sw = (m->mux_index >= 0) ? &m->plans[m->mux_index] : NULL;
+    need_be |= (sw != NULL) && (sw->order != 0);
+
+    candle_dbc_block_t b;
+    size_t out = 0;
+
+    for (size_t base=0; base<num_frames; base+=CANDLE_DBC_BATCH_FRAMES) {
+        uint32_t num = (num_frames - base < CANDLE_DBC_BATCH_FRAMES) ? (uint32_t)(num_frames - base) : CANDLE_DBC_BATCH_FRAMES;
+
+        b.n = 0;
+        kern.scan(frames + base, num, m->info.can_id, &b);
+        if (b.n == 0) {
+            continue;
+        }
+
+        if (need_be) {
+            kern.bswap(b.le, b.be, b.n);
+        }
+
+        uint8_t min_dlc = 8;
+        for (uint32_t k=0; k<b.n; k++) {
+            min_dlc = (b.dlc[k] < min_dlc) ? b.dlc[k] : min_dlc;
+            b.mux[k] = -1;
+        }
+        if (sw != NULL) {
+            const uint64_t *words = sw->order ? b.be : b.le;
+            for (uint32_t k=0; k<b.n; k++) {
+                if (b.dlc[k] >= sw->min_dlc) {
+                    b.mux[k] = candle_dbc_raw_value(sw, words[k]);
+                }
+            }
+        }
+
+        for (size_t c=0; c<num_columns; c++) {
+            const candle_dbc_plan_t *p = &m->plans[columns[c].signal];
+            float *values = (columns[c].values != NULL) ? columns[c].values + out : NULL;
+            int64_t *raw = (columns[c].raw != NULL) ? columns[c].raw + out : NULL;
+
+            kern.column(p, p->order ? b.be : b.le, b.n, values, raw);
+            if ( (p->mux >= 0) || (min_dlc < p->min_dlc) ) {
+                candle_dbc_column_fixup(p, &b, values, raw);
+            }
+        }
+
+        if (index != NULL) {
+            for (uint32_t k=0; k<b.n; k++) {
+                index[out + k] = base + b.pos[k];
+            }
+        }
+        out += b.n;
+    }
+    return out;
+}
@@ -1,21 +1,36 @@
 #pragma once
 
 #include <stdint.h>
-#include <windows.h>
-#include <winbase.h>
-#include <winusb.h>
-#include <setupapi.h>
-#include <devguid.h>
-#include <regstr.h>
-
-#undef __CRT__NO_INLINE
-#include <strsafe.h>
-#define __CRT__NO_INLINE
+#include <stdbool.h>
+#include <string.h>
+#include <wchar.h>
 
 #include "candle.h"
+#include "candle_rx_parse.h"
+#include "candle_ring.h"
+#include "candle_clock.h"
+#include "candle_bittiming.h"
+#include "candle_filter.h"
+#include "candle_change.h"
+#include "candle_dbc.h"
+#include "candle_batch.h"
+#include "candle_capture.h"
 
 #define CANDLE_MAX_DEVICES 32
+#define CANDLE_MAX_CHANNELS 8        /* channels beyond this are not exposed */
 #define CANDLE_URB_COUNT 30
+#define CANDLE_URB_COUNT_MAX 1024
+#define CANDLE_URB_SIZE 64
+#define CANDLE_URB_SIZE_MAX 16384
+#define CANDLE_RX_RING_FRAMES 4096
+#define CANDLE_RX_MAX_BORROWS 8
+#define CANDLE_AUTOBAUD_HISTORY 8
+#define CANDLE_TX_SLOTS 10          /* per channel, as GS_MAX_TX_URBS */
+#define CANDLE_TX_ECHO_BASE 0x100   /* lower echo ids are left to candle_frame_send() */
+#define CANDLE_TX_CHUNK_FRAMES 170  /* frames per bulk-OUT transfer in candle_frame_send_many() */
+#define CANDLE_TS_SLACK_US (1u<<30) /* how far a frame may be ahead of the host's guess, see candle_rx_timebase() */
+
+#define CANDLE_FRAME_FLAG_TIMESTAMP_OVFL 0x80   /* host only, marks synthesized overflow frames */
 
 #pragma pack(push,1)
 
@@ -39,31 +54,146 @@ typedef struct {
 
 #pragma pack(pop)
 
+struct candle_transport;
 
 typedef struct {
-    OVERLAPPED ovl;
-    uint8_t buf[64];
+    bool done;                  /* set by the transport when the read has completed */
+    bool idle;                  /* submitting the read failed, retried before the next wait */
+    candle_err_t status;        /* result of the completed read */
+    uint32_t bytes_transfered;
+    uint8_t *buf;               /* opts.rx_urb_size bytes */
+    uint32_t borrows;           /* frames in buf handed out by candle_frame_peek() */
 } canlde_rx_urb;
 
+typedef struct {
+    const candle_frame_t *frame;  /* NULL while the slot is free */
+    canlde_rx_urb *urb;           /* urb pinned by this borrow, NULL if frame points to copy */
+    candle_frame_t copy;          /* frames that don't live in a urb buffer */
+} candle_rx_borrow_t;
+
+typedef struct {
+    uint32_t bitrate;
+    uint32_t hits;
+} candle_autobaud_hit_t;
+
+/* receive side of one channel with CANDLE_DEVOPT_RX_PER_CHANNEL */
+typedef struct {
+    candle_ring_t ring;
+    uint32_t error;             /* candle_err_t parked by the RX thread */
+    candle_err_t last_error;    /* of the last call by this channel's reader */
+    uint8_t pad[CANDLE_CACHE_LINE];
+} candle_rx_channel_t;
+
 typedef struct {
     wchar_t path[256];
     candle_devstate_t state;
     candle_err_t last_error;
+    bool probed;                /* state reflects an open attempt */
+    bool probing;               /* the transport is opened by candle_dev_probe() only */
+    uint32_t gone;              /* set once the transport reports the device unplugged */
+    bool info_valid;            /* dconf and bt_const hold the device's descriptors */
+    bool is_open;               /* between a successful candle_dev_open() and candle_dev_close() */
 
-    HANDLE deviceHandle;
-    WINUSB_INTERFACE_HANDLE winUSBHandle;
-    UCHAR interfaceNumber;
-    UCHAR bulkInPipe;
-    UCHAR bulkOutPipe;
+    const struct candle_transport *transport;
+    void *transport_data;
+    uint8_t interfaceNumber;
 
     candle_device_config_t dconf;
-    candle_capability_t bt_const;
-    canlde_rx_urb rxurbs[CANDLE_URB_COUNT];
-    HANDLE rxevents[CANDLE_URB_COUNT];
+    candle_capability_t bt_const[CANDLE_MAX_CHANNELS];  /* per channel, valid up to dconf.icount */
+    candle_bt_cache_t bt_cache;
+    candle_autobaud_hit_t autobaud_hits[CANDLE_AUTOBAUD_HISTORY];
+    candle_dev_options_t opts;
+    canlde_rx_urb *rxurbs;      /* opts.rx_urb_count entries, allocated while open */
+
+    /* outstanding urbs in submission order, oldest at rx_order_head */
+    unsigned *rx_order;
+    uint32_t rx_order_head;
+    uint32_t rx_order_count;
+    uint32_t rx_idle_count;
+
+    /* frames split from a completed urb but not yet handed out */
+    candle_rx_parser_t rx_parser;
+    candle_frame_t *rx_pending;
+    uint32_t rx_pending_size;
+    uint32_t rx_pending_head;
+    uint32_t rx_pending_count;
+
+    /* frames of the urb candle_frame_peek() is walking through; the urb
+       is held back from the transport while rx_cursor.count > 0 */
+    unsigned rx_cursor_urb;
+    candle_rx_span_t rx_cursor;
+    candle_frame_t rx_cursor_stitched;
+    bool rx_cursor_ovfl;            /* an overflow frame is due ... */
+    uint32_t rx_cursor_ovfl_left;   /* ... when this many frames are left */
+    uint8_t rx_cursor_ovfl_epoch;
+
+    /* set by candle_dev_set_filter() and candle_dev_set_change_filter(),
+       applied before frames are queued */
+    candle_filter_compiled_t *rx_filter;
+    candle_change_table_t *rx_change;
+    uint32_t rx_filter_busy;
+    uint64_t rx_filtered;
+    uint64_t rx_changed;
+    uint64_t rx_unchanged;
+
+    candle_rx_borrow_t *rx_borrows;
+    uint32_t rx_max_borrows;
+    uint32_t rx_borrow_count;
+
+    /* extended timebase, advanced in delivery order. The low byte of the
+       epoch is stored in the reserved field of each received frame. */
+    bool ts_valid;
+    uint32_t ts_last;
+    uint32_t ts_epoch;
+    uint64_t ts_host_ns;        /* candle_time_ns() when ts_last came in */
+
+    /* candle_frame_send_async() window, CANDLE_TX_SLOTS per channel. Each
+       tx_state word has a bit per slot waiting for its echo (low half) and
+       one per slot whose usb write is still in flight (high half). */
+    uint32_t tx_channels;
+    uint32_t *tx_state;
+    candle_frame_t *tx_frames;
+
+    /* with CANDLE_DEVOPT_RX_THREAD the urbs above belong to rx_thread,
+       readers only ever touch rx_ring */
+    candle_ring_t rx_ring;
+    candle_rx_channel_t *rx_chans;  /* tx_channels entries instead of rx_ring with CANDLE_DEVOPT_RX_PER_CHANNEL */
+    candle_thread_t rx_thread;
+    bool rx_thread_running;
+    uint32_t rx_thread_stop;
+    uint32_t rx_thread_error;   /* candle_err_t, reported once the ring runs empty */
+
+    /* with CANDLE_DEVOPT_CLOCK_SYNC, device clock samples taken by clock_thread */
+    candle_clock_t clock;
+    candle_thread_t clock_thread;
+    bool clock_running;
 } candle_device_t;
 
+/* what a list knows about a device; the rest of candle_device_t only
+   exists once a handle is taken with candle_dev_get() */
+typedef struct {
+    wchar_t *path;
+    candle_devstate_t state;
+    bool probed;
+    bool info_valid;
+    candle_device_config_t dconf;
+    candle_capability_t bt_const[CANDLE_MAX_CHANNELS];
+} candle_list_entry_t;
+
 typedef struct {
     uint8_t num_devices;
     candle_err_t last_error;
-    candle_device_t dev[CANDLE_MAX_DEVICES];
+    const struct candle_transport *transport;
+    uint32_t capacity;
+    candle_list_entry_t *dev;   /* num_devices entries */
+
+    /* guards dev/num_devices against the hotplug monitor */
+    candle_mutex_t lock;
+    candle_cond_t cond;
+    candle_thread_t hotplug_thread;
+    bool hotplug_running;
+    bool hotplug_stop;
+    uint32_t hotplug_interval_ms;
+    candle_hotplug_cb_t hotplug_cb;
+    void *hotplug_arg;
 } candle_list_t;
@@ -0,0 +1,320 @@
+#include "candle_filter.h"
+#include "candle_defs.h"
+#include <stdlib.h>
+#include <string.h>
+
+bool candle_filter_add(candle_filter_t *filter, const candle_filter_rule_t *rule)
+{
+    if (filter->num_rules == filter->capacity) {
+        uint32_t capacity = (filter->capacity == 0) ? 16 : 2 * filter->capacity;
+        candle_filter_rule_t *rules = realloc(filter->rules, capacity * sizeof(candle_filter_rule_t));
+        if (rules == NULL) {
+            return false;
+        }
+        filter->rules = rules;
+        filter->capacity = capacity;
+    }
+
+    filter->rules[filter->num_rules++] = *rule;
+    return true;
+}
+
+/* growable scratch arrays used while compiling */
+typedef struct {
+    void *data;
+    uint32_t count;
+    uint32_t capacity;
+} candle_filter_vec_t;
+
+static void *candle_filter_vec_push(candle_filter_vec_t *v, size_t size)
+{
+    if (v->count == v->capacity) {
+        uint32_t capacity = (v->capacity == 0) ? 16 : 2 * v->capacity;
+        void *data = realloc(v->data, capacity * size);
+        if (data == NULL) {
+            return NULL;
+        }
+        v->data = data;
+        v->capacity = capacity;
+    }
+    return (uint8_t*)v->data + size * v->count++;
+}
+
+static bool candle_filter_push_id(candle_filter_vec_t *ids, uint32_t id)
+{
+    uint32_t *p = candle_filter_vec_push(ids, sizeof(uint32_t));
+    if (p == NULL) {
+        return false;
+    }
+    *p = id;
+    return true;
+}
+
+static bool candle_filter_push_range(candle_filter_vec_t *ranges, uint32_t first, uint32_t last)
+{
+    candle_filter_interval_t *p = candle_filter_vec_push(ranges, sizeof(candle_filter_interval_t));
+    if (p == NULL) {
+        return false;
+    }
+    p->first = first;
+    p->last = last;
+    return true;
+}
+
+static unsigned candle_filter_popcount(uint32_t v)
+{
+    unsigned n = 0;
+    for (; v != 0; v &= v - 1) {
+        n++;
+    }
+    return n;
+}
+
+static void candle_filter_compile_std(candle_filter_compiled_t *c, const candle_filter_rule_t *rule)
+{
+    if (rule->range) {
+        uint32_t last = (rule->b < CANDLE_FILTER_STD_IDS) ? rule->b : CANDLE_FILTER_STD_IDS - 1;
+        for (uint32_t id=rule->a; id<=last; id++) {
+            c->std_bitmap[id / 32] |= 1u << (id % 32);
+        }
+    } else {
+        uint32_t mask = rule->b & (CANDLE_FILTER_STD_IDS - 1);
+        uint32_t value = rule->a & mask;
+        for (uint32_t id=0; id<CANDLE_FILTER_STD_IDS; id++) {
+            if ((id & mask) == value) {
+                c->std_bitmap[id / 32] |= 1u << (id % 32);
+            }
+        }
+    }
+}
+
+/* sort an extended rule into the hash, the intervals or the leftover masks */
+static bool candle_filter_compile_ext(const candle_filter_rule_t *rule, candle_filter_vec_t *ids, candle_filter_vec_t *ranges, candle_filter_vec_t *masks)
+{
+    if (rule->range) {
+        if (rule->b - rule->a < CANDLE_FILTER_EXPAND_MAX) {
+            for (uint32_t id=rule->a; id<=rule->b; id++) {
+                if (!candle_filter_push_id(ids, id)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        return candle_filter_push_range(ranges, rule->a, rule->b);
+    }
+
+    uint32_t mask = rule->b & CANDLE_FILTER_EXT_MAX;
+    uint32_t value = rule->a & mask;
+    uint32_t dont_care = ~mask & CANDLE_FILTER_EXT_MAX;
+
+    if ( ((dont_care & (dont_care + 1)) == 0) && (dont_care >= CANDLE_FILTER_EXPAND_MAX) ) {
+        /* only low bits are free: a prefix, i.e. one interval */
+        return candle_filter_push_range(ranges, value, value | dont_care);
+    }
+
+    if ((1u << candle_filter_popcount(dont_care)) <= CANDLE_FILTER_EXPAND_MAX) {
+        /* walk all subsets of the don't-care bits */
+        uint32_t sub = 0;
+        do {
+            if (!candle_filter_push_id(ids, value | sub)) {
+                return false;
+            }
+            sub = (sub - dont_care) & dont_care;
+        } while (sub != 0);
+        return true;
+    }
+
+    candle_filter_mask_t *p = candle_filter_vec_push(masks, sizeof(candle_filter_mask_t));
+    if (p == NULL) {
+        return false;
+    }
+    p->value = value;
+    p->mask = mask;
+    return true;
+}
+
+static int candle_filter_cmp_interval(const void *a, const void *b)
+{
+    const candle_filter_interval_t *x = a;
+    const candle_filter_interval_t *y = b;
+    return (x->first > y->first) - (x->first < y->first);
+}
+
+/* sort and join overlapping or adjacent intervals */
+static uint32_t candle_filter_merge_ranges(candle_filter_interval_t *r, uint32_t n)
+{
+    if (n == 0) {
+        return 0;
+    }
+
+    qsort(r, n, sizeof(candle_filter_interval_t), candle_filter_cmp_interval);
+
+    uint32_t out = 0;
+    for (uint32_t i=1; i<n; i++) {
+        if (r[i].first <= r[out].last + 1) {
+            if (r[i].last > r[out].last) {
+                r[out].last = r[i].last;
+            }
+        } else {
+            r[++out] = r[i];
+        }
+    }
+    return out + 1;
+}
+
+static uint32_t candle_filter_hash(uint32_t id, uint32_t bits)
+{
+    return (id * 0x9E3779B1u) >> (32 - bits);
+}
+
+static bool candle_filter_build_hash(candle_filter_compiled_t *c, const uint32_t *ids, uint32_t n)
+{
+    if (n == 0) {
+        return true;
+    }
+
+    /* at most half full, so probe chains stay short */
+    uint32_t bits = 4;
+    while ((1u << bits) < 2 * n) {
+        bits++;
+    }
+
+    c->ext_hash = malloc((1u << bits) * sizeof(uint32_t));
+    if (c->ext_hash == NULL) {
+        return false;
+    }
+    memset(c->ext_hash, 0xFF, (1u << bits) * sizeof(uint32_t));
+    c->ext_hash_bits = bits;
+
+    uint32_t mask = (1u << bits) - 1;
+    for (uint32_t i=0; i<n; i++) {
+        uint32_t k = candle_filter_hash(ids[i], bits);
+        while ( (c->ext_hash[k] != CANDLE_FILTER_EMPTY) && (c->ext_hash[k] != ids[i]) ) {
+            k = (k + 1) & mask;
+        }
+        c->ext_hash[k] = ids[i];
+    }
+    return true;
+}
+
+candle_filter_compiled_t *candle_filter_compile(const candle_filter_t *filter)
+{
+    candle_filter_compiled_t *c = calloc(1, sizeof(candle_filter_compiled_t));
+    if (c == NULL) {
+        return NULL;
+    }
+
+    candle_filter_vec_t ids, ranges, masks;
+    memset(&ids, 0, sizeof(ids));
+    memset(&ranges, 0, sizeof(ranges));
+    memset(&masks, 0, sizeof(masks));
+
+    bool rc = true;
+    for (uint32_t i=0; rc && (i<filter->num_rules); i++) {
+        const candle_filter_rule_t *rule = &filter->rules[i];
+        if (rule->extended) {
+            rc = candle_filter_compile_ext(rule, &ids, &ranges, &masks);
+        } else {
+            candle_filter_compile_std(c, rule);
+        }
+    }
+
+    if (rc) {
+        rc = candle_filter_build_hash(c, ids.data, ids.count);
+    }
+    free(ids.data);
+
+    c->ext_ranges = ranges.data;
+    c->num_ext_ranges = candle_filter_merge_ranges(ranges.data, ranges.count);
+    c->ext_masks = masks.data;
+    c->num_ext_masks = masks.count;
+
+    if (!rc) {
+        candle_filter_compiled_free(c);
+        return NULL;
+    }
+    return c;
+}
+
+void candle_filter_compiled_free(candle_filter_compiled_t *c)
+{
+    if (c != NULL) {
+        free(c->ext_hash);
+        free(c->ext_ranges);
+        free(c->ext_masks);
+        free(c);
+    }
+}
+
+static bool candle_filter_match_ext(const candle_filter_compiled_t *c, uint32_t id)
+{
+    if (c->ext_hash != NULL) {
+        uint32_t mask = (1u << c->ext_hash_bits) - 1;
+        uint32_t k = candle_filter_hash(id, c->ext_hash_bits);
+        while (c->ext_hash[k] != CANDLE_FILTER_EMPTY) {
+            if (c->ext_hash[k] == id) {
+                return true;
+            }
+            k = (k + 1) & mask;
+        }
+    }
+
+    uint32_t lo = 0;
+    uint32_t hi = c->num_ext_ranges;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (id < c->ext_ranges[mid].first) {
+            hi = mid;
+        } else if (id > c->ext_ranges[mid].last) {
+            lo = mid + 1;
+        } else {
+            return true;
+        }
+    }
+
+    for (uint32_t i=0; i<c->num_ext_masks; i++) {
+        if ((id & c->ext_masks[i].mask) == c->ext_masks[i].value) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool candle_filter_match(const candle_filter_compiled_t *c, const candle_frame_t *frame)
+{
+    if ( (frame->echo_id != 0xFFFFFFFF)
+      || (frame->flags & CANDLE_FRAME_FLAG_TIMESTAMP_OVFL)
+      || (frame->can_id & 0x20000000) ) {
+        return true;
+    }
+
+    uint32_t id = frame->can_id & 0x1FFFFFFF;
+    if (frame->can_id & 0x80000000) {
+        return candle_filter_match_ext(c, id);
+    }
+    return (id < CANDLE_FILTER_STD_IDS) && (c->std_bitmap[id / 32] & (1u << (id % 32)));
+}
+
+uint32_t candle_filter_apply(const candle_filter_compiled_t *c, candle_frame_t *frames, uint32_t num_frames, uint32_t *mark)
+{
+    uint32_t kept = 0;
+    uint32_t before_mark = 0;
+
+    for (uint32_t i=0; i<num_frames; i++) {
+        if ( (mark != NULL) && (i == *mark) ) {
+            before_mark = kept;
+        }
+        if (candle_filter_match(c, &frames[i])) {
+            if (kept != i) {
+                memcpy(&frames[kept], &frames[i], sizeof(candle_frame_t));
+            }
+            kept++;
+        }
+    }
+
+    if (mark != NULL) {
+        *mark = (*mark < num_frames) ? before_mark : kept;
+    }
+    return kept;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "candle.h"
+
+#define CANDLE_FILTER_STD_IDS    2048
+#define CANDLE_FILTER_EXT_MAX    0x1FFFFFFF
+#define CANDLE_FILTER_EMPTY      0xFFFFFFFF  /* never a valid id */
+#define CANDLE_FILTER_EXPAND_MAX 16          /* extended rules matching up to this many ids go into the hash */
+
+typedef struct {
+    bool extended;
+    bool range;
+    uint32_t a;             /* mask rules: value, ranges: first id */
+    uint32_t b;             /* mask rules: mask, ranges: last id */
+} candle_filter_rule_t;
+
+/* what candle_filter_add_mask() and candle_filter_add_range() collect */
+typedef struct {
+    candle_filter_rule_t *rules;
+    uint32_t num_rules;
+    uint32_t capacity;
+} candle_filter_t;
+
+typedef struct {
+    uint32_t first;
+    uint32_t last;
+} candle_filter_interval_t;
+
+typedef struct {
+    uint32_t value;
+    uint32_t mask;
+} candle_filter_mask_t;
+
+/* Immutable form of a candle_filter_t used on the receive path. Standard ids
+ * are a plain bitmap. Extended rules are split by shape: single ids and
+ * small sets go into an open addressing hash, ranges and prefix masks into
+ * sorted disjoint intervals, and only masks with scattered don't-care bits
+ * are left to be tried one by one.
+ */
+typedef struct {
+    uint32_t std_bitmap[CANDLE_FILTER_STD_IDS / 32];
+
+    uint32_t *ext_hash;     /* CANDLE_FILTER_EMPTY marks free slots */
+    uint32_t ext_hash_bits;
+    candle_filter_interval_t *ext_ranges;
+    uint32_t num_ext_ranges;
+    candle_filter_mask_t *ext_masks;
+    uint32_t num_ext_masks;
+} candle_filter_compiled_t;
+
+bool candle_filter_add(candle_filter_t *filter, const candle_filter_rule_t *rule);
+candle_filter_compiled_t *candle_filter_compile(const candle_filter_t *filter);
+void candle_filter_compiled_free(candle_filter_compiled_t *c);
+
+/* only received data frames are subject to the filter; echoes, error and
+   overflow frames always pass */
+bool candle_filter_match(const candle_filter_compiled_t *c, const candle_frame_t *frame);
+
+/* drop rejected frames, keeping the order of the rest. If mark is not NULL
+   it is an index into frames on input, and the number of frames kept in
+   front of it on return. Returns the number of frames kept. */
+uint32_t candle_filter_apply(const candle_filter_compiled_t *c, candle_frame_t *frames, uint32_t num_frames, uint32_t *mark);
@@ -0,0 +1,359 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include "candle_os.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+typedef struct {
+    candle_thread_fn fn;
+    void *arg;
+} candle_thread_start_t;
+
+#ifdef _WIN32
+
+static DWORD WINAPI candle_thread_entry(LPVOID param)
+{
+    candle_thread_start_t start = *(candle_thread_start_t*)param;
+    free(param);
+    start.fn(start.arg);
+    return 0;
+}
+
+bool candle_thread_start(candle_thread_t *thread, candle_thread_fn fn, void *arg)
+{
+    candle_thread_start_t *start = malloc(sizeof(candle_thread_start_t));
+    if (start == NULL) {
+        return false;
+    }
+    start->fn = fn;
+    start->arg = arg;
+
+    *thread = CreateThread(NULL, 0, candle_thread_entry, start, 0, NULL);
+    if (*thread == NULL) {
+        free(start);
+        return false;
+    }
+    return true;
+}
+
+void candle_thread_join(candle_thread_t thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+typedef struct {
+    void (*fn)(void);
+} candle_once_call_t;
+
+static BOOL CALLBACK candle_once_entry(PINIT_ONCE once, PVOID param, PVOID *context)
+{
+    (void)once;
+    (void)context;
+    ((candle_once_call_t*)param)->fn();
+    return TRUE;
+}
+
+void candle_once(candle_once_t *once, void (*fn)(void))
+{
+    candle_once_call_t call = { fn };
+    InitOnceExecuteOnce(once, candle_once_entry, &call, NULL);
+}
+
+void candle_mutex_init(candle_mutex_t *mutex)
+{
+    InitializeCriticalSection(mutex);
+}
+
+void candle_mutex_destroy(candle_mutex_t *mutex)
+{
+    DeleteCriticalSection(mutex);
+}
+
+void candle_mutex_lock(candle_mutex_t *mutex)
+{
+    EnterCriticalSection(mutex);
+}
+
+void candle_mutex_unlock(candle_mutex_t *mutex)
+{
+    LeaveCriticalSection(mutex);
+}
+
+void candle_cond_init(candle_cond_t *cond)
+{
+    InitializeConditionVariable(cond);
+}
+
+void candle_cond_destroy(candle_cond_t *cond)
+{
+    (void)cond;
+}
+
+void candle_cond_broadcast(candle_cond_t *cond)
+{
+    WakeAllConditionVariable(cond);
+}
+
+bool candle_cond_wait(candle_cond_t *cond, candle_mutex_t *mutex, uint32_t timeout_ms)
+{
+    return SleepConditionVariableCS(cond, mutex, timeout_ms);
+}
+
+void candle_sleep_ms(uint32_t ms)
+{
+    Sleep(ms);
+}
+
+uint64_t candle_time_ns(void)
+{
+    LARGE_INTEGER count, freq;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+
+    /* split to keep count * 1e9 from overflowing */
+    uint64_t sec = (uint64_t)count.QuadPart / (uint64_t)freq.QuadPart;
+    uint64_t rem = (uint64_t)count.QuadPart % (uint64_t)freq.QuadPart;
+    return sec * 1000000000ull + rem * 1000000000ull / (uint64_t)freq.QuadPart;
+}
+
+void *candle_aligned_alloc(size_t size, size_t align)
+{
+    return _aligned_malloc(size, align);
+}
+
+void candle_aligned_free(void *p)
+{
+    _aligned_free(p);
+}
+
+bool candle_file_map(candle_file_map_t *map, const char *path)
+{
+    memset(map, 0, sizeof(*map));
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    bool rc = false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || ((uint64_t)size.QuadPart > SIZE_MAX)) {
+        goto close_file;
+    }
+    map->size = (uint64_t)size.QuadPart;
+    if (map->size > 0) {
+        map->mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (map->mapping == NULL) {
+            goto close_file;
+        }
+        map->data = MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, 0);
+        if (map->data == NULL) {
+            CloseHandle(map->mapping);
+            map->mapping = NULL;
+            goto close_file;
+        }
+    }
+    rc = true;
+
+close_file:
+    /* the mapping holds the file open by itself */
+    CloseHandle(file);
+    return rc;
+}
+
+void candle_file_unmap(candle_file_map_t *map)
+{
+    if (map->data != NULL) {
+        UnmapViewOfFile(map->data);
+        CloseHandle(map->mapping);
+    }
+    memset(map, 0, sizeof(*map));
+}
+
+#else
+
+static void *candle_thread_entry(void *param)
+{
+    candle_thread_start_t start = *(candle_thread_start_t*)param;
+    free(param);
+    start.fn(start.arg);
+    return NULL;
+}
+
+bool candle_thread_start(candle_thread_t *thread, candle_thread_fn fn, void *arg)
+{
+    candle_thread_start_t *start = malloc(sizeof(candle_thread_start_t));
+    if (start == NULL) {
+        return false;
+    }
+    start->fn = fn;
+    start->arg = arg;
+
+    if (pthread_create(thread, NULL, candle_thread_entry, start) != 0) {
+        free(start);
+        return false;
+    }
+    return true;
+}
+
+void candle_thread_join(candle_thread_t thread)
+{
+    pthread_join(thread, NULL);
+}
+
+void candle_once(candle_once_t *once, void (*fn)(void))
+{
+    pthread_once(once, fn);
+}
+
+void candle_mutex_init(candle_mutex_t *mutex)
+{
+    pthread_mutex_init(mutex, NULL);
+}
+
+void candle_mutex_destroy(candle_mutex_t *mutex)
+{
+    pthread_mutex_destroy(mutex);
+}
+
+void candle_mutex_lock(candle_mutex_t *mutex)
+{
+    pthread_mutex_lock(mutex);
+}
+
+void candle_mutex_unlock(candle_mutex_t *mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+
+void candle_cond_init(candle_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+void candle_cond_destroy(candle_cond_t *cond)
+{
+    pthread_cond_destroy(cond);
+}
+
+void candle_cond_broadcast(candle_cond_t *cond)
+{
+    pthread_cond_broadcast(cond);
+}
+
+bool candle_cond_wait(candle_cond_t *cond, candle_mutex_t *mutex, uint32_t timeout_ms)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    return pthread_cond_timedwait(cond, mutex, &deadline) != ETIMEDOUT;
+}
+
+void candle_sleep_ms(uint32_t ms)
+{
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+}
+
+uint64_t candle_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void *candle_aligned_alloc(size_t size, size_t align)
+{
+    void *p;
+    return (posix_memalign(&p, align, size) == 0) ? p : NULL;
+}
+
+void candle_aligned_free(void *p)
+{
+    free(p);
+}
+
+bool candle_file_map(candle_file_map_t *map, const char *path)
+{
+    memset(map, 0, sizeof(*map));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool rc = false;
+    struct stat st;
+    if ( (fstat(fd, &st) != 0) || ((uint64_t)st.st_size > SIZE_MAX) ) {
+        goto close_file;
+    }
+    map->size = (uint64_t)st.st_size;
+    if (map->size > 0) {
+        void *p = mmap(NULL, (size_t)map->size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            goto close_file;
+        }
+        map->data = p;
+    }
+    rc = true;
+
+close_file:
+    /* the mapping stays valid without the descriptor */
+    close(fd);
+    return rc;
+}
+
+void candle_file_unmap(candle_file_map_t *map)
+{
+    if (map->data != NULL) {
+        munmap((void *)map->data, (size_t)map->size);
+    }
+    memset(map, 0, sizeof(*map));
+}
+
+#endif
+
+static candle_isa_t candle_isa_cap = CANDLE_ISA_AVX2;
+
+candle_isa_t candle_cpu_isa(void)
+{
+    candle_isa_t isa = CANDLE_ISA_SCALAR;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        isa = CANDLE_ISA_AVX2;
+    } else if (__builtin_cpu_supports("ssse3")) {
+        isa = CANDLE_ISA_SSSE3;
+    }
+#endif
+    return (isa < candle_isa_cap) ? isa : candle_isa_cap;
+}
+
+void candle_set_isa(candle_isa_t isa)
+{
+    candle_isa_cap = isa;
+}
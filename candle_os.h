@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#define CANDLE_CACHE_LINE 64
+
+#define candle_atomic_load(p)        __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define candle_atomic_store(p, v)    __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define candle_atomic_exchange(p, v) __atomic_exchange_n((p), (v), __ATOMIC_ACQ_REL)
+#define candle_atomic_and(p, v)      __atomic_fetch_and((p), (v), __ATOMIC_ACQ_REL)
+#define candle_atomic_cas(p, e, v)   __atomic_compare_exchange_n((p), (e), (v), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#define candle_atomic_fence()        __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#ifdef _WIN32
+typedef HANDLE candle_thread_t;
+typedef CRITICAL_SECTION candle_mutex_t;
+typedef CONDITION_VARIABLE candle_cond_t;
+typedef INIT_ONCE candle_once_t;
+#define CANDLE_ONCE_INIT INIT_ONCE_STATIC_INIT
+#else
+typedef pthread_t candle_thread_t;
+typedef pthread_mutex_t candle_mutex_t;
+typedef pthread_cond_t candle_cond_t;
+typedef pthread_once_t candle_once_t;
+#define CANDLE_ONCE_INIT PTHREAD_ONCE_INIT
+#endif
+
+typedef void (*candle_thread_fn)(void *arg);
+
+bool candle_thread_start(candle_thread_t *thread, candle_thread_fn fn, void *arg);
+void candle_thread_join(candle_thread_t thread);
+
+/* run fn exactly once per once (set to CANDLE_ONCE_INIT), however many
+   threads get here at the same time */
+void candle_once(candle_once_t *once, void (*fn)(void));
+
+void candle_mutex_init(candle_mutex_t *mutex);
+void candle_mutex_destroy(candle_mutex_t *mutex);
+void candle_mutex_lock(candle_mutex_t *mutex);
+void candle_mutex_unlock(candle_mutex_t *mutex);
+
+void candle_cond_init(candle_cond_t *cond);
+void candle_cond_destroy(candle_cond_t *cond);
+void candle_cond_broadcast(candle_cond_t *cond);
+/* returns false if timeout_ms elapsed without a wakeup */
+bool candle_cond_wait(candle_cond_t *cond, candle_mutex_t *mutex, uint32_t timeout_ms);
+
+void candle_sleep_ms(uint32_t ms);
+/* host monotonic clock (CLOCK_MONOTONIC / QueryPerformanceCounter) */
+uint64_t candle_time_ns(void);
+
+/* size bytes aligned to align (a power of two), released by candle_aligned_free() */
+void *candle_aligned_alloc(size_t size, size_t align);
+void candle_aligned_free(void *p);
+
+/* a whole file mapped read-only; the file itself is not kept open */
+typedef struct {
+    const void *data;       /* NULL for an empty file */
+    uint64_t size;
+#ifdef _WIN32
+    HANDLE mapping;
+#endif
+} candle_file_map_t;
+
+bool candle_file_map(candle_file_map_t *map, const char *path);
+/* safe on a map that is empty or zeroed */
+void candle_file_unmap(candle_file_map_t *map);
+
+typedef enum {
+    CANDLE_ISA_SCALAR,
+    CANDLE_ISA_SSSE3,
+    CANDLE_ISA_AVX2
+} candle_isa_t;
+
+/* best vector extension the cpu has for the batch kernels, capped by candle_set_isa() */
+candle_isa_t candle_cpu_isa(void);
+/* cap the kernels used from now on, to compare them against each other */
+void candle_set_isa(candle_isa_t isa);
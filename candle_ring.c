@@ -0,0 +1,104 @@
+#include "candle_ring.h"
+#include <stdlib.h>
+#include <string.h>
+
+bool candle_ring_init(candle_ring_t *ring, uint32_t size)
+{
+    memset(ring, 0, sizeof(*ring));
+
+    uint32_t n = 1;
+    while (n < size) {
+        n <<= 1;
+    }
+
+    ring->slots = calloc(n, sizeof(candle_frame_t));
+    if (ring->slots == NULL) {
+        return false;
+    }
+    ring->mask = n - 1;
+
+    candle_mutex_init(&ring->lock);
+    candle_cond_init(&ring->cond);
+    return true;
+}
+
+void candle_ring_free(candle_ring_t *ring)
+{
+    if (ring->slots != NULL) {
+        candle_cond_destroy(&ring->cond);
+        candle_mutex_destroy(&ring->lock);
+        free(ring->slots);
+        ring->slots = NULL;
+    }
+}
+
+bool candle_ring_push(candle_ring_t *ring, const candle_frame_t *frame)
+{
+    uint32_t head = ring->head;
+    uint32_t tail = candle_atomic_load(&ring->tail);
+
+    if (head - tail > ring->mask) {
+        candle_atomic_store(&ring->overflows, ring->overflows + 1);
+        return false;
+    }
+
+    memcpy(&ring->slots[head & ring->mask], frame, sizeof(candle_frame_t));
+    candle_atomic_store(&ring->head, head + 1);
+    candle_atomic_store(&ring->pushed, ring->pushed + 1);
+    return true;
+}
+
+void candle_ring_wake(candle_ring_t *ring)
+{
+    /* pairs with the waiting flag store in candle_ring_wait() */
+    candle_atomic_fence();
+    if (__atomic_load_n(&ring->waiting, __ATOMIC_RELAXED)) {
+        candle_mutex_lock(&ring->lock);
+        candle_cond_broadcast(&ring->cond);
+        candle_mutex_unlock(&ring->lock);
+    }
+}
+
+uint32_t candle_ring_pop(candle_ring_t *ring, candle_frame_t *frames, uint32_t max)
+{
+    uint32_t tail = ring->tail;
+    uint32_t avail = candle_atomic_load(&ring->head) - tail;
+    uint32_t n = (avail < max) ? avail : max;
+
+    for (uint32_t i=0; i<n; i++) {
+        memcpy(&frames[i], &ring->slots[(tail + i) & ring->mask], sizeof(candle_frame_t));
+    }
+
+    candle_atomic_store(&ring->tail, tail + n);
+    return n;
+}
+
+static bool candle_ring_waited_enough(candle_ring_t *ring, const uint32_t *error)
+{
+    return (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != ring->tail)
+        || ( (error != NULL) && (__atomic_load_n(error, __ATOMIC_SEQ_CST) != 0) );
+}
+
+bool candle_ring_wait(candle_ring_t *ring, const uint32_t *error, uint32_t timeout_ms)
+{
+    if (candle_atomic_load(&ring->head) != ring->tail) {
+        return true;
+    }
+
+    uint64_t deadline = candle_time_ns() + (uint64_t)timeout_ms * 1000000;
+    candle_mutex_lock(&ring->lock);
+    __atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+
+    /* a wakeup may be spurious, or meant for frames already popped */
+    while (!candle_ring_waited_enough(ring, error)) {
+        uint64_t now = candle_time_ns();
+        if (now >= deadline) {
+            break;
+        }
+        candle_cond_wait(&ring->cond, &ring->lock, (uint32_t)((deadline - now + 999999) / 1000000));
+    }
+
+    __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+    candle_mutex_unlock(&ring->lock);
+    return candle_atomic_load(&ring->head) != ring->tail;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "candle.h"
+#include "candle_os.h"
+
+#define CANDLE_RING_SIZE_MAX (1u<<20)
+
+/* Lock-free single-producer/single-consumer frame ring. Producer and consumer
+ * indices live on separate cache lines; the mutex/cond pair is only used to
+ * park a consumer that waits on an empty ring.
+ */
+typedef struct {
+    uint32_t head;          /* written by the producer only */
+    uint64_t pushed;
+    uint64_t overflows;
+    uint8_t pad_producer[CANDLE_CACHE_LINE];
+
+    uint32_t tail;          /* written by the consumer only */
+    uint8_t pad_consumer[CANDLE_CACHE_LINE];
+
+    uint32_t mask;
+    candle_frame_t *slots;
+
+    uint32_t waiting;
+    candle_mutex_t lock;
+    candle_cond_t cond;
+} candle_ring_t;
+
+/* size is rounded up to a power of two */
+bool candle_ring_init(candle_ring_t *ring, uint32_t size);
+void candle_ring_free(candle_ring_t *ring);
+
+/* producer side; returns false and counts an overflow if the ring is full */
+bool candle_ring_push(candle_ring_t *ring, const candle_frame_t *frame);
+/* producer side; wake a waiting consumer after one or more pushes */
+void candle_ring_wake(candle_ring_t *ring);
+
+/* consumer side */
+uint32_t candle_ring_pop(candle_ring_t *ring, candle_frame_t *frames, uint32_t max);
+/* consumer side; waits up to timeout_ms for the ring to fill, returns false
+   if it is still empty. A wakeup that brings no frames keeps the wait going
+   unless *error (if not NULL) has been set non-zero before it. */
+bool candle_ring_wait(candle_ring_t *ring, const uint32_t *error, uint32_t timeout_ms);
@@ -0,0 +1,82 @@
+#include "candle_rx_parse.h"
+#include <stddef.h>
+#include <string.h>
+
+void candle_rx_parser_init(candle_rx_parser_t *parser, uint8_t num_channels)
+{
+    parser->partial_len = 0;
+    parser->num_channels = num_channels;
+    parser->invalid = 0;
+}
+
+void candle_rx_parser_reset(candle_rx_parser_t *parser)
+{
+    parser->partial_len = 0;
+}
+
+bool candle_rx_record_valid(const candle_rx_parser_t *parser, const uint8_t *rec)
+{
+    return (rec[offsetof(candle_frame_t, can_dlc)] <= 8)
+        && (rec[offsetof(candle_frame_t, channel)] < parser->num_channels);
+}
+
+uint32_t candle_rx_parse_max_frames(uint32_t len)
+{
+    /* a kept partial record can complete one more frame */
+    return (len + sizeof(candle_frame_t) - 1) / sizeof(candle_frame_t);
+}
+
+void candle_rx_parse_span(candle_rx_parser_t *parser, const uint8_t *buf, uint32_t len, candle_frame_t *stitched, candle_rx_span_t *span)
+{
+    uint32_t pos = 0;
+    span->stitched = false;
+
+    if (parser->partial_len > 0) {
+        uint32_t missing = sizeof(candle_frame_t) - parser->partial_len;
+        if (len < missing) {
+            memcpy(&parser->partial[parser->partial_len], buf, len);
+            parser->partial_len += len;
+            span->offset = len;
+            span->count = 0;
+            return;
+        }
+
+        memcpy(&parser->partial[parser->partial_len], buf, missing);
+        parser->partial_len = 0;
+        pos = missing;
+        if (candle_rx_record_valid(parser, parser->partial)) {
+            memcpy(stitched, parser->partial, sizeof(candle_frame_t));
+            span->stitched = true;
+        } else {
+            parser->invalid++;
+        }
+    }
+
+    span->offset = pos;
+    span->count = 0;
+    for (; len - pos >= sizeof(candle_frame_t); pos += sizeof(candle_frame_t)) {
+        if (!candle_rx_record_valid(parser, &buf[pos])) {
+            /* nothing after this can be trusted to be in step */
+            parser->invalid += (len - pos) / sizeof(candle_frame_t);
+            return;
+        }
+        span->count++;
+    }
+
+    memcpy(parser->partial, &buf[pos], len - pos);
+    parser->partial_len = len - pos;
+}
+
+uint32_t candle_rx_parse(candle_rx_parser_t *parser, const uint8_t *buf, uint32_t len, candle_frame_t *frames)
+{
+    candle_rx_span_t span;
+    uint32_t num_frames = 0;
+
+    candle_rx_parse_span(parser, buf, len, &frames[0], &span);
+    if (span.stitched) {
+        num_frames++;
+    }
+
+    memcpy(&frames[num_frames], &buf[span.offset], span.count * sizeof(candle_frame_t));
+    return num_frames + span.count;
+}
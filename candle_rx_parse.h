@@ -0,0 +1,43 @@
+#pragma once
+
+#include "candle.h"
+
+/* Splits a stream of concatenated candle_frame_t records, as delivered by
+ * bulk-IN transfers in packed RX mode, into individual frames. A record cut
+ * off at the end of one transfer is kept and completed by the next one.
+ *
+ * A record whose header can't be right (dlc above 8, channel beyond the
+ * device's) means the stream is out of step: it is dropped together with the
+ * rest of its transfer and any kept partial record, and counted in invalid.
+ */
+typedef struct {
+    uint8_t partial[sizeof(candle_frame_t)];
+    uint32_t partial_len;
+    uint8_t num_channels;
+    uint32_t invalid;   /* records dropped for a bad header */
+} candle_rx_parser_t;
+
+/* where the frames of one transfer live, see candle_rx_parse_span() */
+typedef struct {
+    bool stitched;      /* a kept partial record was completed into the stitched frame */
+    uint32_t offset;    /* byte offset of the first whole record in buf */
+    uint32_t count;     /* number of whole records starting at offset */
+} candle_rx_span_t;
+
+void candle_rx_parser_init(candle_rx_parser_t *parser, uint8_t num_channels);
+
+/* forget a kept partial record */
+void candle_rx_parser_reset(candle_rx_parser_t *parser);
+
+/* check the header of the record at rec, which need not be aligned */
+bool candle_rx_record_valid(const candle_rx_parser_t *parser, const uint8_t *rec);
+
+/* max number of frames candle_rx_parse() can produce from len bytes */
+uint32_t candle_rx_parse_max_frames(uint32_t len);
+
+/* locate the frames in len bytes of buf without copying them out; only a
+   record completed from a kept partial one is assembled into stitched */
+void candle_rx_parse_span(candle_rx_parser_t *parser, const uint8_t *buf, uint32_t len, candle_frame_t *stitched, candle_rx_span_t *span);
+
+/* parse len bytes of buf into frames, returns the number of frames written */
+uint32_t candle_rx_parse(candle_rx_parser_t *parser, const uint8_t *buf, uint32_t len, candle_frame_t *frames);
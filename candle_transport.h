@@ -0,0 +1,57 @@
+#pragma once
+
+#include "candle_defs.h"
+
+/* A transport moves bytes between the candle core and the USB stack.
+ * All functions report failures through dev->last_error (or list->last_error
+ * for scan) and return false, except for the read path which may run on the
+ * RX thread and therefore returns its error code instead.
+ */
+typedef struct candle_transport {
+    const char *name;
+
+    /* add every present device with candle_list_add() */
+    bool (*scan)(candle_list_t *list);
+
+    /* open the device at dev->path, locate the bulk pipes and set dev->interfaceNumber;
+       per-urb state is sized from dev->opts.rx_urb_count. With dev->probing
+       set the device is only looked at and must not be taken from another
+       driver. */
+    bool (*open)(candle_device_t *dev);
+    /* cancel outstanding reads and release everything acquired by open */
+    bool (*close)(candle_device_t *dev);
+
+    /* on failure last_error is CANDLE_ERR_DEVICE_GONE for an unplugged device,
+       any other failure is left to the caller to name */
+    bool (*control)(candle_device_t *dev, uint8_t request, uint8_t requesttype, uint16_t value, uint16_t index, void *data, uint16_t size);
+    /* blocking bulk-OUT write; *written is set to the bytes accepted by the device, also on failure */
+    bool (*write)(candle_device_t *dev, const void *data, uint32_t size, uint32_t *written);
+
+    /* prepare num_slots background writes, called once after open */
+    bool (*alloc_writes)(candle_device_t *dev, unsigned num_slots);
+    /* queue a bulk-OUT write of data that completes in the background and is
+       reported through candle_tx_complete(); data stays valid until then */
+    candle_err_t (*submit_write)(candle_device_t *dev, unsigned slot, const void *data, uint32_t size);
+
+    /* queue a bulk-IN read of dev->opts.rx_urb_size bytes into dev->rxurbs[urb_num].buf */
+    candle_err_t (*submit_read)(candle_device_t *dev, unsigned urb_num);
+    /* wait for completed reads and mark them as done, in any order; writes
+       that complete on the same queue are reported from here as well */
+    candle_err_t (*reap)(candle_device_t *dev, uint32_t timeout_ms);
+} candle_transport_t;
+
+#if defined(CANDLE_TRANSPORT_FAKE)
+/* test builds, see tests/fake_transport.c */
+extern const candle_transport_t candle_transport_fake;
+#elif defined(_WIN32)
+extern const candle_transport_t candle_transport_winusb;
+#else
+extern const candle_transport_t candle_transport_libusb;
+#endif
+
+const candle_transport_t *candle_transport_default(void);
+/* called by the transport when a write queued by submit_write has finished */
+void candle_tx_complete(candle_device_t *dev, unsigned slot, bool ok);
+bool candle_list_scan_transport(candle_list_handle *list, const candle_transport_t *transport);
+/* called by the transport's scan for each device found; sets list->last_error on failure */
+bool candle_list_add(candle_list_t *list, const wchar_t *path);
@@ -0,0 +1,644 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "candle_transport.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <libusb.h>
+
+#define CANDLE_LIBUSB_CTRL_TIMEOUT_MS  1000
+#define CANDLE_LIBUSB_WRITE_TIMEOUT_MS 1000
+#define CANDLE_LIBUSB_EVENT_POLL_US    100000
+#define CANDLE_LIBUSB_MAX_PORTS        7
+
+static const struct {
+    uint16_t vid;
+    uint16_t pid;
+} candle_libusb_ids[] = {
+    { 0x1d50, 0x606f }, /* candleLight / Geschwister Schneider USB/CAN */
+    { 0x1209, 0x2323 }, /* candleLight firmware on pid.codes */
+    { 0x1cd2, 0x606f }, /* CES CANext FD */
+    { 0x16d0, 0x10b8 }, /* ABE CANdebugger FD */
+};
+
+struct candle_libusb;
+
+typedef struct {
+    struct candle_libusb *u;
+    unsigned urb_num;
+    struct libusb_transfer *xfer;
+    bool in_flight;
+    enum libusb_transfer_status status;
+    uint32_t actual_length;
+} candle_libusb_urb_t;
+
+typedef struct {
+    struct candle_libusb *u;
+    candle_device_t *dev;
+    unsigned slot;
+    struct libusb_transfer *xfer;
+    bool in_flight;
+} candle_libusb_tx_t;
+
+typedef struct candle_libusb {
+    libusb_device_handle *handle;
+    uint8_t ep_in;
+    uint8_t ep_out;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    unsigned num_urbs;
+    candle_libusb_urb_t *urbs;
+
+    /* urb numbers in completion order, filled by the event thread */
+    unsigned *completed;
+    unsigned completed_head;
+    unsigned num_completed;
+
+    unsigned num_tx;
+    candle_libusb_tx_t *tx;
+
+    bool unclaimed;     /* probed while bound to the kernel driver */
+} candle_libusb_t;
+
+/* one context and one event thread serve every open device */
+static pthread_mutex_t candle_libusb_ctx_lock = PTHREAD_MUTEX_INITIALIZER;
+static libusb_context *candle_libusb_ctx = NULL;
+static unsigned candle_libusb_open_count = 0;
+static pthread_t candle_libusb_event_thread;
+static volatile bool candle_libusb_event_run = false;
+
+static libusb_context *candle_libusb_get_ctx(void)
+{
+    pthread_mutex_lock(&candle_libusb_ctx_lock);
+    if (candle_libusb_ctx == NULL) {
+        if (libusb_init(&candle_libusb_ctx) != LIBUSB_SUCCESS) {
+            candle_libusb_ctx = NULL;
+        }
+    }
+    libusb_context *ctx = candle_libusb_ctx;
+    pthread_mutex_unlock(&candle_libusb_ctx_lock);
+    return ctx;
+}
+
+static void *candle_libusb_event_loop(void *arg)
+{
+    libusb_context *ctx = (libusb_context*)arg;
+    while (__atomic_load_n(&candle_libusb_event_run, __ATOMIC_ACQUIRE)) {
+        struct timeval tv = { 0, CANDLE_LIBUSB_EVENT_POLL_US };
+        libusb_handle_events_timeout_completed(ctx, &tv, NULL);
+    }
+    return NULL;
+}
+
+static bool candle_libusb_event_thread_get(void)
+{
+    bool rc = true;
+    pthread_mutex_lock(&candle_libusb_ctx_lock);
+    if (candle_libusb_open_count == 0) {
+        candle_libusb_event_run = true;
+        if (pthread_create(&candle_libusb_event_thread, NULL, candle_libusb_event_loop, candle_libusb_ctx) != 0) {
+            candle_libusb_event_run = false;
+            rc = false;
+        }
+    }
+    if (rc) {
+        candle_libusb_open_count++;
+    }
+    pthread_mutex_unlock(&candle_libusb_ctx_lock);
+    return rc;
+}
+
+static void candle_libusb_event_thread_put(void)
+{
+    pthread_mutex_lock(&candle_libusb_ctx_lock);
+    if (--candle_libusb_open_count == 0) {
+        __atomic_store_n(&candle_libusb_event_run, false, __ATOMIC_RELEASE);
+        pthread_join(candle_libusb_event_thread, NULL);
+    }
+    pthread_mutex_unlock(&candle_libusb_ctx_lock);
+}
+
+static bool candle_libusb_is_candle(libusb_device *udev)
+{
+    struct libusb_device_descriptor desc;
+    if (libusb_get_device_descriptor(udev, &desc) != LIBUSB_SUCCESS) {
+        return false;
+    }
+
+    for (unsigned i=0; i<sizeof(candle_libusb_ids)/sizeof(candle_libusb_ids[0]); i++) {
+        if ( (desc.idVendor == candle_libusb_ids[i].vid) && (desc.idProduct == candle_libusb_ids[i].pid) ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* the path identifies the physical port: "usb:<bus>-<port>.<port>..." */
+static bool candle_libusb_get_path(libusb_device *udev, wchar_t *path, size_t path_len)
+{
+    uint8_t ports[CANDLE_LIBUSB_MAX_PORTS];
+    int num_ports = libusb_get_port_numbers(udev, ports, sizeof(ports));
+    if (num_ports < 0) {
+        return false;
+    }
+
+    int len = swprintf(path, path_len, L"usb:%u", libusb_get_bus_number(udev));
+    for (int i=0; (i<num_ports) && (len>0); i++) {
+        int n = swprintf(path+len, path_len-len, (i==0) ? L"-%u" : L".%u", ports[i]);
+        len = (n<0) ? n : len+n;
+    }
+    return len > 0;
+}
+
+static bool candle_libusb_scan(candle_list_t *l)
+{
+    libusb_context *ctx = candle_libusb_get_ctx();
+    if (ctx == NULL) {
+        l->last_error = CANDLE_ERR_GET_DEVICES;
+        return false;
+    }
+
+    libusb_device **udevs;
+    ssize_t count = libusb_get_device_list(ctx, &udevs);
+    if (count < 0) {
+        l->last_error = CANDLE_ERR_GET_DEVICES;
+        return false;
+    }
+
+    bool rv = true;
+    for (ssize_t i=0; (i<count) && (l->num_devices<CANDLE_MAX_DEVICES); i++) {
+        if (!candle_libusb_is_candle(udevs[i])) {
+            continue;
+        }
+
+        wchar_t path[256];
+        if (!candle_libusb_get_path(udevs[i], path, sizeof(path)/sizeof(path[0]))) {
+            l->last_error = CANDLE_ERR_PATH_LEN;
+            rv = false;
+            break;
+        }
+        if (!candle_list_add(l, path)) {
+            rv = false;
+            break;
+        }
+    }
+
+    libusb_free_device_list(udevs, 1);
+
+    if (rv) {
+        l->last_error = CANDLE_ERR_OK;
+    }
+    return rv;
+}
+
+static libusb_device *candle_libusb_find_device(libusb_context *ctx, const wchar_t *path)
+{
+    libusb_device **udevs;
+    ssize_t count = libusb_get_device_list(ctx, &udevs);
+    if (count < 0) {
+        return NULL;
+    }
+
+    libusb_device *found = NULL;
+    for (ssize_t i=0; i<count; i++) {
+        wchar_t udev_path[256];
+        if (candle_libusb_is_candle(udevs[i])
+         && candle_libusb_get_path(udevs[i], udev_path, sizeof(udev_path)/sizeof(udev_path[0]))
+         && (wcscmp(udev_path, path) == 0)) {
+            found = libusb_ref_device(udevs[i]);
+            break;
+        }
+    }
+
+    libusb_free_device_list(udevs, 1);
+    return found;
+}
+
+static bool candle_libusb_find_pipes(candle_device_t *dev, candle_libusb_t *u, libusb_device *udev)
+{
+    struct libusb_config_descriptor *config;
+    if (libusb_get_active_config_descriptor(udev, &config) != LIBUSB_SUCCESS) {
+        dev->last_error = CANDLE_ERR_QUERY_INTERFACE;
+        return false;
+    }
+
+    bool found = false;
+    for (uint8_t i=0; (i<config->bNumInterfaces) && !found; i++) {
+        if (config->interface[i].num_altsetting < 1) {
+            continue;
+        }
+
+        const struct libusb_interface_descriptor *iface = &config->interface[i].altsetting[0];
+        if (iface->bInterfaceClass != LIBUSB_CLASS_VENDOR_SPEC) {
+            continue;
+        }
+
+        unsigned pipes_found = 0;
+        for (uint8_t e=0; e<iface->bNumEndpoints; e++) {
+            const struct libusb_endpoint_descriptor *ep = &iface->endpoint[e];
+            if ((ep->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) != LIBUSB_TRANSFER_TYPE_BULK) {
+                continue;
+            }
+            if (ep->bEndpointAddress & LIBUSB_ENDPOINT_IN) {
+                u->ep_in = ep->bEndpointAddress;
+            } else {
+                u->ep_out = ep->bEndpointAddress;
+            }
+            pipes_found++;
+        }
+
+        if (pipes_found == 2) {
+            dev->interfaceNumber = iface->bInterfaceNumber;
+            found = true;
+        }
+    }
+
+    libusb_free_config_descriptor(config);
+
+    if (!found) {
+        dev->last_error = CANDLE_ERR_PARSE_IF_DESCR;
+    }
+    return found;
+}
+
+static void LIBUSB_CALL candle_libusb_rx_callback(struct libusb_transfer *xfer)
+{
+    candle_libusb_urb_t *urb = (candle_libusb_urb_t*)xfer->user_data;
+    candle_libusb_t *u = urb->u;
+
+    pthread_mutex_lock(&u->lock);
+    urb->in_flight = false;
+    urb->status = xfer->status;
+    urb->actual_length = xfer->actual_length;
+    u->completed[(u->completed_head + u->num_completed) % u->num_urbs] = urb->urb_num;
+    u->num_completed++;
+    pthread_cond_broadcast(&u->cond);
+    pthread_mutex_unlock(&u->lock);
+}
+
+static void candle_libusb_free_urbs(candle_libusb_t *u)
+{
+    for (unsigned i=0; i<u->num_urbs; i++) {
+        if (u->urbs[i].xfer != NULL) {
+            libusb_free_transfer(u->urbs[i].xfer);
+        }
+    }
+    free(u->urbs);
+    free(u->completed);
+    u->urbs = NULL;
+    u->completed = NULL;
+    u->num_urbs = 0;
+
+    for (unsigned i=0; i<u->num_tx; i++) {
+        if (u->tx[i].xfer != NULL) {
+            libusb_free_transfer(u->tx[i].xfer);
+        }
+    }
+    free(u->tx);
+    u->tx = NULL;
+    u->num_tx = 0;
+}
+
+static bool candle_libusb_open_device(candle_device_t *dev)
+{
+    libusb_context *ctx = candle_libusb_get_ctx();
+    if (ctx == NULL) {
+        dev->last_error = CANDLE_ERR_GET_DEVICES;
+        return false;
+    }
+
+    candle_libusb_t *u = calloc(1, sizeof(candle_libusb_t));
+    if (u == NULL) {
+        dev->last_error = CANDLE_ERR_MALLOC;
+        return false;
+    }
+
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&u->cond, &cattr);
+    pthread_condattr_destroy(&cattr);
+    pthread_mutex_init(&u->lock, NULL);
+
+    libusb_device *udev = candle_libusb_find_device(ctx, dev->path);
+    if (udev == NULL) {
+        dev->last_error = CANDLE_ERR_CREATE_FILE;
+        goto free_data;
+    }
+
+    int rc = libusb_open(udev, &u->handle);
+    if (rc != LIBUSB_SUCCESS) {
+        libusb_unref_device(udev);
+        dev->last_error = CANDLE_ERR_CREATE_FILE;
+        goto free_data;
+    }
+
+    bool pipes_ok = candle_libusb_find_pipes(dev, u, udev);
+    libusb_unref_device(udev);
+    if (!pipes_ok) {
+        goto close_handle;
+    }
+
+    /* the gs_usb kernel driver binds to the same devices. Only a real open
+       takes the device from it, a probe leaves it bound: the device counts
+       as available and its descriptors are read once it is opened. */
+    if (!dev->probing) {
+        libusb_set_auto_detach_kernel_driver(u->handle, 1);
+    } else if (libusb_kernel_driver_active(u->handle, dev->interfaceNumber) == 1) {
+        u->unclaimed = true;
+    }
+    if ( !u->unclaimed && (libusb_claim_interface(u->handle, dev->interfaceNumber) != LIBUSB_SUCCESS) ) {
+        dev->last_error = CANDLE_ERR_CLAIM_INTERFACE;
+        goto close_handle;
+    }
+
+    u->urbs = calloc(dev->opts.rx_urb_count, sizeof(candle_libusb_urb_t));
+    u->completed = calloc(dev->opts.rx_urb_count, sizeof(unsigned));
+    if ( (u->urbs == NULL) || (u->completed == NULL) ) {
+        dev->last_error = CANDLE_ERR_MALLOC;
+        goto free_urbs;
+    }
+    u->num_urbs = dev->opts.rx_urb_count;
+
+    for (unsigned i=0; i<u->num_urbs; i++) {
+        u->urbs[i].u = u;
+        u->urbs[i].urb_num = i;
+        u->urbs[i].xfer = libusb_alloc_transfer(0);
+        if (u->urbs[i].xfer == NULL) {
+            dev->last_error = CANDLE_ERR_MALLOC;
+            goto free_urbs;
+        }
+    }
+
+    if (!candle_libusb_event_thread_get()) {
+        dev->last_error = CANDLE_ERR_CREATE_THREAD;
+        goto free_urbs;
+    }
+
+    dev->transport_data = u;
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+
+free_urbs:
+    candle_libusb_free_urbs(u);
+    if (!u->unclaimed) {
+        libusb_release_interface(u->handle, dev->interfaceNumber);
+    }
+
+close_handle:
+    libusb_close(u->handle);
+
+free_data:
+    pthread_cond_destroy(&u->cond);
+    pthread_mutex_destroy(&u->lock);
+    free(u);
+    return false;
+}
+
+static bool candle_libusb_close_device(candle_device_t *dev)
+{
+    candle_libusb_t *u = (candle_libusb_t*)dev->transport_data;
+    if (u == NULL) {
+        return true;
+    }
+
+    /* cancel everything in flight and let the event thread deliver the callbacks */
+    pthread_mutex_lock(&u->lock);
+    for (unsigned i=0; i<u->num_urbs; i++) {
+        if (u->urbs[i].in_flight) {
+            libusb_cancel_transfer(u->urbs[i].xfer);
+        }
+    }
+    for (unsigned i=0; i<u->num_tx; i++) {
+        if (u->tx[i].in_flight) {
+            libusb_cancel_transfer(u->tx[i].xfer);
+        }
+    }
+    for (;;) {
+        bool busy = false;
+        for (unsigned i=0; i<u->num_urbs; i++) {
+            busy |= u->urbs[i].in_flight;
+        }
+        for (unsigned i=0; i<u->num_tx; i++) {
+            busy |= u->tx[i].in_flight;
+        }
+        if (!busy) {
+            break;
+        }
+        pthread_cond_wait(&u->cond, &u->lock);
+    }
+    pthread_mutex_unlock(&u->lock);
+
+    candle_libusb_event_thread_put();
+
+    candle_libusb_free_urbs(u);
+    if (!u->unclaimed) {
+        libusb_release_interface(u->handle, dev->interfaceNumber);
+    }
+    libusb_close(u->handle);
+
+    pthread_cond_destroy(&u->cond);
+    pthread_mutex_destroy(&u->lock);
+    free(u);
+    dev->transport_data = NULL;
+    return true;
+}
+
+/* an unplugged device gets its own error, everything else maps to fallback */
+static candle_err_t candle_libusb_error(int rc, candle_err_t fallback)
+{
+    if (rc == LIBUSB_SUCCESS) {
+        return CANDLE_ERR_OK;
+    }
+    return (rc == LIBUSB_ERROR_NO_DEVICE) ? CANDLE_ERR_DEVICE_GONE : fallback;
+}
+
+static bool candle_libusb_control(candle_device_t *dev, uint8_t request, uint8_t requesttype, uint16_t value, uint16_t index, void *data, uint16_t size)
+{
+    candle_libusb_t *u = (candle_libusb_t*)dev->transport_data;
+    if (u->unclaimed) {
+        /* the interface belongs to the kernel driver */
+        dev->last_error = CANDLE_ERR_CLAIM_INTERFACE;
+        return false;
+    }
+    int rc = libusb_control_transfer(u->handle, requesttype, request, value, index, (unsigned char*)data, size, CANDLE_LIBUSB_CTRL_TIMEOUT_MS);
+    if (rc < 0) {
+        /* the caller names the failure, unless the device is gone */
+        dev->last_error = candle_libusb_error(rc, dev->last_error);
+        return false;
+    }
+    return true;
+}
+
+static bool candle_libusb_write(candle_device_t *dev, const void *data, uint32_t size, uint32_t *written)
+{
+    candle_libusb_t *u = (candle_libusb_t*)dev->transport_data;
+
+    int transferred = 0;
+    int rc = libusb_bulk_transfer(u->handle, u->ep_out, (unsigned char*)data, size, &transferred, CANDLE_LIBUSB_WRITE_TIMEOUT_MS);
+    *written = (uint32_t)transferred;
+
+    bool ok = (rc == LIBUSB_SUCCESS) && ((uint32_t)transferred == size);
+    if (rc == LIBUSB_ERROR_NO_DEVICE) {
+        dev->last_error = CANDLE_ERR_DEVICE_GONE;
+    } else {
+        dev->last_error = ok ? CANDLE_ERR_OK : CANDLE_ERR_SEND_FRAME;
+    }
+    return ok;
+}
+
+static void LIBUSB_CALL candle_libusb_tx_callback(struct libusb_transfer *xfer)
+{
+    candle_libusb_tx_t *tx = (candle_libusb_tx_t*)xfer->user_data;
+    candle_libusb_t *u = tx->u;
+    bool ok = (xfer->status == LIBUSB_TRANSFER_COMPLETED) && (xfer->actual_length == xfer->length);
+
+    /* still under the lock, so close can't return while the slot is released */
+    pthread_mutex_lock(&u->lock);
+    tx->in_flight = false;
+    candle_tx_complete(tx->dev, tx->slot, ok);
+    pthread_cond_broadcast(&u->cond);
+    pthread_mutex_unlock(&u->lock);
+}
+
+static bool candle_libusb_alloc_writes(candle_device_t *dev, unsigned num_slots)
+{
+    candle_libusb_t *u = (candle_libusb_t*)dev->transport_data;
+
+    u->tx = calloc(num_slots, sizeof(candle_libusb_tx_t));
+    if (u->tx == NULL) {
+        dev->last_error = CANDLE_ERR_MALLOC;
+        return false;
+    }
+    u->num_tx = num_slots;
+
+    for (unsigned i=0; i<num_slots; i++) {
+        u->tx[i].u = u;
+        u->tx[i].dev = dev;
+        u->tx[i].slot = i;
+        u->tx[i].xfer = libusb_alloc_transfer(0);
+        if (u->tx[i].xfer == NULL) {
+            dev->last_error = CANDLE_ERR_MALLOC;
+            return false; // freed on close
+        }
+    }
+
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+static candle_err_t candle_libusb_submit_write(candle_device_t *dev, unsigned slot, const void *data, uint32_t size)
+{
+    candle_libusb_t *u = (candle_libusb_t*)dev->transport_data;
+    candle_libusb_tx_t *tx = &u->tx[slot];
+
+    pthread_mutex_lock(&u->lock);
+    libusb_fill_bulk_transfer(
+        tx->xfer,
+        u->handle,
+        u->ep_out,
+        (unsigned char*)data,
+        size,
+        candle_libusb_tx_callback,
+        tx,
+        CANDLE_LIBUSB_WRITE_TIMEOUT_MS
+    );
+    tx->in_flight = true;
+    int rc = libusb_submit_transfer(tx->xfer);
+    if (rc != LIBUSB_SUCCESS) {
+        tx->in_flight = false;
+    }
+    pthread_mutex_unlock(&u->lock);
+
+    return candle_libusb_error(rc, CANDLE_ERR_SEND_FRAME);
+}
+
+static candle_err_t candle_libusb_submit_read(candle_device_t *dev, unsigned urb_num)
+{
+    candle_libusb_t *u = (candle_libusb_t*)dev->transport_data;
+    candle_libusb_urb_t *urb = &u->urbs[urb_num];
+
+    libusb_fill_bulk_transfer(
+        urb->xfer,
+        u->handle,
+        u->ep_in,
+        dev->rxurbs[urb_num].buf,
+        dev->opts.rx_urb_size,
+        candle_libusb_rx_callback,
+        urb,
+        0
+    );
+
+    pthread_mutex_lock(&u->lock);
+    urb->in_flight = true;
+    int rc = libusb_submit_transfer(urb->xfer);
+    if (rc != LIBUSB_SUCCESS) {
+        urb->in_flight = false;
+    }
+    pthread_mutex_unlock(&u->lock);
+
+    return candle_libusb_error(rc, CANDLE_ERR_PREPARE_READ);
+}
+
+static candle_err_t candle_libusb_reap(candle_device_t *dev, uint32_t timeout_ms)
+{
+    candle_libusb_t *u = (candle_libusb_t*)dev->transport_data;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&u->lock);
+    while (u->num_completed == 0) {
+        if (pthread_cond_timedwait(&u->cond, &u->lock, &deadline) == ETIMEDOUT) {
+            pthread_mutex_unlock(&u->lock);
+            return CANDLE_ERR_READ_TIMEOUT;
+        }
+    }
+
+    while (u->num_completed > 0) {
+        unsigned urb_num = u->completed[u->completed_head];
+        u->completed_head = (u->completed_head + 1) % u->num_urbs;
+        u->num_completed--;
+
+        candle_libusb_urb_t *urb = &u->urbs[urb_num];
+        canlde_rx_urb *rxurb = &dev->rxurbs[urb_num];
+        switch (urb->status) {
+            case LIBUSB_TRANSFER_COMPLETED:
+                rxurb->status = CANDLE_ERR_OK;
+                break;
+            case LIBUSB_TRANSFER_NO_DEVICE:
+                rxurb->status = CANDLE_ERR_DEVICE_GONE;
+                break;
+            default:
+                rxurb->status = CANDLE_ERR_READ_RESULT;
+                break;
+        }
+        rxurb->bytes_transfered = urb->actual_length;
+        rxurb->done = true;
+    }
+    pthread_mutex_unlock(&u->lock);
+
+    return CANDLE_ERR_OK;
+}
+
+const candle_transport_t candle_transport_libusb = {
+    "libusb",
+    candle_libusb_scan,
+    candle_libusb_open_device,
+    candle_libusb_close_device,
+    candle_libusb_control,
+    candle_libusb_write,
+    candle_libusb_alloc_writes,
+    candle_libusb_submit_write,
+    candle_libusb_submit_read,
+    candle_libusb_reap
+};
@@ -0,0 +1,432 @@
+#include "candle_transport.h"
+#include <stdlib.h>
+
+#include <windows.h>
+#include <winbase.h>
+#include <winusb.h>
+#include <setupapi.h>
+#include <devguid.h>
+#include <regstr.h>
+
+#undef __CRT__NO_INLINE
+#include <strsafe.h>
+#define __CRT__NO_INLINE
+
+typedef struct {
+    HANDLE deviceHandle;
+    WINUSB_INTERFACE_HANDLE winUSBHandle;
+    UCHAR bulkInPipe;
+    UCHAR bulkOutPipe;
+
+    /* read completions are queued on a completion port, so the number of
+       outstanding reads is not limited by MAXIMUM_WAIT_OBJECTS */
+    HANDLE iocp;
+    unsigned num_urbs;
+    unsigned rx_in_flight;
+    OVERLAPPED *rxovl;
+
+    /* background writes complete on the same port; the count is shared
+       between the sending thread and the one reaping */
+    unsigned num_tx;
+    uint32_t tx_in_flight;
+    OVERLAPPED *txovl;
+} candle_winusb_t;
+
+#define CANDLE_WINUSB_REAP_BATCH 64
+#define CANDLE_WINUSB_CANCEL_TIMEOUT_MS 1000
+
+static bool candle_winusb_read_di(HDEVINFO hdi, SP_DEVICE_INTERFACE_DATA interfaceData, candle_list_t *l)
+{
+    /* get required length first (this call always fails with an error) */
+    ULONG requiredLength=0;
+    SetupDiGetDeviceInterfaceDetail(hdi, &interfaceData, NULL, 0, &requiredLength, NULL);
+    if (GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+        l->last_error = CANDLE_ERR_SETUPDI_IF_DETAILS;
+        return false;
+    }
+
+    PSP_DEVICE_INTERFACE_DETAIL_DATA detail_data =
+        (PSP_DEVICE_INTERFACE_DETAIL_DATA) LocalAlloc(LMEM_FIXED, requiredLength);
+
+    if (detail_data != NULL) {
+        detail_data->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
+    } else {
+        l->last_error = CANDLE_ERR_MALLOC;
+        return false;
+    }
+
+    bool retval = true;
+    wchar_t path[256];
+    ULONG length = requiredLength;
+    if (!SetupDiGetDeviceInterfaceDetail(hdi, &interfaceData, detail_data, length, &requiredLength, NULL) ) {
+        l->last_error = CANDLE_ERR_SETUPDI_IF_DETAILS2;
+        retval = false;
+    } else if (FAILED(StringCchCopy(path, sizeof(path)/sizeof(path[0]), detail_data->DevicePath))) {
+        l->last_error = CANDLE_ERR_PATH_LEN;
+        retval = false;
+    } else {
+        retval = candle_list_add(l, path);
+    }
+
+    LocalFree(detail_data);
+    return retval;
+}
+
+static bool candle_winusb_scan(candle_list_t *l)
+{
+    GUID guid;
+    if (CLSIDFromString(L"{c15b4308-04d3-11e6-b3ea-6057189e6443}", &guid) != NOERROR) {
+        l->last_error = CANDLE_ERR_CLSID;
+        return false;
+    }
+
+    HDEVINFO hdi = SetupDiGetClassDevs(&guid, NULL, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+    if (hdi == INVALID_HANDLE_VALUE) {
+        l->last_error = CANDLE_ERR_GET_DEVICES;
+        return false;
+    }
+
+    bool rv = false;
+    for (unsigned i=0; i<CANDLE_MAX_DEVICES; i++) {
+
+        SP_DEVICE_INTERFACE_DATA interfaceData;
+        interfaceData.cbSize = sizeof(SP_DEVICE_INTERFACE_DATA);
+
+        if (SetupDiEnumDeviceInterfaces(hdi, NULL, &guid, i, &interfaceData)) {
+
+            if (!candle_winusb_read_di(hdi, interfaceData, l)) {
+                rv = false;
+                break;
+            }
+
+        } else {
+
+            DWORD err = GetLastError();
+            if (err==ERROR_NO_MORE_ITEMS) {
+                l->last_error = CANDLE_ERR_OK;
+                rv = true;
+            } else {
+                l->last_error = CANDLE_ERR_SETUPDI_IF_ENUM;
+                rv = false;
+            }
+            break;
+
+        }
+
+    }
+
+    SetupDiDestroyDeviceInfoList(hdi);
+
+    return rv;
+}
+
+/* an unplugged device gets its own error, everything else maps to fallback */
+static candle_err_t candle_winusb_error(candle_err_t fallback)
+{
+    DWORD err = GetLastError();
+    if ( (err == ERROR_DEVICE_NOT_CONNECTED) || (err == ERROR_BAD_COMMAND) ) {
+        return CANDLE_ERR_DEVICE_GONE;
+    }
+    return fallback;
+}
+
+/* returns the urb number of an overlapped read or num_urbs if it is not one of ours
+   (synchronous WinUSB calls on the same handle may post completions as well) */
+static unsigned candle_winusb_urb_num(candle_winusb_t *w, LPOVERLAPPED ovl)
+{
+    if ( (ovl < w->rxovl) || (ovl >= &w->rxovl[w->num_urbs]) ) {
+        return w->num_urbs;
+    }
+    return (unsigned)(ovl - w->rxovl);
+}
+
+/* same for background writes, returns num_tx if ovl is not one */
+static unsigned candle_winusb_tx_slot(candle_winusb_t *w, LPOVERLAPPED ovl)
+{
+    if ( (w->txovl == NULL) || (ovl < w->txovl) || (ovl >= &w->txovl[w->num_tx]) ) {
+        return w->num_tx;
+    }
+    return (unsigned)(ovl - w->txovl);
+}
+
+static bool candle_winusb_open(candle_device_t *dev)
+{
+    candle_winusb_t *w = calloc(1, sizeof(candle_winusb_t));
+    if (w==NULL) {
+        dev->last_error = CANDLE_ERR_MALLOC;
+        return false;
+    }
+
+    w->num_urbs = dev->opts.rx_urb_count;
+    w->rxovl = calloc(w->num_urbs, sizeof(OVERLAPPED));
+    if (w->rxovl==NULL) {
+        dev->last_error = CANDLE_ERR_MALLOC;
+        goto free_data;
+    }
+
+    w->deviceHandle = CreateFile(
+        dev->path,
+        GENERIC_WRITE | GENERIC_READ,
+        FILE_SHARE_WRITE | FILE_SHARE_READ,
+        NULL,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED,
+        NULL
+    );
+
+    if (w->deviceHandle == INVALID_HANDLE_VALUE) {
+        dev->last_error = CANDLE_ERR_CREATE_FILE;
+        goto free_data;
+    }
+
+    if (!WinUsb_Initialize(w->deviceHandle, &w->winUSBHandle)) {
+        dev->last_error = CANDLE_ERR_WINUSB_INITIALIZE;
+        goto close_handle;
+    }
+
+    USB_INTERFACE_DESCRIPTOR ifaceDescriptor;
+    if (!WinUsb_QueryInterfaceSettings(w->winUSBHandle, 0, &ifaceDescriptor)) {
+        dev->last_error = CANDLE_ERR_QUERY_INTERFACE;
+        goto winusb_free;
+    }
+
+    dev->interfaceNumber = ifaceDescriptor.bInterfaceNumber;
+    unsigned pipes_found = 0;
+
+    for (uint8_t i=0; i<ifaceDescriptor.bNumEndpoints; i++) {
+
+        WINUSB_PIPE_INFORMATION pipeInfo;
+        if (!WinUsb_QueryPipe(w->winUSBHandle, 0, i, &pipeInfo)) {
+            dev->last_error = CANDLE_ERR_QUERY_PIPE;
+            goto winusb_free;
+        }
+
+        if (pipeInfo.PipeType == UsbdPipeTypeBulk && USB_ENDPOINT_DIRECTION_IN(pipeInfo.PipeId)) {
+            w->bulkInPipe = pipeInfo.PipeId;
+            pipes_found++;
+        } else if (pipeInfo.PipeType == UsbdPipeTypeBulk && USB_ENDPOINT_DIRECTION_OUT(pipeInfo.PipeId)) {
+            w->bulkOutPipe = pipeInfo.PipeId;
+            pipes_found++;
+        } else {
+            dev->last_error = CANDLE_ERR_PARSE_IF_DESCR;
+            goto winusb_free;
+        }
+
+    }
+
+    if (pipes_found != 2) {
+        dev->last_error = CANDLE_ERR_PARSE_IF_DESCR;
+        goto winusb_free;
+    }
+
+    w->iocp = CreateIoCompletionPort(w->deviceHandle, NULL, 0, 1);
+    if (w->iocp == NULL) {
+        dev->last_error = CANDLE_ERR_COMPLETION_PORT;
+        goto winusb_free;
+    }
+
+    dev->transport_data = w;
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+
+winusb_free:
+    WinUsb_Free(w->winUSBHandle);
+
+close_handle:
+    CloseHandle(w->deviceHandle);
+
+free_data:
+    free(w->rxovl);
+    free(w);
+    return false;
+}
+
+static bool candle_winusb_close(candle_device_t *dev)
+{
+    candle_winusb_t *w = (candle_winusb_t*)dev->transport_data;
+    if (w==NULL) {
+        return true;
+    }
+
+    /* the read and write buffers are freed after close, so wait until
+       every transfer is cancelled */
+    WinUsb_AbortPipe(w->winUSBHandle, w->bulkInPipe);
+    WinUsb_AbortPipe(w->winUSBHandle, w->bulkOutPipe);
+    while ( (w->rx_in_flight > 0) || (candle_atomic_load(&w->tx_in_flight) > 0) ) {
+        OVERLAPPED_ENTRY entries[CANDLE_WINUSB_REAP_BATCH];
+        ULONG num_entries = 0;
+        if (!GetQueuedCompletionStatusEx(w->iocp, entries, CANDLE_WINUSB_REAP_BATCH, &num_entries, CANDLE_WINUSB_CANCEL_TIMEOUT_MS, false)) {
+            break;
+        }
+        for (ULONG i=0; i<num_entries; i++) {
+            if (candle_winusb_urb_num(w, entries[i].lpOverlapped) < w->num_urbs) {
+                w->rx_in_flight--;
+            } else if (candle_winusb_tx_slot(w, entries[i].lpOverlapped) < w->num_tx) {
+                __atomic_fetch_sub(&w->tx_in_flight, 1, __ATOMIC_ACQ_REL);
+            }
+        }
+    }
+
+    WinUsb_Free(w->winUSBHandle);
+    CloseHandle(w->deviceHandle);
+    CloseHandle(w->iocp);
+
+    free(w->rxovl);
+    free(w->txovl);
+    free(w);
+    dev->transport_data = NULL;
+    return true;
+}
+
+static bool candle_winusb_control(candle_device_t *dev, uint8_t request, uint8_t requesttype, uint16_t value, uint16_t index, void *data, uint16_t size)
+{
+    candle_winusb_t *w = (candle_winusb_t*)dev->transport_data;
+
+    WINUSB_SETUP_PACKET packet;
+    memset(&packet, 0, sizeof(packet));
+
+    packet.Request = request;
+    packet.RequestType = requesttype;
+    packet.Value = value;
+    packet.Index = index;
+    packet.Length = size;
+
+    unsigned long bytes_sent = 0;
+    bool rc = WinUsb_ControlTransfer(w->winUSBHandle, packet, (uint8_t*)data, size, &bytes_sent, 0);
+    if (!rc) {
+        /* the caller names the failure, unless the device is gone */
+        dev->last_error = candle_winusb_error(dev->last_error);
+    }
+    return rc;
+}
+
+static bool candle_winusb_write(candle_device_t *dev, const void *data, uint32_t size, uint32_t *written)
+{
+    candle_winusb_t *w = (candle_winusb_t*)dev->transport_data;
+
+    unsigned long bytes_sent = 0;
+
+    bool rc = WinUsb_WritePipe(
+        w->winUSBHandle,
+        w->bulkOutPipe,
+        (uint8_t*)data,
+        size,
+        &bytes_sent,
+        0
+    );
+    *written = bytes_sent;
+
+    dev->last_error = rc ? CANDLE_ERR_OK : candle_winusb_error(CANDLE_ERR_SEND_FRAME);
+    return rc;
+}
+
+static bool candle_winusb_alloc_writes(candle_device_t *dev, unsigned num_slots)
+{
+    candle_winusb_t *w = (candle_winusb_t*)dev->transport_data;
+
+    w->txovl = calloc(num_slots, sizeof(OVERLAPPED));
+    if (w->txovl == NULL) {
+        dev->last_error = CANDLE_ERR_MALLOC;
+        return false;
+    }
+    w->num_tx = num_slots;
+
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+static candle_err_t candle_winusb_submit_write(candle_device_t *dev, unsigned slot, const void *data, uint32_t size)
+{
+    candle_winusb_t *w = (candle_winusb_t*)dev->transport_data;
+
+    memset(&w->txovl[slot], 0, sizeof(OVERLAPPED));
+    __atomic_fetch_add(&w->tx_in_flight, 1, __ATOMIC_ACQ_REL);
+
+    /* the completion is queued on the port even if the write finishes at once */
+    bool rc = WinUsb_WritePipe(
+        w->winUSBHandle,
+        w->bulkOutPipe,
+        (uint8_t*)data,
+        size,
+        NULL,
+        &w->txovl[slot]
+    );
+
+    if (!rc && (GetLastError()!=ERROR_IO_PENDING)) {
+        __atomic_fetch_sub(&w->tx_in_flight, 1, __ATOMIC_ACQ_REL);
+        return candle_winusb_error(CANDLE_ERR_SEND_FRAME);
+    }
+    return CANDLE_ERR_OK;
+}
+
+static candle_err_t candle_winusb_submit_read(candle_device_t *dev, unsigned urb_num)
+{
+    candle_winusb_t *w = (candle_winusb_t*)dev->transport_data;
+
+    bool rc = WinUsb_ReadPipe(
+        w->winUSBHandle,
+        w->bulkInPipe,
+        dev->rxurbs[urb_num].buf,
+        dev->opts.rx_urb_size,
+        NULL,
+        &w->rxovl[urb_num]
+    );
+
+    if (rc || (GetLastError()!=ERROR_IO_PENDING)) {
+        return candle_winusb_error(CANDLE_ERR_PREPARE_READ);
+    } else {
+        w->rx_in_flight++;
+        return CANDLE_ERR_OK;
+    }
+}
+
+static candle_err_t candle_winusb_reap(candle_device_t *dev, uint32_t timeout_ms)
+{
+    candle_winusb_t *w = (candle_winusb_t*)dev->transport_data;
+
+    OVERLAPPED_ENTRY entries[CANDLE_WINUSB_REAP_BATCH];
+    ULONG num_entries = 0;
+    if (!GetQueuedCompletionStatusEx(w->iocp, entries, CANDLE_WINUSB_REAP_BATCH, &num_entries, timeout_ms, false)) {
+        return (GetLastError() == WAIT_TIMEOUT) ? CANDLE_ERR_READ_TIMEOUT : CANDLE_ERR_READ_WAIT;
+    }
+
+    for (ULONG i=0; i<num_entries; i++) {
+        unsigned urb_num = candle_winusb_urb_num(w, entries[i].lpOverlapped);
+        if (urb_num >= w->num_urbs) {
+            unsigned slot = candle_winusb_tx_slot(w, entries[i].lpOverlapped);
+            if (slot < w->num_tx) {
+                DWORD bytes_sent = 0;
+                bool ok = WinUsb_GetOverlappedResult(w->winUSBHandle, &w->txovl[slot], &bytes_sent, false);
+                __atomic_fetch_sub(&w->tx_in_flight, 1, __ATOMIC_ACQ_REL);
+                candle_tx_complete(dev, slot, ok);
+            }
+            continue;
+        }
+
+        canlde_rx_urb *urb = &dev->rxurbs[urb_num];
+        DWORD bytes_transfered = 0;
+        if (WinUsb_GetOverlappedResult(w->winUSBHandle, &w->rxovl[urb_num], &bytes_transfered, false)) {
+            urb->status = CANDLE_ERR_OK;
+        } else {
+            urb->status = candle_winusb_error(CANDLE_ERR_READ_RESULT);
+        }
+        urb->bytes_transfered = bytes_transfered;
+        urb->done = true;
+        w->rx_in_flight--;
+    }
+
+    return CANDLE_ERR_OK;
+}
+
+const candle_transport_t candle_transport_winusb = {
+    "winusb",
+    candle_winusb_scan,
+    candle_winusb_open,
+    candle_winusb_close,
+    candle_winusb_control,
+    candle_winusb_write,
+    candle_winusb_alloc_writes,
+    candle_winusb_submit_write,
+    candle_winusb_submit_read,
+    candle_winusb_reap
+};
@@ -21,6 +21,7 @@ static bool gsusb_open_device(struct gsusb_device *dev)
 {
     memset(dev->rxevents, 0, sizeof(dev->rxevents));
     memset(dev->rxurbs, 0, sizeof(dev->rxurbs));
+    memset(&dev->bt_cache, 0, sizeof(dev->bt_cache));
 
     dev->deviceHandle = CreateFile(
         dev->path,
@@ -277,66 +278,31 @@ bool gsusb_set_bittiming(struct gsusb_device *dev, uint16_t channel, struct gs_d
 
 bool gsusb_set_bitrate(struct gsusb_device *dev, uint16_t channel, uint32_t bitrate)
 {
-
-    if (dev->bt_const.fclk_can != 48000000) {
-        /* this function only works for the candleLight base clock of 48MHz */
-        dev->last_error = GSUSB_ERR_BITRATE_FCLK;
+    candle_capability_t cap;
+    cap.feature = dev->bt_const.feature;
+    cap.fclk_can = dev->bt_const.fclk_can;
+    cap.tseg1_min = dev->bt_const.tseg1_min;
+    cap.tseg1_max = dev->bt_const.tseg1_max;
+    cap.tseg2_min = dev->bt_const.tseg2_min;
+    cap.tseg2_max = dev->bt_const.tseg2_max;
+    cap.sjw_max = dev->bt_const.sjw_max;
+    cap.brp_min = dev->bt_const.brp_min;
+    cap.brp_max = dev->bt_const.brp_max;
+    cap.brp_inc = dev->bt_const.brp_inc;
+
+    candle_bittiming_t ct;
+    candle_err_t err = candle_bt_calc_cached(&dev->bt_cache, &cap, bitrate, 0, &ct, NULL);
+    if (err != CANDLE_ERR_OK) {
+        dev->last_error = (err == CANDLE_ERR_BITRATE_FCLK) ? GSUSB_ERR_BITRATE_FCLK : GSUSB_ERR_BITRATE_UNSUPPORTED;
         return false;
     }
 
     struct gs_device_bittiming t;
-    t.prop_seg = 1;
-    t.sjw = 1;
-    t.phase_seg1 = 13 - t.prop_seg;
-    t.phase_seg2 = 2;
-
-    switch (bitrate) {
-        case 10000:
-            t.brp = 300;
-            break;
-
-        case 20000:
-            t.brp = 150;
-            break;
-
-        case 50000:
-            t.brp = 60;
-            break;
-
-        case 83333:
-            t.brp = 36;
-            break;
-
-        case 100000:
-            t.brp = 30;
-            break;
-
-        case 125000:
-            t.brp = 24;
-            break;
-
-        case 250000:
-            t.brp = 12;
-            break;
-
-        case 500000:
-            t.brp = 6;
-            break;
-
-        case 800000:
-            t.brp = 4;
-            t.phase_seg1 = 12 - t.prop_seg;
-            t.phase_seg2 = 2;
-            break;
-
-        case 1000000:
-            t.brp = 3;
-            break;
-
-        default:
-            dev->last_error = GSUSB_ERR_BITRATE_UNSUPPORTED;
-            return false;
-    }
+    t.prop_seg = ct.prop_seg;
+    t.phase_seg1 = ct.phase_seg1;
+    t.phase_seg2 = ct.phase_seg2;
+    t.sjw = ct.sjw;
+    t.brp = ct.brp;
 
     return gsusb_set_bittiming(dev, channel, &t);
 }
@@ -2,6 +2,7 @@
 
 #include <stdbool.h>
 #include "gsusb_def.h"
+#include "candle_bittiming.h"
 #include <windows.h>
 #include <winbase.h>
 #include <winusb.h>
@@ -65,6 +66,7 @@ struct gsusb_device {
 
     struct gs_device_config dconf;
     struct gs_device_bt_const bt_const;
+    candle_bt_cache_t bt_cache;
     struct rx_urb rxurbs[GS_MAX_RX_URBS];
     HANDLE rxevents[GS_MAX_RX_URBS];
 
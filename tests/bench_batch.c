@@ -0,0 +1,85 @@
+#include "test.h"
+#include "candle_os.h"
+
+/* a histogram of can_id and a count of frames in a time window over a long
+ * recording, once as an array of candle_frame_t and once as a columnar
+ * candle_frame_batch_t, plus the cost of converting into the batch. The
+ * arrays are built one after the other so both fit in memory.
+ *
+ *     bench_batch [frames]
+ */
+
+#define BENCH_CHUNK 65536
+
+static uint32_t bench_seed = 7;
+
+/* frames first.., 7 us apart, over 2048 standard ids */
+static void bench_frames(candle_frame_t *frames, size_t num_frames, size_t first)
+{
+    for (size_t i=0; i<num_frames; i++) {
+        frames[i] = test_frame(test_random(&bench_seed) % 2048, 0, (uint32_t)((first + i) * 7));
+    }
+}
+
+static uint64_t hist[2048];
+
+int main(int argc, char **argv)
+{
+    size_t num_frames = (argc > 1) ? (size_t)strtoull(argv[1], NULL, 0) : 100000000;
+    /* the middle third of the recording, counter wraps included */
+    uint32_t from_us = (uint32_t)(num_frames / 3 * 7), to_us = (uint32_t)(num_frames / 3 * 2 * 7);
+
+    candle_frame_t *frames = malloc(num_frames * sizeof(candle_frame_t));
+    if (frames == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    bench_frames(frames, num_frames, 0);
+
+    uint64_t t0 = candle_time_ns();
+    for (size_t i=0; i<num_frames; i++) {
+        hist[frames[i].can_id & 0x7FF]++;
+    }
+    uint64_t t1 = candle_time_ns();
+    size_t in_window = 0;
+    for (size_t i=0; i<num_frames; i++) {
+        in_window += (frames[i].timestamp_us - from_us <= to_us - from_us);
+    }
+    uint64_t t2 = candle_time_ns();
+    printf("AoS  histogram %6.3f s %5.2f ns/frame  window %6.3f s %5.2f ns/frame  (%zu, %llu)\n",
+           (t1 - t0) / 1e9, (double)(t1 - t0) / num_frames, (t2 - t1) / 1e9, (double)(t2 - t1) / num_frames,
+           in_window, (unsigned long long)hist[3]);
+    free(frames);
+
+    memset(hist, 0, sizeof(hist));
+    candle_frame_batch_t batch;
+    frames = malloc(BENCH_CHUNK * sizeof(candle_frame_t));
+    if ( (frames == NULL) || !candle_frame_batch_init(&batch, num_frames) ) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    bench_seed = 7;
+    uint64_t append_ns = 0;
+    for (size_t at=0; at<num_frames; at+=BENCH_CHUNK) {
+        size_t n = (num_frames - at < BENCH_CHUNK) ? num_frames - at : BENCH_CHUNK;
+        bench_frames(frames, n, at);
+        t0 = candle_time_ns();
+        candle_frame_batch_append(&batch, frames, n);
+        append_ns += candle_time_ns() - t0;
+    }
+
+    t0 = candle_time_ns();
+    for (size_t i=0; i<batch.count; i++) {
+        hist[batch.can_id[i] & 0x7FF]++;
+    }
+    t1 = candle_time_ns();
+    in_window = candle_frame_batch_select_time(&batch, from_us, to_us, NULL);
+    t2 = candle_time_ns();
+    printf("SoA  histogram %6.3f s %5.2f ns/frame  window %6.3f s %5.2f ns/frame  (%zu, %llu)  append %.2f ns/frame\n",
+           (t1 - t0) / 1e9, (double)(t1 - t0) / num_frames, (t2 - t1) / 1e9, (double)(t2 - t1) / num_frames,
+           in_window, (unsigned long long)hist[3], (double)append_ns / num_frames);
+
+    free(frames);
+    candle_frame_batch_free(&batch);
+    return 0;
+}
@@ -0,0 +1,54 @@
+#include "test.h"
+#include "candle_os.h"
+#include "candle_bittiming.h"
+
+/* time per bit-timing solve, from scratch and through the table and cache,
+ * for the standard bitrates on each adapter clock.
+ *
+ *     bench_bittiming [rounds]
+ */
+
+static const uint32_t bench_rates[] = { 10000, 20000, 50000, 83333, 100000, 125000, 250000, 500000, 800000, 1000000, 47619, 333333 };
+
+static void bench_run(const char *name, const candle_capability_t *cap, uint32_t rounds)
+{
+    const uint32_t num_rates = sizeof(bench_rates) / sizeof(bench_rates[0]);
+    candle_bittiming_t t;
+    candle_bittiming_result_t r;
+    uint32_t failed = 0;
+
+    uint64_t t0 = candle_time_ns();
+    for (uint32_t i=0; i<rounds; i++) {
+        for (uint32_t k=0; k<num_rates; k++) {
+            failed += (candle_bt_calc(cap, bench_rates[k], 0, &t, &r) != CANDLE_ERR_OK);
+        }
+    }
+    uint64_t t1 = candle_time_ns();
+
+    candle_bt_cache_t cache;
+    memset(&cache, 0, sizeof(cache));
+    for (uint32_t i=0; i<rounds; i++) {
+        for (uint32_t k=0; k<num_rates; k++) {
+            failed += (candle_bt_calc_cached(&cache, cap, bench_rates[k], 0, &t, &r) != CANDLE_ERR_OK);
+        }
+    }
+    uint64_t t2 = candle_time_ns();
+
+    uint64_t solves = (uint64_t)rounds * num_rates;
+    printf("%-8s solve %8.1f ns  cached %6.1f ns  (%u failed)\n", name,
+           (double)(t1 - t0) / solves, (double)(t2 - t1) / solves, failed);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t rounds = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : 10000;
+
+    const candle_capability_t bxcan = { 0, 48000000, 1, 16, 1, 8, 4, 1, 1024, 1 };
+    const candle_capability_t fdcan80 = { 0, 80000000, 1, 256, 1, 128, 128, 1, 512, 1 };
+    const candle_capability_t fdcan160 = { 0, 160000000, 1, 256, 1, 128, 128, 1, 512, 1 };
+
+    bench_run("48 MHz", &bxcan, rounds);
+    bench_run("80 MHz", &fdcan80, rounds);
+    bench_run("160 MHz", &fdcan160, rounds);
+    return 0;
+}
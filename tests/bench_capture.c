@@ -0,0 +1,121 @@
+#include "test.h"
+#include "candle_os.h"
+
+/* writes a capture file of the given size, then times random time-range
+ * queries against it, of growing windows, over all ids and over one, and
+ * one scan of every record for comparison. The file is removed after.
+ *
+ *     bench_capture [megabytes [path]]
+ */
+
+#define BENCH_CHUNK 4096
+#define BENCH_QUERIES 200
+
+static uint32_t bench_seed = 7;
+
+static uint64_t bench_random64(void)
+{
+    return ((uint64_t)test_random(&bench_seed) << 24) ^ test_random(&bench_seed);
+}
+
+/* 300 standard ids and a rare extended one, on average 100 us apart, so the
+   32-bit counter wraps every ~43M frames */
+static bool bench_write(const char *path, uint64_t num_frames)
+{
+    candle_capture_handle cap;
+    if (!candle_capture_create(path, &cap)) {
+        candle_capture_close(cap);
+        return false;
+    }
+
+    static candle_frame_t frames[BENCH_CHUNK];
+    uint32_t ts = 0;
+    bool rc = true;
+    for (uint64_t at=0; rc && (at<num_frames); at+=BENCH_CHUNK) {
+        uint32_t n = (num_frames - at < BENCH_CHUNK) ? (uint32_t)(num_frames - at) : BENCH_CHUNK;
+        for (uint32_t i=0; i<n; i++) {
+            uint32_t id = (test_random(&bench_seed) % 64 == 0) ? (0x18FEF100u | 0x80000000u) : test_random(&bench_seed) % 300;
+            ts += test_random(&bench_seed) % 200;
+            frames[i] = test_frame(id, 0, ts);
+        }
+        rc = candle_capture_write(cap, NULL, frames, n);
+    }
+    return candle_capture_close(cap) && rc;
+}
+
+static void bench_query(candle_capture_handle cap, candle_frame_batch_t *batch, uint64_t first_us, uint64_t last_us, uint64_t window_us, const uint32_t *ids, size_t num_ids)
+{
+    uint64_t total = 0;
+    uint64_t t0 = candle_time_ns();
+    for (int q=0; q<BENCH_QUERIES; q++) {
+        uint64_t from = first_us + bench_random64() % (last_us - first_us - window_us);
+        size_t count = 0;
+        candle_frame_batch_clear(batch);
+        candle_capture_query(cap, from, from + window_us, ids, num_ids, batch, &count);
+        total += count;
+    }
+    uint64_t t1 = candle_time_ns();
+    printf("window %9.3f s  %-8s %9.1f us/query  %10.1f frames/query  %6.1f ns/frame\n",
+           window_us / 1e6, (ids != NULL) ? "one id" : "all ids", (t1 - t0) / 1e3 / BENCH_QUERIES,
+           (double)total / BENCH_QUERIES, total ? (double)(t1 - t0) / total : 0.0);
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t megabytes = (argc > 1) ? strtoull(argv[1], NULL, 0) : 2048;
+    const char *path = (argc > 2) ? argv[2] : "bench_capture.cap";
+    uint64_t num_frames = megabytes * 1000000 / sizeof(candle_capture_record_t);
+
+    uint64_t t0 = candle_time_ns();
+    if (!bench_write(path, num_frames)) {
+        fprintf(stderr, "writing %s failed\n", path);
+        remove(path);
+        return 1;
+    }
+    uint64_t t1 = candle_time_ns();
+    printf("write  %llu frames, %llu MB  %.1f ns/frame\n", (unsigned long long)num_frames,
+           (unsigned long long)megabytes, (double)(t1 - t0) / num_frames);
+
+    candle_capture_handle cap;
+    uint64_t first_us = 0, last_us = 0;
+    t0 = candle_time_ns();
+    if (!candle_capture_open(path, &cap) || !candle_capture_info(cap, &num_frames, &first_us, &last_us)) {
+        fprintf(stderr, "opening %s failed\n", path);
+        candle_capture_close(cap);
+        remove(path);
+        return 1;
+    }
+    t1 = candle_time_ns();
+    printf("open   %.2f ms, %.1f s recorded\n", (t1 - t0) / 1e6, (last_us - first_us) / 1e6);
+
+    candle_frame_batch_t batch;
+    candle_frame_batch_init(&batch, 0);
+    static const uint64_t windows_us[] = { 1000, 100000, 10000000, 600000000 };
+    uint32_t id = 17;
+    for (unsigned w=0; w<sizeof(windows_us)/sizeof(windows_us[0]); w++) {
+        if (windows_us[w] < last_us - first_us) {
+            bench_query(cap, &batch, first_us, last_us, windows_us[w], NULL, 0);
+            bench_query(cap, &batch, first_us, last_us, windows_us[w], &id, 1);
+        }
+    }
+
+    /* every record, as a reader without the footers would */
+    uint64_t cursor = 0, in_range = 0;
+    const candle_capture_record_t *records;
+    uint32_t count;
+    uint64_t from = first_us + (last_us - first_us) / 2;
+    t0 = candle_time_ns();
+    while (candle_capture_next_block(cap, 0, UINT64_MAX, NULL, 0, &cursor, &records, &count)) {
+        for (uint32_t i=0; i<count; i++) {
+            in_range += (records[i].timestamp_us - from <= 1000);
+        }
+    }
+    t1 = candle_time_ns();
+    printf("scan   %.1f ms for all records  %.2f ns/frame  (%llu)\n", (t1 - t0) / 1e6,
+           (double)(t1 - t0) / num_frames, (unsigned long long)in_range);
+
+    candle_frame_batch_free(&batch);
+    candle_capture_close(cap);
+    remove(path);
+    return 0;
+}
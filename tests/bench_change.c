@@ -0,0 +1,75 @@
+#include "test.h"
+#include "candle_os.h"
+#include "candle_change.h"
+
+/* cost per frame of the deliver-on-change table lookup, for growing
+ * numbers of cyclic ids, with every payload repeating or one in ten
+ * changed. Frames come in blocks of 256 as from a receive call; the copy
+ * that refills a block is timed apart and taken off.
+ *
+ *     bench_change [frames]
+ */
+
+#define BENCH_BLOCK 256
+
+static uint32_t bench_seed = 1;
+
+static void bench_run(uint32_t num_ids, uint32_t change_pct, uint32_t num_frames)
+{
+    candle_change_table_t *t = candle_change_create(1000);
+    candle_frame_t *src = malloc(num_frames * sizeof(candle_frame_t));
+    candle_frame_t block[BENCH_BLOCK];
+    if ( (t == NULL) || (src == NULL) ) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    /* ids in random order, 1 ms apart on the device clock */
+    for (uint32_t i=0; i<num_frames; i++) {
+        uint32_t id = test_random(&bench_seed) % num_ids;
+        src[i] = test_frame((id < 0x800) ? id : (id | 0x80000000), (uint8_t)(id & 1), i * 1000 / num_ids);
+        if (test_random(&bench_seed) % 100 < change_pct) {
+            src[i].data[0] = (uint8_t)test_random(&bench_seed);
+        }
+    }
+
+    /* one pass so every id has its slot */
+    uint32_t passed = 0;
+    for (uint32_t i=0; i+BENCH_BLOCK<=num_frames; i+=BENCH_BLOCK) {
+        memcpy(block, &src[i], sizeof(block));
+        candle_change_apply(t, block, BENCH_BLOCK, NULL, &passed);
+    }
+
+    uint64_t t0 = candle_time_ns();
+    uint64_t kept = 0;
+    for (uint32_t i=0; i+BENCH_BLOCK<=num_frames; i+=BENCH_BLOCK) {
+        memcpy(block, &src[i], sizeof(block));
+        kept += candle_change_apply(t, block, BENCH_BLOCK, NULL, &passed);
+    }
+    uint64_t t1 = candle_time_ns();
+    for (uint32_t i=0; i+BENCH_BLOCK<=num_frames; i+=BENCH_BLOCK) {
+        memcpy(block, &src[i], sizeof(block));
+        kept += block[BENCH_BLOCK - 1].can_dlc;
+    }
+    uint64_t t2 = candle_time_ns();
+
+    uint32_t timed = num_frames - num_frames % BENCH_BLOCK;
+    double copy_ns = (double)(t2 - t1) / timed;
+    printf("%6u ids  %3u%% changed  %6.2f ns/frame  (copy %.2f ns)\n",
+           num_ids, change_pct, (double)(t1 - t0) / timed - copy_ns, copy_ns);
+
+    free(src);
+    candle_change_free(t);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t num_frames = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : 4000000;
+    static const uint32_t ids[] = { 16, 256, 4096, 30000 };
+
+    for (unsigned i=0; i<sizeof(ids)/sizeof(ids[0]); i++) {
+        bench_run(ids[i], 0, num_frames);
+        bench_run(ids[i], 10, num_frames);
+    }
+    return 0;
+}
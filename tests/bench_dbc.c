@@ -0,0 +1,65 @@
+#include "test.h"
+#include "candle_os.h"
+#include "dbc_gen.h"
+
+/* decode time per frame and per signal against a DBC of 500 random
+ * messages, frames drawn from all of them, and the load time of the DBC.
+ *
+ *     bench_dbc [frames]
+ */
+
+#define BENCH_MESSAGES 500
+#define BENCH_POOL 4096     /* distinct frames cycled through */
+
+int main(int argc, char **argv)
+{
+    uint32_t num_frames = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : 10000000;
+
+    size_t len;
+    char *text = dbc_gen(BENCH_MESSAGES, &len);
+    candle_dbc_handle dbc;
+    uint64_t t0 = candle_time_ns();
+    if ( (text == NULL) || !candle_dbc_load_string(text, len, &dbc) ) {
+        fprintf(stderr, "DBC load failed\n");
+        return 1;
+    }
+    uint64_t t1 = candle_time_ns();
+
+    uint32_t count;
+    candle_dbc_message_count(dbc, &count);
+    candle_frame_t *frames = malloc(BENCH_POOL * sizeof(candle_frame_t));
+    if (frames == NULL) {
+        return 1;
+    }
+    for (uint32_t i=0; i<BENCH_POOL; i++) {
+        frames[i] = dbc_gen_frame(candle_dbc_message(dbc, dbc_gen_random() % count), i);
+    }
+    printf("%u messages, %zu bytes loaded in %.2f ms\n", count, len, (t1 - t0) / 1e6);
+
+    double values[64];
+    int64_t raw[64];
+    double sum = 0;
+    uint64_t signals = 0;
+    t0 = candle_time_ns();
+    for (uint32_t i=0; i<num_frames; i++) {
+        const candle_dbc_message_t *m = candle_dbc_decode(dbc, &frames[i % BENCH_POOL], values);
+        sum += values[0];
+        signals += m->num_signals;
+    }
+    t1 = candle_time_ns();
+    for (uint32_t i=0; i<num_frames; i++) {
+        candle_dbc_decode_raw(dbc, &frames[i % BENCH_POOL], raw);
+        sum += (double)raw[0];
+    }
+    uint64_t t2 = candle_time_ns();
+
+    printf("physical %6.1f ns/frame  %5.2f ns/signal  %6.1f Mframes/s\n",
+           (double)(t1 - t0) / num_frames, (double)(t1 - t0) / signals, num_frames * 1e3 / (t1 - t0));
+    printf("raw      %6.1f ns/frame  %5.2f ns/signal  %6.1f Mframes/s  (%g)\n",
+           (double)(t2 - t1) / num_frames, (double)(t2 - t1) / signals, num_frames * 1e3 / (t2 - t1), sum);
+
+    free(frames);
+    free(text);
+    candle_dbc_free(dbc);
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include "test.h"
+#include "candle_os.h"
+#include "dbc_gen.h"
+
+/* frames/s through candle_dbc_extract() with each kernel set the cpu has,
+ * for one signal and for all signals of a message, when a quarter of the
+ * frames are of that message and when all are, against decoding frame by
+ * frame.
+ *
+ *     bench_dbc_batch [frames]
+ */
+
+#define BENCH_REPEAT 5
+
+static double bench_extract(candle_dbc_handle dbc, const candle_frame_t *frames, size_t num_frames, uint32_t can_id, const candle_dbc_column_t *columns, size_t num_columns, size_t *count)
+{
+    uint64_t t0 = candle_time_ns();
+    for (int r=0; r<BENCH_REPEAT; r++) {
+        candle_dbc_extract(dbc, frames, num_frames, can_id, columns, num_columns, NULL, count);
+    }
+    uint64_t t1 = candle_time_ns();
+    return num_frames * 1e3 * BENCH_REPEAT / (t1 - t0);
+}
+
+static void bench_run(const char *name, candle_dbc_handle dbc, candle_frame_t *frames, size_t num_frames, const candle_dbc_message_t *m, float **values)
+{
+    candle_dbc_column_t columns[64];
+    for (uint32_t s=0; s<m->num_signals; s++) {
+        columns[s].signal = s;
+        columns[s].values = values[s];
+        columns[s].raw = NULL;
+    }
+
+    double v[64], sum = 0;
+    uint64_t t0 = candle_time_ns();
+    for (size_t i=0; i<num_frames; i++) {
+        if ( (frames[i].can_id == m->can_id) && (candle_dbc_decode(dbc, &frames[i], v) != NULL) ) {
+            sum += v[0];
+        }
+    }
+    uint64_t t1 = candle_time_ns();
+    printf("%-6s per frame        %7.1f Mframes/s  (%g)\n", name, num_frames * 1e3 / (t1 - t0), sum);
+
+    static const char *names[] = { "scalar", "ssse3", "avx2" };
+    candle_set_isa(CANDLE_ISA_AVX2);
+    candle_isa_t best = candle_cpu_isa();
+    for (candle_isa_t isa=CANDLE_ISA_SCALAR; isa<=best; isa++) {
+        candle_set_isa(isa);
+        size_t count = 0;
+        double one = bench_extract(dbc, frames, num_frames, m->can_id, columns, 1, &count);
+        double all = bench_extract(dbc, frames, num_frames, m->can_id, columns, m->num_signals, &count);
+        printf("%-6s %-6s 1 signal %7.1f Mframes/s  %2u signals %7.1f Mframes/s  %7.1f Mvalues/s  (%zu matched)\n",
+               name, names[isa], one, m->num_signals, all, all * count * m->num_signals / num_frames, count);
+    }
+    candle_set_isa(CANDLE_ISA_AVX2);
+}
+
+int main(int argc, char **argv)
+{
+    size_t num_frames = (argc > 1) ? (size_t)strtoull(argv[1], NULL, 0) : 10000000;
+
+    size_t len;
+    char *text = dbc_gen(500, &len);
+    candle_dbc_handle dbc;
+    if ( (text == NULL) || !candle_dbc_load_string(text, len, &dbc) ) {
+        fprintf(stderr, "DBC load failed\n");
+        return 1;
+    }
+    free(text);
+    uint32_t count;
+    candle_dbc_message_count(dbc, &count);
+    const candle_dbc_message_t *hot = candle_dbc_message(dbc, 3);
+
+    candle_frame_t *frames = malloc(num_frames * sizeof(candle_frame_t));
+    float *values[64];
+    for (uint32_t s=0; s<hot->num_signals; s++) {
+        values[s] = malloc(num_frames * sizeof(float));
+        if (values[s] == NULL) {
+            frames = NULL;
+        }
+    }
+    if (frames == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    for (size_t i=0; i<num_frames; i++) {
+        uint32_t m = (dbc_gen_random() % 4 == 0) ? 3 : dbc_gen_random() % count;
+        frames[i] = dbc_gen_frame(candle_dbc_message(dbc, m), (uint32_t)i);
+    }
+    bench_run("mixed", dbc, frames, num_frames, hot, values);
+
+    for (size_t i=0; i<num_frames; i++) {
+        frames[i] = dbc_gen_frame(hot, (uint32_t)i);
+    }
+    bench_run("dense", dbc, frames, num_frames, hot, values);
+
+    for (uint32_t s=0; s<hot->num_signals; s++) {
+        free(values[s]);
+    }
+    free(frames);
+    candle_dbc_free(dbc);
+    return 0;
+}
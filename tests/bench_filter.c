@@ -0,0 +1,102 @@
+#include "test.h"
+#include "candle_os.h"
+
+/* frames/s through the receive path with the acceptance filter off and
+ * with rule sets of growing size, 11-bit ids spread over the whole range.
+ * Packed transfers of 32 frames keep the transport's share small.
+ *
+ *     bench_filter [frames]
+ */
+
+#define BENCH_BURST 32
+
+typedef bool (*bench_setup_fn)(candle_filter_handle filter);
+
+static bool bench_one_mask(candle_filter_handle filter)
+{
+    return candle_filter_add_mask(filter, false, 0x100, 0x700);
+}
+
+static bool bench_16_ranges(candle_filter_handle filter)
+{
+    bool rc = true;
+    for (uint32_t i=0; i<16; i++) {
+        rc &= candle_filter_add_range(filter, false, i * 0x80, i * 0x80 + 0x1F);
+    }
+    return rc;
+}
+
+static bool bench_256_ids(candle_filter_handle filter)
+{
+    bool rc = true;
+    for (uint32_t i=0; i<256; i++) {
+        rc &= candle_filter_add_mask(filter, false, i * 8, 0x7FF);
+    }
+    return rc;
+}
+
+static void bench_run(const char *name, bench_setup_fn setup, uint32_t num_frames)
+{
+    fake_reset();
+    int d = fake_add_device(1, 48000000);
+    candle_frame_t burst[BENCH_BURST];
+    for (uint32_t i=0; i<num_frames; i+=BENCH_BURST) {
+        for (uint32_t k=0; k<BENCH_BURST; k++) {
+            burst[k] = test_frame(((i + k) * 7) & 0x7FF, 0, i + k);
+        }
+        fake_push_in(d, burst, sizeof(burst));
+    }
+    num_frames -= num_frames % BENCH_BURST;
+
+    candle_dev_options_t opts;
+    candle_dev_options_init(&opts);
+    opts.flags |= CANDLE_DEVOPT_RX_PACKED;
+    opts.rx_urb_size = sizeof(burst);
+    candle_handle hdev = test_open(0, &opts);
+    if (hdev == NULL) {
+        return;
+    }
+    if (setup != NULL) {
+        candle_filter_handle filter;
+        if (!candle_filter_create(&filter) || !setup(filter) || !candle_dev_set_filter(hdev, filter)) {
+            fprintf(stderr, "%s: filter setup failed\n", name);
+            test_close(hdev);
+            return;
+        }
+        candle_filter_free(filter);
+    }
+
+    candle_frame_t frames[256];
+    candle_rx_stats_t stats;
+    uint64_t got = 0;
+    uint64_t t0 = candle_time_ns();
+    do {
+        uint32_t count;
+        if (!candle_frame_read_many(hdev, frames, 256, &count, 1000)) {
+            if (candle_dev_last_error(hdev) == CANDLE_ERR_READ_TIMEOUT) {
+                break;
+            }
+            fprintf(stderr, "%s: read failed: %d\n", name, candle_dev_last_error(hdev));
+            break;
+        }
+        got += count;
+        candle_dev_get_rx_stats(hdev, &stats);
+    } while (got + stats.filtered < num_frames);
+    uint64_t t1 = candle_time_ns();
+    candle_dev_get_rx_stats(hdev, &stats);
+
+    printf("%-10s %8.2f Mframes/s in  %5.1f%% passed\n", name,
+           num_frames * 1e3 / (double)(t1 - t0), 100.0 * got / num_frames);
+    test_close(hdev);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t num_frames = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : 4000000;
+
+    bench_run("none", NULL, num_frames);
+    bench_run("1 mask", bench_one_mask, num_frames);
+    bench_run("16 ranges", bench_16_ranges, num_frames);
+    bench_run("256 ids", bench_256_ids, num_frames);
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include "test.h"
+#include "candle_ring.h"
+
+/* producer/consumer throughput of the frame ring, with the consumer parked
+ * in candle_ring_wait() whenever it catches up.
+ *
+ *     bench_ring [frames]
+ */
+
+typedef struct {
+    candle_ring_t *ring;
+    uint32_t frames;
+    uint32_t burst;         /* frames pushed per wakeup */
+    uint64_t full;          /* pushes retried on a full ring */
+} bench_producer_t;
+
+static void bench_producer(void *arg)
+{
+    bench_producer_t *p = (bench_producer_t*)arg;
+    candle_frame_t f = test_frame(0x100, 0, 0);
+
+    for (uint32_t i=0; i<p->frames; ) {
+        for (uint32_t k=0; (k<p->burst) && (i<p->frames); ) {
+            f.timestamp_us = i;
+            if (candle_ring_push(p->ring, &f)) {
+                i++;
+                k++;
+            } else {
+                p->full++;
+                candle_ring_wake(p->ring);
+            }
+        }
+        candle_ring_wake(p->ring);
+    }
+}
+
+static void bench_run(uint32_t ring_size, uint32_t burst, uint32_t frames)
+{
+    candle_ring_t ring;
+    if (!candle_ring_init(&ring, ring_size)) {
+        return;
+    }
+
+    bench_producer_t p = { &ring, frames, burst, 0 };
+    candle_thread_t thread;
+    uint64_t t0 = candle_time_ns();
+    if (!candle_thread_start(&thread, bench_producer, &p)) {
+        candle_ring_free(&ring);
+        return;
+    }
+
+    candle_frame_t buf[256];
+    uint32_t got = 0, waits = 0;
+    while (got < frames) {
+        uint32_t n = candle_ring_pop(&ring, buf, 256);
+        if (n == 0) {
+            waits++;
+            if (!candle_ring_wait(&ring, NULL, 1000)) {
+                fprintf(stderr, "wait timed out at %u\n", got);
+                break;
+            }
+        }
+        got += n;
+    }
+    uint64_t t1 = candle_time_ns();
+    candle_thread_join(thread);
+
+    printf("ring %6u  burst %4u  %7.2f Mframes/s  %.4f waits/frame  %.4f full/frame\n",
+           ring_size, burst, got * 1e3 / (double)(t1 - t0),
+           (double)waits / got, (double)p.full / got);
+    candle_ring_free(&ring);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t frames = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : 10000000;
+
+    static const uint32_t bursts[] = { 1, 16, 256 };
+    for (uint32_t size=256; size<=65536; size*=16) {
+        for (unsigned i=0; i<sizeof(bursts)/sizeof(bursts[0]); i++) {
+            bench_run(size, bursts[i], frames);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include "test.h"
+#include "candle_os.h"
+
+/* frames/s and waits per frame of the receive paths against the fake
+ * transport, whose reap stands in for the wait syscall of a real one.
+ * Frames come in while the reader runs: a producer thread pushes a burst
+ * every millisecond, as a bus with that many frames per ms would (8 is
+ * about a busy 1 Mbit/s bus). The backlog run has every frame queued
+ * before the first read, for the most a single wait can drain.
+ *
+ *     bench_rx [frames]
+ */
+
+#define BENCH_LIVE_MS 500
+
+typedef bool (*bench_read_fn)(candle_handle hdev, candle_frame_t *frames, uint32_t *count);
+
+static bool bench_read_single(candle_handle hdev, candle_frame_t *frames, uint32_t *count)
+{
+    *count = 1;
+    return candle_frame_read(hdev, frames, 1000);
+}
+
+static bool bench_read_many(candle_handle hdev, candle_frame_t *frames, uint32_t *count)
+{
+    return candle_frame_read_many(hdev, frames, 256, count, 1000);
+}
+
+typedef struct {
+    int dev;
+    uint32_t num_frames;
+    uint32_t burst;
+} bench_producer_t;
+
+static void bench_push(int d, uint32_t first, uint32_t n)
+{
+    for (uint32_t i=first; i<first+n; i++) {
+        candle_frame_t f = test_frame(0x100 + (i & 0xFF), 0, i);
+        fake_push_in(d, &f, sizeof(f));
+    }
+}
+
+static void bench_produce(void *arg)
+{
+    bench_producer_t *p = (bench_producer_t*)arg;
+    for (uint32_t sent=0; sent<p->num_frames; sent+=p->burst) {
+        candle_sleep_ms(1);
+        bench_push(p->dev, sent, (p->num_frames - sent < p->burst) ? p->num_frames - sent : p->burst);
+    }
+}
+
+/* burst 0 queues all frames before the read starts */
+static void bench_run(const char *name, bench_read_fn read, uint32_t num_frames, uint32_t burst)
+{
+    fake_reset();
+    bench_producer_t producer = { fake_add_device(1, 48000000), num_frames, burst };
+    if (burst == 0) {
+        bench_push(producer.dev, 0, num_frames);
+    }
+
+    candle_handle hdev = test_open(0, NULL);
+    if (hdev == NULL) {
+        return;
+    }
+
+    candle_thread_t thread;
+    if ( (burst > 0) && !candle_thread_start(&thread, bench_produce, &producer) ) {
+        fprintf(stderr, "%s: no producer thread\n", name);
+        test_close(hdev);
+        return;
+    }
+
+    candle_frame_t frames[256];
+    uint32_t got = 0;
+    uint32_t reaps = fake_reap_count();
+    uint64_t t0 = candle_time_ns();
+    while (got < num_frames) {
+        uint32_t count;
+        if (!read(hdev, frames, &count)) {
+            fprintf(stderr, "%s: read failed: %d\n", name, candle_dev_last_error(hdev));
+            break;
+        }
+        got += count;
+    }
+    uint64_t t1 = candle_time_ns();
+    reaps = fake_reap_count() - reaps;
+
+    if (burst > 0) {
+        candle_thread_join(thread);
+        /* the rate is the producer's, the waits are what the reader pays */
+        printf("%-10s %3u frames/ms                %.3f waits/frame\n", name, burst, (double)reaps / got);
+    } else {
+        printf("%-10s backlog       %8.2f Mframes/s  %.3f waits/frame\n", name,
+               got * 1e3 / (double)(t1 - t0), (double)reaps / got);
+    }
+    test_close(hdev);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t num_frames = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : 1000000;
+
+    static const uint32_t bursts[] = { 1, 8, 64 };
+    for (unsigned b=0; b<sizeof(bursts)/sizeof(bursts[0]); b++) {
+        bench_run("read", bench_read_single, bursts[b] * BENCH_LIVE_MS, bursts[b]);
+        bench_run("read_many", bench_read_many, bursts[b] * BENCH_LIVE_MS, bursts[b]);
+    }
+    bench_run("read", bench_read_single, num_frames, 0);
+    bench_run("read_many", bench_read_many, num_frames, 0);
+    return 0;
+}
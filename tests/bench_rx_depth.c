@@ -0,0 +1,113 @@
+#include "test.h"
+#include "candle_os.h"
+
+/* drop rate and latency against rx_urb_count under burst load. A producer
+ * thread plays the bus: bursts of back-to-back frames at BENCH_FRAME_NS into
+ * a device that buffers only a few of them itself, so whatever the reads in
+ * flight cannot take while the reader is busy is lost. The reader stalls now
+ * and then, as an application does.
+ *
+ *     bench_rx_depth [bursts] [burst_frames]
+ */
+
+#define BENCH_DEVICE_FIFO   16      /* frames the device holds on its own */
+#define BENCH_FRAME_NS      20000   /* 50k frames/s, a busy bus or two */
+#define BENCH_BURST_GAP_MS  10
+#define BENCH_STALL_EVERY   200     /* frames between reader stalls */
+#define BENCH_STALL_US      2000
+
+typedef struct {
+    int dev;
+    uint32_t bursts;
+    uint32_t burst_frames;
+    bool done;
+} bench_producer_t;
+
+static void bench_producer(void *arg)
+{
+    bench_producer_t *p = (bench_producer_t*)arg;
+    uint32_t n = 0;
+
+    for (uint32_t b=0; b<p->bursts; b++) {
+        candle_sleep_ms(BENCH_BURST_GAP_MS);
+        uint64_t now = candle_time_ns();
+        for (uint32_t i=0; i<p->burst_frames; i++) {
+            uint64_t due = now + BENCH_FRAME_NS;
+            while ((now = candle_time_ns()) < due) {
+            }
+            candle_frame_t f = test_frame(0x100, 0, n++);
+            memcpy(f.data, &now, sizeof(now));
+            fake_push_in(p->dev, &f, sizeof(f));
+        }
+    }
+    candle_sleep_ms(BENCH_BURST_GAP_MS);
+    candle_atomic_store(&p->done, true);
+}
+
+static void bench_run(uint32_t urb_count, uint32_t bursts, uint32_t burst_frames)
+{
+    fake_reset();
+    int d = fake_add_device(1, 48000000);
+    fake_set_in_limit(d, BENCH_DEVICE_FIFO);
+
+    candle_dev_options_t opts;
+    candle_dev_options_init(&opts);
+    opts.rx_urb_count = urb_count;
+    candle_handle hdev = test_open(0, &opts);
+    if (hdev == NULL) {
+        return;
+    }
+
+    bench_producer_t p = { d, bursts, burst_frames, false };
+    candle_thread_t thread;
+    if (!candle_thread_start(&thread, bench_producer, &p)) {
+        test_close(hdev);
+        return;
+    }
+
+    candle_frame_t frames[256];
+    uint64_t got = 0, latency_sum = 0, latency_max = 0;
+    uint32_t since_stall = 0;
+    while (!candle_atomic_load(&p.done) || (fake_pending_in(d) > 0)) {
+        uint32_t count = 0;
+        if (!candle_frame_read_many(hdev, frames, 256, &count, 5)) {
+            continue;
+        }
+        uint64_t now = candle_time_ns();
+        for (uint32_t i=0; i<count; i++) {
+            uint64_t sent;
+            memcpy(&sent, frames[i].data, sizeof(sent));
+            uint64_t latency = now - sent;
+            latency_sum += latency;
+            if (latency > latency_max) {
+                latency_max = latency;
+            }
+        }
+        got += count;
+        since_stall += count;
+        if (since_stall >= BENCH_STALL_EVERY) {
+            since_stall = 0;
+            uint64_t until = candle_time_ns() + BENCH_STALL_US * 1000ull;
+            while (candle_time_ns() < until) {
+            }
+        }
+    }
+    candle_thread_join(thread);
+
+    uint64_t sent = (uint64_t)bursts * burst_frames;
+    printf("%5u urbs  %6.2f %% dropped  latency mean %7.1f us  max %8.1f us\n",
+           urb_count, 100.0 * fake_dropped(d) / sent,
+           got ? latency_sum / 1e3 / got : 0.0, latency_max / 1e3);
+    test_close(hdev);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t bursts = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : 50;
+    uint32_t burst_frames = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) : 1000;
+
+    for (uint32_t urb_count=1; urb_count<=1024; urb_count*=2) {
+        bench_run(urb_count, bursts, burst_frames);
+    }
+    return 0;
+}
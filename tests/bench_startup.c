@@ -0,0 +1,71 @@
+#include "test.h"
+#include "candle_os.h"
+
+/* time from scan until every device's state and descriptors are known, with
+ * all fake devices plugged in and each control request taking as long as a
+ * round trip on the bus. Cold: the devices are new to the process; warm: a
+ * later scan finds their descriptors cached.
+ *
+ *     bench_startup [rounds] [control_us]
+ */
+
+static uint64_t bench_probe_all(void)
+{
+    uint64_t t0 = candle_time_ns();
+    candle_list_handle list;
+    if (!candle_list_scan_transport(&list, &candle_transport_fake) || !candle_list_probe(list)) {
+        fprintf(stderr, "scan failed\n");
+        exit(1);
+    }
+    uint64_t t1 = candle_time_ns();
+    candle_list_free(list);
+    return t1 - t0;
+}
+
+/* a device that left is asked again on its return */
+static void bench_forget_all(void)
+{
+    candle_list_handle list;
+    candle_list_scan_transport(&list, &candle_transport_fake);
+    for (int d=0; d<FAKE_MAX_DEVICES; d++) {
+        fake_unplug(d);
+    }
+    candle_list_refresh(list, NULL, NULL);
+    for (int d=0; d<FAKE_MAX_DEVICES; d++) {
+        fake_replug(d);
+    }
+    candle_list_free(list);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t rounds = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : 20;
+    uint32_t control_us = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) : 250;
+
+    fake_reset();
+    for (int d=0; d<FAKE_MAX_DEVICES; d++) {
+        fake_add_device((d % 2) ? 2 : 1, 48000000);
+    }
+    fake_set_control_delay_us(control_us);
+
+    uint64_t cold = 0, warm = 0;
+    for (uint32_t i=0; i<rounds; i++) {
+        bench_forget_all();
+        uint32_t controls = 0;
+        for (int d=0; d<FAKE_MAX_DEVICES; d++) {
+            controls -= fake_control_count(d);
+        }
+        cold += bench_probe_all();
+        warm += bench_probe_all();
+        for (int d=0; d<FAKE_MAX_DEVICES; d++) {
+            controls += fake_control_count(d);
+        }
+        if (i == 0) {
+            printf("%u devices, %u control requests per cold and warm start\n", FAKE_MAX_DEVICES, controls);
+        }
+    }
+
+    printf("cold %8.2f ms  warm %8.2f ms  (%u us per control request)\n",
+           cold / 1e6 / rounds, warm / 1e6 / rounds, control_us);
+    return 0;
+}
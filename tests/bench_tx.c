@@ -0,0 +1,105 @@
+#include "test.h"
+#include "candle_os.h"
+
+/* frames/s of the send paths against the fake transport, with each bulk-OUT
+ * transfer taking write_delay_us as on the bus. The echoes are read back as
+ * they come, which is what frees the async window.
+ *
+ *     bench_tx [frames] [write_delay_us]
+ *
+ * send_many goes without and packed with CANDLE_DEVOPT_TX_PACKED.
+ */
+
+#define BENCH_MANY_FRAMES 1000
+
+typedef struct {
+    uint64_t would_block;
+} bench_stats_t;
+
+typedef bool (*bench_send_fn)(candle_handle hdev, const candle_frame_t *frame, bench_stats_t *stats);
+
+static bool bench_send_blocking(candle_handle hdev, const candle_frame_t *frame, bench_stats_t *stats)
+{
+    (void)stats;
+    candle_frame_t f = *frame;
+    return candle_frame_send(hdev, 0, &f);
+}
+
+static void bench_drain_echoes(candle_handle hdev, uint32_t timeout_ms)
+{
+    candle_frame_t rx[64];
+    uint32_t count;
+    candle_frame_read_many(hdev, rx, 64, &count, timeout_ms);
+}
+
+static bool bench_send_async(candle_handle hdev, const candle_frame_t *frame, bench_stats_t *stats)
+{
+    while (!candle_frame_send_async(hdev, 0, frame)) {
+        if (candle_dev_last_error(hdev) != CANDLE_ERR_SEND_WOULD_BLOCK) {
+            return false;
+        }
+        stats->would_block++;
+        bench_drain_echoes(hdev, 100);
+    }
+    return true;
+}
+
+/* takes BENCH_MANY_FRAMES at a time */
+static bool bench_send_many(candle_handle hdev, const candle_frame_t *frames, bench_stats_t *stats)
+{
+    (void)stats;
+    size_t sent;
+    return candle_frame_send_many(hdev, 0, frames, BENCH_MANY_FRAMES, &sent);
+}
+
+static void bench_run(const char *name, bench_send_fn send, uint32_t step, uint32_t flags, uint32_t num_frames, uint32_t write_delay_us)
+{
+    fake_reset();
+    int d = fake_add_device(1, 48000000);
+    fake_set_echo(d, true);
+    fake_set_write_delay_us(write_delay_us);
+
+    candle_dev_options_t opts;
+    candle_dev_options_init(&opts);
+    opts.flags |= flags;
+    candle_handle hdev = test_open(0, &opts);
+    if (hdev == NULL) {
+        return;
+    }
+
+    static candle_frame_t frames[BENCH_MANY_FRAMES];
+    for (uint32_t i=0; i<BENCH_MANY_FRAMES; i++) {
+        frames[i] = test_frame(0x100 + i, 0, 0);
+    }
+    bench_stats_t stats = { 0 };
+    uint64_t t0 = candle_time_ns();
+    uint32_t sent, since_drain = 0;
+    for (sent=0; sent<num_frames; sent+=step) {
+        if (!send(hdev, frames, &stats)) {
+            fprintf(stderr, "%s: send failed: %d\n", name, candle_dev_last_error(hdev));
+            break;
+        }
+        since_drain += step;
+        while (since_drain >= 64) {
+            bench_drain_echoes(hdev, 0);
+            since_drain -= 64;
+        }
+    }
+    uint64_t t1 = candle_time_ns();
+
+    printf("%-10s %5u us/transfer  %8.3f Mframes/s  %.3f would-block/frame\n", name, write_delay_us,
+           sent * 1e3 / (double)(t1 - t0), (double)stats.would_block / sent);
+    test_close(hdev);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t num_frames = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : 20000;
+    uint32_t write_delay_us = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) : 125;
+
+    bench_run("send", bench_send_blocking, 1, 0, num_frames, write_delay_us);
+    bench_run("send_async", bench_send_async, 1, 0, num_frames, write_delay_us);
+    bench_run("send_many", bench_send_many, BENCH_MANY_FRAMES, 0, num_frames, write_delay_us);
+    bench_run("packed", bench_send_many, BENCH_MANY_FRAMES, CANDLE_DEVOPT_TX_PACKED, num_frames, write_delay_us);
+    return 0;
+}
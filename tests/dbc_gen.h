@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+/* Random DBC layouts for decoder tests and benchmarks: messages with 4 to
+ * 15 non-overlapping signals of either byte order and signedness, mostly up
+ * to 16 bits long, the first 300 with 11-bit ids and the rest extended.
+ */
+static uint32_t dbc_gen_seed = 12345;
+
+static inline uint32_t dbc_gen_random(void)
+{
+    return test_random(&dbc_gen_seed);
+}
+
+/* DBC text of num_msgs messages, freed by the caller */
+static inline char *dbc_gen(uint32_t num_msgs, size_t *len)
+{
+    size_t capacity = 4096 + (size_t)num_msgs * 16 * 96;
+    char *text = malloc(capacity);
+    if (text == NULL) {
+        return NULL;
+    }
+
+    size_t n = (size_t)sprintf(text, "VERSION \"\"\n\nNS_ :\n\tCM_\n\nBS_:\n\nBU_: A B\n\n");
+    for (uint32_t m=0; m<num_msgs; m++) {
+        uint32_t id = (m < 300) ? (m * 5 + 1) : ((0x18F00000 + m * 7) | 0x80000000u);
+        n += (size_t)sprintf(&text[n], "BO_ %u MSG_%u: 8 A\n", id, m);
+
+        uint32_t num_signals = 4 + dbc_gen_random() % 12;
+        uint8_t used[64] = { 0 };
+        for (uint32_t s=0; s<num_signals; s++) {
+            uint32_t length = 1 + dbc_gen_random() % 16;
+            if (dbc_gen_random() % 8 == 0) {
+                length = 1 + dbc_gen_random() % 32;
+            }
+            bool motorola = dbc_gen_random() % 2;
+
+            /* a few tries to find room for it */
+            for (int tries=0; tries<20; tries++) {
+                uint32_t start = dbc_gen_random() % 64;
+                uint32_t bits[64];
+                uint32_t b = start;
+                bool fits = true;
+                for (uint32_t i=0; i<length; i++) {
+                    if ( (b >= 64) || used[b] ) {
+                        fits = false;
+                        break;
+                    }
+                    bits[i] = b;
+                    b = !motorola ? b + 1 : (b % 8 == 0) ? b + 15 : b - 1;
+                }
+                if (!fits) {
+                    continue;
+                }
+                for (uint32_t i=0; i<length; i++) {
+                    used[bits[i]] = 1;
+                }
+                n += (size_t)sprintf(&text[n], " SG_ S%u_%u : %u|%u@%d%c (%g,%g) [0|0] \"u\" B\n",
+                                     m, s, start, length, motorola ? 0 : 1, (dbc_gen_random() % 2) ? '-' : '+',
+                                     (dbc_gen_random() % 4) ? 0.5 : 1.0, (dbc_gen_random() % 3) ? -10.0 : 0.0);
+                break;
+            }
+        }
+        n += (size_t)sprintf(&text[n], "\n");
+    }
+
+    *len = n;
+    return text;
+}
+
+/* raw value of s in data, bit by bit */
+static inline int64_t dbc_ref_raw(const candle_dbc_signal_t *s, const uint8_t *data)
+{
+    uint64_t v = 0;
+    uint32_t b = s->start_bit;
+    for (uint32_t i=0; i<s->length; i++) {
+        if (s->motorola) {
+            v = (v << 1) | ((data[b / 8] >> (b % 8)) & 1);
+            b = (b % 8 == 0) ? b + 15 : b - 1;
+        } else {
+            v |= (uint64_t)((data[(b + i) / 8] >> ((b + i) % 8)) & 1) << i;
+        }
+    }
+    if ( s->is_signed && (s->length < 64) && ((v >> (s->length - 1)) & 1) ) {
+        v |= ~(uint64_t)0 << s->length;
+    }
+    return (int64_t)v;
+}
+
+/* a data frame of message m with random payload */
+static inline candle_frame_t dbc_gen_frame(const candle_dbc_message_t *m, uint32_t timestamp_us)
+{
+    candle_frame_t f;
+    memset(&f, 0, sizeof(f));
+    f.echo_id = 0xFFFFFFFF;
+    f.can_id = m->can_id;
+    f.can_dlc = 8;
+    for (unsigned i=0; i<8; i++) {
+        f.data[i] = (uint8_t)dbc_gen_random();
+    }
+    f.timestamp_us = timestamp_us;
+    return f;
+}
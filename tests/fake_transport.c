@@ -0,0 +1,746 @@
+#include "fake_transport.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <wchar.h>
+
+#include "candle_os.h"
+#include "test.h"
+
+enum {
+    FAKE_BREQ_HOST_FORMAT = 0,
+    FAKE_BREQ_BITTIMING,
+    FAKE_BREQ_MODE,
+    FAKE_BREQ_BERR,
+    FAKE_BREQ_BT_CONST,
+    FAKE_BREQ_DEVICE_CONFIG,
+    FAKE_TIMESTAMP_GET = 0x40,
+    FAKE_TIMESTAMP_ENABLE = 0x41,
+};
+
+typedef struct {
+    uint8_t *data;
+    uint32_t len;
+} fake_packet_t;
+
+/* a submitted write */
+typedef struct {
+    unsigned slot;
+    uint64_t due;           /* candle_time_ns() at which it is done */
+    uint32_t out;           /* its entry in the device's bulk-OUT log */
+} fake_write_t;
+
+/* per open handle */
+typedef struct {
+    int index;
+    unsigned num_urbs;
+    unsigned *reads;        /* submitted reads, oldest first */
+    uint32_t num_reads;
+    bool *filled;           /* per urb: has its data, completion not yet reported */
+    unsigned num_slots;
+    fake_write_t *writes;   /* submitted writes, completed by a reap once due */
+    uint32_t num_writes;
+} fake_handle_t;
+
+typedef struct {
+    bool present;
+    bool claimed;
+    bool echo;
+    uint8_t channels;
+    uint32_t fclk_can;
+
+    /* bulk-IN payloads not yet read, oldest at in_head */
+    fake_packet_t *in;
+    uint32_t in_head;
+    uint32_t in_count;
+    uint32_t in_capacity;
+
+    fake_packet_t *out;
+    uint32_t out_count;
+    uint32_t out_capacity;
+
+    candle_bittiming_t bittiming[CANDLE_MAX_CHANNELS];
+    candle_device_mode_t mode[CANDLE_MAX_CHANNELS];
+    uint32_t ts_us;
+    uint32_t opens;
+    uint32_t probes;        /* opens with dev->probing set */
+    uint32_t controls;
+
+    /* payloads that find no submitted read wait in the device, which holds
+       at most in_limit of them (0: any number) and drops the rest */
+    uint32_t in_limit;
+    uint32_t dropped;
+
+    /* while open */
+    fake_handle_t *handle;
+    candle_device_t *dev;
+} fake_device_t;
+
+static bool fake_initialized;
+static candle_mutex_t fake_lock;
+static candle_cond_t fake_cond;
+static fake_device_t fake_devices[FAKE_MAX_DEVICES];
+static int fake_num_devices;
+static bool fake_random_order;
+static uint32_t fake_random_state = 1;
+static uint32_t fake_control_delay_us;
+static uint32_t fake_write_delay_us;
+static uint32_t fake_reaps;
+static void (*fake_mode_hook)(int dev, uint8_t ch, uint32_t mode, void *arg);
+static void *fake_mode_hook_arg;
+
+static uint32_t fake_random(void)
+{
+    return test_random(&fake_random_state);
+}
+
+static void fake_free_packets(fake_packet_t *p, uint32_t first, uint32_t count, uint32_t capacity)
+{
+    for (uint32_t i=0; i<count; i++) {
+        free(p[(first + i) % capacity].data);
+    }
+    free(p);
+}
+
+void fake_reset(void)
+{
+    if (!fake_initialized) {
+        candle_mutex_init(&fake_lock);
+        candle_cond_init(&fake_cond);
+        fake_initialized = true;
+    }
+
+    candle_mutex_lock(&fake_lock);
+    for (int i=0; i<fake_num_devices; i++) {
+        fake_device_t *d = &fake_devices[i];
+        fake_free_packets(d->in, d->in_head, d->in_count, d->in_capacity);
+        fake_free_packets(d->out, 0, d->out_count, d->out_capacity ? d->out_capacity : 1);
+    }
+    memset(fake_devices, 0, sizeof(fake_devices));
+    fake_num_devices = 0;
+    fake_random_order = false;
+    fake_random_state = 1;
+    fake_control_delay_us = 0;
+    fake_write_delay_us = 0;
+    fake_reaps = 0;
+    fake_mode_hook = NULL;
+    fake_mode_hook_arg = NULL;
+    candle_mutex_unlock(&fake_lock);
+}
+
+int fake_add_device(uint8_t channels, uint32_t fclk_can)
+{
+    candle_mutex_lock(&fake_lock);
+    int n = fake_num_devices++;
+    fake_device_t *d = &fake_devices[n];
+    memset(d, 0, sizeof(*d));
+    d->present = true;
+    d->channels = channels;
+    d->fclk_can = fclk_can;
+    candle_mutex_unlock(&fake_lock);
+    return n;
+}
+
+/* hand waiting payloads to the reads in the order they were submitted, as
+   the host controller does; called with fake_lock held */
+static void fake_fill(fake_device_t *d)
+{
+    fake_handle_t *h = d->handle;
+    if ( (h == NULL) || !d->present ) {
+        return;
+    }
+
+    for (uint32_t i=0; (i<h->num_reads) && (d->in_count > 0); i++) {
+        unsigned urb_num = h->reads[i];
+        if (h->filled[urb_num]) {
+            continue;
+        }
+        fake_packet_t *p = &d->in[d->in_head];
+        canlde_rx_urb *urb = &d->dev->rxurbs[urb_num];
+        uint32_t len = (p->len < d->dev->opts.rx_urb_size) ? p->len : d->dev->opts.rx_urb_size;
+        memcpy(urb->buf, p->data, len);
+        urb->bytes_transfered = len;
+        free(p->data);
+        d->in_head = (d->in_head + 1) % d->in_capacity;
+        d->in_count--;
+        h->filled[urb_num] = true;
+    }
+}
+
+static void fake_queue_in(fake_device_t *d, const void *data, uint32_t len)
+{
+    if ( (d->in_limit > 0) && (d->in_count >= d->in_limit) ) {
+        d->dropped++;
+        return;
+    }
+
+    if (d->in_count == d->in_capacity) {
+        uint32_t capacity = (d->in_capacity == 0) ? 64 : 2 * d->in_capacity;
+        fake_packet_t *in = malloc(capacity * sizeof(fake_packet_t));
+        for (uint32_t i=0; i<d->in_count; i++) {
+            in[i] = d->in[(d->in_head + i) % d->in_capacity];
+        }
+        free(d->in);
+        d->in = in;
+        d->in_head = 0;
+        d->in_capacity = capacity;
+    }
+
+    fake_packet_t *p = &d->in[(d->in_head + d->in_count) % d->in_capacity];
+    p->data = malloc(len ? len : 1);
+    memcpy(p->data, data, len);
+    p->len = len;
+    d->in_count++;
+    fake_fill(d);
+}
+
+static void fake_log_out(fake_device_t *d, const void *data, uint32_t len)
+{
+    if (d->out_count == d->out_capacity) {
+        d->out_capacity = (d->out_capacity == 0) ? 64 : 2 * d->out_capacity;
+        d->out = realloc(d->out, d->out_capacity * sizeof(fake_packet_t));
+    }
+    fake_packet_t *p = &d->out[d->out_count++];
+    p->data = malloc(len ? len : 1);
+    memcpy(p->data, data, len);
+    p->len = len;
+}
+
+/* a device in echo mode sends every frame it has put on the bus back */
+static void fake_echo(fake_device_t *d, const void *data, uint32_t len)
+{
+    if (d->echo) {
+        for (uint32_t pos=0; pos+sizeof(candle_frame_t)<=len; pos+=sizeof(candle_frame_t)) {
+            fake_queue_in(d, (const uint8_t*)data + pos, sizeof(candle_frame_t));
+        }
+    }
+}
+
+void fake_push_in(int dev, const void *data, uint32_t len)
+{
+    candle_mutex_lock(&fake_lock);
+    fake_queue_in(&fake_devices[dev], data, len);
+    candle_cond_broadcast(&fake_cond);
+    candle_mutex_unlock(&fake_lock);
+}
+
+void fake_set_in_limit(int dev, uint32_t limit)
+{
+    candle_mutex_lock(&fake_lock);
+    fake_devices[dev].in_limit = limit;
+    candle_mutex_unlock(&fake_lock);
+}
+
+uint32_t fake_dropped(int dev)
+{
+    candle_mutex_lock(&fake_lock);
+    uint32_t n = fake_devices[dev].dropped;
+    candle_mutex_unlock(&fake_lock);
+    return n;
+}
+
+uint32_t fake_pending_in(int dev)
+{
+    candle_mutex_lock(&fake_lock);
+    uint32_t n = fake_devices[dev].in_count;
+    candle_mutex_unlock(&fake_lock);
+    return n;
+}
+
+void fake_set_echo(int dev, bool echo)
+{
+    candle_mutex_lock(&fake_lock);
+    fake_devices[dev].echo = echo;
+    candle_mutex_unlock(&fake_lock);
+}
+
+void fake_set_random_order(bool random)
+{
+    candle_mutex_lock(&fake_lock);
+    fake_random_order = random;
+    candle_mutex_unlock(&fake_lock);
+}
+
+uint32_t fake_out_count(int dev)
+{
+    candle_mutex_lock(&fake_lock);
+    uint32_t n = fake_devices[dev].out_count;
+    candle_mutex_unlock(&fake_lock);
+    return n;
+}
+
+bool fake_get_out(int dev, uint32_t n, void *data, uint32_t *len)
+{
+    candle_mutex_lock(&fake_lock);
+    fake_device_t *d = &fake_devices[dev];
+    bool rc = (n < d->out_count);
+    if (rc) {
+        uint32_t k = (d->out[n].len < *len) ? d->out[n].len : *len;
+        memcpy(data, d->out[n].data, k);
+        *len = d->out[n].len;
+    }
+    candle_mutex_unlock(&fake_lock);
+    return rc;
+}
+
+void fake_unplug(int dev)
+{
+    candle_mutex_lock(&fake_lock);
+    fake_devices[dev].present = false;
+    candle_cond_broadcast(&fake_cond);
+    candle_mutex_unlock(&fake_lock);
+}
+
+void fake_replug(int dev)
+{
+    candle_mutex_lock(&fake_lock);
+    fake_devices[dev].present = true;
+    candle_mutex_unlock(&fake_lock);
+}
+
+bool fake_get_bittiming(int dev, uint8_t ch, candle_bittiming_t *t)
+{
+    if (ch >= CANDLE_MAX_CHANNELS) {
+        return false;
+    }
+    candle_mutex_lock(&fake_lock);
+    *t = fake_devices[dev].bittiming[ch];
+    candle_mutex_unlock(&fake_lock);
+    return true;
+}
+
+bool fake_get_mode(int dev, uint8_t ch, uint32_t *mode, uint32_t *flags)
+{
+    if (ch >= CANDLE_MAX_CHANNELS) {
+        return false;
+    }
+    candle_mutex_lock(&fake_lock);
+    *mode = fake_devices[dev].mode[ch].mode;
+    *flags = fake_devices[dev].mode[ch].flags;
+    candle_mutex_unlock(&fake_lock);
+    return true;
+}
+
+void fake_set_mode_hook(void (*hook)(int dev, uint8_t ch, uint32_t mode, void *arg), void *arg)
+{
+    candle_mutex_lock(&fake_lock);
+    fake_mode_hook = hook;
+    fake_mode_hook_arg = arg;
+    candle_mutex_unlock(&fake_lock);
+}
+
+void fake_set_timestamp(int dev, uint32_t ts_us)
+{
+    candle_mutex_lock(&fake_lock);
+    fake_devices[dev].ts_us = ts_us;
+    candle_mutex_unlock(&fake_lock);
+}
+
+void fake_set_control_delay_us(uint32_t us)
+{
+    candle_mutex_lock(&fake_lock);
+    fake_control_delay_us = us;
+    candle_mutex_unlock(&fake_lock);
+}
+
+void fake_set_write_delay_us(uint32_t us)
+{
+    candle_mutex_lock(&fake_lock);
+    fake_write_delay_us = us;
+    candle_mutex_unlock(&fake_lock);
+}
+
+/* finer than candle_sleep_ms(), for bus-like delays */
+static void fake_busy_wait_us(uint32_t us)
+{
+    uint64_t until = candle_time_ns() + (uint64_t)us * 1000;
+    while (candle_time_ns() < until) {
+    }
+}
+
+uint32_t fake_open_count(int dev)
+{
+    candle_mutex_lock(&fake_lock);
+    uint32_t n = fake_devices[dev].opens;
+    candle_mutex_unlock(&fake_lock);
+    return n;
+}
+
+uint32_t fake_probe_count(int dev)
+{
+    candle_mutex_lock(&fake_lock);
+    uint32_t n = fake_devices[dev].probes;
+    candle_mutex_unlock(&fake_lock);
+    return n;
+}
+
+uint32_t fake_reap_count(void)
+{
+    return candle_atomic_load(&fake_reaps);
+}
+
+uint32_t fake_control_count(int dev)
+{
+    candle_mutex_lock(&fake_lock);
+    uint32_t n = fake_devices[dev].controls;
+    candle_mutex_unlock(&fake_lock);
+    return n;
+}
+
+static bool fake_scan(candle_list_t *l)
+{
+    candle_mutex_lock(&fake_lock);
+    bool rc = true;
+    for (int i=0; (i<fake_num_devices) && rc; i++) {
+        if (fake_devices[i].present) {
+            wchar_t path[32];
+            swprintf(path, sizeof(path)/sizeof(path[0]), L"fake:%d", i);
+            rc = candle_list_add(l, path);
+        }
+    }
+    candle_mutex_unlock(&fake_lock);
+
+    if (rc) {
+        l->last_error = CANDLE_ERR_OK;
+    }
+    return rc;
+}
+
+static bool fake_open(candle_device_t *dev)
+{
+    int index = -1;
+    if ( (swscanf(dev->path, L"fake:%d", &index) != 1) || (index < 0) ) {
+        dev->last_error = CANDLE_ERR_CREATE_FILE;
+        return false;
+    }
+
+    candle_mutex_lock(&fake_lock);
+    if ( (index >= fake_num_devices) || !fake_devices[index].present ) {
+        candle_mutex_unlock(&fake_lock);
+        dev->last_error = CANDLE_ERR_CREATE_FILE;
+        return false;
+    }
+    fake_device_t *d = &fake_devices[index];
+    if (d->claimed) {
+        candle_mutex_unlock(&fake_lock);
+        dev->last_error = CANDLE_ERR_CLAIM_INTERFACE;
+        return false;
+    }
+    d->claimed = true;
+    d->opens++;
+    if (dev->probing) {
+        d->probes++;
+    }
+    candle_mutex_unlock(&fake_lock);
+
+    fake_handle_t *h = calloc(1, sizeof(fake_handle_t));
+    h->index = index;
+    h->num_urbs = dev->opts.rx_urb_count;
+    h->reads = calloc(h->num_urbs, sizeof(unsigned));
+    h->filled = calloc(h->num_urbs, sizeof(bool));
+
+    candle_mutex_lock(&fake_lock);
+    d->handle = h;
+    d->dev = dev;
+    candle_mutex_unlock(&fake_lock);
+
+    dev->transport_data = h;
+    dev->interfaceNumber = 0;
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+static bool fake_close(candle_device_t *dev)
+{
+    fake_handle_t *h = (fake_handle_t*)dev->transport_data;
+    if (h == NULL) {
+        return true;
+    }
+
+    candle_mutex_lock(&fake_lock);
+    fake_devices[h->index].claimed = false;
+    fake_devices[h->index].handle = NULL;
+    fake_devices[h->index].dev = NULL;
+    candle_mutex_unlock(&fake_lock);
+
+    free(h->reads);
+    free(h->filled);
+    free(h->writes);
+    free(h);
+    dev->transport_data = NULL;
+    return true;
+}
+
+static bool fake_control(candle_device_t *dev, uint8_t request, uint8_t requesttype, uint16_t value, uint16_t index, void *data, uint16_t size)
+{
+    fake_handle_t *h = (fake_handle_t*)dev->transport_data;
+    (void)requesttype;
+    (void)index;
+
+    candle_mutex_lock(&fake_lock);
+    fake_device_t *d = &fake_devices[h->index];
+    uint32_t delay_us = fake_control_delay_us;
+    d->controls++;
+    if (!d->present) {
+        candle_mutex_unlock(&fake_lock);
+        dev->last_error = CANDLE_ERR_DEVICE_GONE;
+        return false;
+    }
+
+    bool rc = true;
+    bool mode_changed = false;
+    switch (request) {
+        case FAKE_BREQ_HOST_FORMAT:
+        case FAKE_TIMESTAMP_ENABLE:
+            break;
+        case FAKE_BREQ_BITTIMING:
+            rc = (value < d->channels) && (size == sizeof(candle_bittiming_t));
+            if (rc) {
+                memcpy(&d->bittiming[value], data, size);
+            }
+            break;
+        case FAKE_BREQ_MODE:
+            rc = (value < d->channels) && (size == sizeof(candle_device_mode_t));
+            if (rc) {
+                memcpy(&d->mode[value], data, size);
+                mode_changed = true;
+            }
+            break;
+        case FAKE_BREQ_BT_CONST: {
+            candle_capability_t cap = { 0, d->fclk_can, 1, 16, 1, 8, 4, 1, 1024, 1 };
+            rc = (value < d->channels) && (size == sizeof(cap));
+            if (rc) {
+                memcpy(data, &cap, size);
+            }
+            break;
+        }
+        case FAKE_BREQ_DEVICE_CONFIG: {
+            candle_device_config_t conf = { 0, 0, 0, (uint8_t)(d->channels - 1), 2, 1 };
+            rc = (size == sizeof(conf));
+            if (rc) {
+                memcpy(data, &conf, size);
+            }
+            break;
+        }
+        case FAKE_TIMESTAMP_GET:
+            rc = (size == sizeof(uint32_t));
+            if (rc) {
+                memcpy(data, &d->ts_us, size);
+            }
+            break;
+        default:
+            rc = false;
+            break;
+    }
+
+    void (*hook)(int, uint8_t, uint32_t, void *) = mode_changed ? fake_mode_hook : NULL;
+    void *hook_arg = fake_mode_hook_arg;
+    uint32_t mode = d->mode[value % CANDLE_MAX_CHANNELS].mode;
+    candle_mutex_unlock(&fake_lock);
+
+    if (delay_us > 0) {
+        candle_sleep_ms((delay_us + 999) / 1000);
+    }
+    if (hook != NULL) {
+        hook(h->index, (uint8_t)value, mode, hook_arg);
+    }
+
+    dev->last_error = rc ? CANDLE_ERR_OK : CANDLE_ERR_READ_RESULT;
+    return rc;
+}
+
+static bool fake_write(candle_device_t *dev, const void *data, uint32_t size, uint32_t *written)
+{
+    fake_handle_t *h = (fake_handle_t*)dev->transport_data;
+
+    candle_mutex_lock(&fake_lock);
+    fake_device_t *d = &fake_devices[h->index];
+    uint32_t delay_us = fake_write_delay_us;
+    bool rc = d->present;
+    if (rc) {
+        fake_log_out(d, data, size);
+    }
+    candle_mutex_unlock(&fake_lock);
+
+    if (rc && (delay_us > 0)) {
+        fake_busy_wait_us(delay_us);
+    }
+
+    if (rc) {
+        candle_mutex_lock(&fake_lock);
+        fake_echo(d, data, size);
+        candle_cond_broadcast(&fake_cond);
+        candle_mutex_unlock(&fake_lock);
+    }
+
+    *written = rc ? size : 0;
+    dev->last_error = rc ? CANDLE_ERR_OK : CANDLE_ERR_DEVICE_GONE;
+    return rc;
+}
+
+static bool fake_alloc_writes(candle_device_t *dev, unsigned num_slots)
+{
+    fake_handle_t *h = (fake_handle_t*)dev->transport_data;
+
+    h->writes = calloc(num_slots, sizeof(fake_write_t));
+    if (h->writes == NULL) {
+        dev->last_error = CANDLE_ERR_MALLOC;
+        return false;
+    }
+    h->num_slots = num_slots;
+
+    dev->last_error = CANDLE_ERR_OK;
+    return true;
+}
+
+static candle_err_t fake_submit_write(candle_device_t *dev, unsigned slot, const void *data, uint32_t size)
+{
+    fake_handle_t *h = (fake_handle_t*)dev->transport_data;
+
+    candle_mutex_lock(&fake_lock);
+    fake_device_t *d = &fake_devices[h->index];
+    if (!d->present) {
+        candle_mutex_unlock(&fake_lock);
+        return CANDLE_ERR_DEVICE_GONE;
+    }
+    fake_write_t *w = &h->writes[h->num_writes++];
+    w->slot = slot;
+    w->due = candle_time_ns() + (uint64_t)fake_write_delay_us * 1000;
+    w->out = d->out_count;
+    fake_log_out(d, data, size);
+    candle_cond_broadcast(&fake_cond);
+    candle_mutex_unlock(&fake_lock);
+    return CANDLE_ERR_OK;
+}
+
+static candle_err_t fake_submit_read(candle_device_t *dev, unsigned urb_num)
+{
+    fake_handle_t *h = (fake_handle_t*)dev->transport_data;
+
+    candle_mutex_lock(&fake_lock);
+    if (!fake_devices[h->index].present) {
+        candle_mutex_unlock(&fake_lock);
+        return CANDLE_ERR_DEVICE_GONE;
+    }
+    h->reads[h->num_reads++] = urb_num;
+    h->filled[urb_num] = false;
+    fake_fill(&fake_devices[h->index]);
+    candle_cond_broadcast(&fake_cond);
+    candle_mutex_unlock(&fake_lock);
+    return CANDLE_ERR_OK;
+}
+
+static void fake_complete_read(candle_device_t *dev, fake_handle_t *h, uint32_t pos, candle_err_t status)
+{
+    unsigned urb_num = h->reads[pos];
+    memmove(&h->reads[pos], &h->reads[pos+1], (h->num_reads - pos - 1) * sizeof(unsigned));
+    h->num_reads--;
+    h->filled[urb_num] = false;
+
+    canlde_rx_urb *urb = &dev->rxurbs[urb_num];
+    urb->status = status;
+    if (status != CANDLE_ERR_OK) {
+        urb->bytes_transfered = 0;
+    }
+    urb->done = true;
+}
+
+/* called with fake_lock held; returns the number of completions reported */
+static uint32_t fake_reap_locked(candle_device_t *dev, fake_handle_t *h)
+{
+    fake_device_t *d = &fake_devices[h->index];
+    uint32_t completed = 0;
+
+    /* writes are due in the order they were submitted */
+    uint64_t now = candle_time_ns();
+    uint32_t done = 0;
+    while ( (done < h->num_writes) && (!d->present || (h->writes[done].due <= now)) ) {
+        fake_write_t *w = &h->writes[done];
+        if (d->present) {
+            fake_echo(d, d->out[w->out].data, d->out[w->out].len);
+        }
+        candle_tx_complete(dev, w->slot, d->present);
+        done++;
+    }
+    memmove(h->writes, &h->writes[done], (h->num_writes - done) * sizeof(fake_write_t));
+    h->num_writes -= done;
+    completed += done;
+
+    if (!d->present) {
+        while (h->num_reads > 0) {
+            fake_complete_read(dev, h, 0, CANDLE_ERR_DEVICE_GONE);
+            completed++;
+        }
+        return completed;
+    }
+
+    uint32_t filled = 0;
+    for (uint32_t i=0; i<h->num_reads; i++) {
+        filled += h->filled[h->reads[i]];
+    }
+
+    if (!fake_random_order) {
+        while ( (h->num_reads > 0) && h->filled[h->reads[0]] ) {
+            fake_complete_read(dev, h, 0, CANDLE_ERR_OK);
+            completed++;
+        }
+    } else if (filled > 0) {
+        /* report one of them, any one */
+        uint32_t pick = fake_random() % filled;
+        for (uint32_t i=0; i<h->num_reads; i++) {
+            if (h->filled[h->reads[i]] && (pick-- == 0)) {
+                fake_complete_read(dev, h, i, CANDLE_ERR_OK);
+                completed++;
+                break;
+            }
+        }
+    }
+
+    return completed;
+}
+
+static candle_err_t fake_reap(candle_device_t *dev, uint32_t timeout_ms)
+{
+    fake_handle_t *h = (fake_handle_t*)dev->transport_data;
+    uint64_t deadline = candle_time_ns() + (uint64_t)timeout_ms * 1000000;
+
+    candle_mutex_lock(&fake_lock);
+    candle_atomic_store(&fake_reaps, fake_reaps + 1);
+    for (;;) {
+        if (fake_reap_locked(dev, h) > 0) {
+            break;
+        }
+        if ( !fake_devices[h->index].present && (h->num_reads == 0) ) {
+            candle_mutex_unlock(&fake_lock);
+            return CANDLE_ERR_DEVICE_GONE;
+        }
+
+        uint64_t now = candle_time_ns();
+        if (now >= deadline) {
+            candle_mutex_unlock(&fake_lock);
+            return CANDLE_ERR_READ_TIMEOUT;
+        }
+        if (h->num_writes > 0) {
+            /* a write falls due before anything else would wake us */
+            candle_mutex_unlock(&fake_lock);
+            fake_busy_wait_us(1);
+            candle_mutex_lock(&fake_lock);
+            continue;
+        }
+        candle_cond_wait(&fake_cond, &fake_lock, (uint32_t)((deadline - now + 999999) / 1000000));
+    }
+    candle_mutex_unlock(&fake_lock);
+    return CANDLE_ERR_OK;
+}
+
+const candle_transport_t candle_transport_fake = {
+    "fake",
+    fake_scan,
+    fake_open,
+    fake_close,
+    fake_control,
+    fake_write,
+    fake_alloc_writes,
+    fake_submit_write,
+    fake_submit_read,
+    fake_reap
+};
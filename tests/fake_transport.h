@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "candle_transport.h"
+
+/* An in-memory candle device behind the transport interface, for tests and
+ * benchmarks that run without hardware. Devices are listed as "fake:<n>"
+ * in the order they were added. Bulk-IN payloads are queued by the test and
+ * handed to reads in submission order; control requests answer like a
+ * gs_usb firmware with the given channel count and CAN clock.
+ */
+#define FAKE_MAX_DEVICES CANDLE_MAX_DEVICES
+
+extern const candle_transport_t candle_transport_fake;
+
+/* forget all devices and counters */
+void fake_reset(void);
+/* returns the index of the new device */
+int fake_add_device(uint8_t channels, uint32_t fclk_can);
+
+/* one bulk-IN transfer of len bytes, at most 16384. It goes to the oldest
+   submitted read that has no data yet, or waits in the device. */
+void fake_push_in(int dev, const void *data, uint32_t len);
+/* payloads waiting in the device */
+uint32_t fake_pending_in(int dev);
+/* the device holds at most limit waiting payloads (0: no limit) and drops
+   what comes in beyond; fake_dropped() counts them */
+void fake_set_in_limit(int dev, uint32_t limit);
+uint32_t fake_dropped(int dev);
+
+/* write completions are reported on the next reap; with echo every frame
+   written is queued back as its own bulk-IN transfer */
+void fake_set_echo(int dev, bool echo);
+/* reads that have their data report completion in random order */
+void fake_set_random_order(bool random);
+
+/* bulk-OUT transfers received so far */
+uint32_t fake_out_count(int dev);
+/* copies at most *len bytes of transfer n and sets *len to its size */
+bool fake_get_out(int dev, uint32_t n, void *data, uint32_t *len);
+
+/* every transfer and control request fails with CANDLE_ERR_DEVICE_GONE
+   until the device is plugged back in */
+void fake_unplug(int dev);
+void fake_replug(int dev);
+
+/* the last bit timing and mode (mode, flags) set per channel */
+bool fake_get_bittiming(int dev, uint8_t ch, candle_bittiming_t *t);
+bool fake_get_mode(int dev, uint8_t ch, uint32_t *mode, uint32_t *flags);
+/* called for every mode request, e.g. to queue the frames a bus would carry */
+void fake_set_mode_hook(void (*hook)(int dev, uint8_t ch, uint32_t mode, void *arg), void *arg);
+
+/* device counter returned by the timestamp request */
+void fake_set_timestamp(int dev, uint32_t ts_us);
+/* delay of every control request */
+void fake_set_control_delay_us(uint32_t us);
+/* time a bulk-OUT transfer takes: a blocking write returns after it, a
+   submitted one is reported complete no earlier */
+void fake_set_write_delay_us(uint32_t us);
+
+uint32_t fake_open_count(int dev);
+/* opens that were only probes, see candle_device_t.probing */
+uint32_t fake_probe_count(int dev);
+uint32_t fake_control_count(int dev);
+/* calls of reap, the transport's equivalent of a wait syscall */
+uint32_t fake_reap_count(void);
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "candle.h"
+#include "fake_transport.h"
+
+/* Each test program runs its cases with RUN() and exits non-zero if any
+ * CHECK() failed. Device tests start from fake_reset().
+ */
+static int test_failures __attribute__((unused));
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        test_failures++; \
+    } \
+} while (0)
+
+#define RUN(fn) do { \
+    int failures_before = test_failures; \
+    fn(); \
+    printf("%s %s\n", (test_failures == failures_before) ? "ok  " : "FAIL", #fn); \
+} while (0)
+
+#define TEST_EXIT() (test_failures ? EXIT_FAILURE : EXIT_SUCCESS)
+
+/* the one generator of the tests, fakes and benchmarks: 24 bits of a
+   small LCG, from a seed of the caller so every run is the same */
+static inline uint32_t test_random(uint32_t *seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return *seed >> 8;
+}
+
+static inline candle_frame_t test_frame(uint32_t can_id, uint8_t ch, uint32_t timestamp_us)
+{
+    candle_frame_t f;
+    memset(&f, 0, sizeof(f));
+    f.echo_id = 0xFFFFFFFF;
+    f.can_id = can_id;
+    f.can_dlc = 8;
+    f.channel = ch;
+    for (unsigned i=0; i<8; i++) {
+        f.data[i] = (uint8_t)(can_id + i);
+    }
+    f.timestamp_us = timestamp_us;
+    return f;
+}
+
+/* device n of a fresh scan, opened with opts (NULL for the defaults) */
+static inline candle_handle test_open(uint8_t n, const candle_dev_options_t *opts)
+{
+    candle_list_handle list;
+    candle_handle hdev = NULL;
+
+    if (!candle_list_scan_transport(&list, &candle_transport_fake)) {
+        return NULL;
+    }
+    if (!candle_dev_get(list, n, &hdev)) {
+        hdev = NULL;
+    }
+    candle_list_free(list);
+
+    if (hdev == NULL) {
+        return NULL;
+    }
+    bool rc = (opts != NULL) ? candle_dev_open_ex(hdev, opts) : candle_dev_open(hdev);
+    if (!rc) {
+        fprintf(stderr, "open failed: %d\n", candle_dev_last_error(hdev));
+        candle_dev_free(hdev);
+        return NULL;
+    }
+    return hdev;
+}
+
+/* a fresh fake with one single channel device, opened with the default
+   options and flags */
+static inline candle_handle test_open_flags(int *d, uint32_t flags)
+{
+    fake_reset();
+    *d = fake_add_device(1, 48000000);
+
+    candle_dev_options_t opts;
+    candle_dev_options_init(&opts);
+    opts.flags |= flags;
+    return test_open(0, &opts);
+}
+
+static inline void test_close(candle_handle hdev)
+{
+    if (hdev != NULL) {
+        candle_dev_close(hdev);
+        candle_dev_free(hdev);
+    }
+}
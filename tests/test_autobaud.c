@@ -0,0 +1,150 @@
+#include "test.h"
+
+/* A bus running at BUS_RATE: a listening channel receives frames when its
+ * bit timing matches, error frames otherwise. Stopping a mismatched channel
+ * leaves late error frames queued behind it.
+ */
+#define BUS_RATE 250000
+
+typedef struct {
+    uint32_t valid;         /* frames per start at the bus rate */
+    uint32_t errors;        /* error frames per start at another rate */
+    uint32_t late_errors;   /* error frames queued on stopping at another rate */
+    candle_handle hdev;
+    candle_filter_handle set_filter;    /* set on the first start, if not NULL */
+    uint32_t starts;
+    bool matched;
+} bus_t;
+
+static uint32_t bus_rate_of(int d, uint8_t ch)
+{
+    candle_bittiming_t t;
+    if (!fake_get_bittiming(d, ch, &t)) {
+        return 0;
+    }
+    return 48000000 / (t.brp * (1 + t.prop_seg + t.phase_seg1 + t.phase_seg2));
+}
+
+static void bus_push(int d, uint8_t ch, uint32_t n, bool error)
+{
+    for (uint32_t i=0; i<n; i++) {
+        candle_frame_t f = test_frame(error ? 0x20000004 : 0x100 + i, ch, i);
+        fake_push_in(d, &f, sizeof(f));
+    }
+}
+
+static void bus_mode_hook(int d, uint8_t ch, uint32_t mode, void *arg)
+{
+    bus_t *bus = (bus_t*)arg;
+    bus->matched = (bus_rate_of(d, ch) == BUS_RATE);
+
+    if (mode == 1) {
+        if ( (bus->starts++ == 0) && (bus->set_filter != NULL) ) {
+            candle_dev_set_filter(bus->hdev, bus->set_filter);
+        }
+        bus_push(d, ch, bus->matched ? bus->valid : bus->errors, !bus->matched);
+    } else if (!bus->matched) {
+        bus_push(d, ch, bus->late_errors, true);
+    }
+}
+
+static candle_handle bus_open(bus_t *bus, int *d)
+{
+    fake_reset();
+    *d = fake_add_device(2, 48000000);
+    fake_set_mode_hook(bus_mode_hook, bus);
+    bus->hdev = test_open(0, NULL);
+    return bus->hdev;
+}
+
+static void test_detects_bus_rate(void)
+{
+    bus_t bus = { 8, 8, 0, NULL, NULL, 0, false };
+    int d;
+    candle_handle hdev = bus_open(&bus, &d);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+
+    uint32_t detected = 0;
+    CHECK(candle_channel_autobaud(hdev, 1, NULL, 0, 1000, &detected));
+    CHECK(detected == BUS_RATE);
+    CHECK(bus_rate_of(d, 1) == BUS_RATE);
+
+    /* the channel is left stopped */
+    uint32_t mode, flags;
+    CHECK(fake_get_mode(d, 1, &mode, &flags));
+    CHECK(mode == 0);
+
+    /* a bus with nothing but errors at every rate */
+    bus.valid = 0;
+    CHECK(!candle_channel_autobaud(hdev, 1, NULL, 0, 200, &detected));
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_AUTOBAUD_FAILED);
+
+    test_close(hdev);
+}
+
+static void test_late_errors_are_drained(void)
+{
+    /* few frames at the right rate, more late errors from the one before:
+       counted against it they would sink it */
+    bus_t bus = { 2, 1, 5, NULL, NULL, 0, false };
+    int d;
+    candle_handle hdev = bus_open(&bus, &d);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+
+    static const uint32_t candidates[] = { 500000, 250000 };
+    uint32_t detected = 0;
+    CHECK(candle_channel_autobaud(hdev, 0, candidates, 2, 100, &detected));
+    CHECK(detected == BUS_RATE);
+
+    test_close(hdev);
+}
+
+static void test_filter_set_meanwhile_is_kept(void)
+{
+    candle_filter_handle before, meanwhile;
+    CHECK(candle_filter_create(&before));
+    CHECK(candle_filter_add_range(before, false, 0x140, 0x15F));
+    CHECK(candle_filter_create(&meanwhile));
+    CHECK(candle_filter_add_range(meanwhile, false, 0x100, 0x10F));
+    CHECK(candle_filter_add_range(meanwhile, false, 0x300, 0x3FF));
+
+    bus_t bus = { 8, 8, 0, NULL, meanwhile, 0, false };
+    int d;
+    candle_handle hdev = bus_open(&bus, &d);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+    CHECK(candle_dev_set_filter(hdev, before));
+
+    uint32_t detected = 0;
+    CHECK(candle_channel_autobaud(hdev, 0, NULL, 0, 1000, &detected));
+    CHECK(detected == BUS_RATE);
+
+    /* 0x150 passes the filter put aside but not the one set during the search */
+    candle_frame_t f = test_frame(0x150, 0, 0);
+    fake_push_in(d, &f, sizeof(f));
+    f = test_frame(0x350, 0, 1);
+    fake_push_in(d, &f, sizeof(f));
+    candle_frame_t rx;
+    CHECK(candle_frame_read(hdev, &rx, 100));
+    CHECK(candle_frame_id(&rx) == 0x350);
+
+    test_close(hdev);
+    candle_filter_free(before);
+    candle_filter_free(meanwhile);
+}
+
+int main(void)
+{
+    RUN(test_detects_bus_rate);
+    RUN(test_late_errors_are_drained);
+    RUN(test_filter_set_meanwhile_is_kept);
+    return TEST_EXIT();
+}
@@ -0,0 +1,152 @@
+#include "test.h"
+#include "candle_os.h"
+
+static uint32_t test_seed = 7;
+
+/* every field random, so a column mixed up with another shows */
+static void random_frames(candle_frame_t *frames, size_t num_frames)
+{
+    for (size_t i=0; i<num_frames; i++) {
+        candle_frame_t *f = &frames[i];
+        f->echo_id = test_random(&test_seed);
+        f->can_id = test_random(&test_seed) % 2048;
+        f->can_dlc = (uint8_t)(test_random(&test_seed) % 9);
+        f->channel = (uint8_t)test_random(&test_seed);
+        f->flags = (uint8_t)test_random(&test_seed);
+        f->reserved = (uint8_t)test_random(&test_seed);
+        for (unsigned k=0; k<8; k++) {
+            f->data[k] = (uint8_t)test_random(&test_seed);
+        }
+        f->timestamp_us = test_random(&test_seed) * 256;
+    }
+}
+
+static bool aligned(const void *p)
+{
+    return ((uintptr_t)p % 64) == 0;
+}
+
+/* appended in odd sized pieces, growing the batch, with each kernel set */
+static void test_append_get_roundtrip(void)
+{
+    enum { NUM = 5003 };
+    static candle_frame_t in[NUM], out[NUM];
+    random_frames(in, NUM);
+
+    for (candle_isa_t isa=CANDLE_ISA_SCALAR; isa<=CANDLE_ISA_AVX2; isa++) {
+        candle_set_isa(isa);
+        candle_frame_batch_t batch;
+        CHECK(candle_frame_batch_init(&batch, 10));
+        for (size_t at=0, n=1; at<NUM; at+=n, n=n*3+1) {
+            size_t piece = (NUM - at < n) ? NUM - at : n;
+            CHECK(candle_frame_batch_append(&batch, &in[at], piece));
+        }
+        CHECK(batch.count == NUM);
+        CHECK(batch.capacity >= NUM);
+        CHECK(aligned(batch.can_id) && aligned(batch.timestamp_us) && aligned(batch.data) && aligned(batch.echo_id));
+        CHECK(aligned(batch.can_dlc) && aligned(batch.channel) && aligned(batch.flags) && aligned(batch.epoch));
+
+        memset(out, 0, sizeof(out));
+        CHECK(candle_frame_batch_get(&batch, 0, out, NUM));
+        CHECK(memcmp(in, out, sizeof(in)) == 0);
+
+        /* the columns hold the fields as they are */
+        uint32_t mismatches = 0;
+        for (size_t i=0; i<NUM; i++) {
+            uint64_t data;
+            memcpy(&data, in[i].data, sizeof(data));
+            mismatches += (batch.can_id[i] != in[i].can_id) || (batch.timestamp_us[i] != in[i].timestamp_us)
+                        || (batch.data[i] != data) || (batch.epoch[i] != in[i].reserved);
+        }
+        CHECK(mismatches == 0);
+
+        CHECK(!candle_frame_batch_get(&batch, NUM - 1, out, 2));
+        CHECK(candle_frame_batch_clear(&batch));
+        CHECK(batch.count == 0);
+        CHECK(candle_frame_batch_free(&batch));
+    }
+    candle_set_isa(CANDLE_ISA_AVX2);
+}
+
+static void test_select(void)
+{
+    enum { NUM = 3000 };
+    static candle_frame_t in[NUM];
+    static size_t index[NUM];
+    random_frames(in, NUM);
+    for (size_t i=0; i<NUM; i++) {
+        in[i].can_id = (uint32_t)(i % 7);
+        in[i].timestamp_us = 0xFFFFF000u + (uint32_t)i * 3;   /* wraps at 1366 */
+    }
+
+    candle_frame_batch_t batch;
+    CHECK(candle_frame_batch_init(&batch, NUM));
+    CHECK(candle_frame_batch_append(&batch, in, NUM));
+
+    size_t n = candle_frame_batch_select_id(&batch, 3, index);
+    CHECK(n == NUM / 7 + (NUM % 7 > 3));
+    CHECK(candle_frame_batch_select_id(&batch, 3, NULL) == n);
+    uint32_t mismatches = 0;
+    for (size_t k=0; k<n; k++) {
+        mismatches += (index[k] != k * 7 + 3);
+    }
+    CHECK(mismatches == 0);
+    CHECK(candle_frame_batch_select_id(&batch, 7, NULL) == 0);
+
+    /* a window across the counter wrap, inclusive at both ends */
+    uint32_t from = 0xFFFFF000u + 1000 * 3, to = 0xFFFFF000u + 2000 * 3;
+    n = candle_frame_batch_select_time(&batch, from, to, index);
+    CHECK(n == 1001);
+    CHECK(candle_frame_batch_select_time(&batch, from, to, NULL) == n);
+    CHECK((index[0] == 1000) && (index[n - 1] == 2000));
+    CHECK(candle_frame_batch_select_time(&batch, to + 1, from - 1, NULL) == NUM - n);
+
+    CHECK(candle_frame_batch_free(&batch));
+}
+
+static void test_read_batch(void)
+{
+    fake_reset();
+    int d = fake_add_device(1, 48000000);
+    candle_handle hdev = test_open(0, NULL);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+
+    enum { NUM = 600 };
+    static candle_frame_t in[NUM], out[NUM];
+    for (uint32_t i=0; i<NUM; i++) {
+        in[i] = test_frame(i % 2048, 0, i * 10);
+        fake_push_in(d, &in[i], sizeof(in[i]));
+    }
+
+    candle_frame_batch_t batch;
+    CHECK(candle_frame_batch_init(&batch, 0));
+    uint32_t count = 0;
+    /* at most max, and what is not taken stays queued */
+    CHECK(candle_frame_read_batch(hdev, &batch, 100, &count, 100));
+    CHECK((count > 0) && (count <= 100));
+    CHECK(batch.count == count);
+    while ( (batch.count < NUM) && candle_frame_read_batch(hdev, &batch, NUM, &count, 100) ) {
+    }
+    CHECK(batch.count == NUM);
+    CHECK(candle_frame_batch_get(&batch, 0, out, NUM));
+    CHECK(memcmp(in, out, sizeof(in)) == 0);
+
+    CHECK(!candle_frame_read_batch(hdev, &batch, NUM, &count, 20));
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_READ_TIMEOUT);
+    CHECK(count == 0);
+    CHECK(batch.count == NUM);
+
+    CHECK(candle_frame_batch_free(&batch));
+    test_close(hdev);
+}
+
+int main(void)
+{
+    RUN(test_append_get_roundtrip);
+    RUN(test_select);
+    RUN(test_read_batch);
+    return TEST_EXIT();
+}
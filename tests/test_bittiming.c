@@ -0,0 +1,181 @@
+#include "test.h"
+#include "candle_bittiming.h"
+
+/* bxCAN on the 48 MHz candleLight boards, FDCAN on the 80 and 160 MHz ones */
+static const candle_capability_t cap_bxcan = { 0, 48000000, 1, 16, 1, 8, 4, 1, 1024, 1 };
+static const candle_capability_t cap_fdcan80 = { 0, 80000000, 1, 256, 1, 128, 128, 1, 512, 1 };
+static const candle_capability_t cap_fdcan160 = { 0, 160000000, 1, 256, 1, 128, 128, 1, 512, 1 };
+
+static const uint32_t std_rates[] = { 10000, 20000, 50000, 83333, 100000, 125000, 250000, 500000, 800000, 1000000 };
+
+/* known good timings: fclk, bitrate, sample point, brp, tseg1, tseg2 */
+static const uint32_t known_good[][6] = {
+    {  48000000,   10000, 875, 300, 13,  2 },
+    {  48000000,  125000, 875,  24, 13,  2 },
+    {  48000000,  250000, 875,  12, 13,  2 },
+    {  48000000,  500000, 875,   6, 13,  2 },
+    {  48000000,  800000, 875,   4, 12,  2 },
+    {  48000000, 1000000, 875,   3, 13,  2 },
+    {  48000000,  500000, 800,   6, 12,  3 },
+    {  48000000, 1000000, 750,   3, 11,  4 },
+    {  80000000,  125000, 875,  10, 55,  8 },
+    {  80000000,  500000, 875,   4, 34,  5 },
+    {  80000000, 1000000, 800,   1, 63, 16 },
+    { 160000000,  500000, 875,   5, 55,  8 },
+    { 160000000, 1000000, 875,   4, 34,  5 },
+};
+
+static const candle_capability_t *cap_for(uint32_t fclk)
+{
+    return (fclk == 48000000) ? &cap_bxcan : (fclk == 80000000) ? &cap_fdcan80 : &cap_fdcan160;
+}
+
+static uint32_t timing_tseg1(const candle_bittiming_t *t)
+{
+    return t->prop_seg + t->phase_seg1;
+}
+
+static bool within_limits(const candle_capability_t *cap, const candle_bittiming_t *t)
+{
+    uint32_t tseg1 = timing_tseg1(t);
+    return (tseg1 >= cap->tseg1_min) && (tseg1 <= cap->tseg1_max)
+        && (t->phase_seg2 >= cap->tseg2_min) && (t->phase_seg2 <= cap->tseg2_max)
+        && (t->brp >= cap->brp_min) && (t->brp <= cap->brp_max) && (t->brp % cap->brp_inc == 0)
+        && (t->sjw >= 1) && (t->sjw <= cap->sjw_max);
+}
+
+/* bitrate error in ppb and sample point error in ppm of a bit, as the solver ranks them */
+static void score(const candle_capability_t *cap, uint32_t bitrate, uint32_t sp, uint64_t brp, uint64_t tseg1, uint64_t tseg2, uint64_t *rate_err, uint64_t *sp_err)
+{
+    uint64_t nbt = 1 + tseg1 + tseg2;
+    uint64_t div = (uint64_t)bitrate * brp * nbt;
+    uint64_t diff = (cap->fclk_can > div) ? cap->fclk_can - div : div - cap->fclk_can;
+    *rate_err = diff * 1000000000ull / div;
+    uint64_t at = (1 + tseg1) * 1000000 / nbt;
+    *sp_err = (at > sp * 1000ull) ? at - sp * 1000ull : sp * 1000ull - at;
+}
+
+static void test_known_good_rates(void)
+{
+    for (unsigned i=0; i<sizeof(known_good)/sizeof(known_good[0]); i++) {
+        const uint32_t *k = known_good[i];
+        const candle_capability_t *cap = cap_for(k[0]);
+        candle_bittiming_t t;
+        candle_bittiming_result_t r;
+        CHECK(candle_bt_calc(cap, k[1], k[2], &t, &r) == CANDLE_ERR_OK);
+        CHECK(within_limits(cap, &t));
+        CHECK(r.error_ppm == 0);
+        CHECK(r.bitrate == k[1]);
+
+        /* at least as close to the sample point as the known timing */
+        uint64_t rate_err, sp_err, known_rate_err, known_sp_err;
+        score(cap, k[1], k[2], t.brp, timing_tseg1(&t), t.phase_seg2, &rate_err, &sp_err);
+        score(cap, k[1], k[2], k[3], k[4], k[5], &known_rate_err, &known_sp_err);
+        CHECK(rate_err == 0);
+        CHECK(sp_err <= known_sp_err);
+    }
+}
+
+/* every brp/tseg1/tseg2 the limits allow, for bitrates good and awkward */
+static void test_exhaustive_bxcan(void)
+{
+    static const uint32_t rates[] = {
+        10000, 33333, 47619, 50000, 83333, 95238, 100000, 125000, 250000, 333333,
+        500000, 615384, 666666, 800000, 1000000
+    };
+    static const uint32_t sps[] = { 500, 750, 800, 875, 900 };
+    const candle_capability_t *cap = &cap_bxcan;
+
+    for (unsigned r=0; r<sizeof(rates)/sizeof(rates[0]); r++) {
+        for (unsigned s=0; s<sizeof(sps)/sizeof(sps[0]); s++) {
+            uint64_t best_rate = ~0ull, best_sp = ~0ull;
+            for (uint64_t brp=cap->brp_min; brp<=cap->brp_max; brp+=cap->brp_inc) {
+                for (uint64_t t1=cap->tseg1_min; t1<=cap->tseg1_max; t1++) {
+                    for (uint64_t t2=cap->tseg2_min; t2<=cap->tseg2_max; t2++) {
+                        uint64_t re, se;
+                        score(cap, rates[r], sps[s], brp, t1, t2, &re, &se);
+                        if ( (re < best_rate) || ((re == best_rate) && (se < best_sp)) ) {
+                            best_rate = re;
+                            best_sp = se;
+                        }
+                    }
+                }
+            }
+
+            candle_bittiming_t t;
+            candle_err_t err = candle_bt_calc(cap, rates[r], sps[s], &t, NULL);
+            if (best_rate > CANDLE_BT_MAX_ERROR_PPM * 1000ull) {
+                CHECK(err == CANDLE_ERR_BITRATE_UNSUPPORTED);
+                continue;
+            }
+            CHECK(err == CANDLE_ERR_OK);
+            CHECK(within_limits(cap, &t));
+            uint64_t re, se;
+            score(cap, rates[r], sps[s], t.brp, timing_tseg1(&t), t.phase_seg2, &re, &se);
+            if ( (re != best_rate) || (se != best_sp) ) {
+                fprintf(stderr, "%u bit/s at %u: %llu/%llu, best %llu/%llu\n", rates[r], sps[s],
+                        (unsigned long long)re, (unsigned long long)se,
+                        (unsigned long long)best_rate, (unsigned long long)best_sp);
+            }
+            CHECK(re == best_rate);
+            CHECK(se == best_sp);
+        }
+    }
+}
+
+static void test_standard_rates_all_clocks(void)
+{
+    const candle_capability_t *caps[] = { &cap_bxcan, &cap_fdcan80, &cap_fdcan160 };
+    for (unsigned c=0; c<3; c++) {
+        for (unsigned r=0; r<sizeof(std_rates)/sizeof(std_rates[0]); r++) {
+            candle_bittiming_t t;
+            candle_bittiming_result_t res;
+            CHECK(candle_bt_calc(caps[c], std_rates[r], 0, &t, &res) == CANDLE_ERR_OK);
+            CHECK(within_limits(caps[c], &t));
+            CHECK((res.error_ppm >= -100) && (res.error_ppm <= 100));
+            CHECK((res.sample_point >= 855) && (res.sample_point <= 895));
+        }
+    }
+}
+
+static void test_unsupported(void)
+{
+    candle_capability_t cap = cap_bxcan;
+    candle_bittiming_t t;
+
+    CHECK(candle_bt_calc(&cap, 0, 0, &t, NULL) == CANDLE_ERR_BITRATE_UNSUPPORTED);
+    CHECK(candle_bt_calc(&cap, 500000, 1000, &t, NULL) == CANDLE_ERR_BITRATE_UNSUPPORTED);
+    CHECK(candle_bt_calc(&cap, 7000000, 0, &t, NULL) == CANDLE_ERR_BITRATE_UNSUPPORTED);
+    cap.fclk_can = 0;
+    CHECK(candle_bt_calc(&cap, 500000, 0, &t, NULL) == CANDLE_ERR_BITRATE_FCLK);
+}
+
+static void test_cached_matches_solver(void)
+{
+    candle_bt_cache_t cache;
+    memset(&cache, 0, sizeof(cache));
+    static const uint32_t rates[] = { 500000, 47619, 333333, 47619 };
+
+    for (unsigned i=0; i<sizeof(rates)/sizeof(rates[0]); i++) {
+        candle_bittiming_t a, b;
+        candle_bittiming_result_t ra, rb;
+        CHECK(candle_bt_calc(&cap_bxcan, rates[i], 800, &a, &ra) == CANDLE_ERR_OK);
+        CHECK(candle_bt_calc_cached(&cache, &cap_bxcan, rates[i], 800, &b, &rb) == CANDLE_ERR_OK);
+        CHECK(ra.bitrate == rb.bitrate);
+        CHECK(ra.error_ppm == rb.error_ppm);
+        if (rates[i] != 500000) {
+            /* the table may pick another timing of the same quality */
+            CHECK(memcmp(&a, &b, sizeof(a)) == 0);
+        }
+    }
+}
+
+int main(void)
+{
+    RUN(test_known_good_rates);
+    RUN(test_exhaustive_bxcan);
+    RUN(test_standard_rates_all_clocks);
+    RUN(test_unsupported);
+    RUN(test_cached_matches_solver);
+    return TEST_EXIT();
+}
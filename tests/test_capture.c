@@ -0,0 +1,218 @@
+#include "test.h"
+#include "candle_capture.h"
+
+#define TEST_PATH "test_capture.cap"
+
+/* frames 0..num_frames-1, 1 ms apart from just before the 32-bit counter
+   wraps; every 16th extended, one id in 300 otherwise */
+#define TEST_START_US 0xFFF00000u
+
+static candle_frame_t capture_frame(uint32_t i)
+{
+    uint32_t id = (i % 16 == 15) ? (0x18FEF100u | 0x80000000u) : (i * 7) % 300;
+    return test_frame(id, (uint8_t)(i % 2), TEST_START_US + i * 1000);
+}
+
+static uint64_t capture_ts(uint32_t i)
+{
+    return (uint64_t)TEST_START_US + (uint64_t)i * 1000;
+}
+
+static bool write_capture(uint32_t num_frames)
+{
+    candle_capture_handle cap;
+    if (!candle_capture_create(TEST_PATH, &cap)) {
+        candle_capture_close(cap);
+        return false;
+    }
+
+    /* in pieces that do not line up with the blocks */
+    candle_frame_t frames[1000];
+    bool rc = true;
+    for (uint32_t at=0; at<num_frames; at+=1000) {
+        uint32_t n = (num_frames - at < 1000) ? num_frames - at : 1000;
+        for (uint32_t i=0; i<n; i++) {
+            frames[i] = capture_frame(at + i);
+        }
+        rc = rc && candle_capture_write(cap, NULL, frames, n);
+    }
+    return candle_capture_close(cap) && rc;
+}
+
+static void test_roundtrip(void)
+{
+    enum { NUM = 3 * CANDLE_CAPTURE_BLOCK_FRAMES + 100 };
+    CHECK(write_capture(NUM));
+
+    candle_capture_handle cap;
+    CHECK(candle_capture_open(TEST_PATH, &cap));
+    uint64_t num_frames = 0, first_us = 0, last_us = 0;
+    CHECK(candle_capture_info(cap, &num_frames, &first_us, &last_us));
+    CHECK(num_frames == NUM);
+    CHECK(first_us == capture_ts(0));
+    CHECK(last_us == capture_ts(NUM - 1));
+
+    /* the whole file, into a batch that already holds a frame */
+    candle_frame_batch_t batch;
+    candle_frame_t frame = test_frame(1, 0, 0);
+    CHECK(candle_frame_batch_init(&batch, 0));
+    CHECK(candle_frame_batch_append(&batch, &frame, 1));
+    size_t count = 0;
+    CHECK(candle_capture_query(cap, 0, UINT64_MAX, NULL, 0, &batch, &count));
+    CHECK(count == NUM);
+    CHECK(batch.count == NUM + 1);
+
+    uint32_t mismatches = 0;
+    for (uint32_t i=0; (i<NUM) && (batch.count == NUM + 1); i++) {
+        candle_frame_t expected = capture_frame(i);
+        CHECK(candle_frame_batch_get(&batch, i + 1, &frame, 1));
+        mismatches += (memcmp(&frame, &expected, sizeof(frame)) != 0);
+        /* 64-bit timestamps carried past the wrap */
+        mismatches += (batch.timestamp64_us[i + 1] != capture_ts(i));
+    }
+    CHECK(mismatches == 0);
+
+    CHECK(candle_frame_batch_free(&batch));
+    CHECK(candle_capture_close(cap));
+    remove(TEST_PATH);
+}
+
+static void test_query_time_and_ids(void)
+{
+    enum { NUM = 10 * CANDLE_CAPTURE_BLOCK_FRAMES };
+    CHECK(write_capture(NUM));
+
+    candle_capture_handle cap;
+    CHECK(candle_capture_open(TEST_PATH, &cap));
+    candle_frame_batch_t batch;
+    CHECK(candle_frame_batch_init(&batch, 0));
+
+    static const uint32_t ranges[][2] = { { 0, 0 }, { 5000, 5000 }, { 4095, 4096 }, { 1234, 23456 }, { 40000, NUM + 10 } };
+    static const uint32_t ids[] = { 7, 0x18FEF100u | 0x80000000u, 0x7FF };
+    for (unsigned r=0; r<sizeof(ranges)/sizeof(ranges[0]); r++) {
+        for (size_t num_ids=0; num_ids<=3; num_ids++) {
+            const uint32_t *query_ids = (num_ids > 0) ? &ids[3 - num_ids] : NULL;
+            size_t count = 0;
+            CHECK(candle_frame_batch_clear(&batch));
+            CHECK(candle_capture_query(cap, capture_ts(ranges[r][0]), capture_ts(ranges[r][1]), query_ids, num_ids, &batch, &count));
+
+            /* against a plain scan */
+            size_t expected = 0;
+            uint32_t mismatches = 0;
+            for (uint32_t i=ranges[r][0]; (i<=ranges[r][1]) && (i<NUM); i++) {
+                uint32_t id = capture_frame(i).can_id;
+                bool match = (query_ids == NULL);
+                for (size_t k=0; k<num_ids; k++) {
+                    match |= (query_ids[k] == id);
+                }
+                if (match) {
+                    mismatches += (expected >= count) || (batch.timestamp64_us[expected] != capture_ts(i));
+                    expected++;
+                }
+            }
+            CHECK(count == expected);
+            CHECK(mismatches == 0);
+        }
+    }
+
+    /* blocks of a narrow window only, then the end */
+    uint64_t cursor = 0;
+    const candle_capture_record_t *records;
+    uint32_t num_records = 0, blocks = 0;
+    while (candle_capture_next_block(cap, capture_ts(5000), capture_ts(9000), NULL, 0, &cursor, &records, &num_records)) {
+        CHECK(num_records == CANDLE_CAPTURE_BLOCK_FRAMES);
+        blocks++;
+    }
+    CHECK(blocks == 2);
+    CHECK(candle_capture_last_error(cap) == CANDLE_ERR_CAPTURE_END);
+
+    /* an id that is nowhere skips every block */
+    uint32_t none = 0x7FF;
+    cursor = 0;
+    CHECK(!candle_capture_next_block(cap, 0, UINT64_MAX, &none, 1, &cursor, &records, &num_records));
+
+    CHECK(candle_frame_batch_free(&batch));
+    CHECK(candle_capture_close(cap));
+    remove(TEST_PATH);
+}
+
+static void test_cut_short(void)
+{
+    enum { NUM = 2 * CANDLE_CAPTURE_BLOCK_FRAMES + 10 };
+    CHECK(write_capture(NUM));
+
+    /* the last footer half written */
+    FILE *f = fopen(TEST_PATH, "rb");
+    CHECK(f != NULL);
+    if (f == NULL) {
+        return;
+    }
+    static uint8_t content[sizeof(candle_capture_header_t) + 3 * (CANDLE_CAPTURE_BLOCK_FRAMES * sizeof(candle_capture_record_t) + sizeof(candle_capture_footer_t))];
+    size_t size = fread(content, 1, sizeof(content), f);
+    fclose(f);
+    f = fopen(TEST_PATH, "wb");
+    CHECK(f != NULL);
+    if (f == NULL) {
+        return;
+    }
+    CHECK(fwrite(content, size - sizeof(candle_capture_footer_t) / 2, 1, f) == 1);
+    fclose(f);
+
+    candle_capture_handle cap;
+    uint64_t num_frames = 0;
+    CHECK(candle_capture_open(TEST_PATH, &cap));
+    CHECK(candle_capture_info(cap, &num_frames, NULL, NULL));
+    CHECK(num_frames == 2 * CANDLE_CAPTURE_BLOCK_FRAMES);
+    CHECK(candle_capture_close(cap));
+    remove(TEST_PATH);
+}
+
+static void test_bad_files(void)
+{
+    candle_capture_handle cap;
+
+    CHECK(!candle_capture_open("/nonexistent/none.cap", &cap));
+    CHECK(candle_capture_last_error(cap) == CANDLE_ERR_CAPTURE_FILE);
+    CHECK(candle_capture_close(cap));
+
+    /* an empty file maps to nothing; closing must still release it */
+    FILE *f = fopen(TEST_PATH, "wb");
+    CHECK(f != NULL);
+    if (f != NULL) {
+        fclose(f);
+    }
+    CHECK(!candle_capture_open(TEST_PATH, &cap));
+    CHECK(candle_capture_last_error(cap) == CANDLE_ERR_CAPTURE_FORMAT);
+    CHECK(candle_capture_close(cap));
+    CHECK(remove(TEST_PATH) == 0);
+
+    f = fopen(TEST_PATH, "wb");
+    CHECK(f != NULL);
+    if (f != NULL) {
+        static const char junk[200] = "not a capture";
+        fwrite(junk, sizeof(junk), 1, f);
+        fclose(f);
+    }
+    CHECK(!candle_capture_open(TEST_PATH, &cap));
+    CHECK(candle_capture_last_error(cap) == CANDLE_ERR_CAPTURE_FORMAT);
+    CHECK(candle_capture_close(cap));
+    remove(TEST_PATH);
+
+    /* a file with no frames at all */
+    CHECK(write_capture(0));
+    uint64_t num_frames = 1;
+    CHECK(candle_capture_open(TEST_PATH, &cap));
+    CHECK(candle_capture_info(cap, &num_frames, NULL, NULL));
+    CHECK(num_frames == 0);
+    CHECK(candle_capture_close(cap));
+    remove(TEST_PATH);
+}
+
+int main(void)
+{
+    RUN(test_roundtrip);
+    RUN(test_query_time_and_ids);
+    RUN(test_cut_short);
+    RUN(test_bad_files);
+    return TEST_EXIT();
+}
@@ -0,0 +1,127 @@
+#include <math.h>
+
+#include "test.h"
+#include "candle_clock.h"
+
+/* A simulated adapter whose crystal runs 50 to 110 ppm fast, wandering with
+ * temperature, is sampled once a second over round trips with jitter and the
+ * odd slow one. Host times estimated for frames in between must stay within
+ * CLOCK_ERROR_BOUND_NS of the truth, across counter wraps.
+ */
+
+#define CLOCK_ERROR_BOUND_NS 50000
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+typedef struct {
+    uint32_t seed;
+    double dev_us;          /* device counter, unwrapped */
+    uint64_t host_ns;
+} sim_t;
+
+static double sim_random(sim_t *s)
+{
+    return test_random(&s->seed) / (double)(1u << 24);
+}
+
+static double sim_ppm(const sim_t *s)
+{
+    return 80.0 + 30.0 * sin(2 * M_PI * s->host_ns / 1800e9);
+}
+
+static void sim_advance(sim_t *s, uint64_t ns)
+{
+    s->dev_us += ns / 1000.0 * (1.0 + sim_ppm(s) * 1e-6);
+    s->host_ns += ns;
+}
+
+/* one request to the device: returns the reading and the round trip's
+   midpoint, as the sampling thread sees them. The device reads its counter
+   within 25 us of the midpoint, or anywhere in a round trip held up by
+   other traffic. */
+static uint32_t sim_sample(sim_t *s, uint64_t rtt_ns, bool held_up, uint64_t *mid_ns)
+{
+    uint64_t start = s->host_ns;
+    uint64_t at = held_up ? (uint64_t)(rtt_ns * sim_random(s))
+                          : rtt_ns / 2 - 25000 + (uint64_t)(50000 * sim_random(s));
+    sim_advance(s, at);
+    uint32_t dev_us = (uint32_t)(uint64_t)s->dev_us;
+    sim_advance(s, rtt_ns - at);
+    *mid_ns = start + rtt_ns / 2;
+    return dev_us;
+}
+
+static void test_drift_within_bound(void)
+{
+    candle_clock_t clock;
+    candle_clock_init(&clock);
+    sim_t s = { 1, 4000000000.0, 1000000000000ull };
+
+    uint64_t max_err = 0;
+    uint32_t dropped = 0;
+    for (uint32_t n=0; n<3*3600; n++) {
+        /* 150..250 us round trips, one in ten stuck behind other traffic */
+        uint64_t rtt = 150000 + (uint64_t)(100000 * sim_random(&s));
+        bool held_up = (sim_random(&s) < 0.1);
+        if (held_up) {
+            rtt += 5000000;
+        }
+        uint64_t mid;
+        uint32_t dev_us = sim_sample(&s, rtt, held_up, &mid);
+        dropped += !candle_clock_add_sample(&clock, dev_us, mid, rtt);
+
+        /* a frame somewhere before the next sample */
+        sim_advance(&s, (uint64_t)(900e6 * sim_random(&s)));
+        if (n >= CANDLE_CLOCK_WINDOW) {
+            uint64_t est;
+            CHECK(candle_clock_host_ns(&clock, (uint32_t)(uint64_t)s.dev_us, &est));
+            uint64_t err = (est > s.host_ns) ? est - s.host_ns : s.host_ns - est;
+            if (err > max_err) {
+                max_err = err;
+            }
+        }
+        sim_advance(&s, 1000000000ull - (s.host_ns % 1000000000ull));
+    }
+
+    CHECK(max_err < CLOCK_ERROR_BOUND_NS);
+    CHECK(dropped > 500);
+    printf("     max error %.1f us, %u of %u samples dropped\n", max_err / 1e3, dropped, 3*3600);
+    candle_clock_free(&clock);
+}
+
+static void test_slower_bus_is_followed(void)
+{
+    candle_clock_t clock;
+    candle_clock_init(&clock);
+
+    uint32_t dev_us = 0;
+    uint64_t host_ns = 0;
+    for (uint32_t n=0; n<100; n++) {
+        dev_us += 1000000;
+        host_ns += 1000000000;
+        CHECK(candle_clock_add_sample(&clock, dev_us, host_ns, 100000));
+    }
+
+    /* from now on every round trip takes 2 ms: once the fast ones are out of
+       the window the slow ones are taken */
+    uint32_t accepted_at = 0;
+    for (uint32_t n=1; (n<=2*CANDLE_CLOCK_WINDOW) && (accepted_at == 0); n++) {
+        dev_us += 1000000;
+        host_ns += 1000000000;
+        if (candle_clock_add_sample(&clock, dev_us, host_ns, 2000000)) {
+            accepted_at = n;
+        }
+    }
+    CHECK(accepted_at == CANDLE_CLOCK_WINDOW);
+
+    candle_clock_free(&clock);
+}
+
+int main(void)
+{
+    RUN(test_drift_within_bound);
+    RUN(test_slower_bus_is_followed);
+    return TEST_EXIT();
+}
@@ -0,0 +1,166 @@
+#include <math.h>
+
+#include "test.h"
+#include "dbc_gen.h"
+
+static const char basic_dbc[] =
+    "BO_ 100 Basic: 8 ECU\n"
+    " SG_ IntelU : 0|12@1+ (0.5,10) [0|0] \"rpm\" X\n"
+    " SG_ IntelS : 12|4@1- (1,0) [0|0] \"\" X\n"
+    " SG_ MotoU : 23|16@0+ (1,0) [0|0] \"\" X\n"
+    " SG_ MotoS : 39|8@0- (1,0) [0|0] \"\" X\n"
+    " SG_ Tail : 56|8@1+ (1,0) [0|0] \"\" X\n"
+    "\n"
+    "BO_ 2566844926 Ext: 4 ECU\n"
+    " SG_ Mux M : 0|8@1+ (1,0) [0|0] \"\" X\n"
+    " SG_ A m1 : 8|8@1+ (1,0) [0|0] \"\" X\n"
+    " SG_ B m2 : 8|16@1+ (1,0) [0|0] \"\" X\n";
+
+static candle_frame_t data_frame(uint32_t can_id, uint8_t dlc, const uint8_t *data)
+{
+    candle_frame_t f = test_frame(can_id, 0, 0);
+    f.can_dlc = dlc;
+    memcpy(f.data, data, 8);
+    return f;
+}
+
+static void test_decode_byte_orders(void)
+{
+    candle_dbc_handle dbc;
+    uint32_t count = 0;
+    CHECK(candle_dbc_load_string(basic_dbc, strlen(basic_dbc), &dbc));
+    CHECK(candle_dbc_message_count(dbc, &count));
+    CHECK(count == 2);
+
+    static const uint8_t data[8] = { 0x34, 0xF2, 0x12, 0x34, 0xFE, 0, 0, 0x77 };
+    candle_frame_t f = data_frame(100, 8, data);
+    double v[8];
+    int64_t raw[8];
+    const candle_dbc_message_t *m = candle_dbc_decode(dbc, &f, v);
+    CHECK(m != NULL);
+    if (m == NULL) {
+        candle_dbc_free(dbc);
+        return;
+    }
+    CHECK(strcmp(m->name, "Basic") == 0);
+    CHECK(m->num_signals == 5);
+    CHECK(strcmp(m->signals[0].unit, "rpm") == 0);
+    CHECK(v[0] == 0x234 * 0.5 + 10);
+    CHECK(v[1] == -1);
+    CHECK(v[2] == 0x1234);
+    CHECK(v[3] == -2);
+    CHECK(v[4] == 0x77);
+
+    /* a short frame does not carry the tail */
+    f.can_dlc = 5;
+    CHECK(candle_dbc_decode(dbc, &f, v) == m);
+    CHECK(v[3] == -2);
+    CHECK(isnan(v[4]));
+    CHECK(candle_dbc_decode_raw(dbc, &f, raw) == m);
+    CHECK(raw[0] == 0x234);
+    CHECK(raw[4] == 0);
+
+    /* unknown ids and error frames */
+    f.can_id = 101;
+    CHECK(candle_dbc_decode(dbc, &f, v) == NULL);
+    f.can_id = 100 | 0x20000000;
+    CHECK(candle_dbc_decode(dbc, &f, v) == NULL);
+
+    candle_dbc_free(dbc);
+}
+
+static void test_decode_multiplexed(void)
+{
+    candle_dbc_handle dbc;
+    CHECK(candle_dbc_load_string(basic_dbc, strlen(basic_dbc), &dbc));
+
+    static const uint8_t data[8] = { 2, 0x34, 0x12, 0 };
+    candle_frame_t f = data_frame(2566844926u, 4, data);
+    double v[3];
+    const candle_dbc_message_t *m = candle_dbc_decode(dbc, &f, v);
+    CHECK(m != NULL);
+    if (m != NULL) {
+        CHECK(m->signals[0].mux == CANDLE_DBC_MUX_SWITCH);
+        CHECK(v[0] == 2);
+        CHECK(isnan(v[1]));
+        CHECK(v[2] == 0x1234);
+    }
+    CHECK(candle_dbc_find(dbc, 2566844926u) == m);
+    /* the same id without the extended flag is another message */
+    CHECK(candle_dbc_find(dbc, 2566844926u & 0x1FFFFFFF) == NULL);
+
+    candle_dbc_free(dbc);
+}
+
+static void test_load_errors(void)
+{
+    candle_dbc_handle dbc;
+    uint32_t line = 0;
+
+    static const char bad_order[] =
+        "BO_ 1 A: 8 X\n"
+        " SG_ s : 0|8@1+ (1,0) [0|0] \"\" X\n"
+        " SG_ t : 0|8@2+ (1,0) [0|0] \"\" X\n";
+    CHECK(!candle_dbc_load_string(bad_order, strlen(bad_order), &dbc));
+    CHECK(candle_dbc_last_error(dbc, &line) == CANDLE_ERR_DBC_SYNTAX);
+    CHECK(line == 3);
+    candle_dbc_free(dbc);
+
+    static const char duplicate[] = "BO_ 1 A: 8 X\n\nBO_ 1 B: 8 X\n";
+    CHECK(!candle_dbc_load_string(duplicate, strlen(duplicate), &dbc));
+    CHECK(candle_dbc_last_error(dbc, &line) == CANDLE_ERR_DBC_SYNTAX);
+    CHECK(line == 3);
+    candle_dbc_free(dbc);
+
+    CHECK(!candle_dbc_load("/nonexistent/none.dbc", &dbc));
+    CHECK(candle_dbc_last_error(dbc, NULL) == CANDLE_ERR_DBC_FILE);
+    candle_dbc_free(dbc);
+}
+
+/* 500 random layouts against a bit by bit reference */
+static void test_random_layouts(void)
+{
+    size_t len;
+    char *text = dbc_gen(500, &len);
+    CHECK(text != NULL);
+    if (text == NULL) {
+        return;
+    }
+
+    candle_dbc_handle dbc;
+    uint32_t count = 0;
+    CHECK(candle_dbc_load_string(text, len, &dbc));
+    CHECK(candle_dbc_message_count(dbc, &count));
+    CHECK(count == 500);
+
+    uint32_t mismatches = 0;
+    for (uint32_t i=0; i<count; i++) {
+        const candle_dbc_message_t *m = candle_dbc_message(dbc, i);
+        CHECK(candle_dbc_find(dbc, m->can_id) == m);
+        for (int k=0; k<50; k++) {
+            candle_frame_t f = dbc_gen_frame(m, 0);
+            double v[16];
+            int64_t raw[16];
+            CHECK(candle_dbc_decode(dbc, &f, v) == m);
+            CHECK(candle_dbc_decode_raw(dbc, &f, raw) == m);
+            for (uint32_t s=0; s<m->num_signals; s++) {
+                int64_t expected = dbc_ref_raw(&m->signals[s], f.data);
+                mismatches += (raw[s] != expected);
+                mismatches += (v[s] != (double)expected * m->signals[s].factor + m->signals[s].offset);
+            }
+        }
+    }
+    CHECK(mismatches == 0);
+
+    candle_dbc_free(dbc);
+    free(text);
+}
+
+int main(void)
+{
+    RUN(test_decode_byte_orders);
+    RUN(test_decode_multiplexed);
+    RUN(test_load_errors);
+    RUN(test_random_layouts);
+    return TEST_EXIT();
+}
@@ -0,0 +1,186 @@
+#include <math.h>
+
+#include "test.h"
+#include "candle_os.h"
+#include "dbc_gen.h"
+
+/* random layouts plus a multiplexed message and signals up to 64 bits */
+static const char extra_dbc[] =
+    "BO_ 2047 Mux: 8 A\n"
+    " SG_ Sw M : 7|4@0+ (1,0) [0|0] \"\" B\n"
+    " SG_ X m1 : 8|12@1- (0.25,3) [0|0] \"\" B\n"
+    " SG_ Y m2 : 23|24@0+ (1,-5) [0|0] \"\" B\n"
+    " SG_ Big : 0|60@1- (1,0) [0|0] \"\" B\n"
+    " SG_ BigU : 0|64@1+ (2,0) [0|0] \"\" B\n";
+
+#define TEST_FRAMES 20000
+
+static candle_dbc_handle load_dbc(void)
+{
+    size_t len;
+    char *text = dbc_gen(500, &len);
+    if (text == NULL) {
+        return NULL;
+    }
+    char *all = realloc(text, len + sizeof(extra_dbc));
+    if (all == NULL) {
+        free(text);
+        return NULL;
+    }
+    memcpy(&all[len], extra_dbc, sizeof(extra_dbc));
+
+    candle_dbc_handle dbc;
+    bool rc = candle_dbc_load_string(all, len + sizeof(extra_dbc) - 1, &dbc);
+    free(all);
+    if (!rc) {
+        candle_dbc_free(dbc);
+        return NULL;
+    }
+    return dbc;
+}
+
+/* a quarter of the frames of message hot, some short, some remote or error
+   frames, the rest spread over all messages */
+static void fill_frames(candle_dbc_handle dbc, uint32_t hot, candle_frame_t *frames, size_t num_frames)
+{
+    uint32_t count = 0;
+    candle_dbc_message_count(dbc, &count);
+    for (size_t i=0; i<num_frames; i++) {
+        uint32_t m = (dbc_gen_random() % 4 == 0) ? hot : (dbc_gen_random() % 5 == 0) ? count - 1 : dbc_gen_random() % count;
+        frames[i] = dbc_gen_frame(candle_dbc_message(dbc, m), (uint32_t)i);
+        if (dbc_gen_random() % 10 == 0) {
+            frames[i].can_dlc = (uint8_t)(dbc_gen_random() % 9);
+        }
+        if (dbc_gen_random() % 50 == 0) {
+            frames[i].can_id |= 0x40000000;
+        }
+        if (dbc_gen_random() % 50 == 0) {
+            frames[i].can_id |= 0x20000000;
+        }
+    }
+}
+
+/* the scalar kernels against per-frame decoding, then every vector kernel
+   the cpu has against the scalar ones, bit for bit */
+static void check_message(candle_dbc_handle dbc, const candle_frame_t *frames, uint32_t mi, float **values, int64_t **raw)
+{
+    const candle_dbc_message_t *m = candle_dbc_message(dbc, mi);
+    candle_dbc_column_t columns[64];
+    static size_t index0[TEST_FRAMES], index[TEST_FRAMES];
+    size_t count0 = 0, count = 0;
+
+    for (uint32_t s=0; s<m->num_signals; s++) {
+        columns[s].signal = s;
+        columns[s].values = values[s];
+        columns[s].raw = raw[s];
+    }
+    candle_set_isa(CANDLE_ISA_SCALAR);
+    CHECK(candle_dbc_extract(dbc, frames, TEST_FRAMES, m->can_id, columns, m->num_signals, index0, &count0));
+
+    uint32_t mismatches = 0;
+    size_t k = 0;
+    for (size_t i=0; (i<TEST_FRAMES) && (k<count0); i++) {
+        candle_frame_t f = frames[i];
+        double v[64];
+        int64_t r[64];
+        if (candle_dbc_decode(dbc, &f, v) != m) {
+            continue;
+        }
+        candle_dbc_decode_raw(dbc, &f, r);
+        mismatches += (index0[k] != i);
+        for (uint32_t s=0; s<m->num_signals; s++) {
+            mismatches += (raw[s][k] != r[s]);
+            mismatches += !(isnan(v[s]) ? isnan(values[s][k]) : (values[s][k] == (float)v[s]));
+        }
+        k++;
+    }
+    CHECK(k == count0);
+
+    candle_set_isa(CANDLE_ISA_AVX2);
+    candle_isa_t best = candle_cpu_isa();
+    for (candle_isa_t isa=CANDLE_ISA_SSSE3; isa<=best; isa++) {
+        candle_set_isa(isa);
+        /* some columns without raw values */
+        for (uint32_t s=0; s<m->num_signals; s++) {
+            columns[s].values = values[m->num_signals + s];
+            columns[s].raw = (s % 3 == 0) ? NULL : raw[m->num_signals + s];
+        }
+        CHECK(candle_dbc_extract(dbc, frames, TEST_FRAMES, m->can_id, columns, m->num_signals, index, &count));
+        CHECK(count == count0);
+        if (count != count0) {
+            break;
+        }
+        mismatches += (memcmp(index, index0, count * sizeof(size_t)) != 0);
+        for (uint32_t s=0; s<m->num_signals; s++) {
+            mismatches += (memcmp(values[m->num_signals + s], values[s], count * sizeof(float)) != 0);
+            if (s % 3 != 0) {
+                mismatches += (memcmp(raw[m->num_signals + s], raw[s], count * sizeof(int64_t)) != 0);
+            }
+        }
+    }
+    CHECK(mismatches == 0);
+}
+
+static void test_kernels_agree(void)
+{
+    candle_dbc_handle dbc = load_dbc();
+    CHECK(dbc != NULL);
+    if (dbc == NULL) {
+        return;
+    }
+    uint32_t count = 0;
+    candle_dbc_message_count(dbc, &count);
+
+    candle_frame_t *frames = malloc(TEST_FRAMES * sizeof(candle_frame_t));
+    float *values[128];
+    int64_t *raw[128];
+    for (int c=0; c<128; c++) {
+        values[c] = malloc(TEST_FRAMES * sizeof(float));
+        raw[c] = malloc(TEST_FRAMES * sizeof(int64_t));
+    }
+    fill_frames(dbc, 3, frames, TEST_FRAMES);
+
+    /* the first messages, every 37th, and the multiplexed one */
+    for (uint32_t mi=0; mi+1<count; mi+=(mi < 20) ? 1 : 37) {
+        check_message(dbc, frames, mi, values, raw);
+    }
+    check_message(dbc, frames, count - 1, values, raw);
+    candle_set_isa(CANDLE_ISA_AVX2);
+
+    for (int c=0; c<128; c++) {
+        free(values[c]);
+        free(raw[c]);
+    }
+    free(frames);
+    candle_dbc_free(dbc);
+}
+
+static void test_extract_errors(void)
+{
+    candle_dbc_handle dbc = load_dbc();
+    CHECK(dbc != NULL);
+    if (dbc == NULL) {
+        return;
+    }
+
+    candle_frame_t frame = dbc_gen_frame(candle_dbc_message(dbc, 3), 0);
+    float value;
+    size_t count = 1;
+    candle_dbc_column_t column = { 99, &value, NULL };
+    CHECK(!candle_dbc_extract(dbc, &frame, 1, frame.can_id, &column, 1, NULL, &count));
+    CHECK(candle_dbc_last_error(dbc, NULL) == CANDLE_ERR_INVALID_OPTION);
+    column.signal = 0;
+    CHECK(!candle_dbc_extract(dbc, &frame, 1, 12345678, &column, 1, NULL, &count));
+    CHECK(candle_dbc_last_error(dbc, NULL) == CANDLE_ERR_DBC_NO_MESSAGE);
+    CHECK(candle_dbc_extract(dbc, &frame, 1, frame.can_id, &column, 1, NULL, &count));
+    CHECK(count == 1);
+
+    candle_dbc_free(dbc);
+}
+
+int main(void)
+{
+    RUN(test_kernels_agree);
+    RUN(test_extract_errors);
+    return TEST_EXIT();
+}
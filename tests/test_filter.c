@@ -0,0 +1,257 @@
+#include "test.h"
+#include "candle_os.h"
+
+/* a bus that keeps sending: frame ids cycle through num_ids from first_id,
+ * one every FEED_INTERVAL_US, until stopped or feed_ms has passed */
+#define FEED_INTERVAL_US 200
+
+typedef struct {
+    int dev;
+    uint32_t first_id;
+    uint32_t num_ids;
+    uint32_t feed_ms;
+    uint32_t stop;
+} feeder_t;
+
+static void feeder(void *arg)
+{
+    feeder_t *f = (feeder_t*)arg;
+    uint64_t end = candle_time_ns() + (uint64_t)f->feed_ms * 1000000;
+    uint32_t ts = 0;
+    for (uint32_t i=0; !candle_atomic_load(&f->stop) && (candle_time_ns() < end); i++) {
+        candle_frame_t frame = test_frame(f->first_id + (i % f->num_ids), 0, ts);
+        fake_push_in(f->dev, &frame, sizeof(frame));
+        ts += FEED_INTERVAL_US;
+        uint64_t next = candle_time_ns() + FEED_INTERVAL_US * 1000;
+        while (candle_time_ns() < next) {
+        }
+    }
+}
+
+static bool set_range_filter(candle_handle hdev, uint32_t first, uint32_t last)
+{
+    candle_filter_handle filter;
+    if (!candle_filter_create(&filter)) {
+        return false;
+    }
+    bool rc = candle_filter_add_range(filter, false, first, last) && candle_dev_set_filter(hdev, filter);
+    candle_filter_free(filter);
+    return rc;
+}
+
+static void test_filter_drops_by_id(void)
+{
+    int d;
+    candle_handle hdev = test_open_flags(&d, 0);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+
+    candle_filter_handle filter;
+    CHECK(candle_filter_create(&filter));
+    CHECK(candle_filter_add_mask(filter, false, 0x120, 0x7F0));
+    CHECK(candle_filter_add_range(filter, true, 0x1000, 0x1FFF));
+    CHECK(candle_dev_set_filter(hdev, filter));
+    CHECK(candle_filter_free(filter));
+
+    static const uint32_t ids[] = {
+        0x100, 0x123, 0x12F, 0x130, 0x1000 | 0x80000000, 0x1000, 0x2000 | 0x80000000,
+        0x1FFF | 0x80000000, 0x20000004
+    };
+    static const bool pass[] = { false, true, true, false, true, false, false, true, true };
+    uint32_t expected = 0;
+    for (unsigned i=0; i<sizeof(ids)/sizeof(ids[0]); i++) {
+        candle_frame_t f = test_frame(ids[i], 0, i);
+        fake_push_in(d, &f, sizeof(f));
+        expected += pass[i];
+    }
+
+    /* error frames are never filtered */
+    candle_frame_t frames[16];
+    uint32_t count = 0, got = 0;
+    while (candle_frame_read_many(hdev, &frames[got], 16 - got, &count, 50)) {
+        got += count;
+    }
+    CHECK(got == expected);
+    for (uint32_t i=0, k=0; (i<sizeof(ids)/sizeof(ids[0])) && (k<got); i++) {
+        if (pass[i]) {
+            CHECK(frames[k++].can_id == ids[i]);
+        }
+    }
+
+    candle_rx_stats_t stats;
+    CHECK(candle_dev_get_rx_stats(hdev, &stats));
+    CHECK(stats.filtered == sizeof(ids)/sizeof(ids[0]) - expected);
+
+    /* NULL accepts all frames again */
+    CHECK(candle_dev_set_filter(hdev, NULL));
+    candle_frame_t f = test_frame(0x100, 0, 100);
+    fake_push_in(d, &f, sizeof(f));
+    CHECK(candle_frame_read(hdev, &frames[0], 100));
+    CHECK(frames[0].can_id == 0x100);
+
+    test_close(hdev);
+}
+
+typedef bool (*filter_setup_fn)(candle_handle hdev);
+
+static bool setup_range_filter(candle_handle hdev)
+{
+    return set_range_filter(hdev, 0x700, 0x7FF);
+}
+
+static bool setup_change_filter(candle_handle hdev)
+{
+    return candle_dev_set_change_filter(hdev, true, 0, NULL, 0);
+}
+
+/* while the bus keeps sending frames that are all filtered out, reads still
+   give up after their timeout */
+static void check_filtered_stream_times_out(uint32_t flags, bool peek, filter_setup_fn setup)
+{
+    int d;
+    candle_handle hdev = test_open_flags(&d, flags);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+    CHECK(setup(hdev));
+
+    /* the first frame of each id, which may pass */
+    candle_frame_t frame;
+    for (uint32_t i=0; i<16; i++) {
+        frame = test_frame(0x100 + i, 0, 0);
+        fake_push_in(d, &frame, sizeof(frame));
+    }
+    while (candle_frame_read(hdev, &frame, 20)) {
+    }
+
+    feeder_t f = { d, 0x100, 16, 3000, 0 };
+    candle_thread_t thread;
+    CHECK(candle_thread_start(&thread, feeder, &f));
+
+    uint64_t t0 = candle_time_ns();
+    bool rc;
+    if (peek) {
+        const candle_frame_t *peeked;
+        rc = candle_frame_peek(hdev, &peeked, 100);
+    } else {
+        rc = candle_frame_read(hdev, &frame, 100);
+    }
+    uint64_t elapsed_ms = (candle_time_ns() - t0) / 1000000;
+
+    CHECK(!rc);
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_READ_TIMEOUT);
+    CHECK(elapsed_ms >= 100);
+    CHECK(elapsed_ms < 600);
+
+    candle_atomic_store(&f.stop, 1);
+    candle_thread_join(thread);
+
+    candle_rx_stats_t stats;
+    CHECK(candle_dev_get_rx_stats(hdev, &stats));
+    CHECK(stats.filtered + stats.unchanged > 0);
+
+    test_close(hdev);
+}
+
+static void test_filtered_stream_times_out(void)
+{
+    check_filtered_stream_times_out(0, false, setup_range_filter);
+}
+
+static void test_filtered_stream_times_out_peek(void)
+{
+    check_filtered_stream_times_out(0, true, setup_range_filter);
+}
+
+static void test_filtered_stream_times_out_packed(void)
+{
+    check_filtered_stream_times_out(CANDLE_DEVOPT_RX_PACKED, false, setup_range_filter);
+}
+
+static void test_filtered_stream_times_out_thread(void)
+{
+    check_filtered_stream_times_out(CANDLE_DEVOPT_RX_THREAD, false, setup_range_filter);
+}
+
+static void test_change_filter_drops_repeats(void)
+{
+    fake_reset();
+    int d = fake_add_device(2, 48000000);
+    candle_handle hdev = test_open(0, NULL);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+
+    /* 0x200 passes a repeat once 5 ms have gone by, other ids never */
+    candle_change_heartbeat_t hb = { 0, 0x200, 5 };
+    CHECK(candle_dev_set_change_filter(hdev, true, 0, &hb, 1));
+
+    candle_frame_t in[8];
+    in[0] = test_frame(0x100, 0, 0);
+    in[1] = test_frame(0x100, 0, 1000);     /* repeat */
+    in[2] = test_frame(0x100, 0, 2000);
+    in[2].data[7] ^= 1;                     /* changed */
+    in[3] = test_frame(0x100, 1, 2000);     /* other channel */
+    in[4] = test_frame(0x200, 0, 0);
+    in[5] = test_frame(0x200, 0, 4000);     /* repeat within the heartbeat */
+    in[6] = test_frame(0x200, 0, 5000);     /* heartbeat */
+    in[7] = in[2];                          /* much later, still no heartbeat */
+    in[7].timestamp_us = 9000000;
+    static const bool pass[] = { true, false, true, true, true, false, true, false };
+    for (unsigned i=0; i<8; i++) {
+        fake_push_in(d, &in[i], sizeof(in[i]));
+    }
+
+    candle_frame_t frames[8];
+    uint32_t count = 0, got = 0;
+    while (candle_frame_read_many(hdev, &frames[got], 8 - got, &count, 50)) {
+        got += count;
+    }
+    CHECK(got == 5);
+    for (unsigned i=0, k=0; (i<8) && (k<got); i++) {
+        if (pass[i]) {
+            CHECK(memcmp(&frames[k++], &in[i], sizeof(in[i])) == 0);
+        }
+    }
+
+    candle_rx_stats_t stats;
+    CHECK(candle_dev_get_rx_stats(hdev, &stats));
+    CHECK(stats.changed == 5);
+    CHECK(stats.unchanged == 3);
+
+    /* turned off, repeats pass again */
+    CHECK(candle_dev_set_change_filter(hdev, false, 0, NULL, 0));
+    fake_push_in(d, &in[0], sizeof(in[0]));
+    fake_push_in(d, &in[0], sizeof(in[0]));
+    CHECK(candle_frame_read(hdev, &frames[0], 50));
+    CHECK(candle_frame_read(hdev, &frames[1], 50));
+
+    test_close(hdev);
+}
+
+static void test_unchanged_stream_times_out(void)
+{
+    check_filtered_stream_times_out(0, false, setup_change_filter);
+}
+
+static void test_unchanged_stream_times_out_peek(void)
+{
+    check_filtered_stream_times_out(0, true, setup_change_filter);
+}
+
+int main(void)
+{
+    RUN(test_filter_drops_by_id);
+    RUN(test_filtered_stream_times_out);
+    RUN(test_filtered_stream_times_out_peek);
+    RUN(test_filtered_stream_times_out_packed);
+    RUN(test_filtered_stream_times_out_thread);
+    RUN(test_change_filter_drops_repeats);
+    RUN(test_unchanged_stream_times_out);
+    RUN(test_unchanged_stream_times_out_peek);
+    return TEST_EXIT();
+}
@@ -0,0 +1,50 @@
+#include "test.h"
+
+/* what a list of num_devices fake devices holds on the heap */
+static size_t list_footprint(uint32_t num_devices)
+{
+    fake_reset();
+    for (uint32_t i=0; i<num_devices; i++) {
+        fake_add_device(1, 48000000);
+    }
+
+    candle_list_handle list;
+    if (!candle_list_scan_transport(&list, &candle_transport_fake)) {
+        candle_list_free(list);
+        return 0;
+    }
+    candle_list_t *l = (candle_list_t *)list;
+    size_t paths = 0;
+    for (unsigned i=0; i<l->num_devices; i++) {
+        paths += (wcslen(l->dev[i].path) + 1) * sizeof(wchar_t);
+    }
+    size_t total = sizeof(candle_list_t) + l->capacity * sizeof(candle_list_entry_t) + paths;
+    CHECK(l->num_devices == num_devices);
+
+    printf("%2u devices: list %zu + entries %u x %zu + paths %zu = %zu bytes, %zu per device\n",
+           num_devices, sizeof(candle_list_t), l->capacity, sizeof(candle_list_entry_t), paths,
+           total, total / num_devices);
+    candle_list_free(list);
+    return total;
+}
+
+/* the list grows with the devices found instead of holding room for
+   CANDLE_MAX_DEVICES full device structs */
+static void test_list_footprint(void)
+{
+    size_t one = list_footprint(1);
+    size_t eight = list_footprint(8);
+    size_t full = list_footprint(CANDLE_MAX_DEVICES);
+
+    CHECK(one > 0);
+    CHECK(one < eight);
+    CHECK(eight < full);
+    CHECK(one < sizeof(candle_device_t));
+    CHECK(full < CANDLE_MAX_DEVICES * sizeof(candle_device_t));
+}
+
+int main(void)
+{
+    RUN(test_list_footprint);
+    return TEST_EXIT();
+}
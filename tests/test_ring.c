@@ -0,0 +1,126 @@
+#include "test.h"
+#include "candle_ring.h"
+
+#define STRESS_FRAMES 200000
+
+typedef struct {
+    candle_ring_t *ring;
+    uint32_t error;
+    uint32_t frames;
+    uint32_t spurious;      /* wakeups without a push */
+} ring_producer_t;
+
+static void ring_producer(void *arg)
+{
+    ring_producer_t *p = (ring_producer_t*)arg;
+    uint32_t seed = 1;
+
+    for (uint32_t i=0; i<p->frames; ) {
+        /* a few frames at a time, then a wakeup, now and then a pause */
+        uint32_t n = 1 + (test_random(&seed) % 32);
+        for (uint32_t k=0; (k<n) && (i<p->frames); k++) {
+            candle_frame_t f = test_frame(0x100, 0, i);
+            if (candle_ring_push(p->ring, &f)) {
+                i++;
+            }
+        }
+        candle_ring_wake(p->ring);
+        if (((seed >> 8) & 0xFF) == 0) {
+            candle_sleep_ms(1);
+        }
+    }
+}
+
+static void ring_waker(void *arg)
+{
+    ring_producer_t *p = (ring_producer_t*)arg;
+    for (uint32_t i=0; i<p->spurious; i++) {
+        candle_ring_wake(p->ring);
+        candle_sleep_ms(1);
+    }
+}
+
+static void ring_error(void *arg)
+{
+    ring_producer_t *p = (ring_producer_t*)arg;
+    candle_sleep_ms(20);
+    candle_atomic_store(&p->error, CANDLE_ERR_DEVICE_GONE);
+    candle_ring_wake(p->ring);
+}
+
+static void test_stress_in_order(void)
+{
+    candle_ring_t ring;
+    CHECK(candle_ring_init(&ring, 256));
+
+    ring_producer_t p = { &ring, 0, STRESS_FRAMES, 0 };
+    candle_thread_t thread;
+    CHECK(candle_thread_start(&thread, ring_producer, &p));
+
+    uint32_t got = 0;
+    bool in_order = true;
+    while (got < STRESS_FRAMES) {
+        candle_frame_t frames[64];
+        /* the producer never pauses for long, an empty wait means a lost wakeup */
+        if (!candle_ring_wait(&ring, NULL, 1000)) {
+            break;
+        }
+        uint32_t n = candle_ring_pop(&ring, frames, 64);
+        CHECK(n > 0);
+        for (uint32_t i=0; i<n; i++) {
+            in_order &= (frames[i].timestamp_us == got + i);
+        }
+        got += n;
+    }
+    candle_thread_join(thread);
+
+    CHECK(got == STRESS_FRAMES);
+    CHECK(in_order);
+    CHECK(ring.pushed == STRESS_FRAMES);
+    candle_ring_free(&ring);
+}
+
+static void test_empty_wakeups_keep_waiting(void)
+{
+    candle_ring_t ring;
+    CHECK(candle_ring_init(&ring, 16));
+
+    ring_producer_t p = { &ring, 0, 0, 100 };
+    candle_thread_t thread;
+    CHECK(candle_thread_start(&thread, ring_waker, &p));
+
+    uint64_t t0 = candle_time_ns();
+    CHECK(!candle_ring_wait(&ring, &p.error, 50));
+    uint64_t waited_ms = (candle_time_ns() - t0) / 1000000;
+    CHECK(waited_ms >= 49);
+    CHECK(waited_ms < 1000);
+
+    candle_thread_join(thread);
+    candle_ring_free(&ring);
+}
+
+static void test_error_ends_wait(void)
+{
+    candle_ring_t ring;
+    CHECK(candle_ring_init(&ring, 16));
+
+    ring_producer_t p = { &ring, 0, 0, 0 };
+    candle_thread_t thread;
+    CHECK(candle_thread_start(&thread, ring_error, &p));
+
+    uint64_t t0 = candle_time_ns();
+    CHECK(!candle_ring_wait(&ring, &p.error, 5000));
+    CHECK(candle_time_ns() - t0 < 2000000000ull);
+
+    candle_thread_join(thread);
+    CHECK(p.error == CANDLE_ERR_DEVICE_GONE);
+    candle_ring_free(&ring);
+}
+
+int main(void)
+{
+    RUN(test_stress_in_order);
+    RUN(test_empty_wakeups_keep_waiting);
+    RUN(test_error_ends_wait);
+    return TEST_EXIT();
+}
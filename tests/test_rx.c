@@ -0,0 +1,411 @@
+#include "test.h"
+#include "candle_os.h"
+
+static void push_frames(int d, uint32_t first_ts, uint32_t n)
+{
+    for (uint32_t i=0; i<n; i++) {
+        candle_frame_t f = test_frame(0x100 + i, 0, first_ts + i);
+        fake_push_in(d, &f, sizeof(f));
+    }
+}
+
+static void test_read_many_drains_completed(void)
+{
+    fake_reset();
+    int d = fake_add_device(1, 48000000);
+    candle_handle hdev = test_open(0, NULL);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+
+    /* all 20 transfers complete before the first read */
+    push_frames(d, 0, 20);
+    candle_frame_t frames[64];
+    uint32_t count = 0;
+    uint32_t reaps = fake_reap_count();
+    CHECK(candle_frame_read_many(hdev, frames, 64, &count, 100));
+    CHECK(count == 20);
+    CHECK(fake_reap_count() - reaps == 1);
+    for (uint32_t i=0; i<count; i++) {
+        CHECK(frames[i].timestamp_us == i);
+    }
+
+    /* what does not fit stays for the next call */
+    push_frames(d, 20, 10);
+    CHECK(candle_frame_read_many(hdev, frames, 4, &count, 100));
+    CHECK(count == 4);
+    CHECK(frames[0].timestamp_us == 20);
+    CHECK(candle_frame_read_many(hdev, frames, 64, &count, 100));
+    CHECK(count == 6);
+    CHECK(frames[5].timestamp_us == 29);
+
+    CHECK(!candle_frame_read_many(hdev, frames, 64, &count, 10));
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_READ_TIMEOUT);
+    CHECK(count == 0);
+
+    test_close(hdev);
+}
+
+static void test_urb_options_are_checked(void)
+{
+    fake_reset();
+    fake_add_device(1, 48000000);
+
+    candle_list_handle list;
+    candle_handle hdev;
+    candle_dev_options_t opts;
+    CHECK(candle_list_scan_transport(&list, &candle_transport_fake));
+    CHECK(candle_dev_get(list, 0, &hdev));
+
+    static const uint32_t bad[][2] = { {0, 64}, {1025, 64}, {30, 23}, {30, 16385} };
+    for (unsigned i=0; i<sizeof(bad)/sizeof(bad[0]); i++) {
+        candle_dev_options_init(&opts);
+        opts.rx_urb_count = bad[i][0];
+        opts.rx_urb_size = bad[i][1];
+        CHECK(!candle_dev_open_ex(hdev, &opts));
+        CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_INVALID_OPTION);
+    }
+
+    /* the largest depth works end to end */
+    candle_dev_options_init(&opts);
+    opts.rx_urb_count = 1024;
+    opts.rx_urb_size = 16384;
+    CHECK(candle_dev_open_ex(hdev, &opts));
+    candle_dev_close(hdev);
+
+    candle_dev_free(hdev);
+    candle_list_free(list);
+}
+
+static void test_in_flight_reads_buffer_bursts(void)
+{
+    fake_reset();
+    int d = fake_add_device(1, 48000000);
+    fake_set_in_limit(d, 4);
+
+    candle_dev_options_t opts;
+    candle_dev_options_init(&opts);
+    opts.rx_urb_count = 64;
+    candle_handle hdev = test_open(0, &opts);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+
+    /* a burst larger than the device FIFO is kept by the reads in flight */
+    push_frames(d, 0, 60);
+    CHECK(fake_dropped(d) == 0);
+
+    candle_frame_t frames[64];
+    uint32_t count = 0;
+    CHECK(candle_frame_read_many(hdev, frames, 64, &count, 100));
+    CHECK(count == 60);
+
+    /* beyond them the device drops */
+    push_frames(d, 60, 100);
+    CHECK(fake_dropped(d) == 100 - 64 - 4);
+
+    test_close(hdev);
+}
+
+/* reads that complete out of order still hand out frames in bus order */
+static void check_in_order(uint32_t flags, bool peek)
+{
+    fake_reset();
+    int d = fake_add_device(1, 48000000);
+    fake_set_random_order(true);
+
+    candle_dev_options_t opts;
+    candle_dev_options_init(&opts);
+    opts.rx_urb_count = 16;
+    opts.flags |= flags;
+    candle_handle hdev = test_open(0, &opts);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+
+    push_frames(d, 0, 500);
+    uint32_t got = 0;
+    bool in_order = true;
+    while (got < 500) {
+        candle_frame_t frames[32];
+        uint32_t count = 0;
+        if (peek) {
+            const candle_frame_t *frame;
+            if (candle_frame_peek(hdev, &frame, 100)) {
+                frames[0] = *frame;
+                count = 1;
+                CHECK(candle_frame_release(hdev, frame));
+            }
+        } else {
+            candle_frame_read_many(hdev, frames, 32, &count, 100);
+        }
+        if (count == 0) {
+            break;
+        }
+        for (uint32_t i=0; i<count; i++) {
+            in_order &= (frames[i].timestamp_us == got + i);
+        }
+        got += count;
+    }
+    CHECK(got == 500);
+    CHECK(in_order);
+
+    test_close(hdev);
+}
+
+static void test_random_completion_read_in_order(void)
+{
+    check_in_order(0, false);
+    check_in_order(CANDLE_DEVOPT_RX_PACKED, false);
+}
+
+static void test_random_completion_peek_in_order(void)
+{
+    check_in_order(0, true);
+}
+
+static void test_random_completion_thread_in_order(void)
+{
+    check_in_order(CANDLE_DEVOPT_RX_THREAD, false);
+}
+
+static void test_peek_with_one_urb(void)
+{
+    fake_reset();
+    int d = fake_add_device(1, 48000000);
+
+    candle_dev_options_t opts;
+    candle_dev_options_init(&opts);
+    opts.rx_urb_count = 1;
+    candle_handle hdev = test_open(0, &opts);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+
+    /* the only urb goes back in flight while its frame is borrowed, so
+       frames that come in meanwhile are still read */
+    const candle_frame_t *frames[3];
+    push_frames(d, 0, 1);
+    for (uint32_t i=0; i<3; i++) {
+        frames[i] = NULL;
+        CHECK(candle_frame_peek(hdev, &frames[i], 100));
+        if (frames[i] == NULL) {
+            break;
+        }
+        CHECK(frames[i]->timestamp_us == i);
+        push_frames(d, i + 1, 1);
+    }
+    candle_frame_t frame;
+    CHECK(candle_frame_read(hdev, &frame, 100));
+    CHECK(frame.timestamp_us == 3);
+    for (uint32_t i=0; (i<3) && (frames[i] != NULL); i++) {
+        CHECK(candle_frame_release(hdev, frames[i]));
+    }
+
+    test_close(hdev);
+}
+
+/* channel 0 carries 1000 frames for each 100 of channel 1 and 1 of
+   channel 2, interleaved; the timestamp counts the channel's frames */
+#define SKEW_CHANNELS 3
+static const uint32_t skew_every[SKEW_CHANNELS] = { 1, 10, 1000 };
+#define SKEW_FRAMES 20000
+
+static uint32_t skew_total(uint8_t ch)
+{
+    return SKEW_FRAMES / skew_every[ch];
+}
+
+/* frames first..last-1 of channel 0 and the others' in between */
+static void push_skewed(int d, uint32_t first, uint32_t last)
+{
+    for (uint32_t i=first; i<last; i++) {
+        for (uint8_t ch=0; ch<SKEW_CHANNELS; ch++) {
+            if (i % skew_every[ch] == 0) {
+                candle_frame_t f = test_frame(0x100 + ch, ch, i / skew_every[ch]);
+                fake_push_in(d, &f, sizeof(f));
+            }
+        }
+    }
+}
+
+typedef struct {
+    candle_handle hdev;
+    uint8_t ch;
+    uint32_t got;
+    bool in_order;
+    candle_err_t err;
+} skew_reader_t;
+
+static void skew_reader(void *arg)
+{
+    skew_reader_t *r = (skew_reader_t*)arg;
+    uint32_t expected = skew_total(r->ch);
+    candle_frame_t frames[64];
+    r->in_order = true;
+    while (r->got < expected) {
+        uint32_t count;
+        if (!candle_channel_frame_read_many(r->hdev, r->ch, frames, 64, &count, 1000)) {
+            r->err = candle_channel_last_error(r->hdev, r->ch);
+            break;
+        }
+        for (uint32_t i=0; i<count; i++) {
+            r->in_order &= (frames[i].channel == r->ch) && (frames[i].timestamp_us == r->got + i);
+        }
+        r->got += count;
+    }
+}
+
+static candle_handle open_per_channel(int *d, uint32_t ring_frames)
+{
+    fake_reset();
+    *d = fake_add_device(SKEW_CHANNELS, 48000000);
+
+    candle_dev_options_t opts;
+    candle_dev_options_init(&opts);
+    opts.flags |= CANDLE_DEVOPT_RX_THREAD | CANDLE_DEVOPT_RX_PER_CHANNEL;
+    opts.rx_ring_frames = ring_frames;
+    return test_open(0, &opts);
+}
+
+static void test_per_channel_skewed_rates(void)
+{
+    int d;
+    candle_handle hdev = open_per_channel(&d, SKEW_FRAMES);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+
+    /* a reader per channel, each on its own thread */
+    skew_reader_t readers[SKEW_CHANNELS];
+    candle_thread_t threads[SKEW_CHANNELS];
+    for (uint8_t ch=0; ch<SKEW_CHANNELS; ch++) {
+        skew_reader_t r = { hdev, ch, 0, true, CANDLE_ERR_OK };
+        readers[ch] = r;
+        CHECK(candle_thread_start(&threads[ch], skew_reader, &readers[ch]));
+    }
+    push_skewed(d, 0, SKEW_FRAMES);
+    for (uint8_t ch=0; ch<SKEW_CHANNELS; ch++) {
+        candle_thread_join(threads[ch]);
+        CHECK(readers[ch].err == CANDLE_ERR_OK);
+        CHECK(readers[ch].got == skew_total(ch));
+        CHECK(readers[ch].in_order);
+
+        candle_rx_stats_t stats;
+        CHECK(candle_channel_get_rx_stats(hdev, ch, &stats));
+        CHECK(stats.frames == skew_total(ch));
+        CHECK(stats.overflows == 0);
+    }
+
+    test_close(hdev);
+}
+
+static void test_per_channel_overflow_stays_on_channel(void)
+{
+    int d;
+    candle_handle hdev = open_per_channel(&d, 64);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+
+    /* nobody reads channel 0, whose ring fills up; the quieter channels
+       still get every frame in order */
+    uint32_t got[SKEW_CHANNELS] = { 0 };
+    bool in_order = true;
+    for (uint32_t i=0; i<SKEW_FRAMES; i+=100) {
+        push_skewed(d, i, i + 100);
+        for (uint8_t ch=1; ch<SKEW_CHANNELS; ch++) {
+            candle_frame_t frames[64];
+            uint32_t count;
+            while ( (got[ch] < (i + 99) / skew_every[ch] + 1)
+                 && candle_channel_frame_read_many(hdev, ch, frames, 64, &count, 1000) ) {
+                for (uint32_t i=0; i<count; i++) {
+                    in_order &= (frames[i].timestamp_us == got[ch] + i);
+                }
+                got[ch] += count;
+            }
+        }
+    }
+    CHECK(in_order);
+
+    candle_rx_stats_t stats;
+    CHECK(candle_channel_get_rx_stats(hdev, 0, &stats));
+    CHECK(stats.overflows == skew_total(0) - 64);
+    for (uint8_t ch=1; ch<SKEW_CHANNELS; ch++) {
+        CHECK(got[ch] == skew_total(ch));
+        CHECK(candle_channel_get_rx_stats(hdev, ch, &stats));
+        CHECK(stats.overflows == 0);
+    }
+
+    /* what channel 0 kept is the oldest, in order */
+    candle_frame_t frames[64];
+    uint32_t count = 0;
+    CHECK(candle_channel_frame_read_many(hdev, 0, frames, 64, &count, 100));
+    CHECK(count == 64);
+    CHECK(frames[0].timestamp_us == 0);
+    CHECK(frames[count-1].timestamp_us == count - 1);
+
+    test_close(hdev);
+}
+
+/* a read that fails before it starts reports no frames, and a channel
+   reader's errors stay off the device */
+static void test_read_misuse_clears_count(void)
+{
+    int d;
+    candle_handle hdev = open_per_channel(&d, 64);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+
+    candle_frame_t frames[4];
+    uint32_t count = 99;
+    CHECK(!candle_frame_read_many(hdev, frames, 4, &count, 10));
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_INVALID_OPTION);
+    CHECK(count == 0);
+
+    count = 99;
+    CHECK(!candle_channel_frame_read_many(hdev, SKEW_CHANNELS, frames, 4, &count, 10));
+    CHECK(candle_channel_last_error(hdev, SKEW_CHANNELS) == CANDLE_ERR_CHANNEL_OUT_OF_RANGE);
+    CHECK(count == 0);
+
+    count = 99;
+    CHECK(!candle_channel_frame_read_many(hdev, 1, frames, 4, &count, 10));
+    CHECK(candle_channel_last_error(hdev, 1) == CANDLE_ERR_READ_TIMEOUT);
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_CHANNEL_OUT_OF_RANGE);
+    CHECK(count == 0);
+    test_close(hdev);
+
+    hdev = test_open(0, NULL);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+    count = 99;
+    CHECK(!candle_channel_frame_read_many(hdev, 0, frames, 4, &count, 10));
+    CHECK(candle_channel_last_error(hdev, 0) == CANDLE_ERR_INVALID_OPTION);
+    CHECK(count == 0);
+    test_close(hdev);
+}
+
+int main(void)
+{
+    RUN(test_read_many_drains_completed);
+    RUN(test_urb_options_are_checked);
+    RUN(test_in_flight_reads_buffer_bursts);
+    RUN(test_random_completion_read_in_order);
+    RUN(test_random_completion_peek_in_order);
+    RUN(test_random_completion_thread_in_order);
+    RUN(test_peek_with_one_urb);
+    RUN(test_per_channel_skewed_rates);
+    RUN(test_per_channel_overflow_stays_on_channel);
+    RUN(test_read_misuse_clears_count);
+    return TEST_EXIT();
+}
@@ -0,0 +1,157 @@
+#include "test.h"
+#include "candle_rx_parse.h"
+
+#define STREAM_FRAMES 10
+
+static void make_stream(uint8_t *buf, candle_frame_t *frames, uint32_t n)
+{
+    for (uint32_t i=0; i<n; i++) {
+        frames[i] = test_frame(0x100 + i, (uint8_t)(i % 2), i * 10);
+        memcpy(&buf[i * sizeof(candle_frame_t)], &frames[i], sizeof(candle_frame_t));
+    }
+}
+
+static void test_multi_frame_transfer(void)
+{
+    candle_rx_parser_t parser;
+    candle_frame_t in[3], out[3];
+    uint8_t buf[sizeof(in)];
+    candle_rx_parser_init(&parser, 2);
+    make_stream(buf, in, 3);
+
+    CHECK(candle_rx_parse_max_frames(sizeof(buf)) == 3);
+    CHECK(candle_rx_parse(&parser, buf, sizeof(buf), out) == 3);
+    CHECK(memcmp(in, out, sizeof(in)) == 0);
+    CHECK(parser.partial_len == 0);
+    CHECK(parser.invalid == 0);
+}
+
+static void test_split_at_every_size(void)
+{
+    candle_frame_t in[STREAM_FRAMES], out[STREAM_FRAMES + 1];
+    uint8_t buf[sizeof(in)];
+    make_stream(buf, in, STREAM_FRAMES);
+
+    /* the same stream cut into transfers of every size up to three records */
+    for (uint32_t chunk=1; chunk<=3*sizeof(candle_frame_t); chunk++) {
+        candle_rx_parser_t parser;
+        candle_rx_parser_init(&parser, 2);
+        uint32_t got = 0;
+        for (uint32_t pos=0; pos<sizeof(buf); pos+=chunk) {
+            uint32_t len = (sizeof(buf) - pos < chunk) ? sizeof(buf) - pos : chunk;
+            CHECK(candle_rx_parse_max_frames(len) + got <= STREAM_FRAMES + 1);
+            got += candle_rx_parse(&parser, &buf[pos], len, &out[got]);
+        }
+        CHECK(got == STREAM_FRAMES);
+        CHECK(memcmp(in, out, sizeof(in)) == 0);
+        CHECK(parser.partial_len == 0);
+    }
+}
+
+static void test_span_points_into_transfer(void)
+{
+    candle_rx_parser_t parser;
+    candle_frame_t in[4], stitched;
+    candle_rx_span_t span;
+    uint8_t buf[sizeof(in)];
+    candle_rx_parser_init(&parser, 2);
+    make_stream(buf, in, 4);
+
+    /* half a record, then the rest of it and two and a half more */
+    candle_rx_parse_span(&parser, buf, 12, &stitched, &span);
+    CHECK(!span.stitched);
+    CHECK(span.count == 0);
+    candle_rx_parse_span(&parser, &buf[12], 3 * sizeof(candle_frame_t), &stitched, &span);
+    CHECK(span.stitched);
+    CHECK(memcmp(&stitched, &in[0], sizeof(stitched)) == 0);
+    CHECK(span.offset == 12);
+    CHECK(span.count == 2);
+    CHECK(parser.partial_len == 12);
+}
+
+static void test_bad_header_drops_rest_of_transfer(void)
+{
+    candle_rx_parser_t parser;
+    candle_frame_t in[4], out[4];
+    uint8_t buf[sizeof(in)];
+    candle_rx_parser_init(&parser, 2);
+    make_stream(buf, in, 4);
+
+    in[1].can_dlc = 9;
+    memcpy(&buf[sizeof(candle_frame_t)], &in[1], sizeof(candle_frame_t));
+    CHECK(candle_rx_parse(&parser, buf, sizeof(buf) - 5, out) == 1);
+    CHECK(memcmp(&out[0], &in[0], sizeof(candle_frame_t)) == 0);
+    CHECK(parser.invalid == 2);
+    CHECK(parser.partial_len == 0);
+
+    /* the next transfer starts in step again */
+    make_stream(buf, in, 4);
+    CHECK(candle_rx_parse(&parser, buf, sizeof(buf), out) == 4);
+
+    in[2].channel = 2;
+    memcpy(&buf[2 * sizeof(candle_frame_t)], &in[2], sizeof(candle_frame_t));
+    CHECK(candle_rx_parse(&parser, buf, sizeof(buf), out) == 2);
+    CHECK(parser.invalid == 4);
+}
+
+static void test_bad_stitched_record_is_dropped(void)
+{
+    candle_rx_parser_t parser;
+    candle_frame_t in[2], out[2];
+    uint8_t buf[sizeof(in)];
+    candle_rx_parser_init(&parser, 1);
+    make_stream(buf, in, 2);
+
+    /* in[1] is on channel 1, which a single channel device doesn't have */
+    CHECK(candle_rx_parse(&parser, buf, sizeof(candle_frame_t) + 8, out) == 1);
+    CHECK(candle_rx_parse(&parser, &buf[sizeof(candle_frame_t) + 8], sizeof(candle_frame_t) - 8, out) == 0);
+    CHECK(parser.invalid == 1);
+    CHECK(parser.partial_len == 0);
+}
+
+static void test_device_drops_bad_records(void)
+{
+    fake_reset();
+    int d = fake_add_device(1, 48000000);
+
+    candle_dev_options_t opts;
+    candle_dev_options_init(&opts);
+    opts.flags |= CANDLE_DEVOPT_RX_PACKED;
+    opts.rx_urb_size = 4 * sizeof(candle_frame_t);
+    candle_handle hdev = test_open(0, &opts);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+
+    candle_frame_t in[4], out[8];
+    for (uint32_t i=0; i<4; i++) {
+        in[i] = test_frame(0x200 + i, 0, i);
+    }
+    in[2].can_dlc = 15;
+    fake_push_in(d, in, sizeof(in));
+    in[2].can_dlc = 8;
+    fake_push_in(d, in, sizeof(in));
+
+    uint32_t count = 0, got = 0;
+    while ( (got < 6) && candle_frame_read_many(hdev, &out[got], 8 - got, &count, 100) ) {
+        got += count;
+    }
+    CHECK(got == 6);
+    CHECK(candle_frame_id(&out[1]) == 0x201);
+    CHECK(candle_frame_id(&out[2]) == 0x200);
+    CHECK(candle_frame_id(&out[5]) == 0x203);
+
+    test_close(hdev);
+}
+
+int main(void)
+{
+    RUN(test_multi_frame_transfer);
+    RUN(test_split_at_every_size);
+    RUN(test_span_points_into_transfer);
+    RUN(test_bad_header_drops_rest_of_transfer);
+    RUN(test_bad_stitched_record_is_dropped);
+    RUN(test_device_drops_bad_records);
+    return TEST_EXIT();
+}
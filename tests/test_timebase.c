@@ -0,0 +1,171 @@
+#include "test.h"
+#include "candle_os.h"
+
+/* linked with --wrap=candle_time_ns, so the host clock can be moved ahead
+   instead of waiting out a gap of an hour */
+static uint64_t test_clock_offset_ns;
+
+uint64_t __real_candle_time_ns(void);
+uint64_t __wrap_candle_time_ns(void)
+{
+    return __real_candle_time_ns() + candle_atomic_load(&test_clock_offset_ns);
+}
+
+static void test_clock_advance_us(uint64_t us)
+{
+    candle_atomic_store(&test_clock_offset_ns, test_clock_offset_ns + us * 1000);
+}
+
+#define MINUTES_US(m) ((uint64_t)(m) * 60 * 1000000)
+
+/* push one frame with the low 32 bits of ts, read it back and return its
+   64-bit timestamp */
+static uint64_t receive(candle_handle hdev, int d, uint64_t ts)
+{
+    candle_frame_t f = test_frame(0x100, 0, (uint32_t)ts);
+    fake_push_in(d, &f, sizeof(f));
+
+    candle_frame_t rx;
+    if (!candle_frame_read(hdev, &rx, 100)) {
+        return ~(uint64_t)0;
+    }
+    return candle_frame_timestamp64_us(hdev, &rx);
+}
+
+static void test_wrap_sequence(void)
+{
+    int d;
+    candle_handle hdev = test_open_flags(&d, 0);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+
+    /* across three wraps: 50 ms between frames within half a second of a
+       wrap, minutes in between */
+    bool exact = true;
+    uint64_t ts = 0xFFFFFFFFull - 500000;
+    while (ts < 3 * ((uint64_t)1 << 32) + 500000) {
+        exact &= (receive(hdev, d, ts) == ts);
+
+        uint64_t to_wrap = (((ts >> 32) + 1) << 32) - ts;
+        uint64_t step = 50000;
+        if ( (to_wrap > 500000) && ((uint32_t)ts > 500000) ) {
+            step = (to_wrap - 500000 < MINUTES_US(7)) ? to_wrap - 500000 : MINUTES_US(7);
+        }
+        ts += step;
+        test_clock_advance_us(step);
+    }
+    CHECK(exact);
+
+    test_close(hdev);
+}
+
+static void test_reordered_around_wrap(void)
+{
+    int d;
+    candle_handle hdev = test_open_flags(&d, 0);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+
+    static const uint64_t seq[] = {
+        0xFFFFFF00, 0xFFFFFFF0, 0x100000010, 0xFFFFFFF8, 0x100000020, 0x100000018
+    };
+    uint64_t got[sizeof(seq)/sizeof(seq[0])];
+    for (unsigned i=0; i<sizeof(seq)/sizeof(seq[0]); i++) {
+        candle_frame_t f = test_frame(0x100, 0, (uint32_t)seq[i]);
+        fake_push_in(d, &f, sizeof(f));
+    }
+    for (unsigned i=0; i<sizeof(seq)/sizeof(seq[0]); i++) {
+        candle_frame_t rx;
+        CHECK(candle_frame_read(hdev, &rx, 100));
+        got[i] = candle_frame_timestamp64_us(hdev, &rx);
+    }
+    for (unsigned i=0; i<sizeof(seq)/sizeof(seq[0]); i++) {
+        CHECK(got[i] == seq[i]);
+    }
+
+    test_close(hdev);
+}
+
+static void test_idle_gaps(void)
+{
+    int d;
+    candle_handle hdev = test_open_flags(&d, 0);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+
+    /* gaps of 40 and 80 minutes and four hours, longer than half and than a
+       whole wrap of the 32-bit microsecond counter */
+    uint64_t ts = 1000;
+    CHECK(receive(hdev, d, ts) == ts);
+    static const uint32_t gaps_min[] = { 40, 40, 80, 240, 1 };
+    for (unsigned i=0; i<sizeof(gaps_min)/sizeof(gaps_min[0]); i++) {
+        ts += MINUTES_US(gaps_min[i]);
+        test_clock_advance_us(MINUTES_US(gaps_min[i]));
+        CHECK(receive(hdev, d, ts) == ts);
+        CHECK(receive(hdev, d, ts + 10) == ts + 10);
+    }
+
+    test_close(hdev);
+}
+
+static void test_frames_read_late(void)
+{
+    int d;
+    candle_handle hdev = test_open_flags(&d, 0);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+
+    /* frames that came in right away but are read 40 minutes later */
+    CHECK(receive(hdev, d, 1000) == 1000);
+    candle_frame_t f = test_frame(0x100, 0, 2000);
+    fake_push_in(d, &f, sizeof(f));
+    test_clock_advance_us(MINUTES_US(40));
+
+    candle_frame_t rx;
+    CHECK(candle_frame_read(hdev, &rx, 100));
+    CHECK(candle_frame_timestamp64_us(hdev, &rx) == 2000);
+
+    test_close(hdev);
+}
+
+static void test_overflow_frame_after_gap(void)
+{
+    int d;
+    candle_handle hdev = test_open_flags(&d, CANDLE_DEVOPT_TS_OVFL_FRAMES);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+
+    CHECK(receive(hdev, d, 1000) == 1000);
+    test_clock_advance_us(MINUTES_US(80));
+    uint64_t ts = 1000 + MINUTES_US(80);
+    candle_frame_t f = test_frame(0x100, 0, (uint32_t)ts);
+    fake_push_in(d, &f, sizeof(f));
+
+    candle_frame_t rx;
+    CHECK(candle_frame_read(hdev, &rx, 100));
+    CHECK(candle_frame_type(&rx) == CANDLE_FRAMETYPE_TIMESTAMP_OVFL);
+    CHECK(candle_frame_read(hdev, &rx, 100));
+    CHECK(candle_frame_timestamp64_us(hdev, &rx) == ts);
+
+    test_close(hdev);
+}
+
+int main(void)
+{
+    RUN(test_wrap_sequence);
+    RUN(test_reordered_around_wrap);
+    RUN(test_idle_gaps);
+    RUN(test_frames_read_late);
+    RUN(test_overflow_frame_after_gap);
+    return TEST_EXIT();
+}
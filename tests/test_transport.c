@@ -0,0 +1,596 @@
+#include "test.h"
+#include "candle_os.h"
+
+static void test_scan_lists_devices(void)
+{
+    fake_reset();
+    fake_add_device(2, 48000000);
+    fake_add_device(1, 80000000);
+
+    candle_list_handle list;
+    uint8_t len = 0;
+    CHECK(candle_list_scan_transport(&list, &candle_transport_fake));
+    CHECK(candle_list_length(list, &len));
+    CHECK(len == 2);
+
+    candle_handle hdev;
+    CHECK(candle_dev_get(list, 1, &hdev));
+    CHECK(wcscmp(candle_dev_get_path(hdev), L"fake:1") == 0);
+
+    candle_devstate_t state;
+    uint8_t channels = 0;
+    CHECK(candle_dev_get_state(hdev, &state));
+    CHECK(state == CANDLE_DEVSTATE_AVAIL);
+    CHECK(candle_channel_count(hdev, &channels));
+    CHECK(channels == 1);
+
+    candle_capability_t cap;
+    CHECK(candle_channel_get_capabilities(hdev, 0, &cap));
+    CHECK(cap.fclk_can == 80000000);
+
+    candle_dev_free(hdev);
+    candle_list_free(list);
+}
+
+static void test_default_scan_uses_fake(void)
+{
+    fake_reset();
+    fake_add_device(1, 48000000);
+
+    candle_list_handle list;
+    uint8_t len = 0;
+    CHECK(candle_list_scan(&list));
+    CHECK(candle_list_length(list, &len));
+    CHECK(len == 1);
+    candle_list_free(list);
+}
+
+static void test_open_configures_device(void)
+{
+    fake_reset();
+    int d = fake_add_device(2, 48000000);
+
+    candle_handle hdev = test_open(0, NULL);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+
+    CHECK(candle_channel_set_bitrate(hdev, 1, 500000));
+    candle_bittiming_t t;
+    CHECK(fake_get_bittiming(d, 1, &t));
+    uint32_t tq = 1 + t.prop_seg + t.phase_seg1 + t.phase_seg2;
+    CHECK(48000000 / (t.brp * tq) == 500000);
+
+    uint32_t mode, flags;
+    CHECK(candle_channel_start(hdev, 1, CANDLE_MODE_LOOP_BACK));
+    CHECK(fake_get_mode(d, 1, &mode, &flags));
+    CHECK(mode == 1);
+    CHECK(flags == CANDLE_MODE_LOOP_BACK);
+    CHECK(candle_channel_stop(hdev, 1));
+    CHECK(fake_get_mode(d, 1, &mode, &flags));
+    CHECK(mode == 0);
+
+    CHECK(!candle_channel_start(hdev, 2, 0));
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_CHANNEL_OUT_OF_RANGE);
+
+    test_close(hdev);
+}
+
+static void test_send_and_receive(void)
+{
+    fake_reset();
+    int d = fake_add_device(1, 48000000);
+    fake_set_echo(d, true);
+
+    candle_handle hdev = test_open(0, NULL);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+
+    candle_frame_t tx = test_frame(0x123, 0, 0);
+    CHECK(candle_frame_send(hdev, 0, &tx));
+    CHECK(fake_out_count(d) == 1);
+
+    candle_frame_t rx;
+    CHECK(candle_frame_read(hdev, &rx, 100));
+    CHECK(candle_frame_type(&rx) == CANDLE_FRAMETYPE_ECHO);
+    CHECK(candle_frame_id(&rx) == 0x123);
+
+    fake_set_echo(d, false);
+    candle_frame_t f = test_frame(0x456, 0, 1000);
+    fake_push_in(d, &f, sizeof(f));
+    CHECK(candle_frame_read(hdev, &rx, 100));
+    CHECK(candle_frame_type(&rx) == CANDLE_FRAMETYPE_RECEIVE);
+    CHECK(candle_frame_id(&rx) == 0x456);
+    CHECK(candle_frame_timestamp_us(&rx) == 1000);
+
+    CHECK(!candle_frame_read(hdev, &rx, 10));
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_READ_TIMEOUT);
+
+    test_close(hdev);
+}
+
+static void test_send_async_window(void)
+{
+    fake_reset();
+    int d = fake_add_device(2, 48000000);
+    fake_set_echo(d, true);
+
+    candle_handle hdev = test_open(0, NULL);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+
+    /* ten frames per channel in flight, the channels don't share them */
+    candle_frame_t tx = test_frame(0x321, 0, 0);
+    for (unsigned i=0; i<10; i++) {
+        CHECK(candle_frame_send_async(hdev, 0, &tx));
+    }
+    CHECK(!candle_frame_send_async(hdev, 0, &tx));
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_SEND_WOULD_BLOCK);
+    CHECK(candle_frame_send_async(hdev, 1, &tx));
+    CHECK(fake_out_count(d) == 11);
+
+    /* reading the echoes frees the window */
+    candle_frame_t rx[16];
+    uint32_t count = 0, echoes = 0;
+    while ( (echoes < 11) && candle_frame_read_many(hdev, rx, 16, &count, 100) ) {
+        for (uint32_t i=0; i<count; i++) {
+            CHECK(candle_frame_type(&rx[i]) == CANDLE_FRAMETYPE_ECHO);
+        }
+        echoes += count;
+    }
+    CHECK(echoes == 11);
+    for (unsigned i=0; i<10; i++) {
+        CHECK(candle_frame_send_async(hdev, 0, &tx));
+    }
+    CHECK(!candle_frame_send_async(hdev, 0, &tx));
+
+    test_close(hdev);
+}
+
+static void check_send_many(uint32_t flags, uint32_t transfers)
+{
+    fake_reset();
+    int d = fake_add_device(2, 48000000);
+
+    candle_dev_options_t opts;
+    candle_dev_options_init(&opts);
+    opts.flags |= flags;
+    candle_handle hdev = test_open(0, &opts);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+
+    candle_frame_t tx[400];
+    for (unsigned i=0; i<400; i++) {
+        tx[i] = test_frame(0x100 + i, 0, 0);
+    }
+    size_t sent = 0;
+    CHECK(candle_frame_send_many(hdev, 1, tx, 400, &sent));
+    CHECK(sent == 400);
+    CHECK(fake_out_count(d) == transfers);
+
+    /* the frames go out in order, on the channel asked for */
+    unsigned n = 0;
+    for (uint32_t i=0; i<fake_out_count(d); i++) {
+        static candle_frame_t out[400];
+        uint32_t len = sizeof(out);
+        CHECK(fake_get_out(d, i, out, &len));
+        CHECK(len % sizeof(candle_frame_t) == 0);
+        for (uint32_t k=0; (k<len/sizeof(candle_frame_t)) && (n<400); k++, n++) {
+            CHECK(out[k].can_id == tx[n].can_id);
+            CHECK(out[k].channel == 1);
+        }
+    }
+    CHECK(n == 400);
+
+    fake_unplug(d);
+    CHECK(!candle_frame_send_many(hdev, 1, tx, 400, &sent));
+    CHECK(sent == 0);
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_DEVICE_GONE);
+
+    test_close(hdev);
+}
+
+static void test_send_many_packs_frames(void)
+{
+    /* 170 frames per transfer */
+    check_send_many(CANDLE_DEVOPT_TX_PACKED, 3);
+}
+
+static void test_send_many_unpacked(void)
+{
+    check_send_many(0, 400);
+}
+
+static void test_second_open_is_in_use(void)
+{
+    fake_reset();
+    fake_add_device(1, 48000000);
+
+    candle_handle hdev = test_open(0, NULL);
+    CHECK(hdev != NULL);
+
+    candle_list_handle list;
+    candle_handle other;
+    candle_devstate_t state;
+    CHECK(candle_list_scan_transport(&list, &candle_transport_fake));
+    CHECK(candle_dev_get(list, 0, &other));
+    CHECK(candle_dev_get_state(other, &state));
+    CHECK(state == CANDLE_DEVSTATE_INUSE);
+    CHECK(!candle_dev_open(other));
+
+    candle_dev_free(other);
+    candle_list_free(list);
+    test_close(hdev);
+}
+
+static void test_open_twice_fails(void)
+{
+    int d;
+    candle_handle hdev = test_open_flags(&d, CANDLE_DEVOPT_RX_THREAD);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+
+    /* the first open keeps running, with its options */
+    candle_dev_options_t again;
+    candle_dev_options_init(&again);
+    again.rx_urb_count = 1;
+    CHECK(!candle_dev_open_ex(hdev, &again));
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_DEVICE_ALREADY_OPEN);
+    CHECK(!candle_dev_open(hdev));
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_DEVICE_ALREADY_OPEN);
+
+    candle_frame_t in = test_frame(0x123, 0, 42), out;
+    fake_push_in(d, &in, sizeof(in));
+    CHECK(candle_frame_read(hdev, &out, 100));
+    CHECK(out.timestamp_us == 42);
+    test_close(hdev);
+}
+
+static void test_probe_is_flagged(void)
+{
+    fake_reset();
+    int d = fake_add_device(1, 48000000);
+
+    candle_list_handle list;
+    candle_handle hdev;
+    candle_devstate_t state;
+    CHECK(candle_list_scan_transport(&list, &candle_transport_fake));
+    CHECK(candle_dev_get(list, 0, &hdev));
+    CHECK(candle_dev_get_state(hdev, &state));
+    CHECK(fake_open_count(d) == 1);
+    CHECK(fake_probe_count(d) == 1);
+
+    /* only a real open may take the device from a kernel driver */
+    CHECK(candle_dev_open(hdev));
+    CHECK(fake_open_count(d) == 2);
+    CHECK(fake_probe_count(d) == 1);
+
+    candle_dev_close(hdev);
+    candle_dev_free(hdev);
+    candle_list_free(list);
+}
+
+static void test_unplug_reports_gone(void)
+{
+    fake_reset();
+    int d = fake_add_device(1, 48000000);
+
+    candle_handle hdev = test_open(0, NULL);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+
+    fake_unplug(d);
+    candle_frame_t rx;
+    CHECK(!candle_frame_read(hdev, &rx, 100));
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_DEVICE_GONE);
+    candle_frame_t tx = test_frame(0x1, 0, 0);
+    CHECK(!candle_frame_send(hdev, 0, &tx));
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_DEVICE_GONE);
+
+    test_close(hdev);
+}
+
+static void check_not_open(candle_handle hdev)
+{
+    candle_frame_t f = test_frame(0x100, 0, 0);
+    const candle_frame_t *peeked;
+    candle_bittiming_t t = { 1, 12, 2, 1, 6 };
+    candle_frame_batch_t batch;
+    uint32_t count = 1, detected;
+    size_t sent = 1;
+
+    CHECK(!candle_channel_set_timing(hdev, 0, &t));
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_DEVICE_NOT_OPEN);
+    CHECK(!candle_channel_set_bitrate(hdev, 0, 500000));
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_DEVICE_NOT_OPEN);
+    CHECK(!candle_channel_start(hdev, 0, 0));
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_DEVICE_NOT_OPEN);
+    CHECK(!candle_channel_stop(hdev, 0));
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_DEVICE_NOT_OPEN);
+    CHECK(!candle_channel_autobaud(hdev, 0, NULL, 0, 10, &detected));
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_DEVICE_NOT_OPEN);
+    CHECK(!candle_frame_send(hdev, 0, &f));
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_DEVICE_NOT_OPEN);
+    CHECK(!candle_frame_send_async(hdev, 0, &f));
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_DEVICE_NOT_OPEN);
+    CHECK(!candle_frame_send_many(hdev, 0, &f, 1, &sent));
+    CHECK(sent == 0);
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_DEVICE_NOT_OPEN);
+    CHECK(!candle_frame_read_many(hdev, &f, 1, &count, 10));
+    CHECK(count == 0);
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_DEVICE_NOT_OPEN);
+    CHECK(!candle_channel_frame_read(hdev, 0, &f, 10));
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_DEVICE_NOT_OPEN);
+    CHECK(!candle_frame_peek(hdev, &peeked, 10));
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_DEVICE_NOT_OPEN);
+    CHECK(candle_frame_batch_init(&batch, 4));
+    CHECK(!candle_frame_read_batch(hdev, &batch, 4, &count, 10));
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_DEVICE_NOT_OPEN);
+    CHECK(!candle_channel_frame_read_batch(hdev, 0, &batch, 4, &count, 10));
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_DEVICE_NOT_OPEN);
+    candle_frame_batch_free(&batch);
+}
+
+static void test_unopened_handle_fails(void)
+{
+    fake_reset();
+    int d = fake_add_device(1, 48000000);
+
+    candle_list_handle list;
+    candle_handle hdev;
+    CHECK(candle_list_scan_transport(&list, &candle_transport_fake));
+    CHECK(candle_dev_get(list, 0, &hdev));
+
+    /* descriptors are known from the probe, but nothing reaches the device */
+    candle_capability_t cap;
+    CHECK(candle_channel_get_capabilities(hdev, 0, &cap));
+    uint32_t controls = fake_control_count(d);
+    check_not_open(hdev);
+    CHECK(fake_control_count(d) == controls);
+    CHECK(fake_out_count(d) == 0);
+
+    /* nor after it is closed again */
+    CHECK(candle_dev_open(hdev));
+    CHECK(candle_dev_close(hdev));
+    controls = fake_control_count(d);
+    check_not_open(hdev);
+    CHECK(fake_control_count(d) == controls);
+
+    candle_dev_free(hdev);
+    candle_list_free(list);
+}
+
+static void test_unplug_fails_control_requests(void)
+{
+    fake_reset();
+    int d = fake_add_device(1, 48000000);
+
+    candle_handle hdev = test_open(0, NULL);
+    CHECK(hdev != NULL);
+    if (hdev == NULL) {
+        return;
+    }
+
+    fake_unplug(d);
+    CHECK(!candle_channel_set_bitrate(hdev, 0, 500000));
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_DEVICE_GONE);
+    uint32_t controls = fake_control_count(d);
+    CHECK(!candle_channel_start(hdev, 0, 0));
+    CHECK(candle_dev_last_error(hdev) == CANDLE_ERR_DEVICE_GONE);
+    /* without asking the device again */
+    CHECK(fake_control_count(d) == controls);
+
+    /* opened again once it is back */
+    fake_replug(d);
+    candle_dev_close(hdev);
+    CHECK(candle_dev_open(hdev));
+    CHECK(candle_channel_set_bitrate(hdev, 0, 500000));
+    CHECK(candle_channel_start(hdev, 0, 0));
+
+    test_close(hdev);
+}
+
+static void test_descriptors_are_cached(void)
+{
+    fake_reset();
+    int d0 = fake_add_device(2, 48000000);
+    int d1 = fake_add_device(1, 48000000);
+
+    candle_list_handle list;
+    CHECK(candle_list_scan_transport(&list, &candle_transport_fake));
+    CHECK(candle_list_probe(list));
+    CHECK(candle_list_free(list));
+    uint32_t controls = fake_control_count(d0) + fake_control_count(d1);
+
+    /* a second scan has the descriptors without asking */
+    CHECK(candle_list_scan_transport(&list, &candle_transport_fake));
+    CHECK(candle_list_probe(list));
+    CHECK(fake_control_count(d0) + fake_control_count(d1) == controls);
+
+    /* once a device has left, the next one on its path is asked again */
+    fake_unplug(d0);
+    CHECK(candle_list_refresh(list, NULL, NULL));
+    fake_reset();
+    d0 = fake_add_device(1, 80000000);
+    CHECK(candle_list_refresh(list, NULL, NULL));
+
+    candle_handle hdev;
+    uint8_t len = 0, channels = 0;
+    CHECK(candle_list_length(list, &len));
+    CHECK(len == 1);
+    CHECK(candle_dev_get(list, 0, &hdev));
+    CHECK(wcscmp(candle_dev_get_path(hdev), L"fake:0") == 0);
+    CHECK(candle_channel_count(hdev, &channels));
+    CHECK(channels == 1);
+    candle_capability_t cap;
+    CHECK(candle_channel_get_capabilities(hdev, 0, &cap));
+    CHECK(cap.fclk_can == 80000000);
+    CHECK(fake_control_count(d0) > 0);
+
+    candle_dev_free(hdev);
+    candle_list_free(list);
+}
+
+/* hotplug callbacks as they come, from the caller or the monitor thread */
+typedef struct {
+    candle_mutex_t lock;
+    uint32_t count;
+    candle_hotplug_event_t event[8];
+    wchar_t path[8][32];
+} hotplug_log_t;
+
+static void hotplug_note(candle_list_handle list, candle_hotplug_event_t event, const wchar_t *path, void *arg)
+{
+    (void)list;
+    hotplug_log_t *log = (hotplug_log_t *)arg;
+    candle_mutex_lock(&log->lock);
+    if (log->count < 8) {
+        log->event[log->count] = event;
+        wcsncpy(log->path[log->count], path, 31);
+        log->count++;
+    }
+    candle_mutex_unlock(&log->lock);
+}
+
+static uint32_t hotplug_count(hotplug_log_t *log)
+{
+    candle_mutex_lock(&log->lock);
+    uint32_t count = log->count;
+    candle_mutex_unlock(&log->lock);
+    return count;
+}
+
+/* exactly one LEFT for left and one ARRIVED for arrived, in either order */
+static void check_hotplug_log(hotplug_log_t *log, const wchar_t *left, const wchar_t *arrived)
+{
+    CHECK(log->count == 2);
+    uint32_t seen_left = 0, seen_arrived = 0;
+    for (uint32_t i=0; i<log->count; i++) {
+        seen_left += (log->event[i] == CANDLE_HOTPLUG_LEFT) && (wcscmp(log->path[i], left) == 0);
+        seen_arrived += (log->event[i] == CANDLE_HOTPLUG_ARRIVED) && (wcscmp(log->path[i], arrived) == 0);
+    }
+    CHECK(seen_left == 1);
+    CHECK(seen_arrived == 1);
+}
+
+/* the entries of the list still probed, and their devices asked nothing */
+static void check_kept_entries(candle_list_handle list, const uint32_t *controls)
+{
+    candle_list_t *l = (candle_list_t *)list;
+    for (unsigned i=0; i<l->num_devices; i++) {
+        int index = -1;
+        CHECK(swscanf(l->dev[i].path, L"fake:%d", &index) == 1);
+        if ( (index < 0) || (controls[index] == 0) ) {
+            continue;   /* the new one */
+        }
+        CHECK(l->dev[i].probed);
+        CHECK(l->dev[i].info_valid);
+        CHECK(fake_control_count(index) == controls[index]);
+    }
+}
+
+static void test_refresh_reports_changes(void)
+{
+    fake_reset();
+    for (int i=0; i<3; i++) {
+        fake_add_device(1, 48000000);
+    }
+
+    candle_list_handle list;
+    CHECK(candle_list_scan_transport(&list, &candle_transport_fake));
+    CHECK(candle_list_probe(list));
+    uint32_t controls[4] = { fake_control_count(0), fake_control_count(1), fake_control_count(2), 0 };
+
+    hotplug_log_t log;
+    memset(&log, 0, sizeof(log));
+    candle_mutex_init(&log.lock);
+
+    /* nothing changed, nothing reported */
+    CHECK(candle_list_refresh(list, hotplug_note, &log));
+    CHECK(log.count == 0);
+
+    fake_unplug(1);
+    CHECK(fake_add_device(1, 48000000) == 3);
+    CHECK(candle_list_refresh(list, hotplug_note, &log));
+    check_hotplug_log(&log, L"fake:1", L"fake:3");
+
+    uint8_t len = 0;
+    CHECK(candle_list_length(list, &len));
+    CHECK(len == 3);
+    check_kept_entries(list, controls);
+
+    candle_list_free(list);
+    candle_mutex_destroy(&log.lock);
+}
+
+static void test_hotplug_monitor_reports_changes(void)
+{
+    fake_reset();
+    for (int i=0; i<3; i++) {
+        fake_add_device(1, 48000000);
+    }
+    fake_unplug(1);
+
+    candle_list_handle list;
+    CHECK(candle_list_scan_transport(&list, &candle_transport_fake));
+    CHECK(candle_list_probe(list));
+    uint32_t controls[3] = { fake_control_count(0), 0, fake_control_count(2) };
+
+    hotplug_log_t log;
+    memset(&log, 0, sizeof(log));
+    candle_mutex_init(&log.lock);
+    CHECK(candle_list_hotplug_start(list, 5, hotplug_note, &log));
+    CHECK(!candle_list_hotplug_start(list, 5, hotplug_note, &log));
+    CHECK(((candle_list_t *)list)->last_error == CANDLE_ERR_INVALID_OPTION);
+
+    /* both changes between two polls, or spread over two */
+    fake_replug(1);
+    fake_unplug(2);
+    uint64_t end = candle_time_ns() + 1000000000ull;
+    while ( (hotplug_count(&log) < 2) && (candle_time_ns() < end) ) {
+        candle_sleep_ms(1);
+    }
+    candle_sleep_ms(20);
+    CHECK(candle_list_hotplug_stop(list));
+    check_hotplug_log(&log, L"fake:2", L"fake:1");
+
+    uint8_t len = 0;
+    CHECK(candle_list_length(list, &len));
+    CHECK(len == 2);
+    check_kept_entries(list, controls);
+
+    candle_list_free(list);
+    candle_mutex_destroy(&log.lock);
+}
+
+int main(void)
+{
+    RUN(test_scan_lists_devices);
+    RUN(test_default_scan_uses_fake);
+    RUN(test_open_configures_device);
+    RUN(test_send_and_receive);
+    RUN(test_send_async_window);
+    RUN(test_send_many_packs_frames);
+    RUN(test_send_many_unpacked);
+    RUN(test_second_open_is_in_use);
+    RUN(test_open_twice_fails);
+    RUN(test_probe_is_flagged);
+    RUN(test_unplug_reports_gone);
+    RUN(test_unplug_fails_control_requests);
+    RUN(test_unopened_handle_fails);
+    RUN(test_descriptors_are_cached);
+    RUN(test_refresh_reports_changes);
+    RUN(test_hotplug_monitor_reports_changes);
+    return TEST_EXIT();
+}
@@ -12,18 +12,45 @@ CONFIG -= app_bundle
 TEMPLATE = app
 
 SOURCES += main.cpp \
-    gsusb.c \
     candle.c \
-    candle_ctrl_req.c
+    candle_ctrl_req.c \
+    candle_rx_parse.c \
+    candle_ring.c \
+    candle_clock.c \
+    candle_bittiming.c \
+    candle_filter.c \
+    candle_change.c \
+    candle_dbc.c \
+    candle_dbc_batch.c \
+    candle_batch.c \
+    candle_capture.c \
+    candle_os.c
 
+win32: SOURCES += gsusb.c candle_transport_winusb.c
 win32: LIBS += -lSetupApi
 win32: LIBS += -lOle32
 win32: LIBS += -lwinusb
 
+unix: SOURCES += candle_transport_libusb.c
+unix: CONFIG += link_pkgconfig
+unix: PKGCONFIG += libusb-1.0
+unix: LIBS += -lpthread
+
 HEADERS += \
     ch_9.h \
     gsusb_def.h \
     gsusb.h \
     candle.h \
     candle_defs.h \
-    candle_ctrl_req.h
+    candle_rx_parse.h \
+    candle_ring.h \
+    candle_clock.h \
+    candle_bittiming.h \
+    candle_filter.h \
+    candle_change.h \
+    candle_dbc.h \
+    candle_batch.h \
+    candle_capture.h \
+    candle_os.h \
+    candle_ctrl_req.h \
+    candle_transport.h